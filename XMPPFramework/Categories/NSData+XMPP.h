@@ -9,7 +9,26 @@
 
 - (NSString *)hexStringValue;
 
+/**
+ * Base64 encoding and decoding (RFC 4648).
+ * 
+ * Decoding ignores any characters outside the base64 alphabet (such as line breaks and other whitespace),
+ * and stops at the first padding character.
+**/
 - (NSString *)base64Encoded;
 - (NSData *)base64Decoded;
 
+/**
+ * Variants of the above that encode or decode into a caller-provided buffer,
+ * which must have room for at least base64EncodedLengthForLength: (or base64DecodedMaxLengthForLength:) bytes.
+ * 
+ * Returns the number of bytes written to the buffer.
+ * The encoded characters are not NULL terminated.
+**/
++ (NSUInteger)base64EncodedLengthForLength:(NSUInteger)length;
++ (NSUInteger)base64DecodedMaxLengthForLength:(NSUInteger)length;
+
++ (NSUInteger)base64EncodeBytes:(const void *)bytes length:(NSUInteger)length intoBuffer:(char *)buffer;
++ (NSUInteger)base64DecodeCharacters:(const char *)characters length:(NSUInteger)length intoBuffer:(void *)buffer;
+
 @end
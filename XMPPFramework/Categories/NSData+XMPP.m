@@ -1,18 +1,347 @@
 #import "NSData+XMPP.h"
 #import <CommonCrypto/CommonDigest.h>
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+  #import <arm_neon.h>
+#elif defined(__SSSE3__)
+  #import <tmmintrin.h>
+#endif
+
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
 
-@implementation NSData (XMPP)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Base64 Tables
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const char encodingTable[64] = {
+	'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+	'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+	'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+	'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/' };
+
+#define BASE64_PAD     0x40 // '='
+#define BASE64_IGNORE  0x80 // Anything that isn't part of the alphabet (whitespace, line breaks, garbage)
+
+static uint8_t decodingTable[256];
+
+static void XMPPBase64Initialize(void)
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		memset(decodingTable, BASE64_IGNORE, sizeof(decodingTable));
+		
+		uint8_t i;
+		for (i = 0; i < 64; i++)
+		{
+			decodingTable[(uint8_t)encodingTable[i]] = i;
+		}
+		decodingTable['='] = BASE64_PAD;
+	});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Base64 Vector Blocks
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The vector blocks translate a fixed number of bytes at a time.
+ * The instruction set is chosen at compile time, as every architecture slice is compiled separately:
+ * NEON on ARM, SSSE3 on x86 (which every Intel Mac supports). Anything else uses the scalar loops only.
+ * 
+ * Encode blocks consume BASE64_ENCODE_BLOCK bytes, but may read up to BASE64_ENCODE_READ bytes.
+ * Decode blocks consume BASE64_DECODE_BLOCK characters, and return NO (without writing anything)
+ * if the block contains anything other than the 64 alphabet characters, in which case the scalar loop takes over.
+**/
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#define BASE64_VECTOR_NEON  1
+
+#define BASE64_ENCODE_BLOCK 48
+#define BASE64_ENCODE_READ  48
+#define BASE64_DECODE_BLOCK 64
+
+static inline uint8x16_t XMPPBase64NEONEncodeChars(uint8x16_t idx)
+{
+	uint8x16_t shift = vdupq_n_u8('A');
+	shift = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(26)), vdupq_n_u8((uint8_t)('a' - 26)), shift);
+	shift = vbslq_u8(vcgeq_u8(idx, vdupq_n_u8(52)), vdupq_n_u8((uint8_t)('0' - 52)), shift);
+	shift = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(62)), vdupq_n_u8((uint8_t)('+' - 62)), shift);
+	shift = vbslq_u8(vceqq_u8(idx, vdupq_n_u8(63)), vdupq_n_u8((uint8_t)('/' - 63)), shift);
+	
+	return vaddq_u8(idx, shift);
+}
+
+static inline void XMPPBase64EncodeBlock(const uint8_t *src, char *dst)
+{
+	uint8x16x3_t in = vld3q_u8(src);
+	uint8x16x4_t out;
+	
+	out.val[0] = vshrq_n_u8(in.val[0], 2);
+	out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(in.val[1], 4));
+	out.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(in.val[2], 6));
+	out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+	
+	out.val[0] = XMPPBase64NEONEncodeChars(out.val[0]);
+	out.val[1] = XMPPBase64NEONEncodeChars(out.val[1]);
+	out.val[2] = XMPPBase64NEONEncodeChars(out.val[2]);
+	out.val[3] = XMPPBase64NEONEncodeChars(out.val[3]);
+	
+	vst4q_u8((uint8_t *)dst, out);
+}
+
+static inline uint8x16_t XMPPBase64NEONDecodeChars(uint8x16_t c, uint8x16_t *valid)
+{
+	uint8x16_t upper = vandq_u8(vcgeq_u8(c, vdupq_n_u8('A')), vcleq_u8(c, vdupq_n_u8('Z')));
+	uint8x16_t lower = vandq_u8(vcgeq_u8(c, vdupq_n_u8('a')), vcleq_u8(c, vdupq_n_u8('z')));
+	uint8x16_t digit = vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+	uint8x16_t plus  = vceqq_u8(c, vdupq_n_u8('+'));
+	uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+	
+	uint8x16_t shift = vdupq_n_u8(0);
+	shift = vbslq_u8(upper, vdupq_n_u8((uint8_t)(0 - 'A')), shift);
+	shift = vbslq_u8(lower, vdupq_n_u8((uint8_t)(26 - 'a')), shift);
+	shift = vbslq_u8(digit, vdupq_n_u8((uint8_t)(52 - '0')), shift);
+	shift = vbslq_u8(plus,  vdupq_n_u8((uint8_t)(62 - '+')), shift);
+	shift = vbslq_u8(slash, vdupq_n_u8((uint8_t)(63 - '/')), shift);
+	
+	*valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash))));
+	
+	return vaddq_u8(c, shift);
+}
+
+static inline BOOL XMPPBase64DecodeBlock(const char *src, uint8_t *dst)
+{
+	uint8x16x4_t in = vld4q_u8((const uint8_t *)src);
+	uint8x16_t valid = vdupq_n_u8(0xFF);
+	
+	uint8x16_t a = XMPPBase64NEONDecodeChars(in.val[0], &valid);
+	uint8x16_t b = XMPPBase64NEONDecodeChars(in.val[1], &valid);
+	uint8x16_t c = XMPPBase64NEONDecodeChars(in.val[2], &valid);
+	uint8x16_t d = XMPPBase64NEONDecodeChars(in.val[3], &valid);
+	
+	uint64x2_t valid64 = vreinterpretq_u64_u8(valid);
+	if ((vgetq_lane_u64(valid64, 0) & vgetq_lane_u64(valid64, 1)) != UINT64_MAX)
+	{
+		return NO;
+	}
+	
+	uint8x16x3_t out;
+	out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+	out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+	out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+	
+	vst3q_u8(dst, out);
+	return YES;
+}
+
+#elif defined(__SSSE3__)
+
+#define BASE64_VECTOR_SSSE3 1
+
+#define BASE64_ENCODE_BLOCK 12
+#define BASE64_ENCODE_READ  16
+#define BASE64_DECODE_BLOCK 16
+
+static inline void XMPPBase64EncodeBlock(const uint8_t *src, char *dst)
+{
+	// Spread each 3 byte group over 4 bytes, and move each 6 bit index into its own byte.
+	
+	__m128i in = _mm_loadu_si128((const __m128i *)src);
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	
+	__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+	__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+	__m128i idx = _mm_or_si128(t0, t1);
+	
+	// Translate each index into its character, by adding the offset of its range:
+	// 0..25 -> 'A', 26..51 -> 'a', 52..61 -> '0', 62 -> '+', 63 -> '/'
+	
+	__m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+	range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+	
+	__m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	
+	__m128i out = _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, range));
+	_mm_storeu_si128((__m128i *)dst, out);
+}
+
+static inline __m128i XMPPBase64SSERange(__m128i c, char first, char last)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(first - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(last + 1)));
+}
+
+static inline BOOL XMPPBase64DecodeBlock(const char *src, uint8_t *dst)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)src);
+	
+	// Bytes >= 0x80 are negative (as signed bytes), and thus never fall within any of the ranges.
+	
+	__m128i upper = XMPPBase64SSERange(c, 'A', 'Z');
+	__m128i lower = XMPPBase64SSERange(c, 'a', 'z');
+	__m128i digit = XMPPBase64SSERange(c, '0', '9');
+	__m128i plus  = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+	__m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+	
+	__m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+	if (_mm_movemask_epi8(valid) != 0xFFFF)
+	{
+		return NO;
+	}
+	
+	__m128i shift = _mm_and_si128(upper, _mm_set1_epi8(0 - 'A'));
+	shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	shift = _mm_or_si128(shift, _mm_and_si128(plus,  _mm_set1_epi8(62 - '+')));
+	shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+	
+	__m128i values = _mm_add_epi8(c, shift);
+	
+	// Merge each group of 4 6-bit values into 3 bytes, and pack the groups together.
+	
+	__m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+	merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	
+	// Only 12 of the 16 bytes are output (and the caller's buffer may not have room for all 16).
+	
+	uint8_t buf[16];
+	_mm_storeu_si128((__m128i *)buf, merged);
+	memcpy(dst, buf, 12);
+	
+	return YES;
+}
 
-static char encodingTable[64] = {
-        'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
-        'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
-        'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
-        'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/' };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Base64 Codec
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t XMPPBase64Encode(const uint8_t *src, size_t length, char *dst)
+{
+	char *start = dst;
+	
+#ifdef BASE64_ENCODE_BLOCK
+	while (length >= BASE64_ENCODE_READ)
+	{
+		XMPPBase64EncodeBlock(src, dst);
+		
+		src += BASE64_ENCODE_BLOCK;
+		dst += BASE64_ENCODE_BLOCK / 3 * 4;
+		length -= BASE64_ENCODE_BLOCK;
+	}
+#endif
+	
+	while (length >= 3)
+	{
+		uint32_t triple = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+		
+		dst[0] = encodingTable[(triple >> 18)       ];
+		dst[1] = encodingTable[(triple >> 12) & 0x3F];
+		dst[2] = encodingTable[(triple >>  6) & 0x3F];
+		dst[3] = encodingTable[(triple      ) & 0x3F];
+		
+		src += 3;
+		dst += 4;
+		length -= 3;
+	}
+	
+	if (length > 0)
+	{
+		uint32_t triple = (uint32_t)src[0] << 16;
+		if (length > 1)
+			triple |= (uint32_t)src[1] << 8;
+		
+		dst[0] = encodingTable[(triple >> 18)       ];
+		dst[1] = encodingTable[(triple >> 12) & 0x3F];
+		dst[2] = (length > 1) ? encodingTable[(triple >> 6) & 0x3F] : '=';
+		dst[3] = '=';
+		
+		dst += 4;
+	}
+	
+	return (size_t)(dst - start);
+}
+
+/**
+ * Characters outside the base64 alphabet are ignored (e.g. line breaks).
+ * Decoding stops at the first padding character.
+**/
+static size_t XMPPBase64Decode(const char *src, size_t length, uint8_t *dst)
+{
+	uint8_t *start = dst;
+	
+	uint32_t quad = 0;
+	unsigned count = 0;
+	
+	size_t i = 0;
+	while (i < length)
+	{
+#ifdef BASE64_DECODE_BLOCK
+		if (count == 0)
+		{
+			while ((i + BASE64_DECODE_BLOCK <= length) && XMPPBase64DecodeBlock(src + i, dst))
+			{
+				i += BASE64_DECODE_BLOCK;
+				dst += BASE64_DECODE_BLOCK / 4 * 3;
+			}
+			
+			if (i >= length) break;
+		}
+#endif
+		
+		uint8_t value = decodingTable[(uint8_t)src[i++]];
+		
+		if (value == BASE64_IGNORE)
+		{
+			continue;
+		}
+		
+		if (value == BASE64_PAD)
+		{
+			// xx== holds one byte, xxx= holds two.
+			// A lone character doesn't hold a full byte, but we output what it has.
+			
+			if (count > 0)
+			{
+				quad <<= 6 * (4 - count);
+				
+				*dst++ = (uint8_t)(quad >> 16);
+				if (count == 3)
+					*dst++ = (uint8_t)(quad >> 8);
+			}
+			break;
+		}
+		
+		quad = (quad << 6) | value;
+		
+		if (++count == 4)
+		{
+			dst[0] = (uint8_t)(quad >> 16);
+			dst[1] = (uint8_t)(quad >>  8);
+			dst[2] = (uint8_t)(quad      );
+			
+			dst += 3;
+			quad = 0;
+			count = 0;
+		}
+	}
+	
+	return (size_t)(dst - start);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation NSData (XMPP)
 
 
 - (NSData *)md5Digest
@@ -58,116 +387,52 @@ static char encodingTable[64] = {
 
 - (NSString *)base64Encoded
 {
-	const unsigned char	*bytes = [self bytes];
-	NSMutableString *result = [NSMutableString stringWithCapacity:[self length]];
-	unsigned long ixtext = 0;
-	unsigned long lentext = [self length];
-	long ctremaining = 0;
-	unsigned char inbuf[3], outbuf[4];
-	unsigned short i = 0;
-	unsigned short charsonline = 0, ctcopy = 0;
-	unsigned long ix = 0;
-	
-	while( YES )
-	{
-		ctremaining = lentext - ixtext;
-		if( ctremaining <= 0 ) break;
-		
-		for( i = 0; i < 3; i++ ) {
-			ix = ixtext + i;
-			if( ix < lentext ) inbuf[i] = bytes[ix];
-			else inbuf [i] = 0;
-		}
-		
-		outbuf [0] = (inbuf [0] & 0xFC) >> 2;
-		outbuf [1] = ((inbuf [0] & 0x03) << 4) | ((inbuf [1] & 0xF0) >> 4);
-		outbuf [2] = ((inbuf [1] & 0x0F) << 2) | ((inbuf [2] & 0xC0) >> 6);
-		outbuf [3] = inbuf [2] & 0x3F;
-		ctcopy = 4;
-		
-		switch( ctremaining )
-		{
-			case 1:
-				ctcopy = 2;
-				break;
-			case 2:
-				ctcopy = 3;
-				break;
-		}
-		
-		for( i = 0; i < ctcopy; i++ )
-			[result appendFormat:@"%c", encodingTable[outbuf[i]]];
-		
-		for( i = ctcopy; i < 4; i++ )
-			[result appendString:@"="];
-		
-		ixtext += 3;
-		charsonline += 4;
-	}
+	NSUInteger length = [self length];
+	if (length == 0) return @"";
+	
+	NSUInteger encodedLength = [NSData base64EncodedLengthForLength:length];
+	char *buffer = malloc(encodedLength);
+	
+	XMPPBase64Encode([self bytes], length, buffer);
 	
-	return [NSString stringWithString:result];
+	return [[NSString alloc] initWithBytesNoCopy:buffer
+	                                      length:encodedLength
+	                                    encoding:NSASCIIStringEncoding
+	                                freeWhenDone:YES];
 }
 
 - (NSData *)base64Decoded
 {
-	const unsigned char	*bytes = [self bytes];
-	NSMutableData *result = [NSMutableData dataWithCapacity:[self length]];
+	NSUInteger length = [self length];
 	
-	unsigned long ixtext = 0;
-	unsigned long lentext = [self length];
-	unsigned char ch = 0;
-	unsigned char inbuf[4] = {0, 0, 0, 0};
-	unsigned char outbuf[3] = {0, 0, 0};
-	short i = 0, ixinbuf = 0;
-	BOOL flignore = NO;
-	BOOL flendtext = NO;
+	NSMutableData *result = [NSMutableData dataWithLength:[NSData base64DecodedMaxLengthForLength:length]];
 	
-	while( YES )
-	{
-		if( ixtext >= lentext ) break;
-		ch = bytes[ixtext++];
-		flignore = NO;
-		
-		if( ( ch >= 'A' ) && ( ch <= 'Z' ) ) ch = ch - 'A';
-		else if( ( ch >= 'a' ) && ( ch <= 'z' ) ) ch = ch - 'a' + 26;
-		else if( ( ch >= '0' ) && ( ch <= '9' ) ) ch = ch - '0' + 52;
-		else if( ch == '+' ) ch = 62;
-		else if( ch == '=' ) flendtext = YES;
-		else if( ch == '/' ) ch = 63;
-		else flignore = YES;
-		
-		if( ! flignore )
-		{
-			short ctcharsinbuf = 3;
-			BOOL flbreak = NO;
-			
-			if( flendtext )
-			{
-				if( ! ixinbuf ) break;
-				if( ( ixinbuf == 1 ) || ( ixinbuf == 2 ) ) ctcharsinbuf = 1;
-				else ctcharsinbuf = 2;
-				ixinbuf = 3;
-				flbreak = YES;
-			}
-			
-			inbuf [ixinbuf++] = ch;
-			
-			if( ixinbuf == 4 )
-			{
-				ixinbuf = 0;
-				outbuf [0] = ( inbuf[0] << 2 ) | ( ( inbuf[1] & 0x30) >> 4 );
-				outbuf [1] = ( ( inbuf[1] & 0x0F ) << 4 ) | ( ( inbuf[2] & 0x3C ) >> 2 );
-				outbuf [2] = ( ( inbuf[2] & 0x03 ) << 6 ) | ( inbuf[3] & 0x3F );
-				
-				for( i = 0; i < ctcharsinbuf; i++ )
-					[result appendBytes:&outbuf[i] length:1];
-			}
-			
-			if( flbreak )  break;
-		}
-	}
+	XMPPBase64Initialize();
+	size_t decodedLength = XMPPBase64Decode([self bytes], length, [result mutableBytes]);
 	
-	return [NSData dataWithData:result];
+	[result setLength:decodedLength];
+	return result;
+}
+
++ (NSUInteger)base64EncodedLengthForLength:(NSUInteger)length
+{
+	return (length + 2) / 3 * 4;
+}
+
++ (NSUInteger)base64DecodedMaxLengthForLength:(NSUInteger)length
+{
+	return (length + 3) / 4 * 3;
+}
+
++ (NSUInteger)base64EncodeBytes:(const void *)bytes length:(NSUInteger)length intoBuffer:(char *)buffer
+{
+	return XMPPBase64Encode(bytes, length, buffer);
+}
+
++ (NSUInteger)base64DecodeCharacters:(const char *)characters length:(NSUInteger)length intoBuffer:(void *)buffer
+{
+	XMPPBase64Initialize();
+	return XMPPBase64Decode(characters, length, buffer);
 }
 
 @end
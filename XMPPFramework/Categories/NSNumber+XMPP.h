@@ -15,6 +15,20 @@
 + (BOOL)parseString:(NSString *)str intoNSInteger:(NSInteger *)pNum;
 + (BOOL)parseString:(NSString *)str intoNSUInteger:(NSUInteger *)pNum;
 
+/**
+ * Same as above, but for a (NUL terminated) C string, such as the content of a libxml node.
+ * Returns NO for a NULL string.
+**/
+
++ (BOOL)parseCString:(const char *)cStr intoInt32:(int32_t *)pNum;
++ (BOOL)parseCString:(const char *)cStr intoUInt32:(uint32_t *)pNum;
+
++ (BOOL)parseCString:(const char *)cStr intoInt64:(int64_t *)pNum;
++ (BOOL)parseCString:(const char *)cStr intoUInt64:(uint64_t *)pNum;
+
++ (BOOL)parseCString:(const char *)cStr intoNSInteger:(NSInteger *)pNum;
++ (BOOL)parseCString:(const char *)cStr intoNSUInteger:(NSUInteger *)pNum;
+
 + (UInt8)extractUInt8FromData:(NSData *)data atOffset:(unsigned int)offset;
 
 + (UInt16)extractUInt16FromData:(NSData *)data atOffset:(unsigned int)offset andConvertFromNetworkOrder:(BOOL)flag;
@@ -4,6 +4,38 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+// Large enough for any decimal number (with some surrounding whitespace)
+#define XMPP_NUMBER_BUFFER_SIZE 64
+
+/**
+ * Returns a C string for the given string, suitable for strtol & friends.
+ * 
+ * Unlike [str UTF8String], this doesn't allocate anything in the common case:
+ * strings backed by ASCII storage are used in place, and other short strings are copied into the given buffer.
+**/
+static const char *XMPPNumberCString(NSString *str, char *buf, size_t bufSize)
+{
+	const char *cStr = CFStringGetCStringPtr((__bridge CFStringRef)str, kCFStringEncodingASCII);
+	if (cStr)
+		return cStr;
+	
+	if (CFStringGetCString((__bridge CFStringRef)str, buf, (CFIndex)bufSize, kCFStringEncodingASCII))
+		return buf;
+	
+	// Non-ASCII or very long: this won't be a valid number, but let strtol decide how much of it to parse
+	return [str UTF8String];
+}
+
+/**
+ * strtoul and strtoull silently negate negative input (e.g. "-1" becomes ULONG_MAX).
+**/
+static BOOL XMPPNumberCStringIsNegative(const char *cStr)
+{
+	while (isspace((unsigned char)*cStr)) cStr++;
+	
+	return (*cStr == '-');
+}
+
 
 @implementation NSNumber (XMPP)
 
@@ -19,15 +51,24 @@
 
 + (BOOL)parseString:(NSString *)str intoInt32:(int32_t *)pNum
 {
-	if (str == nil)
+	char buf[XMPP_NUMBER_BUFFER_SIZE];
+	
+	return [self parseCString:(str ? XMPPNumberCString(str, buf, sizeof(buf)) : NULL) intoInt32:pNum];
+}
+
++ (BOOL)parseCString:(const char *)cStr intoInt32:(int32_t *)pNum
+{
+	if (cStr == NULL)
 	{
 		*pNum = (int32_t)0;
 		return NO;
 	}
 	
+	char *end = NULL;
+	
 	errno = 0;
 	
-	long result = strtol([str UTF8String], NULL, 10);
+	long result = strtol(cStr, &end, 10);
 	
 	if (LONG_BIT != 32)
 	{
@@ -53,7 +94,7 @@
 	
 	*pNum = (int32_t)result;
 	
-	if (errno != 0)
+	if (errno != 0 || end == cStr)
 		return NO;
 	else
 		return YES;
@@ -61,15 +102,30 @@
 
 + (BOOL)parseString:(NSString *)str intoUInt32:(uint32_t *)pNum
 {
-	if (str == nil)
+	char buf[XMPP_NUMBER_BUFFER_SIZE];
+	
+	return [self parseCString:(str ? XMPPNumberCString(str, buf, sizeof(buf)) : NULL) intoUInt32:pNum];
+}
+
++ (BOOL)parseCString:(const char *)cStr intoUInt32:(uint32_t *)pNum
+{
+	if (cStr == NULL)
 	{
 		*pNum = (uint32_t)0;
 		return NO;
 	}
 	
+	char *end = NULL;
+	
 	errno = 0;
 	
-	unsigned long result = strtoul([str UTF8String], NULL, 10);
+	unsigned long result = strtoul(cStr, &end, 10);
+	
+	if (result != 0 && XMPPNumberCStringIsNegative(cStr))
+	{
+		*pNum = 0;
+		return NO;
+	}
 	
 	if (LONG_BIT != 32)
 	{
@@ -90,7 +146,7 @@
 	
 	*pNum = (uint32_t)result;
 	
-	if (errno != 0)
+	if (errno != 0 || end == cStr)
 		return NO;
 	else
 		return YES;
@@ -98,17 +154,26 @@
 
 + (BOOL)parseString:(NSString *)str intoInt64:(int64_t *)pNum
 {
-	if (str == nil)
+	char buf[XMPP_NUMBER_BUFFER_SIZE];
+	
+	return [self parseCString:(str ? XMPPNumberCString(str, buf, sizeof(buf)) : NULL) intoInt64:pNum];
+}
+
++ (BOOL)parseCString:(const char *)cStr intoInt64:(int64_t *)pNum
+{
+	if (cStr == NULL)
 	{
 		*pNum = (int64_t)0;
 		return NO;
 	}
 	
+	char *end = NULL;
+	
 	errno = 0;
 	
 	// On both 32-bit and 64-bit machines, long long = 64 bit
 	
-	*pNum = strtoll([str UTF8String], NULL, 10);
+	*pNum = strtoll(cStr, &end, 10);
 	
 	// From the manpage:
 	// 
@@ -118,7 +183,7 @@
 	// Clamped means it will be TYPE_MAX or TYPE_MIN.
 	// If overflow/underflow occurs, returning a clamped value is more accurate then returning zero.
 	
-	if (errno != 0)
+	if (errno != 0 || end == cStr)
 		return NO;
 	else
 		return YES;
@@ -126,17 +191,32 @@
 
 + (BOOL)parseString:(NSString *)str intoUInt64:(uint64_t *)pNum
 {
-	if (str == nil)
+	char buf[XMPP_NUMBER_BUFFER_SIZE];
+	
+	return [self parseCString:(str ? XMPPNumberCString(str, buf, sizeof(buf)) : NULL) intoUInt64:pNum];
+}
+
++ (BOOL)parseCString:(const char *)cStr intoUInt64:(uint64_t *)pNum
+{
+	if (cStr == NULL)
 	{
 		*pNum = (uint64_t)0;
 		return NO;
 	}
 	
+	char *end = NULL;
+	
 	errno = 0;
 	
 	// On both 32-bit and 64-bit machines, unsigned long long = 64 bit
 	
-	*pNum = strtoull([str UTF8String], NULL, 10);
+	*pNum = strtoull(cStr, &end, 10);
+	
+	if (*pNum != 0 && XMPPNumberCStringIsNegative(cStr))
+	{
+		*pNum = 0;
+		return NO;
+	}
 	
 	// From the manpage:
 	// 
@@ -146,7 +226,7 @@
 	// Clamped means it will be TYPE_MAX or TYPE_MIN.
 	// If overflow/underflow occurs, returning a clamped value is more accurate then returning zero.
 	
-	if (errno != 0)
+	if (errno != 0 || end == cStr)
 		return NO;
 	else
 		return YES;
@@ -168,6 +248,22 @@
 		return [self parseString:str intoUInt64:(uint64_t *)pNum];
 }
 
++ (BOOL)parseCString:(const char *)cStr intoNSInteger:(NSInteger *)pNum
+{
+	if (NSIntegerMax == INT32_MAX)
+		return [self parseCString:cStr intoInt32:(int32_t *)pNum];
+	else
+		return [self parseCString:cStr intoInt64:(int64_t *)pNum];
+}
+
++ (BOOL)parseCString:(const char *)cStr intoNSUInteger:(NSUInteger *)pNum
+{
+	if (NSUIntegerMax == UINT32_MAX)
+		return [self parseCString:cStr intoUInt32:(uint32_t *)pNum];
+	else
+		return [self parseCString:cStr intoUInt64:(uint64_t *)pNum];
+}
+
 + (UInt8)extractUInt8FromData:(NSData *)data atOffset:(unsigned int)offset
 {
 	// 8 bits = 1 byte
@@ -32,6 +32,29 @@
 - (NSXMLElement *)elementForName:(NSString *)name xmlns:(NSString *)xmlns;
 - (NSXMLElement *)elementForName:(NSString *)name xmlnsPrefix:(NSString *)xmlnsPrefix;
 
+/**
+ * Child index.
+ * 
+ * The extraction methods above normally scan the children on every call.
+ * An element that's going to be probed repeatedly (e.g. a received stanza, which every module inspects)
+ * can opt in to a child index, which turns those lookups into dictionary lookups.
+ * 
+ * enableChildIndex merely opts the element in. The index is built lazily, on the first lookup,
+ * and is safe to build and read from multiple threads at once (as received stanzas are, by every delegate),
+ * as long as the element isn't modified at the same time.
+ * The index only answers lookups it has a (still valid) entry for. Everything else falls back to scanning the children.
+ * 
+ * XMPPStream enables the index for every received iq, message and presence,
+ * after the willReceive filters have run, and before the stanza is dispatched to the delegates.
+ * 
+ * If you alter the children of an indexed element, invoke invalidateChildIndex afterwards,
+ * so the index gets rebuilt on the next lookup.
+ * Both enableChildIndex and invalidateChildIndex must be invoked by the (single) thread that owns the element.
+**/
+
+- (void)enableChildIndex;
+- (void)invalidateChildIndex;
+
 /**
  * Working with the common xmpp xmlns value.
  * 
@@ -91,6 +114,25 @@
 - (NSNumber *)attributeNumberIntValueForName:(NSString *)name withDefaultValue:(int)defaultValue;
 - (NSNumber *)attributeNumberBoolValueForName:(NSString *)name withDefaultValue:(BOOL)defaultValue;
 
+/**
+ * Checked accessors for numeric and boolean attributes.
+ * 
+ * These return NO if the attribute doesn't exist, isn't a valid value of the given type,
+ * or doesn't fit into the given type (in which case the value is clamped to the type's limits).
+ * Booleans accept the XML Schema lexical forms: "true", "false", "1" and "0".
+ * 
+ * With KissXML, the value is parsed straight from the content of the underlying libxml attribute node,
+ * so nothing is allocated. (NSXMLElement doesn't expose its storage, so there the value goes through an NSString.)
+**/
+
+- (BOOL)getAttributeInt32Value:(int32_t *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeUInt32Value:(uint32_t *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeInt64Value:(int64_t *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeUInt64Value:(uint64_t *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeIntegerValue:(NSInteger *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeUnsignedIntegerValue:(NSUInteger *)pValue forName:(NSString *)name;
+- (BOOL)getAttributeBoolValue:(BOOL *)pValue forName:(NSString *)name;
+
 - (NSMutableDictionary *)attributesAsDictionary;
 
 /**
@@ -110,6 +152,14 @@
 - (NSInteger)stringValueAsNSInteger;
 - (NSUInteger)stringValueAsNSUInteger;
 
+/**
+ * Checked accessors for numeric element values, which parse the value the same way as the attribute accessors above.
+ * E.g. <priority>5</priority> // NSInteger priority; [priorityElement getStringValueAsNSInteger:&priority];
+**/
+
+- (BOOL)getStringValueAsNSInteger:(NSInteger *)pValue;
+- (BOOL)getStringValueAsNSUInteger:(NSUInteger *)pValue;
+
 /**
  * Working with namespaces.
 **/
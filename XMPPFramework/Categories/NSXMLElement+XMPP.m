@@ -1,10 +1,148 @@
 #import "NSXMLElement+XMPP.h"
 #import "NSNumber+XMPP.h"
 
+#import <objc/runtime.h>
+
+#if TARGET_OS_IPHONE
+  #import <libxml/tree.h>
+#endif
+
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+static char XMPPChildIndexKey;
+
+/**
+ * A lazily built snapshot of an element's child elements, grouped by name, local name and xmlns.
+ * Each group lists the elements in document order.
+ * 
+ * The groups are built on first use, via dispatch_once, so they may be read from multiple threads at once.
+ * The name groups and the xmlns groups are built separately,
+ * as fetching the xmlns of every child allocates a namespace node for each of them.
+ * 
+ * The index doesn't retain the element it belongs to (the element retains the index),
+ * so the element is passed to every lookup.
+ * Lookups return nil if the group is missing, or if the element's children were added or removed since it was built.
+**/
+@interface XMPPElementChildIndex : NSObject
+{
+	dispatch_once_t namesOnce;
+	NSUInteger namesChildCount;
+	NSDictionary *elementsByName;
+	NSDictionary *elementsByLocalName;
+	
+	dispatch_once_t xmlnsOnce;
+	NSUInteger xmlnsChildCount;
+	NSDictionary *elementsByXmlns;
+}
+
+- (NSArray *)elementsForName:(NSString *)name inElement:(NSXMLElement *)parent;
+- (NSArray *)elementsForLocalName:(NSString *)localName inElement:(NSXMLElement *)parent;
+- (NSArray *)elementsForXmlns:(NSString *)xmlns inElement:(NSXMLElement *)parent;
+
+@end
+
+@implementation XMPPElementChildIndex
+
+static void XMPPChildIndexAdd(NSMutableDictionary *dict, NSString *key, NSXMLElement *element)
+{
+	if (key == nil) return;
+	
+	NSMutableArray *elements = [dict objectForKey:key];
+	if (elements == nil)
+	{
+		elements = [[NSMutableArray alloc] initWithCapacity:1];
+		[dict setObject:elements forKey:key];
+	}
+	
+	[elements addObject:element];
+}
+
+- (void)buildNamesForElement:(NSXMLElement *)parent
+{
+	NSMutableDictionary *byName = [[NSMutableDictionary alloc] init];
+	NSMutableDictionary *byLocalName = [[NSMutableDictionary alloc] init];
+	
+	NSArray *children = [parent children];
+	
+	for (NSXMLNode *node in children)
+	{
+		if ([node isKindOfClass:[NSXMLElement class]])
+		{
+			NSXMLElement *element = (NSXMLElement *)node;
+			
+			XMPPChildIndexAdd(byName, [element name], element);
+			XMPPChildIndexAdd(byLocalName, [element localName], element);
+		}
+	}
+	
+	elementsByName = byName;
+	elementsByLocalName = byLocalName;
+	
+	namesChildCount = [children count];
+}
+
+- (void)buildXmlnsForElement:(NSXMLElement *)parent
+{
+	NSMutableDictionary *byXmlns = [[NSMutableDictionary alloc] init];
+	
+	NSArray *children = [parent children];
+	
+	for (NSXMLNode *node in children)
+	{
+		if ([node isKindOfClass:[NSXMLElement class]])
+		{
+			NSXMLElement *element = (NSXMLElement *)node;
+			
+			XMPPChildIndexAdd(byXmlns, [element xmlns], element);
+		}
+	}
+	
+	elementsByXmlns = byXmlns;
+	
+	xmlnsChildCount = [children count];
+}
+
+- (NSArray *)elementsForName:(NSString *)name inElement:(NSXMLElement *)parent
+{
+	dispatch_once(&namesOnce, ^{
+		[self buildNamesForElement:parent];
+	});
+	
+	if (namesChildCount != [parent childCount]) return nil;
+	
+	return [elementsByName objectForKey:name];
+}
+
+- (NSArray *)elementsForLocalName:(NSString *)localName inElement:(NSXMLElement *)parent
+{
+	dispatch_once(&namesOnce, ^{
+		[self buildNamesForElement:parent];
+	});
+	
+	if (namesChildCount != [parent childCount]) return nil;
+	
+	return [elementsByLocalName objectForKey:localName];
+}
+
+- (NSArray *)elementsForXmlns:(NSString *)xmlns inElement:(NSXMLElement *)parent
+{
+	dispatch_once(&xmlnsOnce, ^{
+		[self buildXmlnsForElement:parent];
+	});
+	
+	if (xmlnsChildCount != [parent childCount]) return nil;
+	
+	return [elementsByXmlns objectForKey:xmlns];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @implementation NSXMLElement (XMPP)
 
 /**
@@ -26,8 +164,70 @@
 	return self;
 }
 
+/**
+ * Returns the child index, if it's been enabled for this element.
+ * 
+ * The association is atomic, so the returned index stays valid even if invalidateChildIndex replaces it.
+**/
+- (XMPPElementChildIndex *)xmpp_childIndex
+{
+	return objc_getAssociatedObject(self, &XMPPChildIndexKey);
+}
+
+/**
+ * Returns whether the given elements, found via the child index, are all still children of ours.
+ * 
+ * The index only ever answers lookups it has an entry for.
+ * A missing entry (nil) may just mean the children were replaced after the index was built,
+ * so in that case, as well as when the entry is stale, the lookup falls back to scanning the children.
+**/
+- (BOOL)xmpp_childIndexElementsAreValid:(NSArray *)elements
+{
+	if ([elements count] == 0) return NO;
+	
+	for (NSXMLElement *element in elements)
+	{
+		if ([element parent] != self) return NO;
+	}
+	
+	return YES;
+}
+
+- (void)enableChildIndex
+{
+	if (objc_getAssociatedObject(self, &XMPPChildIndexKey) == nil)
+	{
+		// Nothing is built until the first lookup
+		
+		XMPPElementChildIndex *index = [[XMPPElementChildIndex alloc] init];
+		
+		objc_setAssociatedObject(self, &XMPPChildIndexKey, index, OBJC_ASSOCIATION_RETAIN);
+	}
+}
+
+- (void)invalidateChildIndex
+{
+	if (objc_getAssociatedObject(self, &XMPPChildIndexKey))
+	{
+		XMPPElementChildIndex *index = [[XMPPElementChildIndex alloc] init];
+		
+		objc_setAssociatedObject(self, &XMPPChildIndexKey, index, OBJC_ASSOCIATION_RETAIN);
+	}
+}
+
 - (NSArray *)elementsForXmlns:(NSString *)ns
 {
+	XMPPElementChildIndex *index = [self xmpp_childIndex];
+	if (index)
+	{
+		NSArray *elements = [index elementsForXmlns:ns inElement:self];
+		
+		if ([self xmpp_childIndexElementsAreValid:elements])
+		{
+			return [elements copy];
+		}
+	}
+	
 	NSMutableArray *elements = [NSMutableArray array];
 	
 	for (NSXMLNode *node in [self children])
@@ -72,6 +272,17 @@
 **/
 - (NSXMLElement *)elementForName:(NSString *)name
 {
+	XMPPElementChildIndex *index = [self xmpp_childIndex];
+	if (index)
+	{
+		NSArray *elements = [index elementsForName:name inElement:self];
+		
+		if ([self xmpp_childIndexElementsAreValid:elements])
+		{
+			return [elements objectAtIndex:0];
+		}
+	}
+	
 	NSArray *elements = [self elementsForName:name];
 	if ([elements count] > 0)
 	{
@@ -108,6 +319,18 @@
 **/
 - (NSXMLElement *)elementForName:(NSString *)name xmlns:(NSString *)xmlns
 {
+	XMPPElementChildIndex *index = [self xmpp_childIndex];
+	if (index)
+	{
+		for (NSXMLElement *element in [index elementsForLocalName:name inElement:self])
+		{
+			if ([[element URI] isEqualToString:xmlns] && [element parent] == self)
+			{
+				return element;
+			}
+		}
+	}
+	
 	NSArray *elements = [self elementsForLocalName:name URI:xmlns];
 	if ([elements count] > 0)
 	{
@@ -123,6 +346,18 @@
     
     NSXMLElement *result = nil;
 	
+	XMPPElementChildIndex *index = [self xmpp_childIndex];
+	if (index)
+	{
+		for (NSXMLElement *element in [index elementsForName:name inElement:self])
+		{
+			if ([[element xmlns] hasPrefix:xmlnsPrefix] && [element parent] == self)
+			{
+				return element;
+			}
+		}
+	}
+	
 	for (NSXMLNode *node in [self children])
 	{
 		if ([node isKindOfClass:[NSXMLElement class]])
@@ -215,19 +450,19 @@
 }
 - (int64_t)attributeInt64ValueForName:(NSString *)name
 {
-	int64_t result;
+	int64_t result = 0;
 	[NSNumber parseString:[self attributeStringValueForName:name] intoInt64:&result];
 	return result;
 }
 - (uint64_t)attributeUInt64ValueForName:(NSString *)name
 {
-	uint64_t result;
+	uint64_t result = 0;
 	[NSNumber parseString:[self attributeStringValueForName:name] intoUInt64:&result];
 	return result;
 }
 - (NSInteger)attributeIntegerValueForName:(NSString *)name
 {
-	NSInteger result;
+	NSInteger result = 0;
 	[NSNumber parseString:[self attributeStringValueForName:name] intoNSInteger:&result];
 	return result;
 }
@@ -321,6 +556,153 @@
 	return [NSNumber numberWithBool:[self attributeBoolValueForName:name withDefaultValue:defaultValue]];
 }
 
+/**
+ * The following methods parse the value of the attribute with the given name, with overflow checking.
+ * The parsing is done by the NSNumber+XMPP methods, which work on the stored string directly.
+**/
+
+#if TARGET_OS_IPHONE
+
+/**
+ * Gets the content of the given libxml children, if it's a single text node (or nothing at all).
+ * Anything else (e.g. entity references or child elements) is left to KissXML, and NO is returned.
+**/
+static BOOL XMPPGetTextContent(xmlNodePtr children, const char **pCStr)
+{
+	if (children == NULL)
+	{
+		*pCStr = "";
+		return YES;
+	}
+	
+	if (children->type != XML_TEXT_NODE || children->next != NULL || children->content == NULL) return NO;
+	
+	*pCStr = (const char *)children->content;
+	return YES;
+}
+
+#endif
+
+/**
+ * Looks up the value of the given attribute in the underlying libxml node, without going through an NSString.
+ * 
+ * Returns NO if that's not possible, in which case the caller should use attributeStringValueForName: instead.
+ * Otherwise *pCStr is set to the content of the attribute (which is only valid until the attribute changes),
+ * or NULL if the attribute doesn't exist.
+**/
+- (BOOL)xmpp_getAttributeCString:(const char **)pCStr forName:(NSString *)name
+{
+#if TARGET_OS_IPHONE
+	
+	xmlNodePtr node = (xmlNodePtr)genericPtr;
+	if (node == NULL || node->type != XML_ELEMENT_NODE) return NO;
+	
+	char buf[64];
+	const char *cName = CFStringGetCStringPtr((__bridge CFStringRef)name, kCFStringEncodingUTF8);
+	if (cName == NULL)
+	{
+		if (!CFStringGetCString((__bridge CFStringRef)name, buf, (CFIndex)sizeof(buf), kCFStringEncodingUTF8))
+			return NO;
+		
+		cName = buf;
+	}
+	
+	// Prefixed names are matched against the prefix of the namespace, which is left to KissXML
+	if (strchr(cName, ':')) return NO;
+	
+	xmlAttrPtr attr;
+	for (attr = node->properties; attr; attr = attr->next)
+	{
+		if (attr->ns == NULL && xmlStrEqual(attr->name, (const xmlChar *)cName)) break;
+	}
+	
+	if (attr == NULL)
+	{
+		*pCStr = NULL;
+		return YES;
+	}
+	
+	return XMPPGetTextContent(attr->children, pCStr);
+	
+#else
+	
+	// NSXMLElement doesn't expose its storage
+	return NO;
+	
+#endif
+}
+
+- (BOOL)getAttributeInt32Value:(int32_t *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoInt32:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoInt32:pValue];
+}
+- (BOOL)getAttributeUInt32Value:(uint32_t *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoUInt32:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoUInt32:pValue];
+}
+- (BOOL)getAttributeInt64Value:(int64_t *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoInt64:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoInt64:pValue];
+}
+- (BOOL)getAttributeUInt64Value:(uint64_t *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoUInt64:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoUInt64:pValue];
+}
+- (BOOL)getAttributeIntegerValue:(NSInteger *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoNSInteger:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoNSInteger:pValue];
+}
+- (BOOL)getAttributeUnsignedIntegerValue:(NSUInteger *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if ([self xmpp_getAttributeCString:&cStr forName:name])
+		return [NSNumber parseCString:cStr intoNSUInteger:pValue];
+	else
+		return [NSNumber parseString:[self attributeStringValueForName:name] intoNSUInteger:pValue];
+}
+- (BOOL)getAttributeBoolValue:(BOOL *)pValue forName:(NSString *)name
+{
+	const char *cStr;
+	if (![self xmpp_getAttributeCString:&cStr forName:name])
+	{
+		cStr = [[self attributeStringValueForName:name] UTF8String];
+	}
+	
+	if (cStr && (strcmp(cStr, "true") == 0 || strcmp(cStr, "1") == 0))
+	{
+		*pValue = YES;
+		return YES;
+	}
+	if (cStr && (strcmp(cStr, "false") == 0 || strcmp(cStr, "0") == 0))
+	{
+		*pValue = NO;
+		return YES;
+	}
+	
+	*pValue = NO;
+	return NO;
+}
+
 /**
  * Returns all the attributes in a dictionary.
 **/
@@ -408,6 +790,42 @@
 		return 0;
 }
 
+/**
+ * Same as xmpp_getAttributeCString:forName:, but for the text content of the element.
+**/
+- (BOOL)xmpp_getStringValueCString:(const char **)pCStr
+{
+#if TARGET_OS_IPHONE
+	
+	xmlNodePtr node = (xmlNodePtr)genericPtr;
+	if (node == NULL || node->type != XML_ELEMENT_NODE) return NO;
+	
+	return XMPPGetTextContent(node->children, pCStr);
+	
+#else
+	
+	return NO;
+	
+#endif
+}
+
+- (BOOL)getStringValueAsNSInteger:(NSInteger *)pValue
+{
+	const char *cStr;
+	if ([self xmpp_getStringValueCString:&cStr])
+		return [NSNumber parseCString:cStr intoNSInteger:pValue];
+	else
+		return [NSNumber parseString:[self stringValue] intoNSInteger:pValue];
+}
+- (BOOL)getStringValueAsNSUInteger:(NSUInteger *)pValue
+{
+	const char *cStr;
+	if ([self xmpp_getStringValueCString:&cStr])
+		return [NSNumber parseCString:cStr intoNSUInteger:pValue];
+	else
+		return [NSNumber parseString:[self stringValue] intoNSUInteger:pValue];
+}
+
 /**
  *	Shortcut to avoid having to use NSXMLNode everytime
 **/
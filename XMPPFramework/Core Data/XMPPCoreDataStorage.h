@@ -1,5 +1,8 @@
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+#import <libkern/OSAtomic.h>
+
+@class XMPPCoreDataStorageMetrics;
 
 /**
  * This class provides an optional base class that may be used to implement
@@ -22,6 +25,17 @@
  * it is an important memory management concern to keep the number of changed objects within a healthy range.
  * This class uses a configurable saveThreshold to save at appropriate times.
  * 
+ * Third, it bounds the time changes may remain unsaved (see maxCommitLatency),
+ * so a steady stream of requests can't postpone saving indefinitely.
+ * 
+ * Where supported (iOS 5, Mac OS X 10.7), the actual disk IO is done by a separate writer context, on its own queue.
+ * Saving the managedObjectContext merely hands the changes to the writer context (in memory),
+ * so the storageQueue doesn't have to wait for the write itself to finish.
+ * However, the managedObjectContext is a child of the writer context, so its fetches and faults go through it.
+ * A request that needs to read from the database while the writer context is writing has to wait for the write.
+ * Changes that are handed over while the writer context is busy are written together (group commit).
+ * If a write fails, its changes are lost, and the managedObjectContext is reset to match the database.
+ * 
  * This class also offers several useful features such as
  * preventing multiple instances from using the same database file (conflict)
  * and caching of xmppStream.myJID to improve performance.
@@ -48,6 +62,30 @@
 	NSPersistentStoreCoordinator *persistentStoreCoordinator;
 	NSManagedObjectContext *managedObjectContext;
 	NSManagedObjectContext *mainThreadManagedObjectContext;
+	NSManagedObjectContext *writerManagedObjectContext;
+	
+	NSTimeInterval maxCommitLatency;
+	CFAbsoluteTime firstUnsavedChangeTime;
+	
+	// Shared between the storageQueue and the queue of the writer context
+	OSSpinLock commitLock;
+	BOOL writerSaveScheduled;
+	NSUInteger writerPendingChanges;
+	CFAbsoluteTime writerPendingStartTime;
+	CFAbsoluteTime writerWriteStartTime;
+	CFAbsoluteTime writerWriteEndTime;
+	
+	// Metrics (protected by the commitLock)
+	uint64_t commitCount;
+	uint64_t committedChanges;
+	NSUInteger lastCommitSize;
+	NSUInteger largestCommitSize;
+	NSTimeInterval lastCommitLatency;
+	NSTimeInterval longestCommitLatency;
+	NSTimeInterval totalCommitLatency;
+	uint64_t stallCount;
+	NSTimeInterval longestStall;
+	NSTimeInterval totalStallTime;
 	
 @protected
 	
@@ -95,6 +133,30 @@
 **/
 @property (readwrite) NSUInteger saveThreshold;
 
+/**
+ * The maximum amount of time changes may remain unsaved while the storage instance is busy.
+ * 
+ * Normally changes are saved once there are no more pending requests (or the saveThreshold is reached).
+ * But if requests keep coming in, that may never happen.
+ * So once changes have been unsaved for this long, they're saved regardless of the pending requests.
+ * 
+ * Pass zero to disable the limit.
+ * 
+ * Default 2 seconds
+**/
+@property (readwrite) NSTimeInterval maxCommitLatency;
+
+/**
+ * Returns a snapshot of the save statistics of this instance.
+ * This method is thread-safe, and doesn't wait for the storageQueue.
+**/
+- (XMPPCoreDataStorageMetrics *)metrics;
+
+/**
+ * Resets the save statistics.
+**/
+- (void)resetMetrics;
+
 /**
  * Provides access to the the thread-safe components of the CoreData stack.
  * 
@@ -146,3 +208,39 @@
 @property (readwrite) BOOL autoAllowExternalBinaryDataStorage;
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * An immutable snapshot of the save statistics of an XMPPCoreDataStorage instance.
+ * 
+ * A commit is a write to disk. With a writer context, a single commit may contain several saves.
+ * The commit latency is the time from when the first of its changes was noticed, until it was written to disk.
+ * 
+ * A stall is a period during which the storageQueue couldn't serve any requests.
+ * Every save is a stall. Without a writer context, it includes the entire write to disk.
+ * With one, it includes handing the changes to the writer context (which waits for any write in progress).
+ * With a writer context, a request that runs while the writer context is writing is a stall as well,
+ * as its fetches and faults wait for the write. The stall is the part of the request that overlapped the write.
+ * (A request that doesn't touch the database isn't actually held up, so this is an upper bound.)
+**/
+@interface XMPPCoreDataStorageMetrics : NSObject
+
+@property (nonatomic, readonly) uint64_t commitCount;
+@property (nonatomic, readonly) uint64_t committedChanges;
+
+@property (nonatomic, readonly) NSUInteger lastCommitSize;
+@property (nonatomic, readonly) NSUInteger largestCommitSize;
+@property (nonatomic, readonly) double averageCommitSize;
+
+@property (nonatomic, readonly) NSTimeInterval lastCommitLatency;
+@property (nonatomic, readonly) NSTimeInterval longestCommitLatency;
+@property (nonatomic, readonly) NSTimeInterval averageCommitLatency;
+
+@property (nonatomic, readonly) uint64_t stallCount;
+@property (nonatomic, readonly) NSTimeInterval longestStall;
+@property (nonatomic, readonly) NSTimeInterval totalStallTime;
+
+@end
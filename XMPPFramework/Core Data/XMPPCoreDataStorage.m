@@ -19,6 +19,25 @@
   static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 #endif
 
+@interface XMPPCoreDataStorageMetrics ()
+
+@property (nonatomic, readwrite) uint64_t commitCount;
+@property (nonatomic, readwrite) uint64_t committedChanges;
+
+@property (nonatomic, readwrite) NSUInteger lastCommitSize;
+@property (nonatomic, readwrite) NSUInteger largestCommitSize;
+@property (nonatomic, readwrite) double averageCommitSize;
+
+@property (nonatomic, readwrite) NSTimeInterval lastCommitLatency;
+@property (nonatomic, readwrite) NSTimeInterval longestCommitLatency;
+@property (nonatomic, readwrite) NSTimeInterval averageCommitLatency;
+
+@property (nonatomic, readwrite) uint64_t stallCount;
+@property (nonatomic, readwrite) NSTimeInterval longestStall;
+@property (nonatomic, readwrite) NSTimeInterval totalStallTime;
+
+@end
+
 
 @implementation XMPPCoreDataStorage
 
@@ -224,6 +243,9 @@ static NSMutableSet *databaseFileNames;
 - (void)commonInit
 {
 	saveThreshold = 500;
+	maxCommitLatency = 2.0;
+	
+	commitLock = OS_SPINLOCK_INIT;
 	
 	storageQueue = dispatch_queue_create(class_getName([self class]), NULL);
 	
@@ -325,6 +347,36 @@ static NSMutableSet *databaseFileNames;
 		dispatch_async(storageQueue, block);
 }
 
+- (NSTimeInterval)maxCommitLatency
+{
+	if (dispatch_get_specific(storageQueueTag))
+	{
+		return maxCommitLatency;
+	}
+	else
+	{
+		__block NSTimeInterval result;
+		
+		dispatch_sync(storageQueue, ^{
+			result = maxCommitLatency;
+		});
+		
+		return result;
+	}
+}
+
+- (void)setMaxCommitLatency:(NSTimeInterval)newMaxCommitLatency
+{
+	dispatch_block_t block = ^{
+		maxCommitLatency = newMaxCommitLatency;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Stream JID Caching
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -637,12 +689,27 @@ static NSMutableSet *databaseFileNames;
 		XMPPLogVerbose(@"%@: Creating managedObjectContext", [self class]);
 		
 		if ([NSManagedObjectContext instancesRespondToSelector:@selector(initWithConcurrencyType:)])
+		{
+			// The writer context does the disk IO on its own queue.
+			// Our managedObjectContext is its child, so saving it only hands the changes over (in memory).
+			
+			writerManagedObjectContext =
+			    [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+			
+			writerManagedObjectContext.persistentStoreCoordinator = coordinator;
+			writerManagedObjectContext.undoManager = nil;
+			
 			managedObjectContext =
 			    [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
+			
+			managedObjectContext.parentContext = writerManagedObjectContext;
+		}
 		else
+		{
 			managedObjectContext = [[NSManagedObjectContext alloc] init];
+			managedObjectContext.persistentStoreCoordinator = coordinator;
+		}
 		
-		managedObjectContext.persistentStoreCoordinator = coordinator;
 		managedObjectContext.undoManager = nil;
 		
 		[self didCreateManagedObjectContext];
@@ -706,7 +773,12 @@ static NSMutableSet *databaseFileNames;
 {
 	NSManagedObjectContext *sender = (NSManagedObjectContext *)[notification object];
 	
-	if ((sender != mainThreadManagedObjectContext) &&
+	// Saves of child contexts (such as our managedObjectContext, when it has a writer context) haven't hit the disk yet.
+	// Their changes are merged once their parent has saved them.
+	
+	BOOL isChildContext = [sender respondsToSelector:@selector(parentContext)] && (sender.parentContext != nil);
+	
+	if ((sender != mainThreadManagedObjectContext) && !isChildContext &&
 	    (sender.persistentStoreCoordinator == mainThreadManagedObjectContext.persistentStoreCoordinator))
 	{
 		XMPPLogVerbose(@"%@: %@ - Merging changes into mainThreadManagedObjectContext", THIS_FILE, THIS_METHOD);
@@ -800,17 +872,151 @@ static NSMutableSet *databaseFileNames;
 	
 	[self willSaveManagedObjectContext];
 	
+	NSManagedObjectContext *moc = [self managedObjectContext];
+	
+	CFAbsoluteTime saveStartTime = CFAbsoluteTimeGetCurrent();
+	CFAbsoluteTime changesStartTime = (firstUnsavedChangeTime > 0.0) ? firstUnsavedChangeTime : saveStartTime;
+	
+	NSUInteger unsavedCount = [self numberOfUnsavedChanges];
+	
+	if (writerManagedObjectContext)
+	{
+		// Objects inserted into a child context only get permanent IDs once the parent saves them.
+		// Obtain them now, so the objectIDs handed out by the storageQueue remain valid.
+		
+		NSSet *insertedObjects = [moc insertedObjects];
+		if ([insertedObjects count] > 0)
+		{
+			NSError *error = nil;
+			if (![moc obtainPermanentIDsForObjects:[insertedObjects allObjects] error:&error])
+			{
+				// The objects still get permanent IDs once the writer saves them,
+				// but until then their objectIDs are temporary, and only valid within our managedObjectContext.
+				
+				XMPPLogWarn(@"%@: Error obtaining permanent IDs - %@ %@", [self class], error, [error userInfo]);
+			}
+		}
+	}
+	
 	NSError *error = nil;
-	if ([[self managedObjectContext] save:&error])
+	if ([moc save:&error])
 	{
 		saveCount++;
-		[self didSaveManagedObjectContext];
+		firstUnsavedChangeTime = 0.0;
+		
+		if (writerManagedObjectContext)
+		{
+			// The changes are only in memory, so didSaveManagedObjectContext is invoked once the writer has saved them
+			[self scheduleWriterSaveWithChanges:unsavedCount startTime:changesStartTime];
+		}
+		else
+		{
+			[self didSaveManagedObjectContext];
+			
+			OSSpinLockLock(&commitLock);
+			[self recordCommitWithChanges:unsavedCount latency:(CFAbsoluteTimeGetCurrent() - changesStartTime)];
+			OSSpinLockUnlock(&commitLock);
+		}
 	}
 	else
 	{
 		XMPPLogWarn(@"%@: Error saving - %@ %@", [self class], error, [error userInfo]);
 		
-		[[self managedObjectContext] rollback];
+		[moc rollback];
+		firstUnsavedChangeTime = 0.0;
+	}
+	
+	NSTimeInterval stall = CFAbsoluteTimeGetCurrent() - saveStartTime;
+	
+	OSSpinLockLock(&commitLock);
+	[self recordStall:stall];
+	OSSpinLockUnlock(&commitLock);
+}
+
+- (void)scheduleWriterSaveWithChanges:(NSUInteger)changes startTime:(CFAbsoluteTime)startTime
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	// Group commit:
+	// If a write is already scheduled (but hasn't started yet), it will write these changes as well.
+	
+	BOOL schedule = NO;
+	
+	OSSpinLockLock(&commitLock);
+	{
+		writerPendingChanges += changes;
+		
+		if (writerPendingStartTime == 0.0 || startTime < writerPendingStartTime)
+			writerPendingStartTime = startTime;
+		
+		if (!writerSaveScheduled)
+		{
+			writerSaveScheduled = YES;
+			schedule = YES;
+		}
+	}
+	OSSpinLockUnlock(&commitLock);
+	
+	if (schedule)
+	{
+		NSManagedObjectContext *writer = writerManagedObjectContext;
+		
+		[writer performBlock:^{ @autoreleasepool {
+			
+			// Any changes handed over from now on will schedule another write.
+			// (Handing over changes requires the writer's queue, so they can't sneak into this write unaccounted.)
+			
+			OSSpinLockLock(&commitLock);
+			
+			NSUInteger pendingChanges = writerPendingChanges;
+			CFAbsoluteTime pendingStartTime = writerPendingStartTime;
+			
+			writerPendingChanges = 0;
+			writerPendingStartTime = 0.0;
+			writerSaveScheduled = NO;
+			
+			writerWriteStartTime = CFAbsoluteTimeGetCurrent();
+			writerWriteEndTime = 0.0;
+			
+			OSSpinLockUnlock(&commitLock);
+			
+			NSError *error = nil;
+			BOOL result = [writer save:&error];
+			
+			OSSpinLockLock(&commitLock);
+			writerWriteEndTime = CFAbsoluteTimeGetCurrent();
+			OSSpinLockUnlock(&commitLock);
+			
+			if (result)
+			{
+				OSSpinLockLock(&commitLock);
+				[self recordCommitWithChanges:pendingChanges latency:(writerWriteEndTime - pendingStartTime)];
+				OSSpinLockUnlock(&commitLock);
+				
+				dispatch_async(storageQueue, ^{ @autoreleasepool {
+					
+					[self didSaveManagedObjectContext];
+				}});
+			}
+			else
+			{
+				// The changes never made it to disk, but our managedObjectContext believes they're saved.
+				// Retrying is pointless (the same changes would fail again), so they're discarded,
+				// and our managedObjectContext is reset to match the database again.
+				// Any objects fetched from it before the reset must be fetched again.
+				
+				XMPPLogError(@"%@: Error writing, discarding %lu changes - %@ %@",
+				             [self class], (unsigned long)pendingChanges, error, [error userInfo]);
+				
+				[writer rollback];
+				
+				dispatch_async(storageQueue, ^{ @autoreleasepool {
+					
+					[managedObjectContext reset];
+					firstUnsavedChangeTime = 0.0;
+				}});
+			}
+		}}];
 	}
 }
 
@@ -834,12 +1040,149 @@ static NSMutableSet *databaseFileNames;
 			{
 				XMPPLogVerbose(@"%@: Triggering save (unsavedCount=%lu)", [self class], (unsigned long)unsavedCount);
 				
+				[self save];
+			}
+			else if (firstUnsavedChangeTime == 0.0)
+			{
+				firstUnsavedChangeTime = CFAbsoluteTimeGetCurrent();
+				
+				[self scheduleCommitDeadline];
+			}
+			else if ((maxCommitLatency > 0.0) &&
+			         (CFAbsoluteTimeGetCurrent() - firstUnsavedChangeTime) >= maxCommitLatency)
+			{
+				XMPPLogVerbose(@"%@: Triggering save (maxCommitLatency)", [self class]);
+				
 				[self save];
 			}
 		}
 	}
 }
 
+- (void)scheduleCommitDeadline
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (maxCommitLatency <= 0.0) return;
+	
+	// If the storage is busy with a long running request, maybeSave won't be invoked for a while.
+	// So the deadline is enforced by a timer as well.
+	
+	CFAbsoluteTime changeTime = firstUnsavedChangeTime;
+	
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(maxCommitLatency * NSEC_PER_SEC));
+	dispatch_after(tt, storageQueue, ^{ @autoreleasepool {
+		
+		// Ignore the timer if the changes it was scheduled for have been saved since
+		
+		if ((firstUnsavedChangeTime == changeTime) && [[self managedObjectContext] hasChanges])
+		{
+			XMPPLogVerbose(@"%@: Triggering save (maxCommitLatency)", [self class]);
+			
+			[self save];
+		}
+	}});
+}
+
+- (void)recordCommitWithChanges:(NSUInteger)changes latency:(NSTimeInterval)latency
+{
+	// Invoked with the commitLock held
+	
+	commitCount++;
+	committedChanges += changes;
+	
+	lastCommitSize = changes;
+	largestCommitSize = MAX(largestCommitSize, changes);
+	
+	lastCommitLatency = latency;
+	longestCommitLatency = MAX(longestCommitLatency, latency);
+	totalCommitLatency += latency;
+}
+
+- (void)recordStall:(NSTimeInterval)stall
+{
+	// Invoked with the commitLock held
+	
+	stallCount++;
+	totalStallTime += stall;
+	longestStall = MAX(longestStall, stall);
+}
+
+/**
+ * Records the part of a request (run on the storageQueue) that overlapped a write of the writer context.
+ * 
+ * Our managedObjectContext fetches and faults through the writer context,
+ * so the request most likely spent that time waiting for the write to finish.
+ * Writes are serialized on the queue of the writer context, and only the last one is remembered.
+ * That's enough, as a request that spans several writes is already recorded as a long stall.
+**/
+- (void)recordWriterWaitForRequestWithStartTime:(CFAbsoluteTime)requestStartTime
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	CFAbsoluteTime requestEndTime = CFAbsoluteTimeGetCurrent();
+	
+	OSSpinLockLock(&commitLock);
+	{
+		if (writerWriteStartTime > 0.0)
+		{
+			CFAbsoluteTime writeEndTime = (writerWriteEndTime > 0.0) ? writerWriteEndTime : requestEndTime;
+			
+			NSTimeInterval overlap = MIN(requestEndTime, writeEndTime) - MAX(requestStartTime, writerWriteStartTime);
+			if (overlap > 0.0)
+			{
+				[self recordStall:overlap];
+			}
+		}
+	}
+	OSSpinLockUnlock(&commitLock);
+}
+
+- (XMPPCoreDataStorageMetrics *)metrics
+{
+	XMPPCoreDataStorageMetrics *metrics = [[XMPPCoreDataStorageMetrics alloc] init];
+	
+	OSSpinLockLock(&commitLock);
+	{
+		metrics.commitCount          = commitCount;
+		metrics.committedChanges     = committedChanges;
+		metrics.lastCommitSize       = lastCommitSize;
+		metrics.largestCommitSize    = largestCommitSize;
+		metrics.lastCommitLatency    = lastCommitLatency;
+		metrics.longestCommitLatency = longestCommitLatency;
+		metrics.stallCount           = stallCount;
+		metrics.longestStall         = longestStall;
+		metrics.totalStallTime       = totalStallTime;
+		
+		if (commitCount > 0)
+		{
+			metrics.averageCommitSize    = (double)committedChanges / (double)commitCount;
+			metrics.averageCommitLatency = totalCommitLatency / (double)commitCount;
+		}
+	}
+	OSSpinLockUnlock(&commitLock);
+	
+	return metrics;
+}
+
+- (void)resetMetrics
+{
+	OSSpinLockLock(&commitLock);
+	{
+		commitCount = 0;
+		committedChanges = 0;
+		lastCommitSize = 0;
+		largestCommitSize = 0;
+		lastCommitLatency = 0.0;
+		longestCommitLatency = 0.0;
+		totalCommitLatency = 0.0;
+		stallCount = 0;
+		longestStall = 0.0;
+		totalStallTime = 0.0;
+	}
+	OSSpinLockUnlock(&commitLock);
+}
+
 - (void)maybeSave
 {
 	// Convenience method in the very rare case that a subclass would need to invoke maybeSave manually.
@@ -864,7 +1207,17 @@ static NSMutableSet *databaseFileNames;
 	OSAtomicIncrement32(&pendingRequests);
 	dispatch_sync(storageQueue, ^{ @autoreleasepool {
 		
-		block();
+		if (writerManagedObjectContext)
+		{
+			CFAbsoluteTime requestStartTime = CFAbsoluteTimeGetCurrent();
+			
+			block();
+			[self recordWriterWaitForRequestWithStartTime:requestStartTime];
+		}
+		else
+		{
+			block();
+		}
 		
 		// Since this is a synchronous request, we want to return as quickly as possible.
 		// So we delay the maybeSave operation til later.
@@ -894,11 +1247,127 @@ static NSMutableSet *databaseFileNames;
 	OSAtomicIncrement32(&pendingRequests);
 	dispatch_async(storageQueue, ^{ @autoreleasepool {
 		
-		block();
+		if (writerManagedObjectContext)
+		{
+			CFAbsoluteTime requestStartTime = CFAbsoluteTimeGetCurrent();
+			
+			block();
+			[self recordWriterWaitForRequestWithStartTime:requestStartTime];
+		}
+		else
+		{
+			block();
+		}
+		
 		[self maybeSave:OSAtomicDecrement32(&pendingRequests)];
 	}});
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Bulk Operations
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSArray *)objectIDsForEntityName:(NSString *)entityName predicate:(NSPredicate *)predicate
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	NSManagedObjectContext *moc = [self managedObjectContext];
+	
+	NSEntityDescription *entity = [NSEntityDescription entityForName:entityName inManagedObjectContext:moc];
+	
+	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+	[fetchRequest setEntity:entity];
+	[fetchRequest setPredicate:predicate];
+	[fetchRequest setResultType:NSManagedObjectIDResultType];
+	
+	NSError *error = nil;
+	NSArray *results = [moc executeFetchRequest:fetchRequest error:&error];
+	
+	if (results == nil)
+	{
+		XMPPLogWarn(@"%@: Error fetching %@ objectIDs - %@ %@", [self class], entityName, error, [error userInfo]);
+	}
+	
+	return results;
+}
+
+- (void)deleteObjectsWithIDs:(NSArray *)objectIDs completionBlock:(dispatch_block_t)completionBlock
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	[self deleteObjectsWithIDs:objectIDs fromIndex:0 completionBlock:completionBlock];
+}
+
+- (void)deleteObjectsWithIDs:(NSArray *)objectIDs
+                   fromIndex:(NSUInteger)index
+             completionBlock:(dispatch_block_t)completionBlock
+{
+	NSUInteger count = [objectIDs count];
+	
+	if (index >= count)
+	{
+		if (completionBlock)
+			completionBlock();
+		
+		return;
+	}
+	
+	NSRange range = NSMakeRange(index, MIN(MAX(saveThreshold, (NSUInteger)1), count - index));
+	
+	XMPPLogVerbose(@"%@: Deleting objects %lu-%lu of %lu", [self class],
+	               (unsigned long)range.location, (unsigned long)NSMaxRange(range), (unsigned long)count);
+	
+	// Group the objectIDs of the chunk by entity, so each entity takes a single fetch.
+	
+	NSMutableDictionary *chunkIDsByEntity = [NSMutableDictionary dictionary];
+	
+	for (NSManagedObjectID *objectID in [objectIDs subarrayWithRange:range])
+	{
+		NSString *entityName = [[objectID entity] name];
+		
+		NSMutableArray *entityIDs = [chunkIDsByEntity objectForKey:entityName];
+		if (entityIDs == nil)
+		{
+			entityIDs = [NSMutableArray array];
+			[chunkIDsByEntity setObject:entityIDs forKey:entityName];
+		}
+		
+		[entityIDs addObject:objectID];
+	}
+	
+	NSManagedObjectContext *moc = [self managedObjectContext];
+	
+	[chunkIDsByEntity enumerateKeysAndObjectsUsingBlock:^(NSString *entityName, NSArray *entityIDs, BOOL *stop) {
+		
+		// Objects that have been deleted in the meantime are simply not returned.
+		// The property values aren't needed, so the objects are returned as faults.
+		
+		NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+		[fetchRequest setEntity:[NSEntityDescription entityForName:entityName inManagedObjectContext:moc]];
+		[fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"self IN %@", entityIDs]];
+		[fetchRequest setIncludesPropertyValues:NO];
+		
+		NSArray *results = [moc executeFetchRequest:fetchRequest error:nil];
+		
+		for (NSManagedObject *object in results)
+		{
+			[moc deleteObject:object];
+		}
+	}];
+	
+	// Save each chunk, so the deleted objects don't pile up in the managedObjectContext.
+	[self save];
+	
+	// And give the requests that arrived in the meantime a chance to run before the next chunk.
+	
+	NSUInteger nextIndex = NSMaxRange(range);
+	
+	dispatch_async(storageQueue, ^{ @autoreleasepool {
+		
+		[self deleteObjectsWithIDs:objectIDs fromIndex:nextIndex completionBlock:completionBlock];
+	}});
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Memory Management
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -919,3 +1388,32 @@ static NSMutableSet *databaseFileNames;
 }
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPCoreDataStorageMetrics
+
+@synthesize commitCount;
+@synthesize committedChanges;
+@synthesize lastCommitSize;
+@synthesize largestCommitSize;
+@synthesize averageCommitSize;
+@synthesize lastCommitLatency;
+@synthesize longestCommitLatency;
+@synthesize averageCommitLatency;
+@synthesize stallCount;
+@synthesize longestStall;
+@synthesize totalStallTime;
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPCoreDataStorageMetrics[%p]: commits(%llu) size(avg %.1f, max %lu) "
+	                                  @"latency(avg %.3fs, max %.3fs) stalls(%llu, max %.3fs, total %.3fs)>",
+	                                  self, commitCount, averageCommitSize, (unsigned long)largestCommitSize,
+	                                  averageCommitLatency, longestCommitLatency,
+	                                  stallCount, longestStall, totalStallTime];
+}
+
+@end
@@ -101,6 +101,13 @@
 /**
  * Override me if you need to do anything special after changes have been saved to disk.
  * 
+ * If the storage uses a writer context (see XMPPCoreDataStorage.h),
+ * this is invoked once the writer context has written the changes to disk.
+ * Since the writer may write the changes of several saves at once, it may be invoked fewer times than willSave.
+ * 
+ * If the writer fails to write the changes, they're discarded, this method isn't invoked,
+ * and the managedObjectContext is reset (so it matches the database again).
+ * 
  * This method will be invoked on the storageQueue.
  * The default implementation does nothing.
 **/
@@ -244,7 +251,8 @@
  * This method makes informed decisions as to whether it should save the managedObjectContext changes to disk.
  * Since this disk IO is a slow process, it is better to buffer writes during high demand.
  * This method takes into account the number of pending requests waiting on the storage instance,
- * as well as the number of unsaved changes (which reside in NSManagedObjectContext's internal memory).
+ * the number of unsaved changes (which reside in NSManagedObjectContext's internal memory),
+ * and how long the changes have been unsaved (see maxCommitLatency).
  * 
  * Please see the documentation for executeBlock and scheduleBlock below.
 **/
@@ -295,4 +303,34 @@
 **/
 - (void)scheduleBlock:(dispatch_block_t)block;
 
+#pragma mark Bulk Operations
+
+/**
+ * Returns the objectIDs of the objects matching the given predicate,
+ * without fetching the objects themselves into the managedObjectContext.
+ * 
+ * This method must be invoked on the storageQueue.
+**/
+- (NSArray *)objectIDsForEntityName:(NSString *)entityName predicate:(NSPredicate *)predicate;
+
+/**
+ * Deletes the objects with the given objectIDs, in chunks of saveThreshold objects.
+ * 
+ * Deleting a large number of objects in a single loop means fetching all of them into the managedObjectContext,
+ * and keeping the storageQueue busy until they've all been deleted.
+ * Instead, each chunk is fetched as faults (without property values), deleted and saved.
+ * Between the chunks, requests that arrived in the meantime are allowed to run.
+ * 
+ * The first chunk is deleted right away, the rest asynchronously.
+ * Objects that have been deleted in the meantime are skipped.
+ * The completionBlock (if any) is invoked on the storageQueue once all the objects have been deleted.
+ * 
+ * Keep in mind that requests running in between the chunks may still find the objects that are yet to be deleted.
+ * If this matters, the subclass should keep track of the objectIDs until the completionBlock is invoked.
+ * (See XMPPCapabilitiesCoreDataStorage for an example.)
+ * 
+ * This method must be invoked on the storageQueue.
+**/
+- (void)deleteObjectsWithIDs:(NSArray *)objectIDs completionBlock:(dispatch_block_t)completionBlock;
+
 @end
@@ -1,13 +1,183 @@
 #import "LibIDN.h"
 #import "stringprep.h"
 
+/**
+ * ASCII fast path.
+ *
+ * The vast majority of JIDs consist entirely of ASCII characters.
+ * For ASCII input, the stringprep profiles reduce to:
+ *
+ * - nodeprep:     map A-Z to a-z, prohibit controls, space and  " & ' / : < > @
+ * - nameprep:     map A-Z to a-z
+ * - resourceprep: nothing (resourceprep does no case folding)
+ *
+ * So we classify each character via a small table, and only hand the string to libidn
+ * if it contains non-ASCII characters, or anything we'd rather not reason about (controls, prohibited characters).
+ * In the latter case libidn produces the authoritative result (usually a failure).
+ *
+ * Strings that are already canonical are returned as-is, without any copying.
+**/
+
+#define LIBIDN_MAX_LENGTH 1023 // Each allowable portion of a JID MUST NOT be more than 1023 bytes in length
+
+enum LibIDNASCIIClass
+{
+	LibIDNASCIIClassPass = 0,  // Character maps to itself
+	LibIDNASCIIClassFold = 1,  // Character maps to its lowercase form
+	LibIDNASCIIClassSlow = 2,  // Let libidn decide
+};
+
+enum LibIDNProfile
+{
+	LibIDNProfileNode,
+	LibIDNProfileDomain,
+	LibIDNProfileResource,
+	
+	LibIDNProfileCount
+};
+typedef enum LibIDNProfile LibIDNProfile;
+
+static uint8_t asciiClasses[LibIDNProfileCount][128];
+
+static void LibIDNInitializeASCIIClasses(void)
+{
+	int profile;
+	for (profile = 0; profile < LibIDNProfileCount; profile++)
+	{
+		unsigned c;
+		for (c = 0; c < 128; c++)
+		{
+			uint8_t class = LibIDNASCIIClassPass;
+			
+			if (c < 0x20 || c == 0x7F)
+			{
+				class = LibIDNASCIIClassSlow;
+			}
+			else if (c >= 'A' && c <= 'Z')
+			{
+				if (profile != LibIDNProfileResource)
+					class = LibIDNASCIIClassFold;
+			}
+			else if (profile == LibIDNProfileNode && strchr(" \"&'/:<>@", (int)c) != NULL)
+			{
+				class = LibIDNASCIIClassSlow;
+			}
+			
+			asciiClasses[profile][c] = class;
+		}
+	}
+}
+
+/**
+ * Returns the prepped string if the fast path could handle it.
+ * Returns nil (and sets handled to NO) if the string must go through libidn.
+**/
+static NSString *LibIDNASCIIPrep(NSString *str, LibIDNProfile profile, BOOL *handled)
+{
+	*handled = NO;
+	
+	NSUInteger length = [str length];
+	if (length > LIBIDN_MAX_LENGTH) return nil;
+	
+	const uint8_t *classes = asciiClasses[profile];
+	uint8_t flags = 0;
+	
+	const char *cStr = CFStringGetCStringPtr((__bridge CFStringRef)str, kCFStringEncodingASCII);
+	if (cStr)
+	{
+		// Backed by 8-bit storage, which we can scan directly.
+		// Check 8 bytes at a time for non-ASCII characters before classifying them.
+		
+		const uint8_t *bytes = (const uint8_t *)cStr;
+		NSUInteger i = 0;
+		
+		for (; i + 8 <= length; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			
+			if (word & 0x8080808080808080ULL) return nil;
+			
+			flags |= classes[bytes[i+0]] | classes[bytes[i+1]] | classes[bytes[i+2]] | classes[bytes[i+3]]
+			       | classes[bytes[i+4]] | classes[bytes[i+5]] | classes[bytes[i+6]] | classes[bytes[i+7]];
+		}
+		for (; i < length; i++)
+		{
+			if (bytes[i] & 0x80) return nil;
+			
+			flags |= classes[bytes[i]];
+		}
+		
+		if (flags & LibIDNASCIIClassSlow) return nil;
+		
+		*handled = YES;
+		
+		if (flags == LibIDNASCIIClassPass)
+		{
+			return [str copy];
+		}
+		
+		char buf[LIBIDN_MAX_LENGTH];
+		for (i = 0; i < length; i++)
+		{
+			uint8_t c = bytes[i];
+			buf[i] = (classes[c] == LibIDNASCIIClassFold) ? (char)(c | 0x20) : (char)c;
+		}
+		
+		return [[NSString alloc] initWithBytes:buf length:length encoding:NSASCIIStringEncoding];
+	}
+	else
+	{
+		unichar buf[LIBIDN_MAX_LENGTH];
+		[str getCharacters:buf range:NSMakeRange(0, length)];
+		
+		NSUInteger i;
+		for (i = 0; i < length; i++)
+		{
+			if (buf[i] >= 0x80) return nil;
+			
+			flags |= classes[buf[i]];
+		}
+		
+		if (flags & LibIDNASCIIClassSlow) return nil;
+		
+		*handled = YES;
+		
+		if (flags == LibIDNASCIIClassPass)
+		{
+			return [str copy];
+		}
+		
+		for (i = 0; i < length; i++)
+		{
+			if (classes[buf[i]] == LibIDNASCIIClassFold)
+				buf[i] |= 0x20;
+		}
+		
+		return [NSString stringWithCharacters:buf length:length];
+	}
+}
+
 
 @implementation LibIDN
 
++ (void)initialize
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		LibIDNInitializeASCIIClasses();
+	});
+}
+
 + (NSString *)prepNode:(NSString *)node
 {
 	if(node == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = LibIDNASCIIPrep(node, LibIDNProfileNode, &handled);
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -23,6 +193,10 @@
 {
 	if(domain == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = LibIDNASCIIPrep(domain, LibIDNProfileDomain, &handled);
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -38,6 +212,10 @@
 {
 	if(resource == nil) return nil;
 	
+	BOOL handled;
+	NSString *result = LibIDNASCIIPrep(resource, LibIDNProfileResource, &handled);
+	if (handled) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
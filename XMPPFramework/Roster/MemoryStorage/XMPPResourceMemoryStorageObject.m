@@ -6,6 +6,20 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+NSComparator const XMPPCompareResources = ^NSComparisonResult(id obj1, id obj2) {
+	
+	XMPPResourceMemoryStorageObject *resource1 = (XMPPResourceMemoryStorageObject *)obj1;
+	XMPPResourceMemoryStorageObject *resource2 = (XMPPResourceMemoryStorageObject *)obj2;
+	
+	NSComparisonResult result = [resource1 compare:resource2];
+	if (result == NSOrderedSame)
+	{
+		result = [[[resource1 jid] full] compare:[[resource2 jid] full]];
+	}
+	
+	return result;
+};
+
 
 @implementation XMPPResourceMemoryStorageObject
 
@@ -36,7 +50,7 @@
 	XMPPResourceMemoryStorageObject *deepCopy = (XMPPResourceMemoryStorageObject *)[[[self class] alloc] init];
 	
 	deepCopy->jid = [jid copy];
-	deepCopy->presence = presence; // No need to bother with a copy sicne we don't alter presence
+	deepCopy->presence = [presence copy]; // The element may still be altered by whoever else received it
 	deepCopy->presenceDate = [presenceDate copy];
 	
 	return deepCopy;
@@ -3,6 +3,10 @@
 #import "XMPPUserMemoryStorageObject.h"
 #import "XMPPResourceMemoryStorageObject.h"
 
+@class XMPPRosterMemoryStorageChangeSet;
+@class XMPPRosterMemoryStorageSnapshot;
+@class XMPPBinaryDecoder;
+
 
 /**
  * This class is an example implementation of the XMPPRosterStorage protocol.
@@ -27,12 +31,57 @@
 	BOOL isRosterPopulation;
 	NSMutableDictionary *roster;
 	
+	// Sorted indexes of the roster (maintained incrementally, see the Sorted Indexes section)
+	NSMutableArray *usersByName;
+	NSMutableArray *availableUsersByName;
+	NSMutableArray *unavailableUsersByName;
+	NSMutableArray *availableResources;
+	BOOL sortedIndexesNeedRebuild;
+	
+	NSTimeInterval presenceBatchingInterval;
+	XMPPRosterMemoryStorageChangeSet *pendingChanges;
+	
+	// Roster versioning (see initWithSnapshotPath:)
+	NSString *snapshotPath;
+	NSString *rosterVersion;
+	XMPPBinaryDecoder *snapshot;
+	dispatch_queue_t snapshotQueue;
+	BOOL snapshotNeedsSave;
+	
+	// Published snapshots (see publishesSnapshots)
+	BOOL publishesSnapshots;
+	BOOL snapshotPublishScheduled;
+	BOOL snapshotNeedsFullPublish;
+	NSMutableSet *unpublishedJIDs;
+	NSMutableDictionary *publishedUsers;
+	XMPPUserMemoryStorageObject *publishedMyUser;
+	uint64_t snapshotVersion;
+	XMPPRosterMemoryStorageSnapshot *publishedSnapshot;
+	
 	XMPPJID *myJID;
 	XMPPUserMemoryStorageObject *myUser;
 }
 
 - (id)init;
 
+/**
+ * Initializes the storage with a roster snapshot file, which enables roster versioning (XEP-0237).
+ * 
+ * Whenever the server sends a new version of the roster, the roster is saved to the given file.
+ * Saving is deferred by a couple of seconds, so a burst of roster pushes results in a single save.
+ * The snapshot is loaded (memory mapped) at initialization, so that after a restart,
+ * only the changes since the stored version have to be downloaded from the server.
+ * If the roster hasn't changed, it's restored from the snapshot in a single pass, without any parsing.
+ * 
+ * The file is written in the compact binary format (see XMPPBinaryCoding.h), in the background.
+ * If the file is missing or can't be decoded, the full roster is simply downloaded as usual.
+ * 
+ * The snapshot doesn't include the presence of users (which doesn't outlive a session).
+**/
+- (id)initWithSnapshotPath:(NSString *)path;
+
+@property (readonly) NSString *snapshotPath;
+
 @property (readonly) XMPPRoster *parent;
 
 /**
@@ -42,6 +91,42 @@
 @property (readwrite, assign) Class userClass;
 @property (readwrite, assign) Class resourceClass;
 
+/**
+ * When a large roster comes online, thousands of presence elements may arrive within a second or two.
+ * Normally every presence element is reported individually (xmppRoster:didAddResource:withUser:, etc).
+ * 
+ * If a batching interval is set, presence elements are still applied to the roster immediately,
+ * but the resulting changes are collected, and reported together at the end of the interval
+ * via xmppRoster:didApplyChanges:, followed by a single xmppRosterDidChange:.
+ * The individual resource delegate methods are NOT invoked for batched changes.
+ * 
+ * Changes to the roster itself (roster items) are never batched.
+ * Any pending presence changes are reported before them, so the order of events is preserved.
+ * 
+ * The default value is zero, which disables batching.
+**/
+@property (readwrite, assign) NSTimeInterval presenceBatchingInterval;
+
+/**
+ * The methods below (e.g. sortedUsersByName) are exact, but if they're invoked from another queue,
+ * they have to wait for the roster's queue, and they copy every user they return.
+ * During a flood of presence elements, that can block the calling thread (e.g. the main thread) for a while.
+ * 
+ * If publishesSnapshots is enabled, the storage publishes an immutable snapshot of the roster shortly after it changes.
+ * Fetching the publishedSnapshot never waits for the roster's queue, and the snapshot can be used from any thread.
+ * Every snapshot has a version (which increases with every snapshot that's published),
+ * and every snapshot is announced via the xmppRoster:didPublishSnapshot: delegate method.
+ * 
+ * Changes are coalesced, so a burst of changes results in a single snapshot.
+ * If presenceBatchingInterval is set, the snapshot is published along with each batch of changes.
+ * Only the users that have changed are copied again. Unchanged users are shared with the previous snapshot.
+ * 
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL publishesSnapshots;
+
+@property (readonly) XMPPRosterMemoryStorageSnapshot *publishedSnapshot;
+
 /**
  * The methods below provide access to the roster data.
  * 
@@ -70,6 +155,87 @@
 
 - (NSArray *)sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself;
 
+/**
+ * The sorted lists above are maintained incrementally, as roster items and presence elements are received,
+ * so they don't need to be sorted when they're requested.
+ * 
+ * The methods below return a single page of a sorted list (e.g. the rows of a table that are visible).
+ * The range is clipped to the number of users.
+**/
+
+- (NSUInteger)numberOfUsers;
+- (NSUInteger)numberOfAvailableUsers;
+
+- (NSArray *)sortedUsersByNameInRange:(NSRange)range;
+- (NSArray *)sortedUsersByAvailabilityNameInRange:(NSRange)range;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The net effect of a batch of presence elements (see presenceBatchingInterval).
+ * 
+ * Changes are coalesced per resource (and per user).
+ * E.g. a resource that was added and then updated is reported once, as added.
+ * And a resource that was added and then removed within the same batch isn't reported at all.
+ * 
+ * The updated users are the users whose resources (and thus possibly availability) changed.
+ * Users are only ever added by presence elements if the roster allows rosterless operation.
+**/
+@interface XMPPRosterMemoryStorageChangeSet : NSObject
+
+@property (nonatomic, readonly) NSArray *addedUsers;
+@property (nonatomic, readonly) NSArray *updatedUsers;
+
+@property (nonatomic, readonly) NSArray *addedResources;
+@property (nonatomic, readonly) NSArray *updatedResources;
+@property (nonatomic, readonly) NSArray *removedResources;
+
+/**
+ * The number of presence elements that were applied in the batch.
+**/
+@property (nonatomic, readonly) NSUInteger presenceCount;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * An immutable copy of the roster, as published by the storage (see publishesSnapshots).
+ * 
+ * The methods mirror those of XMPPRosterMemoryStorage.
+ * The snapshot (and the users and resources within it) never change, so they may be used from any thread.
+**/
+@interface XMPPRosterMemoryStorageSnapshot : NSObject
+
+@property (nonatomic, readonly) uint64_t version;
+
+- (XMPPUserMemoryStorageObject *)myUser;
+- (XMPPResourceMemoryStorageObject *)myResource;
+
+- (XMPPUserMemoryStorageObject *)userForJID:(XMPPJID *)jid;
+- (XMPPResourceMemoryStorageObject *)resourceForJID:(XMPPJID *)jid;
+
+- (NSArray *)sortedUsersByName;
+- (NSArray *)sortedUsersByAvailabilityName;
+
+- (NSArray *)sortedAvailableUsersByName;
+- (NSArray *)sortedUnavailableUsersByName;
+
+- (NSArray *)unsortedUsers;
+- (NSArray *)unsortedAvailableUsers;
+- (NSArray *)unsortedUnavailableUsers;
+
+- (NSArray *)sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself;
+
+- (NSUInteger)numberOfUsers;
+- (NSUInteger)numberOfAvailableUsers;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -125,4 +291,15 @@
  didRemoveResource:(XMPPResourceMemoryStorageObject *)resource
           withUser:(XMPPUserMemoryStorageObject *)user;
 
+/**
+ * Invoked instead of the resource notifications above, if presenceBatchingInterval is set.
+**/
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didApplyChanges:(XMPPRosterMemoryStorageChangeSet *)changes;
+
+/**
+ * Invoked whenever a new snapshot is published, if publishesSnapshots is enabled.
+ * The snapshots are delivered in order of their version.
+**/
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didPublishSnapshot:(XMPPRosterMemoryStorageSnapshot *)snapshot;
+
 @end
@@ -2,6 +2,7 @@
 #import "XMPPRosterPrivate.h"
 #import "XMPPRosterMemoryStorage.h"
 #import "XMPPRosterMemoryStoragePrivate.h"
+#import "XMPPBinaryCoding.h"
 #import "XMPPLogging.h"
 
 #if ! __has_feature(objc_arc)
@@ -15,6 +16,8 @@
   static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 #endif
 
+#define SNAPSHOT_SAVE_DELAY 2.0 // seconds
+
 #define AssertPrivateQueue() \
         NSAssert(dispatch_get_specific(parentQueueTag), @"Private method: MUST run on parentQueue");
 
@@ -24,9 +27,57 @@
 @interface XMPPRosterMemoryStorage ()
 
 @property (readonly) dispatch_queue_t parentQueue;
+@property (readwrite, strong) XMPPRosterMemoryStorageSnapshot *publishedSnapshot;
+
+@end
+
+@interface XMPPRosterMemoryStorageChangeSet ()
+
+- (void)recordAddedUser:(XMPPUserMemoryStorageObject *)user;
+
+- (void)recordChange:(int)change
+         forResource:(XMPPResourceMemoryStorageObject *)resource
+            withUser:(XMPPUserMemoryStorageObject *)user;
+
+- (void)recordPresence;
+
+- (BOOL)isEmpty;
 
 @end
 
+@interface XMPPRosterMemoryStorageSnapshot ()
+
+- (id)initWithVersion:(uint64_t)version
+                users:(NSDictionary *)users
+               myUser:(XMPPUserMemoryStorageObject *)myUser
+                myJID:(XMPPJID *)myJID
+ availableUsersByName:(NSArray *)availableUsersByName
+unavailableUsersByName:(NSArray *)unavailableUsersByName
+   availableResources:(NSArray *)availableResources;
+
+@end
+
+/**
+ * The comparators of the sorted indexes.
+ * 
+ * They're the same comparisons the roster has always sorted by,
+ * with a tie-breaker (the jid) so that every object has exactly one position in its index.
+**/
+
+static NSComparator const XMPPCompareUsersByName = ^NSComparisonResult(id obj1, id obj2) {
+	
+	XMPPUserMemoryStorageObject *user1 = (XMPPUserMemoryStorageObject *)obj1;
+	XMPPUserMemoryStorageObject *user2 = (XMPPUserMemoryStorageObject *)obj2;
+	
+	NSComparisonResult result = [user1 compareByName:user2];
+	if (result == NSOrderedSame)
+	{
+		result = [[[user1 jid] bare] compare:[[user2 jid] bare]];
+	}
+	
+	return result;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -34,6 +85,11 @@
 @implementation XMPPRosterMemoryStorage
 
 - (id)init
+{
+	return [self initWithSnapshotPath:nil];
+}
+
+- (id)initWithSnapshotPath:(NSString *)path
 {
 	if ((self = [super init]))
 	{
@@ -41,6 +97,19 @@
 		resourceClass = [XMPPResourceMemoryStorageObject class];
 		
 		roster = [[NSMutableDictionary alloc] init];
+		
+		usersByName = [[NSMutableArray alloc] init];
+		availableUsersByName = [[NSMutableArray alloc] init];
+		unavailableUsersByName = [[NSMutableArray alloc] init];
+		availableResources = [[NSMutableArray alloc] init];
+		
+		if (path)
+		{
+			snapshotPath = [path copy];
+			snapshotQueue = dispatch_queue_create("XMPPRosterMemoryStorage.snapshot", NULL);
+			
+			[self loadSnapshot];
+		}
 	}
 	return self;
 }
@@ -75,6 +144,8 @@
 	#if !OS_OBJECT_USE_OBJC
 	if (parentQueue)
 		dispatch_release(parentQueue);
+	if (snapshotQueue)
+		dispatch_release(snapshotQueue);
 	#endif
 }
 
@@ -84,6 +155,8 @@
 
 @synthesize userClass;
 @synthesize resourceClass;
+@synthesize snapshotPath;
+@synthesize publishedSnapshot;
 
 - (XMPPRoster *)parent
 {
@@ -109,6 +182,44 @@
 	return result;
 }
 
+- (NSTimeInterval)presenceBatchingInterval
+{
+	__block NSTimeInterval result = 0.0;
+	
+	dispatch_block_t block = ^{
+		result = presenceBatchingInterval;
+	};
+	
+	dispatch_queue_t queue = self.parentQueue;
+	
+	if (queue == NULL || dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_sync(queue, block);
+	
+	return result;
+}
+
+- (void)setPresenceBatchingInterval:(NSTimeInterval)interval
+{
+	dispatch_block_t block = ^{
+		
+		presenceBatchingInterval = interval;
+		
+		if (interval <= 0.0 && pendingChanges)
+		{
+			[self flushPendingChanges];
+		}
+	};
+	
+	dispatch_queue_t queue = self.parentQueue;
+	
+	if (queue == NULL || dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_async(queue, block);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Internal API
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -148,112 +259,684 @@
 	return (XMPPResourceMemoryStorageObject *)[user resourceForJID:jid];
 }
 
-- (NSArray *)_unsortedUsers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Presence Batching
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the change set of the current batch, starting a new batch if needed.
+ * A batch is reported once its interval has elapsed (unless it's flushed earlier).
+**/
+- (XMPPRosterMemoryStorageChangeSet *)pendingChanges
 {
 	AssertPrivateQueue();
 	
-	return [roster allValues];
+	if (pendingChanges == nil)
+	{
+		XMPPRosterMemoryStorageChangeSet *changes = [[XMPPRosterMemoryStorageChangeSet alloc] init];
+		pendingChanges = changes;
+		
+		dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(presenceBatchingInterval * NSEC_PER_SEC));
+		dispatch_after(tt, parentQueue, ^{ @autoreleasepool {
+			
+			// The batch may have been flushed early, in which case a new batch may already be pending
+			if (pendingChanges == changes)
+			{
+				[self flushPendingChanges];
+			}
+		}});
+	}
+	
+	return pendingChanges;
 }
 
-- (NSArray *)_unsortedAvailableUsers
+- (void)flushPendingChanges
+{
+	AssertPrivateQueue();
+	
+	if (pendingChanges == nil) return;
+	
+	XMPPRosterMemoryStorageChangeSet *changes = pendingChanges;
+	pendingChanges = nil;
+	
+	// The snapshot goes out with the batch (see scheduleSnapshotPublish)
+	if (snapshotPublishScheduled)
+	{
+		[self publishSnapshot];
+	}
+	
+	if ([changes isEmpty]) return;
+	
+	[[self multicastDelegate] xmppRoster:self didApplyChanges:changes];
+	[[self multicastDelegate] xmppRosterDidChange:self];
+}
+
+- (BOOL)publishesSnapshots
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = publishesSnapshots;
+	};
+	
+	dispatch_queue_t queue = self.parentQueue;
+	
+	if (queue == NULL || dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_sync(queue, block);
+	
+	return result;
+}
+
+- (void)setPublishesSnapshots:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		
+		if (publishesSnapshots == flag) return;
+		publishesSnapshots = flag;
+		
+		if (flag)
+		{
+			unpublishedJIDs = [[NSMutableSet alloc] init];
+			publishedUsers = [[NSMutableDictionary alloc] init];
+			
+			// If we're not attached to a roster yet, the first snapshot is published once the roster changes
+			if (parentQueue)
+				[self snapshotRosterDidChange];
+			else
+				snapshotNeedsFullPublish = YES;
+		}
+		else
+		{
+			unpublishedJIDs = nil;
+			publishedUsers = nil;
+			publishedMyUser = nil;
+			
+			self.publishedSnapshot = nil;
+		}
+	};
+	
+	dispatch_queue_t queue = self.parentQueue;
+	
+	if (queue == NULL || dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_async(queue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Published Snapshots
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Changes to the roster are recorded (by bare jid), and a snapshot is published asynchronously on the parentQueue.
+ * So any changes that are applied before the publish block runs (e.g. a flood of queued presence elements)
+ * end up in the same snapshot.
+ * 
+ * If presence batching is enabled, the snapshot is instead published when the current batch is flushed.
+ * Otherwise a flood spread over time would still publish (and copy the sorted lists) once per presence.
+ * 
+ * Copies of the users are kept between snapshots, and only the copies of the changed users are replaced.
+ * The sorted lists of the snapshot are then mapped from the sorted indexes, so nothing has to be sorted.
+**/
+
+- (void)snapshotUserDidChange:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (!publishesSnapshots || user == nil) return;
+	
+	[unpublishedJIDs addObject:[user jid]];
+	[self scheduleSnapshotPublish];
+}
+
+- (void)snapshotRosterDidChange
+{
+	AssertPrivateQueue();
+	
+	if (!publishesSnapshots) return;
+	
+	snapshotNeedsFullPublish = YES;
+	[self scheduleSnapshotPublish];
+}
+
+- (void)scheduleSnapshotPublish
+{
+	AssertPrivateQueue();
+	
+	if (snapshotPublishScheduled || parentQueue == NULL) return;
+	snapshotPublishScheduled = YES;
+	
+	if (presenceBatchingInterval > 0.0)
+	{
+		// Starts a batch if needed, which publishes the snapshot when it's flushed
+		[self pendingChanges];
+	}
+	else
+	{
+		dispatch_async(parentQueue, ^{ @autoreleasepool {
+			
+			if (snapshotPublishScheduled)
+			{
+				[self publishSnapshot];
+			}
+		}});
+	}
+}
+
+- (void)publishSnapshot
+{
+	AssertPrivateQueue();
+	
+	snapshotPublishScheduled = NO;
+	
+	if (!publishesSnapshots) return;
+	
+	[self ensureSortedIndexes];
+	
+	XMPPJID *myBareJID = [myJID bareJID];
+	
+	if (snapshotNeedsFullPublish)
+	{
+		[publishedUsers removeAllObjects];
+		
+		for (XMPPUserMemoryStorageObject *user in [roster objectEnumerator])
+		{
+			[publishedUsers setObject:[user copy] forKey:[user jid]];
+		}
+		
+		publishedMyUser = [myUser copy];
+	}
+	else
+	{
+		for (XMPPJID *jid in unpublishedJIDs)
+		{
+			XMPPUserMemoryStorageObject *user = [roster objectForKey:jid];
+			
+			if (user)
+				[publishedUsers setObject:[user copy] forKey:jid];
+			else
+				[publishedUsers removeObjectForKey:jid];
+			
+			if ([jid isEqualToJID:myBareJID])
+			{
+				publishedMyUser = [myUser copy];
+			}
+		}
+	}
+	
+	snapshotNeedsFullPublish = NO;
+	[unpublishedJIDs removeAllObjects];
+	
+	NSMutableArray *snapshotAvailableUsers = [NSMutableArray arrayWithCapacity:[availableUsersByName count]];
+	for (XMPPUserMemoryStorageObject *user in availableUsersByName)
+	{
+		XMPPUserMemoryStorageObject *userCopy = [publishedUsers objectForKey:[user jid]];
+		if (userCopy) [snapshotAvailableUsers addObject:userCopy];
+	}
+	
+	NSMutableArray *snapshotUnavailableUsers = [NSMutableArray arrayWithCapacity:[unavailableUsersByName count]];
+	for (XMPPUserMemoryStorageObject *user in unavailableUsersByName)
+	{
+		XMPPUserMemoryStorageObject *userCopy = [publishedUsers objectForKey:[user jid]];
+		if (userCopy) [snapshotUnavailableUsers addObject:userCopy];
+	}
+	
+	NSMutableArray *snapshotResources = [NSMutableArray arrayWithCapacity:[availableResources count]];
+	for (XMPPResourceMemoryStorageObject *resource in availableResources)
+	{
+		XMPPJID *resourceJID = [resource jid];
+		XMPPUserMemoryStorageObject *userCopy = [publishedUsers objectForKey:[resourceJID bareJID]];
+		
+		XMPPResourceMemoryStorageObject *resourceCopy =
+		    (XMPPResourceMemoryStorageObject *)[userCopy resourceForJID:resourceJID];
+		
+		if (resourceCopy) [snapshotResources addObject:resourceCopy];
+	}
+	
+	XMPPRosterMemoryStorageSnapshot *newSnapshot =
+	    [[XMPPRosterMemoryStorageSnapshot alloc] initWithVersion:++snapshotVersion
+	                                                       users:[publishedUsers copy]
+	                                                      myUser:publishedMyUser
+	                                                       myJID:myJID
+	                                        availableUsersByName:snapshotAvailableUsers
+	                                      unavailableUsersByName:snapshotUnavailableUsers
+	                                          availableResources:snapshotResources];
+	
+	self.publishedSnapshot = newSnapshot;
+	
+	[[self multicastDelegate] xmppRoster:self didPublishSnapshot:newSnapshot];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Roster Snapshot
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The snapshot file consists of the roster query (which carries the version):
+ * 
+ * <query xmlns="jabber:iq:roster" ver="ver14"/>
+ * 
+ * followed by a roster item record for every user.
+**/
+
+- (void)loadSnapshot
+{
+	// Invoked from the init method (so there's no parentQueue yet)
+	
+	if (![[NSFileManager defaultManager] fileExistsAtPath:snapshotPath]) return;
+	
+	NSError *error = nil;
+	XMPPBinaryDecoder *decoder = [XMPPBinaryDecoder decoderWithContentsOfFile:snapshotPath error:&error];
+	
+	if (decoder == nil)
+	{
+		XMPPLogWarn(@"%@: Unable to load roster snapshot: %@", THIS_FILE, error);
+		return;
+	}
+	
+	NSXMLElement *query = nil;
+	if ([decoder count] > 0)
+	{
+		query = [decoder elementAtIndex:0];
+	}
+	
+	NSString *ver = [query attributeStringValueForName:@"ver"];
+	
+	if (![[query name] isEqualToString:@"query"] || ![[query xmlns] isEqualToString:@"jabber:iq:roster"] || ver == nil)
+	{
+		XMPPLogWarn(@"%@: Ignoring invalid roster snapshot", THIS_FILE);
+		return;
+	}
+	
+	snapshot = decoder;
+	rosterVersion = ver;
+}
+
+- (void)saveSnapshot
+{
+	AssertPrivateQueue();
+	
+	snapshotNeedsSave = NO;
+	
+	if (snapshotPath == nil) return;
+	
+	NSString *path = snapshotPath;
+	
+	// Encoding is a single pass over the roster (no XML is generated).
+	// Only writing the file is moved off the parentQueue.
+	
+	XMPPBinaryEncoder *encoder = nil;
+	
+	if (rosterVersion)
+	{
+		encoder = [[XMPPBinaryEncoder alloc] init];
+		
+		NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:@"jabber:iq:roster"];
+		[query addAttributeWithName:@"ver" stringValue:rosterVersion];
+		
+		BOOL encoded = [encoder encodeElement:query];
+		
+		for (XMPPUserMemoryStorageObject *user in [roster objectEnumerator])
+		{
+			if (!encoded) break;
+			encoded = [user encodeWithBinaryEncoder:encoder];
+		}
+		
+		if (!encoded)
+		{
+			// A snapshot missing a user would be worse than no snapshot at all
+			XMPPLogWarn(@"%@: Unable to encode roster snapshot", THIS_FILE);
+			encoder = nil;
+		}
+	}
+	
+	if (encoder == nil)
+	{
+		snapshot = nil;
+		
+		dispatch_async(snapshotQueue, ^{ @autoreleasepool {
+			
+			[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+		}});
+		return;
+	}
+	
+	NSData *data = [encoder data];
+	
+	// Keep the latest version around, so the roster can be restored from it later (e.g. after a reconnect)
+	snapshot = [[XMPPBinaryDecoder alloc] initWithData:data error:nil];
+	
+	dispatch_async(snapshotQueue, ^{ @autoreleasepool {
+		
+		NSError *error = nil;
+		if (![data writeToFile:path options:NSDataWritingAtomic error:&error])
+		{
+			XMPPLogWarn(@"%@: Unable to save roster snapshot: %@", THIS_FILE, error);
+		}
+	}});
+}
+
+/**
+ * Every versioned roster push changes the version, and saving encodes the entire roster.
+ * So the snapshot is only marked as dirty, and a burst of pushes is saved once, after a short delay.
+ * 
+ * The snapshot must match the roster it was encoded from,
+ * so a pending save is done right away before the roster is cleared (see clearAllUsersAndResourcesForXMPPStream:).
+**/
+- (void)scheduleSnapshotSave
+{
+	AssertPrivateQueue();
+	
+	if (snapshotNeedsSave) return;
+	snapshotNeedsSave = YES;
+	
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(SNAPSHOT_SAVE_DELAY * NSEC_PER_SEC));
+	dispatch_after(tt, parentQueue, ^{ @autoreleasepool {
+		
+		[self saveSnapshotIfNeeded];
+	}});
+}
+
+- (void)saveSnapshotIfNeeded
 {
 	AssertPrivateQueue();
 	
-	NSArray *allUsers = [roster allValues];
+	if (snapshotNeedsSave)
+	{
+		[self saveSnapshot];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Sorted Indexes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The roster is indexed by name (all users, and the available & unavailable users separately),
+ * and the resources of the available users are indexed by their compare: method.
+ * 
+ * The indexes are sorted arrays, updated with binary searches.
+ * Whenever a user (or resource) is about to change in a way that could affect its position,
+ * it's removed from the indexes first (while its position can still be found), and reinserted afterwards.
+ * 
+ * During roster population, the indexes are simply rebuilt (once) when they're next needed.
+**/
+
+- (void)insertObject:(id)object intoSortedArray:(NSMutableArray *)array usingComparator:(NSComparator)cmptr
+{
+	NSUInteger index = [array indexOfObject:object
+	                          inSortedRange:NSMakeRange(0, [array count])
+	                                options:NSBinarySearchingInsertionIndex
+	                        usingComparator:cmptr];
+	
+	[array insertObject:object atIndex:index];
+}
+
+- (void)removeObject:(id)object fromSortedArray:(NSMutableArray *)array usingComparator:(NSComparator)cmptr
+{
+	NSUInteger index = [array indexOfObject:object
+	                          inSortedRange:NSMakeRange(0, [array count])
+	                                options:NSBinarySearchingFirstEqual
+	                        usingComparator:cmptr];
 	
-	NSMutableArray *result = [NSMutableArray arrayWithCapacity:[allUsers count]];
+	if (index == NSNotFound || [array objectAtIndex:index] != object)
+	{
+		// The object changed behind our back (e.g. a subclass with a custom displayName),
+		// so it's no longer where the binary search expects it to be.
+		
+		index = [array indexOfObjectIdenticalTo:object];
+	}
 	
-	for (id <XMPPUser> user in allUsers)
+	if (index != NSNotFound)
+	{
+		[array removeObjectAtIndex:index];
+	}
+}
+
+- (void)rebuildSortedIndexes
+{
+	AssertPrivateQueue();
+	
+	[usersByName setArray:[roster allValues]];
+	[usersByName sortUsingComparator:XMPPCompareUsersByName];
+	
+	[availableUsersByName removeAllObjects];
+	[unavailableUsersByName removeAllObjects];
+	[availableResources removeAllObjects];
+	
+	for (XMPPUserMemoryStorageObject *user in usersByName)
 	{
 		if ([user isOnline])
 		{
-			[result addObject:user];
+			[availableUsersByName addObject:user];
+			[availableResources addObjectsFromArray:[user allResources]];
+		}
+		else
+		{
+			[unavailableUsersByName addObject:user];
 		}
 	}
 	
-	return result;
+	[availableResources sortUsingComparator:XMPPCompareResources];
+	
+	sortedIndexesNeedRebuild = NO;
 }
 
-- (NSArray *)_unsortedUnavailableUsers
+- (void)ensureSortedIndexes
 {
 	AssertPrivateQueue();
 	
-	NSArray *allUsers = [roster allValues];
+	if (sortedIndexesNeedRebuild)
+	{
+		[self rebuildSortedIndexes];
+	}
+}
+
+/**
+ * Presence only affects the availability of a user (and its resources), never its name.
+ * So presence changes only need to touch the availability indexes.
+**/
+- (void)addUserToAvailabilityIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	if (sortedIndexesNeedRebuild) return;
 	
-	NSMutableArray *result = [NSMutableArray arrayWithCapacity:[allUsers count]];
+	if ([user isOnline])
+	{
+		[self insertObject:user intoSortedArray:availableUsersByName usingComparator:XMPPCompareUsersByName];
+		
+		for (XMPPResourceMemoryStorageObject *resource in [user allResources])
+		{
+			[self insertObject:resource intoSortedArray:availableResources usingComparator:XMPPCompareResources];
+		}
+	}
+	else
+	{
+		[self insertObject:user intoSortedArray:unavailableUsersByName usingComparator:XMPPCompareUsersByName];
+	}
+}
+
+- (void)removeUserFromAvailabilityIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	if (sortedIndexesNeedRebuild) return;
 	
-	for (id <XMPPUser> user in allUsers)
+	if ([user isOnline])
 	{
-		if (![user isOnline])
+		[self removeObject:user fromSortedArray:availableUsersByName usingComparator:XMPPCompareUsersByName];
+		
+		for (XMPPResourceMemoryStorageObject *resource in [user allResources])
 		{
-			[result addObject:user];
+			[self removeObject:resource fromSortedArray:availableResources usingComparator:XMPPCompareResources];
 		}
 	}
+	else
+	{
+		[self removeObject:user fromSortedArray:unavailableUsersByName usingComparator:XMPPCompareUsersByName];
+	}
+}
+
+- (void)addUserToSortedIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	if (sortedIndexesNeedRebuild) return;
 	
-	return result;
+	[self insertObject:user intoSortedArray:usersByName usingComparator:XMPPCompareUsersByName];
+	[self addUserToAvailabilityIndexes:user];
+}
+
+- (void)removeUserFromSortedIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	if (sortedIndexesNeedRebuild) return;
+	
+	[self removeObject:user fromSortedArray:usersByName usingComparator:XMPPCompareUsersByName];
+	[self removeUserFromAvailabilityIndexes:user];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Queries
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSArray *)_unsortedUsers
+{
+	AssertPrivateQueue();
+	
+	return [roster allValues];
+}
+
+- (NSArray *)_unsortedAvailableUsers
+{
+	AssertPrivateQueue();
+	
+	[self ensureSortedIndexes];
+	
+	return [NSArray arrayWithArray:availableUsersByName];
+}
+
+- (NSArray *)_unsortedUnavailableUsers
+{
+	AssertPrivateQueue();
+	
+	[self ensureSortedIndexes];
+	
+	return [NSArray arrayWithArray:unavailableUsersByName];
 }
 
 - (NSArray *)_sortedUsersByName
 {
 	AssertPrivateQueue();
 	
-	return [[roster allValues] sortedArrayUsingSelector:@selector(compareByName:)];
+	[self ensureSortedIndexes];
+	
+	return [NSArray arrayWithArray:usersByName];
 }
 
 - (NSArray *)_sortedUsersByAvailabilityName
 {
 	AssertPrivateQueue();
 	
-	return [[roster allValues] sortedArrayUsingSelector:@selector(compareByAvailabilityName:)];
+	[self ensureSortedIndexes];
+	
+	return [availableUsersByName arrayByAddingObjectsFromArray:unavailableUsersByName];
 }
 
 - (NSArray *)_sortedAvailableUsersByName
 {
 	AssertPrivateQueue();
 	
-	return [[self _unsortedAvailableUsers] sortedArrayUsingSelector:@selector(compareByName:)];
+	[self ensureSortedIndexes];
+	
+	return [NSArray arrayWithArray:availableUsersByName];
 }
 
 - (NSArray *)_sortedUnavailableUsersByName
 {
 	AssertPrivateQueue();
 	
-	return [[self _unsortedUnavailableUsers] sortedArrayUsingSelector:@selector(compareByName:)];
+	[self ensureSortedIndexes];
+	
+	return [NSArray arrayWithArray:unavailableUsersByName];
 }
 
 - (NSArray *)_sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself
 {
 	AssertPrivateQueue();
 	
-	// Add all the resouces from all the available users in the roster
+	[self ensureSortedIndexes];
+	
+	// All the resouces from all the available users in the roster are already indexed.
 	// 
 	// Remember: There may be multiple resources per user
 	
-	NSArray *availableUsers = [self unsortedAvailableUsers];
+	if (!includeResourcesForMyUserExcludingMyself)
+	{
+		return [NSArray arrayWithArray:availableResources];
+	}
 	
-	NSMutableArray *result = [NSMutableArray arrayWithCapacity:[availableUsers count]];
+	NSMutableArray *result = [availableResources mutableCopy];
 	
-	for (id<XMPPUser> user in availableUsers)
+	// Now add all the available resources from our own user account (excluding ourselves)
+	
+	NSArray *myResources = [myUser allResources];
+	
+	for (XMPPResourceMemoryStorageObject *resource in myResources)
 	{
-		[result addObjectsFromArray:[user allResources]];
+		if (![myJID isEqualToJID:[resource jid]])
+		{
+			[self insertObject:resource intoSortedArray:result usingComparator:XMPPCompareResources];
+		}
 	}
 	
-	if (includeResourcesForMyUserExcludingMyself)
+	return result;
+}
+
+- (NSArray *)_sortedUsersByNameInRange:(NSRange)range
+{
+	AssertPrivateQueue();
+	
+	[self ensureSortedIndexes];
+	
+	NSUInteger count = [usersByName count];
+	
+	NSUInteger location = MIN(range.location, count);
+	NSUInteger length = MIN(range.length, count - location);
+	
+	return [usersByName subarrayWithRange:NSMakeRange(location, length)];
+}
+
+- (NSArray *)_sortedUsersByAvailabilityNameInRange:(NSRange)range
+{
+	AssertPrivateQueue();
+	
+	[self ensureSortedIndexes];
+	
+	// The available users come first, followed by the unavailable users
+	
+	NSUInteger availableCount = [availableUsersByName count];
+	NSUInteger count = availableCount + [unavailableUsersByName count];
+	
+	NSUInteger location = MIN(range.location, count);
+	NSUInteger length = MIN(range.length, count - location);
+	
+	NSMutableArray *result = [NSMutableArray arrayWithCapacity:length];
+	
+	if (location < availableCount)
 	{
-		// Now add all the available resources from our own user account (excluding ourselves)
+		NSUInteger availableLength = MIN(length, availableCount - location);
 		
-		NSArray *myResources = [myUser allResources];
+		[result addObjectsFromArray:[availableUsersByName subarrayWithRange:NSMakeRange(location, availableLength)]];
 		
-		for (id<XMPPResource> resource in myResources)
-		{
-			if (![myJID isEqualToJID:[resource jid]])
-			{
-				[result addObject:resource];
-			}
-		}
+		location = availableCount;
+		length -= availableLength;
+	}
+	
+	if (length > 0)
+	{
+		NSRange unavailableRange = NSMakeRange(location - availableCount, length);
+		
+		[result addObjectsFromArray:[unavailableUsersByName subarrayWithRange:unavailableRange]];
 	}
 	
-	return [result sortedArrayUsingSelector:@selector(compare:)];
+	return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -548,7 +1231,114 @@
 	}
 }
 
-- (NSArray *)unsortedUnavailableUsers
+- (NSArray *)unsortedUnavailableUsers
+{
+	// This is a public method, so it may be invoked on any thread/queue.
+	
+	if (self.parentQueue == NULL)
+	{
+		// Haven't been attached to parent yet
+		return nil;
+	}
+	
+	if (dispatch_get_specific(parentQueueTag))
+	{
+		return [self _unsortedUnavailableUsers];
+	}
+	else
+	{
+		__block NSArray *result;
+		
+		dispatch_sync(parentQueue, ^{ @autoreleasepool {
+			
+			NSArray *temp = [self _unsortedUnavailableUsers];
+			result = [[NSArray alloc] initWithArray:temp copyItems:YES];
+			
+		}});
+		
+		return result;
+	}
+}
+
+- (NSArray *)sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself
+{
+	// This is a public method, so it may be invoked on any thread/queue.
+	
+	if (self.parentQueue == NULL)
+	{
+		// Haven't been attached to parent yet
+		return nil;
+	}
+	
+	if (dispatch_get_specific(parentQueueTag))
+	{
+		return [self _sortedResources:includeResourcesForMyUserExcludingMyself];
+	}
+	else
+	{
+		__block NSArray *result;
+		
+		dispatch_sync(parentQueue, ^{ @autoreleasepool {
+			
+			NSArray *temp = [self _sortedResources:includeResourcesForMyUserExcludingMyself];
+			result = [[NSArray alloc] initWithArray:temp copyItems:YES];
+			
+		}});
+		
+		return result;
+	}
+}
+
+- (NSUInteger)numberOfUsers
+{
+	// This is a public method, so it may be invoked on any thread/queue.
+	
+	if (self.parentQueue == NULL)
+	{
+		// Haven't been attached to parent yet
+		return 0;
+	}
+	
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		result = [roster count];
+	};
+	
+	if (dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_sync(parentQueue, block);
+	
+	return result;
+}
+
+- (NSUInteger)numberOfAvailableUsers
+{
+	// This is a public method, so it may be invoked on any thread/queue.
+	
+	if (self.parentQueue == NULL)
+	{
+		// Haven't been attached to parent yet
+		return 0;
+	}
+	
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		[self ensureSortedIndexes];
+		result = [availableUsersByName count];
+	};
+	
+	if (dispatch_get_specific(parentQueueTag))
+		block();
+	else
+		dispatch_sync(parentQueue, block);
+	
+	return result;
+}
+
+- (NSArray *)sortedUsersByNameInRange:(NSRange)range
 {
 	// This is a public method, so it may be invoked on any thread/queue.
 	
@@ -560,7 +1350,7 @@
 	
 	if (dispatch_get_specific(parentQueueTag))
 	{
-		return [self _unsortedUnavailableUsers];
+		return [self _sortedUsersByNameInRange:range];
 	}
 	else
 	{
@@ -568,7 +1358,7 @@
 		
 		dispatch_sync(parentQueue, ^{ @autoreleasepool {
 			
-			NSArray *temp = [self _unsortedUnavailableUsers];
+			NSArray *temp = [self _sortedUsersByNameInRange:range];
 			result = [[NSArray alloc] initWithArray:temp copyItems:YES];
 			
 		}});
@@ -577,7 +1367,7 @@
 	}
 }
 
-- (NSArray *)sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself
+- (NSArray *)sortedUsersByAvailabilityNameInRange:(NSRange)range
 {
 	// This is a public method, so it may be invoked on any thread/queue.
 	
@@ -589,7 +1379,7 @@
 	
 	if (dispatch_get_specific(parentQueueTag))
 	{
-		return [self _sortedResources:includeResourcesForMyUserExcludingMyself];
+		return [self _sortedUsersByAvailabilityNameInRange:range];
 	}
 	else
 	{
@@ -597,7 +1387,7 @@
 		
 		dispatch_sync(parentQueue, ^{ @autoreleasepool {
 			
-			NSArray *temp = [self _sortedResources:includeResourcesForMyUserExcludingMyself];
+			NSArray *temp = [self _sortedUsersByAvailabilityNameInRange:range];
 			result = [[NSArray alloc] initWithArray:temp copyItems:YES];
 			
 		}});
@@ -629,6 +1419,8 @@
 	
 	isRosterPopulation = NO;
 	
+	[self snapshotRosterDidChange];
+	
 	[[self multicastDelegate] xmppRosterDidPopulate:self]; 
 	[[self multicastDelegate] xmppRosterDidChange:self];
 }
@@ -648,10 +1440,16 @@
 		
 		[roster setObject:newUser forKey:jid];
 		
-		XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
+		// Rather than inserting every item into the sorted indexes, they're rebuilt (once) when next needed
+		sortedIndexesNeedRebuild = YES;
+		
+		XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], jid);
 	}
 	else
 	{
+		// Report any pending presence changes first, so the order of events is preserved
+		[self flushPendingChanges];
+		
 		NSString *subscription = [item attributeStringValueForName:@"subscription"];
 		
 		if ([subscription isEqualToString:@"remove"])
@@ -659,9 +1457,11 @@
 			XMPPUserMemoryStorageObject *user = [roster objectForKey:jid];
 			if (user)
 			{
+				[self removeUserFromSortedIndexes:user];
 				[roster removeObjectForKey:jid];
+				[self snapshotUserDidChange:user];
 				
-				XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
+				XMPPLogVerbose(@"roster(%lu): -%@", (unsigned long)[roster count], jid);
 				
 				[[self multicastDelegate] xmppRoster:self didRemoveUser:user];
 				[[self multicastDelegate] xmppRosterDidChange:self];
@@ -678,9 +1478,12 @@
 					//
 					// TODO: Remove once Facebook has fixed the issue on their end.
 				} else {
+					[self removeUserFromSortedIndexes:user];
 					[user updateWithItem:item];
+					[self addUserToSortedIndexes:user];
+					[self snapshotUserDidChange:user];
 					
-					XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
+					XMPPLogVerbose(@"roster(%lu): ~%@", (unsigned long)[roster count], jid);
 					
 					[[self multicastDelegate] xmppRoster:self didUpdateUser:user];
 					[[self multicastDelegate] xmppRosterDidChange:self];
@@ -692,8 +1495,10 @@
 				    (XMPPUserMemoryStorageObject *)[[self.userClass alloc] initWithItem:item];
 				
 				[roster setObject:newUser forKey:jid];
+				[self addUserToSortedIndexes:newUser];
+				[self snapshotUserDidChange:newUser];
 				
-				XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
+				XMPPLogVerbose(@"roster(%lu): +%@", (unsigned long)[roster count], jid);
 				
 				[[self multicastDelegate] xmppRoster:self didAddUser:newUser];
 				[[self multicastDelegate] xmppRosterDidChange:self];
@@ -715,6 +1520,8 @@
 	
 	XMPPJID *jidKey = [[presence from] bareJID];
 	
+	BOOL isBatching = (presenceBatchingInterval > 0.0);
+	
 	user = [roster objectForKey:jidKey];
 	if (user == nil)
 	{
@@ -734,15 +1541,45 @@
 			user = (XMPPUserMemoryStorageObject *)[[self.userClass alloc] initWithJID:jidKey];
 			
 			[roster setObject:user forKey:jidKey];
+			[self addUserToSortedIndexes:user];
 			
-			[[self multicastDelegate] xmppRoster:self didAddUser:user];
-			[[self multicastDelegate] xmppRosterDidChange:self];
+			if (isBatching)
+			{
+				[[self pendingChanges] recordAddedUser:user];
+			}
+			else
+			{
+				[[self multicastDelegate] xmppRoster:self didAddUser:user];
+				[[self multicastDelegate] xmppRosterDidChange:self];
+			}
 		}
 	}
 	
+	// Our own user isn't part of the roster (or its indexes)
+	BOOL isIndexed = (user != nil) && (user != myUser);
+	
+	if (isIndexed)
+		[self removeUserFromAvailabilityIndexes:user];
+	
 	change = [user updateWithPresence:presence resourceClass:self.resourceClass andGetResource:&resource];
 	
-	XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
+	if (isIndexed)
+		[self addUserToAvailabilityIndexes:user];
+	
+	if (change != XMPP_USER_NO_CHANGE)
+		[self snapshotUserDidChange:user];
+	
+	XMPPLogVerbose(@"roster(%lu): %@ %@", (unsigned long)[roster count], [presence fromStr], [presence type]);
+	
+	if (isBatching)
+	{
+		XMPPRosterMemoryStorageChangeSet *changes = [self pendingChanges];
+		
+		[changes recordPresence];
+		[changes recordChange:change forResource:resource withUser:user];
+		
+		return;
+	}
 	
 	if (change == XMPP_USER_ADDED_RESOURCE)
 		[[self multicastDelegate] xmppRoster:self didAddResource:resource withUser:user];
@@ -788,11 +1625,24 @@
 	XMPPLogTrace();
 	AssertParentQueue();
 	
+	[self flushPendingChanges];
+	
 	for (XMPPUserMemoryStorageObject *user in [roster objectEnumerator])
 	{
 		[user clearAllResources];
 	}
 	
+	// Every user is now unavailable
+	
+	if (!sortedIndexesNeedRebuild)
+	{
+		[unavailableUsersByName setArray:usersByName];
+		[availableUsersByName removeAllObjects];
+		[availableResources removeAllObjects];
+	}
+	
+	[self snapshotRosterDidChange];
+	
 	[[self multicastDelegate] xmppRosterDidChange:self];
 }
 
@@ -801,13 +1651,79 @@
 	XMPPLogTrace();
 	AssertParentQueue();
 	
+	[self flushPendingChanges];
+	[self saveSnapshotIfNeeded];
+	
 	[roster removeAllObjects];
 	
+	[usersByName removeAllObjects];
+	[availableUsersByName removeAllObjects];
+	[unavailableUsersByName removeAllObjects];
+	[availableResources removeAllObjects];
+	sortedIndexesNeedRebuild = NO;
+	
 	myUser = nil;
 	
+	[self snapshotRosterDidChange];
+	
 	[[self multicastDelegate] xmppRosterDidChange:self];
 }
 
+- (NSString *)rosterVersionForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	AssertParentQueue();
+	
+	return rosterVersion;
+}
+
+- (void)setRosterVersion:(NSString *)version xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	AssertParentQueue();
+	
+	if (snapshotPath == nil) return;
+	
+	rosterVersion = [version copy];
+	
+	[self scheduleSnapshotSave];
+}
+
+- (BOOL)restoreRosterForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	AssertParentQueue();
+	
+	if (snapshot == nil) return NO;
+	
+	[self clearAllUsersAndResourcesForXMPPStream:stream];
+	[self beginRosterPopulationForXMPPStream:stream];
+	
+	NSUInteger count = [snapshot count];
+	NSUInteger i;
+	
+	for (i = 1; i < count; i++)
+	{
+		if ([snapshot typeOfRecordAtIndex:i] != XMPPBinaryRecordTypeRosterItem) continue;
+		
+		XMPPUserMemoryStorageObject *user =
+		    (XMPPUserMemoryStorageObject *)[[self.userClass alloc] initWithBinaryDecoder:snapshot recordIndex:i];
+		
+		if (user)
+		{
+			[roster setObject:user forKey:[user jid]];
+		}
+	}
+	
+	// The sorted indexes are rebuilt (once) when next needed
+	sortedIndexesNeedRebuild = YES;
+	
+	XMPPLogVerbose(@"%@: Restored %lu users from roster snapshot", THIS_FILE, (unsigned long)[roster count]);
+	
+	[self endRosterPopulationForXMPPStream:stream];
+	return YES;
+}
+
 - (NSArray *)jidsForXMPPStream:(XMPPStream *)stream
 {
     XMPPLogTrace();
@@ -824,3 +1740,322 @@
 }
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPRosterMemoryStorageChangeSet
+{
+	// Keyed by bare jid
+	NSMutableDictionary *addedUsers;
+	NSMutableDictionary *updatedUsers;
+	
+	// Keyed by full jid
+	NSMutableDictionary *addedResources;
+	NSMutableDictionary *updatedResources;
+	NSMutableDictionary *removedResources;
+}
+
+@synthesize presenceCount;
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		addedUsers = [[NSMutableDictionary alloc] init];
+		updatedUsers = [[NSMutableDictionary alloc] init];
+		
+		addedResources = [[NSMutableDictionary alloc] init];
+		updatedResources = [[NSMutableDictionary alloc] init];
+		removedResources = [[NSMutableDictionary alloc] init];
+	}
+	return self;
+}
+
+- (void)recordPresence
+{
+	presenceCount++;
+}
+
+- (void)recordAddedUser:(XMPPUserMemoryStorageObject *)user
+{
+	XMPPJID *key = [user jid];
+	
+	[updatedUsers removeObjectForKey:key];
+	[addedUsers setObject:user forKey:key];
+}
+
+- (void)recordChange:(int)change
+         forResource:(XMPPResourceMemoryStorageObject *)resource
+            withUser:(XMPPUserMemoryStorageObject *)user
+{
+	if (change == XMPP_USER_NO_CHANGE || resource == nil) return;
+	
+	XMPPJID *key = [resource jid];
+	
+	if (change == XMPP_USER_ADDED_RESOURCE)
+	{
+		if ([removedResources objectForKey:key])
+		{
+			// Went offline and came back within the batch
+			
+			[removedResources removeObjectForKey:key];
+			[updatedResources setObject:resource forKey:key];
+		}
+		else
+		{
+			[addedResources setObject:resource forKey:key];
+		}
+	}
+	else if (change == XMPP_USER_UPDATED_RESOURCE)
+	{
+		if ([addedResources objectForKey:key])
+			[addedResources setObject:resource forKey:key];
+		else
+			[updatedResources setObject:resource forKey:key];
+	}
+	else if (change == XMPP_USER_REMOVED_RESOURCE)
+	{
+		if ([addedResources objectForKey:key])
+		{
+			// Came online and went offline again within the batch
+			
+			[addedResources removeObjectForKey:key];
+		}
+		else
+		{
+			[updatedResources removeObjectForKey:key];
+			[removedResources setObject:resource forKey:key];
+		}
+	}
+	
+	XMPPJID *userKey = [user jid];
+	
+	if (userKey && [addedUsers objectForKey:userKey] == nil)
+	{
+		[updatedUsers setObject:user forKey:userKey];
+	}
+}
+
+- (BOOL)isEmpty
+{
+	return [addedUsers count] == 0 && [updatedUsers count] == 0 &&
+	       [addedResources count] == 0 && [updatedResources count] == 0 && [removedResources count] == 0;
+}
+
+- (NSArray *)addedUsers
+{
+	return [addedUsers allValues];
+}
+
+- (NSArray *)updatedUsers
+{
+	return [updatedUsers allValues];
+}
+
+- (NSArray *)addedResources
+{
+	return [addedResources allValues];
+}
+
+- (NSArray *)updatedResources
+{
+	return [updatedResources allValues];
+}
+
+- (NSArray *)removedResources
+{
+	return [removedResources allValues];
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPRosterMemoryStorageChangeSet[%p]: presences(%lu) users(+%lu ~%lu) "
+	                                  @"resources(+%lu ~%lu -%lu)>", self, (unsigned long)presenceCount,
+	                                  (unsigned long)[addedUsers count], (unsigned long)[updatedUsers count],
+	                                  (unsigned long)[addedResources count], (unsigned long)[updatedResources count],
+	                                  (unsigned long)[removedResources count]];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPRosterMemoryStorageSnapshot
+{
+	NSDictionary *users; // Keyed by bare jid
+	
+	XMPPUserMemoryStorageObject *myUser;
+	XMPPJID *myJID;
+	
+	NSArray *availableUsersByName;
+	NSArray *unavailableUsersByName;
+	NSArray *availableResources;
+}
+
+@synthesize version;
+
+- (id)initWithVersion:(uint64_t)aVersion
+                users:(NSDictionary *)aUsers
+               myUser:(XMPPUserMemoryStorageObject *)aMyUser
+                myJID:(XMPPJID *)aMyJID
+ availableUsersByName:(NSArray *)anAvailableUsersByName
+unavailableUsersByName:(NSArray *)anUnavailableUsersByName
+   availableResources:(NSArray *)anAvailableResources
+{
+	if ((self = [super init]))
+	{
+		version = aVersion;
+		users = aUsers;
+		
+		myUser = aMyUser;
+		myJID = aMyJID;
+		
+		availableUsersByName = [anAvailableUsersByName copy];
+		unavailableUsersByName = [anUnavailableUsersByName copy];
+		availableResources = [anAvailableResources copy];
+	}
+	return self;
+}
+
+- (XMPPUserMemoryStorageObject *)myUser
+{
+	return myUser;
+}
+
+- (XMPPResourceMemoryStorageObject *)myResource
+{
+	return (XMPPResourceMemoryStorageObject *)[myUser resourceForJID:myJID];
+}
+
+- (XMPPUserMemoryStorageObject *)userForJID:(XMPPJID *)jid
+{
+	XMPPJID *bareJID = [jid bareJID];
+	
+	XMPPUserMemoryStorageObject *result = [users objectForKey:bareJID];
+	
+	if (result == nil && [bareJID isEqualToJID:[myJID bareJID]])
+	{
+		result = myUser;
+	}
+	
+	return result;
+}
+
+- (XMPPResourceMemoryStorageObject *)resourceForJID:(XMPPJID *)jid
+{
+	return (XMPPResourceMemoryStorageObject *)[[self userForJID:jid] resourceForJID:jid];
+}
+
+- (NSArray *)sortedUsersByName
+{
+	// The users are either available or unavailable, so merge the two (sorted) lists
+	
+	NSMutableArray *result = [NSMutableArray arrayWithCapacity:[users count]];
+	
+	NSUInteger availableCount = [availableUsersByName count];
+	NSUInteger unavailableCount = [unavailableUsersByName count];
+	NSUInteger i = 0;
+	NSUInteger j = 0;
+	
+	while (i < availableCount && j < unavailableCount)
+	{
+		id user1 = [availableUsersByName objectAtIndex:i];
+		id user2 = [unavailableUsersByName objectAtIndex:j];
+		
+		if (XMPPCompareUsersByName(user1, user2) != NSOrderedDescending)
+		{
+			[result addObject:user1];
+			i++;
+		}
+		else
+		{
+			[result addObject:user2];
+			j++;
+		}
+	}
+	
+	if (i < availableCount)
+		[result addObjectsFromArray:[availableUsersByName subarrayWithRange:NSMakeRange(i, availableCount - i)]];
+	
+	if (j < unavailableCount)
+		[result addObjectsFromArray:[unavailableUsersByName subarrayWithRange:NSMakeRange(j, unavailableCount - j)]];
+	
+	return result;
+}
+
+- (NSArray *)sortedUsersByAvailabilityName
+{
+	return [availableUsersByName arrayByAddingObjectsFromArray:unavailableUsersByName];
+}
+
+- (NSArray *)sortedAvailableUsersByName
+{
+	return availableUsersByName;
+}
+
+- (NSArray *)sortedUnavailableUsersByName
+{
+	return unavailableUsersByName;
+}
+
+- (NSArray *)unsortedUsers
+{
+	return [users allValues];
+}
+
+- (NSArray *)unsortedAvailableUsers
+{
+	return availableUsersByName;
+}
+
+- (NSArray *)unsortedUnavailableUsers
+{
+	return unavailableUsersByName;
+}
+
+- (NSArray *)sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself
+{
+	if (!includeResourcesForMyUserExcludingMyself)
+	{
+		return availableResources;
+	}
+	
+	NSMutableArray *result = [availableResources mutableCopy];
+	
+	for (XMPPResourceMemoryStorageObject *resource in [myUser allResources])
+	{
+		if (![myJID isEqualToJID:[resource jid]])
+		{
+			NSUInteger index = [result indexOfObject:resource
+			                           inSortedRange:NSMakeRange(0, [result count])
+			                                 options:NSBinarySearchingInsertionIndex
+			                         usingComparator:XMPPCompareResources];
+			
+			[result insertObject:resource atIndex:index];
+		}
+	}
+	
+	return result;
+}
+
+- (NSUInteger)numberOfUsers
+{
+	return [users count];
+}
+
+- (NSUInteger)numberOfAvailableUsers
+{
+	return [availableUsersByName count];
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPRosterMemoryStorageSnapshot[%p] version(%llu) users(%lu)>",
+	                                  self, version, (unsigned long)[users count]];
+}
+
+@end
@@ -15,6 +15,13 @@
 #define XMPP_USER_UPDATED_RESOURCE 2
 #define XMPP_USER_REMOVED_RESOURCE 3
 
+/**
+ * The resources of a user are kept sorted by their compare: method (best resource first),
+ * with the full jid as a tiebreaker, so every resource has a well defined position.
+ * XMPPRosterMemoryStorage indexes the available resources of all users in the same order.
+**/
+extern NSComparator const XMPPCompareResources;
+
 
 @interface XMPPUserMemoryStorageObject ()
 
@@ -15,6 +15,7 @@
 	NSMutableDictionary *itemAttributes;
 	
 	NSMutableDictionary *resources;
+	NSMutableArray *sortedResources;
 	XMPPResourceMemoryStorageObject *primaryResource;
 	
 #if TARGET_OS_IPHONE
@@ -39,6 +40,15 @@
 
 */
 
+/**
+ * Encodes the roster item (the jid and item attributes) in the compact binary format (see XMPPBinaryCoding.h).
+ * Resources and the photo are not encoded, as they don't outlive the session.
+ * 
+ * Encoding returns NO if the item couldn't be encoded (see encodeRosterItemWithJID:attributes:).
+**/
+- (id)initWithBinaryDecoder:(XMPPBinaryDecoder *)decoder recordIndex:(NSUInteger)index;
+- (BOOL)encodeWithBinaryEncoder:(XMPPBinaryEncoder *)encoder;
+
 /**
  * Simple convenience method.
  * If a nickname exists for the user, the nickname is returned.
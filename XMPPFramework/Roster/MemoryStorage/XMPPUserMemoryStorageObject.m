@@ -7,6 +7,7 @@
 
 @interface XMPPUserMemoryStorageObject (PrivateAPI)
 - (void)recalculatePrimaryResource;
+- (void)rebuildSortedResources;
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -23,6 +24,7 @@
 	// If you override this method, don't forget to invoke [super commonInit];
 	
 	resources = [[NSMutableDictionary alloc] initWithCapacity:1];
+	sortedResources = [[NSMutableArray alloc] initWithCapacity:1];
 }
 
 - (id)initWithJID:(XMPPJID *)aJid
@@ -75,6 +77,7 @@
 		[deepCopy->resources setObject:resourceCopy forKey:key];
 	}
 	
+	[deepCopy rebuildSortedResources];
 	[deepCopy recalculatePrimaryResource];
 	
 	return deepCopy;
@@ -123,6 +126,8 @@
 			resources       = [[coder decodeObject] mutableCopy];
 			primaryResource = [coder decodeObject];
 		}
+		
+		[self rebuildSortedResources];
 	}
 	return self;
 }
@@ -155,6 +160,36 @@
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Binary Encoding, Decoding
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithBinaryDecoder:(XMPPBinaryDecoder *)decoder recordIndex:(NSUInteger)index
+{
+	XMPPJID *aJid = nil;
+	NSDictionary *attributes = nil;
+	
+	if (![decoder decodeRosterItemAtIndex:index jid:&aJid attributes:&attributes])
+	{
+		return nil;
+	}
+	
+	if ((self = [super init]))
+	{
+		jid = [aJid bareJID];
+		
+		itemAttributes = [attributes mutableCopy];
+		
+		[self commonInit];
+	}
+	return self;
+}
+
+- (BOOL)encodeWithBinaryEncoder:(XMPPBinaryEncoder *)encoder
+{
+	return [encoder encodeRosterItemWithJID:jid attributes:itemAttributes];
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Standard Methods
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -248,12 +283,12 @@
 {
 	// Override me to customize how the primary resource is chosen.
 	// 
-	// This method uses the [XMPPResourceMemoryStorage compare:] method to sort the resources,
-	// and properly supports negative (bot) priorities.
+	// The resources are kept sorted using the [XMPPResourceMemoryStorage compare:] method,
+	// so the best resource is simply the first one.
+	// This method properly supports negative (bot) priorities.
 	
 	primaryResource = nil;
 	
-	NSArray *sortedResources = [[self allResources] sortedArrayUsingSelector:@selector(compare:)];
 	if ([sortedResources count] > 0)
 	{
 		XMPPResourceMemoryStorageObject *possiblePrimary = [sortedResources objectAtIndex:0];
@@ -266,6 +301,53 @@
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Sorted Resources
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The sorted resources are updated with binary searches as presence elements arrive.
+ * A resource is removed before its presence is updated (while its position can still be found),
+ * and reinserted afterwards.
+**/
+
+- (void)rebuildSortedResources
+{
+	sortedResources = [[resources allValues] mutableCopy];
+	[sortedResources sortUsingComparator:XMPPCompareResources];
+}
+
+- (void)insertSortedResource:(XMPPResourceMemoryStorageObject *)resource
+{
+	NSUInteger index = [sortedResources indexOfObject:resource
+	                                    inSortedRange:NSMakeRange(0, [sortedResources count])
+	                                          options:NSBinarySearchingInsertionIndex
+	                                  usingComparator:XMPPCompareResources];
+	
+	[sortedResources insertObject:resource atIndex:index];
+}
+
+- (void)removeSortedResource:(XMPPResourceMemoryStorageObject *)resource
+{
+	NSUInteger index = [sortedResources indexOfObject:resource
+	                                    inSortedRange:NSMakeRange(0, [sortedResources count])
+	                                          options:NSBinarySearchingFirstEqual
+	                                  usingComparator:XMPPCompareResources];
+	
+	if (index == NSNotFound || [sortedResources objectAtIndex:index] != resource)
+	{
+		// The resource changed behind our back (e.g. a subclass with a custom compare: method),
+		// so it's no longer where the binary search expects it to be.
+		
+		index = [sortedResources indexOfObjectIdenticalTo:resource];
+	}
+	
+	if (index != NSNotFound)
+	{
+		[sortedResources removeObjectAtIndex:index];
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Update Methods
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -273,6 +355,7 @@
 - (void)clearAllResources
 {
 	[resources removeAllObjects];
+	[sortedResources removeAllObjects];
 	
 	primaryResource = nil;
 }
@@ -298,14 +381,15 @@
 	XMPPResourceMemoryStorageObject *resource;
 	
 	XMPPJID *key = [presence from];
-	NSString *presenceType = [presence type];
+	XMPPAtom presenceType = [presence typeAtom];
 	
-	if ([presenceType isEqualToString:@"unavailable"] || [presenceType isEqualToString:@"error"])
+	if (presenceType == XMPPAtomUnavailable || presenceType == XMPPAtomError)
 	{
 		resource = [resources objectForKey:key];
 		if (resource)
 		{
 			[resources removeObjectForKey:key];
+			[self removeSortedResource:resource];
 			[self didRemoveResource:resource withPresence:presence];
 			
 			result = XMPP_USER_REMOVED_RESOURCE;
@@ -317,7 +401,11 @@
 		if (resource)
 		{
 			[self willUpdateResource:resource withPresence:presence];
+			
+			[self removeSortedResource:resource];
 			[resource updateWithPresence:presence];
+			[self insertSortedResource:resource];
+			
 			[self didUpdateResource:resource withPresence:presence];
 			
 			result = XMPP_USER_UPDATED_RESOURCE;
@@ -327,6 +415,7 @@
 			resource = (XMPPResourceMemoryStorageObject *)[[resourceClass alloc] initWithPresence:presence];
 			
 			[resources setObject:resource forKey:key];
+			[self insertSortedResource:resource];
 			[self didAddResource:resource withPresence:presence];
 			
 			result = XMPP_USER_ADDED_RESOURCE;
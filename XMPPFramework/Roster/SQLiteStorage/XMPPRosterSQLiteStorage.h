@@ -0,0 +1,63 @@
+#import <Foundation/Foundation.h>
+
+#import "XMPPRoster.h"
+#import "XMPPSQLiteStorage.h"
+
+/**
+ * This class is an implementation of XMPPRosterStorage using SQLite directly (without Core Data).
+ *
+ * The roster is kept in the database file, along with its version (XEP-0237).
+ * So if the server supports roster versioning, the roster is restored from the database file
+ * between sessions (and between launches), and only the changes are downloaded.
+ *
+ * The presence of each resource is kept too, but only for the duration of a session.
+ *
+ * This class is designed to be used with a single XMPPRoster instance at a time.
+**/
+
+@interface XMPPRosterSQLiteStorage : XMPPSQLiteStorage <XMPPRosterStorage>
+{
+	/* Inherited protected variables from XMPPSQLiteStorage
+	
+	NSString *databaseFileName;
+	NSUInteger saveThreshold;
+	
+	dispatch_queue_t storageQueue;
+	
+	*/
+	
+	__weak XMPPRoster *parent;
+}
+
+/**
+ * Returns the roster item of the user with the given jid, as it was last received from the server.
+ *
+ * <item jid="romeo@example.net" name="Romeo" subscription="both">
+ *   <group>Friends</group>
+ * </item>
+ *
+ * Returns nil if the user isn't in the roster.
+ * If the user was added in rosterless operation mode, it has no item, and an item with just a jid is returned.
+**/
+- (NSXMLElement *)rosterItemForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream;
+
+/**
+ * Returns the current presence of each available resource of the user with the given jid,
+ * sorted by priority (highest first).
+**/
+- (NSArray *)presencesForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream;
+
+/* Inherited from XMPPSQLiteStorage
+ * Please see the XMPPSQLiteStorage header file for extensive documentation.
+
+- (id)initWithDatabaseFilename:(NSString *)databaseFileName;
+- (id)initWithInMemoryStore;
+
+@property (readonly) NSString *databaseFileName;
+
+@property (readwrite) NSUInteger saveThreshold;
+@property (readwrite) NSTimeInterval maxCommitLatency;
+
+*/
+
+@end
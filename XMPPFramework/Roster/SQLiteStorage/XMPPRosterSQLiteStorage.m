@@ -0,0 +1,521 @@
+#import "XMPPRosterSQLiteStorage.h"
+#import "XMPPSQLiteStorageProtected.h"
+#import "XMPP.h"
+#import "XMPPLogging.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+
+@implementation XMPPRosterSQLiteStorage
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Setup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)configureWithParent:(XMPPRoster *)aParent queue:(dispatch_queue_t)queue
+{
+	// This storage class is designed to be used with a single parent,
+	// as it needs to ask the parent whether it allows rosterless operation.
+	
+	@synchronized(self)
+	{
+		if (parent != nil) return NO;
+		
+		if (![super configureWithParent:aParent queue:queue]) return NO;
+		
+		parent = aParent;
+	}
+	
+	return YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Overrides
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)createSchema
+{
+	// The item of each user is stored as it was received from the server.
+	// A user added in rosterless operation mode has no item.
+	
+	return [self executeSQL:@"CREATE TABLE IF NOT EXISTS users ("
+	                        @"id INTEGER PRIMARY KEY, "
+	                        @"streamBareJidStr TEXT NOT NULL, "
+	                        @"jidStr TEXT NOT NULL, "
+	                        @"itemStr TEXT)"]
+	    && [self executeSQL:@"CREATE UNIQUE INDEX IF NOT EXISTS users_jid ON users (streamBareJidStr, jidStr)"]
+	    && [self executeSQL:@"CREATE TABLE IF NOT EXISTS resources ("
+	                        @"id INTEGER PRIMARY KEY, "
+	                        @"streamBareJidStr TEXT NOT NULL, "
+	                        @"userJidStr TEXT NOT NULL, "
+	                        @"jidStr TEXT NOT NULL, "
+	                        @"presenceStr TEXT, "
+	                        @"priority INTEGER NOT NULL DEFAULT 0)"]
+	    && [self executeSQL:@"CREATE UNIQUE INDEX IF NOT EXISTS resources_jid ON resources (streamBareJidStr, jidStr)"]
+	    && [self executeSQL:@"CREATE INDEX IF NOT EXISTS resources_user ON resources (streamBareJidStr, userJidStr)"]
+	    && [self executeSQL:@"CREATE TABLE IF NOT EXISTS roster_versions ("
+	                        @"streamBareJidStr TEXT NOT NULL PRIMARY KEY, "
+	                        @"version TEXT NOT NULL)"];
+}
+
+- (void)didOpenDatabase
+{
+	// This method is overriden from the XMPPSQLiteStorage superclass.
+	//
+	// Presence is only valid for the duration of a session.
+	
+	[self executeUpdateStatement:[self statementForSQL:@"DELETE FROM resources"]];
+	
+	// Databases created by earlier versions may contain rows stored without a stream JID (NULL),
+	// which can never be found again. (See streamBareJidStrForXMPPStream:)
+	
+	[self executeUpdateStatement:[self statementForSQL:@"DELETE FROM users WHERE streamBareJidStr IS NULL"]];
+	[self executeUpdateStatement:[self statementForSQL:@"DELETE FROM roster_versions WHERE streamBareJidStr IS NULL"]];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Utilities
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)_userExistsWithJID:(XMPPJID *)jid streamBareJidStr:(NSString *)streamBareJidStr
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	sqlite3_stmt *statement =
+	    [self statementForSQL:@"SELECT 1 FROM users WHERE streamBareJidStr = ? AND jidStr = ? LIMIT 1"];
+	
+	if (statement == NULL) return NO;
+	
+	XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+	XMPPSQLiteBindString(statement, 2, [jid bare]);
+	
+	BOOL result = (sqlite3_step(statement) == SQLITE_ROW);
+	
+	sqlite3_reset(statement);
+	
+	return result;
+}
+
+- (NSString *)_rosterVersionForStreamBareJidStr:(NSString *)streamBareJidStr
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	sqlite3_stmt *statement = [self statementForSQL:@"SELECT version FROM roster_versions WHERE streamBareJidStr = ?"];
+	
+	if (statement == NULL) return nil;
+	
+	XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+	
+	NSString *version = nil;
+	
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		version = XMPPSQLiteColumnString(statement, 0);
+	}
+	
+	sqlite3_reset(statement);
+	
+	return version;
+}
+
+- (void)_insertUserWithJID:(XMPPJID *)jid item:(NSXMLElement *)item streamBareJidStr:(NSString *)streamBareJidStr
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	sqlite3_stmt *statement =
+	    [self statementForSQL:@"INSERT OR REPLACE INTO users (streamBareJidStr, jidStr, itemStr) VALUES (?, ?, ?)"];
+	
+	XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+	XMPPSQLiteBindString(statement, 2, [jid bare]);
+	XMPPSQLiteBindString(statement, 3, [item compactXMLString]);
+	
+	[self executeUpdateStatement:statement];
+}
+
+- (void)_deleteUserWithJID:(XMPPJID *)jid streamBareJidStr:(NSString *)streamBareJidStr
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	sqlite3_stmt *statement;
+	
+	statement = [self statementForSQL:@"DELETE FROM resources WHERE streamBareJidStr = ? AND userJidStr = ?"];
+	
+	XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+	XMPPSQLiteBindString(statement, 2, [jid bare]);
+	[self executeUpdateStatement:statement];
+	
+	statement = [self statementForSQL:@"DELETE FROM users WHERE streamBareJidStr = ? AND jidStr = ?"];
+	
+	XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+	XMPPSQLiteBindString(statement, 2, [jid bare]);
+	[self executeUpdateStatement:statement];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Public API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSXMLElement *)rosterItemForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	if (jid == nil) return nil;
+	
+	__block BOOL exists = NO;
+	__block NSString *itemStr = nil;
+	
+	[self executeBlock:^{
+		
+		sqlite3_stmt *statement =
+		    [self statementForSQL:@"SELECT itemStr FROM users WHERE streamBareJidStr = ? AND jidStr = ?"];
+		
+		if (statement == NULL) return;
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		
+		if (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			exists = YES;
+			itemStr = XMPPSQLiteColumnString(statement, 0);
+		}
+		
+		sqlite3_reset(statement);
+	}];
+	
+	if (!exists) return nil;
+	
+	NSXMLElement *item = nil;
+	
+	if (itemStr)
+	{
+		item = [[NSXMLElement alloc] initWithXMLString:itemStr error:nil];
+	}
+	else
+	{
+		item = [NSXMLElement elementWithName:@"item"];
+		[item addAttributeWithName:@"jid" stringValue:[jid bare]];
+	}
+	
+	return item;
+}
+
+- (NSArray *)presencesForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	if (jid == nil) return nil;
+	
+	NSMutableArray *presenceStrs = [NSMutableArray array];
+	
+	[self executeBlock:^{
+		
+		sqlite3_stmt *statement =
+		    [self statementForSQL:@"SELECT presenceStr FROM resources "
+		                          @"WHERE streamBareJidStr = ? AND userJidStr = ? ORDER BY priority DESC"];
+		
+		if (statement == NULL) return;
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		
+		while (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			NSString *presenceStr = XMPPSQLiteColumnString(statement, 0);
+			if (presenceStr)
+			{
+				[presenceStrs addObject:presenceStr];
+			}
+		}
+		
+		sqlite3_reset(statement);
+	}];
+	
+	// The presence elements are parsed outside the storageQueue
+	
+	NSMutableArray *results = [NSMutableArray arrayWithCapacity:[presenceStrs count]];
+	
+	for (NSString *presenceStr in presenceStrs)
+	{
+		NSXMLElement *element = [[NSXMLElement alloc] initWithXMLString:presenceStr error:nil];
+		if (element)
+		{
+			[results addObject:[XMPPPresence presenceFromElement:element]];
+		}
+	}
+	
+	return results;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Protocol Private API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)beginRosterPopulationForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		// The full roster is about to be received, which replaces any stored roster
+		
+		sqlite3_stmt *statement = [self statementForSQL:@"DELETE FROM users WHERE streamBareJidStr = ?"];
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		[self executeUpdateStatement:statement];
+	}];
+}
+
+- (void)endRosterPopulationForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	// Commit the roster as soon as possible
+	
+	[self scheduleBlock:^{
+		
+		[self save];
+	}];
+}
+
+- (void)handleRosterItem:(NSXMLElement *)item xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	NSString *jidStr = [item attributeStringValueForName:@"jid"];
+	XMPPJID *jid = [[XMPPJID jidWithString:jidStr] bareJID];
+	
+	if (jid == nil) return;
+	
+	[self scheduleBlock:^{
+		
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		
+		NSString *subscription = [item attributeStringValueForName:@"subscription"];
+		
+		if ([subscription isEqualToString:@"remove"])
+		{
+			[self _deleteUserWithJID:jid streamBareJidStr:streamBareJidStr];
+		}
+		else
+		{
+			[self _insertUserWithJID:jid item:item streamBareJidStr:streamBareJidStr];
+		}
+	}];
+}
+
+- (void)handlePresence:(XMPPPresence *)presence xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	XMPPJID *jid = [presence from];
+	if (jid == nil) return;
+	
+	// The parent is queried here, as this method is invoked on the parent's queue
+	BOOL allowRosterlessOperation = [parent allowRosterlessOperation];
+	
+	[self scheduleBlock:^{
+		
+		XMPPJID *myJID = [self myJIDForXMPPStream:stream];
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		
+		XMPPJID *userJID = [jid bareJID];
+		sqlite3_stmt *statement;
+		
+		if ([presence typeAtom] == XMPPAtomUnavailable)
+		{
+			statement = [self statementForSQL:@"DELETE FROM resources WHERE streamBareJidStr = ? AND jidStr = ?"];
+			
+			XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+			XMPPSQLiteBindString(statement, 2, [jid full]);
+			[self executeUpdateStatement:statement];
+			
+			return;
+		}
+		
+		// Our own user isn't part of the roster, but the presence of its resources is kept.
+		
+		if (![userJID isEqualToJID:[myJID bareJID]] &&
+		    ![self _userExistsWithJID:userJID streamBareJidStr:streamBareJidStr])
+		{
+			if (!allowRosterlessOperation)
+			{
+				// Not a presence element from anyone in our roster
+				return;
+			}
+			
+			// Unknown user (this is the first time we've encountered them).
+			// This happens if the roster is in rosterlessOperation mode.
+			
+			[self _insertUserWithJID:userJID item:nil streamBareJidStr:streamBareJidStr];
+		}
+		
+		statement = [self statementForSQL:@"INSERT OR REPLACE INTO resources "
+		                                  @"(streamBareJidStr, userJidStr, jidStr, presenceStr, priority) "
+		                                  @"VALUES (?, ?, ?, ?, ?)"];
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		XMPPSQLiteBindString(statement, 2, [userJID bare]);
+		XMPPSQLiteBindString(statement, 3, [jid full]);
+		XMPPSQLiteBindString(statement, 4, [presence compactXMLString]);
+		sqlite3_bind_int64(statement, 5, (sqlite3_int64)[presence priority]);
+		
+		[self executeUpdateStatement:statement];
+	}];
+}
+
+- (BOOL)userExistsWithJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	__block BOOL result = NO;
+	
+	[self executeBlock:^{
+		
+		result = [self _userExistsWithJID:[jid bareJID] streamBareJidStr:[self streamBareJidStrForXMPPStream:stream]];
+	}];
+	
+	return result;
+}
+
+#if TARGET_OS_IPHONE
+- (void)setPhoto:(UIImage *)photo forUserWithJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+#else
+- (void)setPhoto:(NSImage *)photo forUserWithJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+#endif
+{
+	// Photos aren't stored by this class.
+	// They're available from the vCard avatar module (and its storage).
+}
+
+- (void)clearAllResourcesForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		sqlite3_stmt *statement = [self statementForSQL:@"DELETE FROM resources WHERE streamBareJidStr = ?"];
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		[self executeUpdateStatement:statement];
+	}];
+}
+
+- (void)clearAllUsersAndResourcesForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		sqlite3_stmt *statement;
+		
+		statement = [self statementForSQL:@"DELETE FROM resources WHERE streamBareJidStr = ?"];
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		[self executeUpdateStatement:statement];
+		
+		// If the roster has a version, it's kept so it can be restored in the next session.
+		// It's replaced by beginRosterPopulation if the server sends the full roster instead.
+		
+		if ([self _rosterVersionForStreamBareJidStr:streamBareJidStr] == nil)
+		{
+			statement = [self statementForSQL:@"DELETE FROM users WHERE streamBareJidStr = ?"];
+			
+			XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+			[self executeUpdateStatement:statement];
+		}
+	}];
+}
+
+- (NSString *)rosterVersionForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	__block NSString *result = nil;
+	
+	[self executeBlock:^{
+		
+		result = [self _rosterVersionForStreamBareJidStr:[self streamBareJidStrForXMPPStream:stream]];
+	}];
+	
+	return result;
+}
+
+- (void)setRosterVersion:(NSString *)version xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		sqlite3_stmt *statement;
+		
+		if (version)
+		{
+			statement = [self statementForSQL:@"INSERT OR REPLACE INTO roster_versions (streamBareJidStr, version) "
+			                                  @"VALUES (?, ?)"];
+			
+			XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+			XMPPSQLiteBindString(statement, 2, version);
+		}
+		else
+		{
+			statement = [self statementForSQL:@"DELETE FROM roster_versions WHERE streamBareJidStr = ?"];
+			
+			XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		}
+		
+		[self executeUpdateStatement:statement];
+	}];
+}
+
+- (BOOL)restoreRosterForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	// The stored roster is the users table itself.
+	// So there's nothing to restore, as long as the roster has a version.
+	
+	return ([self rosterVersionForXMPPStream:stream] != nil);
+}
+
+- (NSArray *)jidsForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	NSMutableArray *results = [NSMutableArray array];
+	
+	[self executeBlock:^{
+		
+		sqlite3_stmt *statement = [self statementForSQL:@"SELECT jidStr FROM users WHERE streamBareJidStr = ?"];
+		
+		if (statement == NULL) return;
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		
+		while (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			XMPPJID *jid = [XMPPJID jidWithString:XMPPSQLiteColumnString(statement, 0)];
+			if (jid)
+			{
+				[results addObject:jid];
+			}
+		}
+		
+		sqlite3_reset(statement);
+	}];
+	
+	return results;
+}
+
+@end
@@ -46,6 +46,7 @@
 	Byte flags;
 	
 	NSMutableArray *earlyPresenceElements;
+	NSString *fetchRosterElementID;
 	
 	DDList *mucModules;
 }
@@ -151,6 +152,11 @@
 /**
  * Manually fetch the roster from the server.
  * Useful if you disable autoFetchRoster.
+ * 
+ * If the server supports roster versioning (XEP-0237), and the storage keeps the roster between sessions
+ * (see rosterVersionForXMPPStream: in the XMPPRosterStorage protocol), the version of the stored roster is sent along.
+ * The server then only sends the changes since that version (as roster pushes),
+ * or nothing at all if the roster hasn't changed.
 **/
 - (void)fetchRoster;
 
@@ -318,6 +324,27 @@
 
 @optional
 
+/**
+ * Roster versioning (XEP-0237).
+ * 
+ * A storage class that keeps the roster between sessions can implement these methods,
+ * so the roster is only downloaded if it has changed (and then usually only the changes).
+ * 
+ * rosterVersionForXMPPStream: should return the version of the stored roster, or nil if there isn't one.
+ * 
+ * setRosterVersion:xmppStream: is invoked after a roster (or a roster push) that carries a version has been handled.
+ * So once it's invoked, the storage holds that version of the roster, and should persist it.
+ * It's invoked with a nil version if the stored roster should be discarded.
+ * 
+ * If the server reports that the stored roster is current, restoreRosterForXMPPStream: is invoked,
+ * instead of the usual beginRosterPopulation / handleRosterItem / endRosterPopulation sequence.
+ * The storage should then make the stored roster its current roster, and return YES.
+ * If the stored roster is no longer available, it should return NO, and the full roster is fetched instead.
+**/
+- (NSString *)rosterVersionForXMPPStream:(XMPPStream *)stream;
+- (void)setRosterVersion:(NSString *)version xmppStream:(XMPPStream *)stream;
+- (BOOL)restoreRosterForXMPPStream:(XMPPStream *)stream;
+
 /**
  * When XMPPvCardAvatarModule is included in the framework, the roster will integrate with it.
  * Implement this method to provide support for storing the downloaded user photos.
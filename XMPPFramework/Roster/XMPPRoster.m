@@ -612,14 +612,29 @@ enum XMPPRosterFlags
 			return;
 		}
 		
-		// <iq type="get">
-		//   <query xmlns="jabber:iq:roster"/>
+		// <iq type="get" id="abc123">
+		//   <query xmlns="jabber:iq:roster" ver="ver14"/>
 		// </iq>
+		// 
+		// The ver attribute is only included if the server supports roster versioning (XEP-0237),
+		// and our storage can keep the roster between sessions.
+		// If we don't have a stored roster yet, the version is empty.
 		
 		NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:@"jabber:iq:roster"];
 		
+		if ([xmppRosterStorage respondsToSelector:@selector(rosterVersionForXMPPStream:)] &&
+		    [self serverSupportsRosterVersioning])
+		{
+			NSString *ver = [xmppRosterStorage rosterVersionForXMPPStream:xmppStream];
+			
+			[query addAttributeWithName:@"ver" stringValue:(ver ?: @"")];
+		}
+		
+		fetchRosterElementID = [xmppStream generateUUID];
+		
 		NSXMLElement *iq = [NSXMLElement elementWithName:@"iq"];
 		[iq addAttributeWithName:@"type" stringValue:@"get"];
+		[iq addAttributeWithName:@"id" stringValue:fetchRosterElementID];
 		[iq addChild:query];
 		
 		[xmppStream sendElement:iq];
@@ -633,6 +648,104 @@ enum XMPPRosterFlags
 		dispatch_async(moduleQueue, block);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Roster Versioning
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)serverSupportsRosterVersioning
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	// <stream:features>
+	//   <ver xmlns="urn:xmpp:features:rosterver"/>
+	// </stream:features>
+	
+	NSXMLElement *features = [[xmppStream rootElement] elementForName:@"stream:features"];
+	
+	return ([features elementForName:@"ver" xmlns:@"urn:xmpp:features:rosterver"] != nil);
+}
+
+- (void)updateRosterVersionFromQuery:(NSXMLElement *)query
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	NSString *ver = [query attributeStringValueForName:@"ver"];
+	
+	if (ver && [xmppRosterStorage respondsToSelector:@selector(setRosterVersion:xmppStream:)])
+	{
+		[xmppRosterStorage setRosterVersion:ver xmppStream:xmppStream];
+	}
+}
+
+/**
+ * The server responded to our (versioned) roster request with an empty result.
+ * This means the roster hasn't changed since the version we sent,
+ * and any changes will be sent as roster pushes.
+**/
+- (void)handleRosterNotModified
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	if ([self _hasRoster]) return;
+	
+	BOOL restored = NO;
+	
+	if ([xmppRosterStorage respondsToSelector:@selector(restoreRosterForXMPPStream:)])
+	{
+		restored = [xmppRosterStorage restoreRosterForXMPPStream:xmppStream];
+	}
+	
+	if (!restored)
+	{
+		NSString *ver = nil;
+		if ([xmppRosterStorage respondsToSelector:@selector(rosterVersionForXMPPStream:)])
+		{
+			ver = [xmppRosterStorage rosterVersionForXMPPStream:xmppStream];
+		}
+		
+		if (ver == nil)
+		{
+			// We didn't send a version, so the server shouldn't have sent an empty result.
+			// Don't ask again, as we'd likely get the same response.
+			
+			XMPPLogWarn(@"%@: Unexpected empty roster result", THIS_FILE);
+			return;
+		}
+		
+		// The storage no longer has the roster it gave us the version of.
+		// Discard the version, and fetch the full roster.
+		
+		XMPPLogWarn(@"%@: Stored roster unavailable - fetching full roster", THIS_FILE);
+		
+		if ([xmppRosterStorage respondsToSelector:@selector(setRosterVersion:xmppStream:)])
+		{
+			[xmppRosterStorage setRosterVersion:nil xmppStream:xmppStream];
+		}
+		
+		[self _setRequestedRoster:NO];
+		[self fetchRoster];
+		return;
+	}
+	
+	[self _setHasRoster:YES];
+	
+	[multicastDelegate xmppRosterDidBeginPopulating:self];
+	[multicastDelegate xmppRosterDidEndPopulating:self];
+	
+	[self processEarlyPresenceElements];
+}
+
+- (void)processEarlyPresenceElements
+{
+	// Process any premature presence elements we received.
+	
+	for (XMPPPresence *presence in earlyPresenceElements)
+	{
+		[self xmppStream:xmppStream didReceivePresence:presence];
+	}
+	[earlyPresenceElements removeAllObjects];
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark XMPPStream Delegate
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -660,6 +773,22 @@ enum XMPPRosterFlags
 	// it is important we specify the xmlns for the query.
 	
 	NSXMLElement *query = [iq elementForName:@"query" xmlns:@"jabber:iq:roster"];
+	
+	if (fetchRosterElementID && [[iq elementID] isEqualToString:fetchRosterElementID])
+	{
+		fetchRosterElementID = nil;
+		
+		if (query == nil && [iq isResultIQ])
+		{
+			// <iq type="result" id="abc123"/>
+			// 
+			// XEP-0237: Our stored roster is current
+			
+			[self handleRosterNotModified];
+			return YES;
+		}
+	}
+	
 	if (query)
 	{
 		BOOL hasRoster = [self _hasRoster];
@@ -686,6 +815,11 @@ enum XMPPRosterFlags
 			}
 		}
 		
+		// If the roster (or the roster push) carries a version,
+		// the storage now holds that version of the roster.
+		
+		[self updateRosterVersionFromQuery:query];
+		
 		if (!hasRoster)
 		{
 			// We should have our roster now
@@ -695,13 +829,7 @@ enum XMPPRosterFlags
             [multicastDelegate xmppRosterDidEndPopulating:self];
 			[xmppRosterStorage endRosterPopulationForXMPPStream:xmppStream];
 			
-			// Process any premature presence elements we received.
-			
-			for (XMPPPresence *presence in earlyPresenceElements)
-			{
-				[self xmppStream:xmppStream didReceivePresence:presence];
-			}
-			[earlyPresenceElements removeAllObjects];
+			[self processEarlyPresenceElements];
 		}
 		
 		return YES;
@@ -795,7 +923,7 @@ enum XMPPRosterFlags
 	
 	// We check the toStr, so we don't dump the resources when a user leaves a MUC room.
 	
-	if ([[presence type] isEqualToString:@"unavailable"] && [presence toStr] == nil)
+	if ([presence typeAtom] == XMPPAtomUnavailable && [presence toStr] == nil)
 	{
 		// We don't receive presence notifications when we're offline.
 		// So we need to remove all resources from our roster when we're offline.
@@ -823,6 +951,7 @@ enum XMPPRosterFlags
 	[self _setHasRoster:NO];
 	
 	[earlyPresenceElements removeAllObjects];
+	fetchRosterElementID = nil;
 }
 
 #ifdef _XMPP_MUC_H
@@ -0,0 +1,112 @@
+#import <Foundation/Foundation.h>
+#import <sqlite3.h>
+
+/**
+ * This class provides an optional base class that may be used to implement
+ * a storage class for an xmpp extension directly on top of SQLite, without Core Data.
+ *
+ * Core Data is a good fit for an object graph that's bound to a user interface.
+ * But most xmpp storage is accessed as simple keyed lookups and updates (by jid, by hash, etc),
+ * for which Core Data adds a lot of overhead (object materialization, faulting, change tracking, merging).
+ * And Core Data isn't available on every platform Foundation is.
+ *
+ * Like XMPPCoreDataStorage, this class operates on its own dispatch queue,
+ * which allows it to easily provide storage for multiple extension instances,
+ * and buffers its writes to maximize performance:
+ *
+ * - Every statement is prepared once, and cached for the lifetime of the database connection.
+ * - Writes are batched into transactions.
+ *   A transaction is started by the first write, and committed once there are no more pending requests,
+ *   once saveThreshold changes have been made, or once the changes have been uncommitted for maxCommitLatency.
+ * - File based databases use write-ahead logging (WAL), so a commit is a sequential append to the log,
+ *   and only requires a single fsync. The log is checkpointed into the database file automatically.
+ *
+ * The framework comes with several classes that extend this base class:
+ * - XMPPRosterSQLiteStorage       (Roster)
+ * - XMPPCapabilitiesSQLiteStorage (XEP-0115)
+ * - XMPPvCardSQLiteStorage        (XEP-0054)
+ *
+ * For more information on how to extend this class,
+ * please see the XMPPSQLiteStorageProtected.h header file.
+**/
+
+@interface XMPPSQLiteStorage : NSObject {
+@private
+	
+	NSMutableDictionary *myJidCache;
+	
+	int32_t pendingRequests;
+	
+	sqlite3 *database;
+	BOOL databaseOpenFailed;
+	
+	NSMutableDictionary *statements;
+	
+	BOOL inTransaction;
+	NSUInteger unsavedChanges;
+	
+	NSTimeInterval maxCommitLatency;
+	CFAbsoluteTime firstUnsavedChangeTime;
+
+@protected
+	
+	NSString *databaseFileName;
+	NSUInteger saveThreshold;
+	
+	BOOL autoRecreateDatabaseFile;
+	
+	dispatch_queue_t storageQueue;
+	void *storageQueueTag;
+}
+
+/**
+ * Initializes a storage instance, backed by an SQLite database file with the given name.
+ * If you pass nil, a default database filename is automatically used.
+ * This default is derived from the classname,
+ * meaning subclasses will get a default database filename derived from the subclass classname.
+ *
+ * If you attempt to create an instance of this class with the same databaseFileName as another existing instance,
+ * this method will return nil.
+**/
+- (id)initWithDatabaseFilename:(NSString *)databaseFileName;
+
+/**
+ * Initializes a storage instance, backed by an in-memory SQLite database.
+**/
+- (id)initWithInMemoryStore;
+
+/**
+ * Readonly access to the databaseFileName used during initialization.
+ * If nil was passed to the init method, returns the actual databaseFileName being used (the default filename).
+**/
+@property (readonly) NSString *databaseFileName;
+
+/**
+ * The saveThreshold specifies the maximum number of uncommitted changes (rows) before the transaction is committed.
+ *
+ * Default 500
+**/
+@property (readwrite) NSUInteger saveThreshold;
+
+/**
+ * The maximum amount of time changes may remain uncommitted while the storage instance is busy.
+ *
+ * Normally the transaction is committed once there are no more pending requests (or the saveThreshold is reached).
+ * But if requests keep coming in, that may never happen.
+ * So once changes have been uncommitted for this long, they're committed regardless of the pending requests.
+ *
+ * Pass zero to disable the limit.
+ *
+ * Default 2 seconds
+**/
+@property (readwrite) NSTimeInterval maxCommitLatency;
+
+/**
+ * The database file is automatically recreated if it can't be opened,
+ * e.g. the file is corrupt, or it was created with a different schema version.
+ *
+ * Default NO
+**/
+@property (readwrite) BOOL autoRecreateDatabaseFile;
+
+@end
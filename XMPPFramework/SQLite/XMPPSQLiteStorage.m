@@ -0,0 +1,812 @@
+#import "XMPPSQLiteStorage.h"
+#import "XMPPSQLiteStorageProtected.h"
+#import "XMPPStream.h"
+#import "XMPPInternal.h"
+#import "XMPPJID.h"
+#import "XMPPLogging.h"
+#import "NSNumber+XMPP.h"
+
+#import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+
+@implementation XMPPSQLiteStorage
+
+static NSMutableSet *databaseFileNames;
+
++ (void)initialize
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		databaseFileNames = [[NSMutableSet alloc] init];
+	});
+}
+
++ (BOOL)registerDatabaseFileName:(NSString *)dbFileName
+{
+	BOOL result = NO;
+	
+	@synchronized(databaseFileNames)
+	{
+		if (![databaseFileNames containsObject:dbFileName])
+		{
+			[databaseFileNames addObject:dbFileName];
+			result = YES;
+		}
+	}
+	
+	return result;
+}
+
++ (void)unregisterDatabaseFileName:(NSString *)dbFileName
+{
+	@synchronized(databaseFileNames)
+	{
+		[databaseFileNames removeObject:dbFileName];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Override Me
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)defaultDatabaseFileName
+{
+	// Override me, if needed, to provide customized behavior.
+	//
+	// This method is queried if the initWithDatabaseFileName method is invoked with a nil parameter.
+	//
+	// The default implementation returns the name of the subclass, stripping any suffix of "SQLiteStorage".
+	
+	NSString *className = NSStringFromClass([self class]);
+	NSString *suffix = @"SQLiteStorage";
+	
+	if ([className hasSuffix:suffix] && ([className length] > [suffix length]))
+	{
+		className = [className substringToIndex:([className length] - [suffix length])];
+	}
+	
+	return [NSString stringWithFormat:@"%@.sqlite", className];
+}
+
+- (int)schemaVersion
+{
+	// Override me to provide the version of your schema.
+	
+	return 1;
+}
+
+- (BOOL)createSchema
+{
+	// Override me to create your tables and indexes.
+	
+	return YES;
+}
+
+- (void)willOpenDatabaseWithPath:(NSString *)path
+{
+	// Override me, if needed, to provide customized behavior.
+	//
+	// If you are using a database file with pure non-persistent data (e.g. for memory optimization purposes on iOS),
+	// you may want to delete the database file if it already exists on disk.
+	//
+	// If this instance was created via initWithDatabaseFilename, then the path parameter will be non-nil.
+	// If this instance was created via initWithInMemoryStore, then the path parameter will be nil.
+}
+
+- (void)didOpenDatabase
+{
+	// Override me, if needed, to provide customized behavior.
+	//
+	// For example, you may want to perform cleanup of any non-persistent data before you start using the database.
+	//
+	// This method is invoked on the storageQueue.
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Setup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@synthesize databaseFileName;
+
+- (void)commonInit
+{
+	saveThreshold = 500;
+	maxCommitLatency = 2.0;
+	
+	statements = [[NSMutableDictionary alloc] init];
+	
+	storageQueue = dispatch_queue_create(class_getName([self class]), NULL);
+	
+	storageQueueTag = &storageQueueTag;
+	dispatch_queue_set_specific(storageQueue, storageQueueTag, storageQueueTag, NULL);
+	
+	myJidCache = [[NSMutableDictionary alloc] init];
+	
+	[[NSNotificationCenter defaultCenter] addObserver:self
+	                                         selector:@selector(updateJidCache:)
+	                                             name:XMPPStreamDidChangeMyJIDNotification
+	                                           object:nil];
+}
+
+- (id)init
+{
+    return [self initWithDatabaseFilename:nil];
+}
+
+- (id)initWithDatabaseFilename:(NSString *)aDatabaseFileName
+{
+	if ((self = [super init]))
+	{
+		if (aDatabaseFileName)
+			databaseFileName = [aDatabaseFileName copy];
+		else
+			databaseFileName = [[self defaultDatabaseFileName] copy];
+		
+		if (![[self class] registerDatabaseFileName:databaseFileName])
+		{
+			return nil;
+		}
+		
+		[self commonInit];
+		NSAssert(storageQueue != NULL, @"Subclass forgot to invoke [super commonInit]");
+	}
+	return self;
+}
+
+- (id)initWithInMemoryStore
+{
+	if ((self = [super init]))
+	{
+		[self commonInit];
+		NSAssert(storageQueue != NULL, @"Subclass forgot to invoke [super commonInit]");
+	}
+	return self;
+}
+
+- (BOOL)configureWithParent:(id)aParent queue:(dispatch_queue_t)queue
+{
+	// This is the standard configure method used by xmpp extensions to configure a storage class.
+	//
+	// Feel free to override this method if needed,
+	// and just invoke super at some point to make sure everything is kosher at this level as well.
+	
+	NSParameterAssert(aParent != nil);
+	NSParameterAssert(queue != NULL);
+	
+	if (queue == storageQueue)
+	{
+		// This class is designed to be run on a separate dispatch queue from its parent.
+		// This allows us to batch writes into transactions,
+		// and commit them when demand on the storage instance is low.
+		
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (NSUInteger)saveThreshold
+{
+	if (dispatch_get_specific(storageQueueTag))
+	{
+		return saveThreshold;
+	}
+	else
+	{
+		__block NSUInteger result;
+		
+		dispatch_sync(storageQueue, ^{
+			result = saveThreshold;
+		});
+		
+		return result;
+	}
+}
+
+- (void)setSaveThreshold:(NSUInteger)newSaveThreshold
+{
+	dispatch_block_t block = ^{
+		saveThreshold = newSaveThreshold;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+- (NSTimeInterval)maxCommitLatency
+{
+	if (dispatch_get_specific(storageQueueTag))
+	{
+		return maxCommitLatency;
+	}
+	else
+	{
+		__block NSTimeInterval result;
+		
+		dispatch_sync(storageQueue, ^{
+			result = maxCommitLatency;
+		});
+		
+		return result;
+	}
+}
+
+- (void)setMaxCommitLatency:(NSTimeInterval)newMaxCommitLatency
+{
+	dispatch_block_t block = ^{
+		maxCommitLatency = newMaxCommitLatency;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+- (BOOL)autoRecreateDatabaseFile
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = autoRecreateDatabaseFile;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+	
+	return result;
+}
+
+- (void)setAutoRecreateDatabaseFile:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		autoRecreateDatabaseFile = flag;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Stream JID Caching
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// We cache a stream's myJID to avoid constantly querying the xmppStream for it.
+// See XMPPCoreDataStorage for a full discussion.
+
+- (XMPPJID *)myJIDForXMPPStream:(XMPPStream *)stream
+{
+	if (stream == nil) return nil;
+	
+	__block XMPPJID *result = nil;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		NSNumber *key = [NSNumber numberWithPtr:(__bridge void *)stream];
+		
+		result = (XMPPJID *)[myJidCache objectForKey:key];
+		if (!result)
+		{
+			result = [stream myJID];
+			if (result)
+			{
+				[myJidCache setObject:result forKey:key];
+			}
+		}
+	}};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+	
+	return result;
+}
+
+- (NSString *)streamBareJidStrForXMPPStream:(XMPPStream *)stream
+{
+	NSString *streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
+	
+	return streamBareJidStr ? streamBareJidStr : @"";
+}
+
+- (void)didChangeCachedMyJID:(XMPPJID *)cachedMyJID forXMPPStream:(XMPPStream *)stream
+{
+	// Override me if you'd like to do anything special when this happens.
+}
+
+- (void)updateJidCache:(NSNotification *)notification
+{
+	// Notifications are delivered on the thread/queue that posted them.
+	// In this case, they are delivered on xmppStream's internal processing queue.
+	
+	XMPPStream *stream = (XMPPStream *)[notification object];
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		NSNumber *key = [NSNumber numberWithPtr:(__bridge void *)stream];
+		XMPPJID *cachedJID = [myJidCache objectForKey:key];
+		
+		if (cachedJID)
+		{
+			XMPPJID *newJID = [stream myJID];
+			
+			if (newJID)
+			{
+				if (![cachedJID isEqualToJID:newJID])
+				{
+					[myJidCache setObject:newJID forKey:key];
+					[self didChangeCachedMyJID:newJID forXMPPStream:stream];
+				}
+			}
+			else
+			{
+				[myJidCache removeObjectForKey:key];
+				[self didChangeCachedMyJID:nil forXMPPStream:stream];
+			}
+		}
+	}};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Database
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)persistentStoreDirectory
+{
+	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES);
+    NSString *basePath = ([paths count] > 0) ? [paths objectAtIndex:0] : NSTemporaryDirectory();
+	
+	// Attempt to find a name for this application
+	NSString *appName = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleDisplayName"];
+	if (appName == nil) {
+		appName = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"CFBundleName"];
+	}
+	
+	if (appName == nil) {
+		appName = @"xmppframework";
+	}
+	
+	
+	NSString *result = [basePath stringByAppendingPathComponent:appName];
+	
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	
+	if (![fileManager fileExistsAtPath:result])
+	{
+		[fileManager createDirectoryAtPath:result withIntermediateDirectories:YES attributes:nil error:nil];
+	}
+
+    return result;
+}
+
+- (sqlite3 *)database
+{
+	// This is a protected method.
+	//
+	// The connection is opened in the multi-thread mode of SQLite,
+	// which means it must never be used from two threads at the same time.
+	// So it's only ever used from within the storageQueue.
+	
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (database || databaseOpenFailed)
+	{
+		return database;
+	}
+	
+	NSString *path = nil;
+	if (databaseFileName)
+	{
+		path = [[self persistentStoreDirectory] stringByAppendingPathComponent:databaseFileName];
+	}
+	
+	[self willOpenDatabaseWithPath:path];
+	
+	BOOL opened = [self openDatabaseWithPath:path];
+	
+	if (!opened && path && autoRecreateDatabaseFile)
+	{
+		XMPPLogWarn(@"%@: Recreating database file %@", [self class], path);
+		
+		NSFileManager *fileManager = [NSFileManager defaultManager];
+		
+		[fileManager removeItemAtPath:path error:nil];
+		[fileManager removeItemAtPath:[path stringByAppendingString:@"-wal"] error:nil];
+		[fileManager removeItemAtPath:[path stringByAppendingString:@"-shm"] error:nil];
+		
+		opened = [self openDatabaseWithPath:path];
+	}
+	
+	if (opened)
+	{
+		[self didOpenDatabase];
+	}
+	else
+	{
+		databaseOpenFailed = YES;
+	}
+	
+	return database;
+}
+
+- (BOOL)openDatabaseWithPath:(NSString *)path
+{
+	XMPPLogVerbose(@"%@: Opening database %@", [self class], path);
+	
+	const char *filename = path ? [path fileSystemRepresentation] : ":memory:";
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+	
+	if (sqlite3_open_v2(filename, &database, flags, NULL) != SQLITE_OK)
+	{
+		XMPPLogWarn(@"%@: Error opening database %@ - %s", [self class], path, sqlite3_errmsg(database));
+		
+		[self closeDatabase];
+		return NO;
+	}
+	
+	if (path)
+	{
+		// With write-ahead logging a commit appends to the log (a single fsync), instead of rewriting pages in place.
+		// In WAL mode, synchronous=NORMAL is safe against application crashes
+		// (a power loss may lose the most recent commits, but never corrupts the database).
+		
+		[self executeSQL:@"PRAGMA journal_mode = WAL"];
+		[self executeSQL:@"PRAGMA synchronous = NORMAL"];
+	}
+	
+	// The schema version is stored as the user_version of the database.
+	// This is also the first read of the file, so it detects files that aren't databases.
+	
+	int version = -1;
+	
+	sqlite3_stmt *statement = [self statementForSQL:@"PRAGMA user_version"];
+	if (statement && sqlite3_step(statement) == SQLITE_ROW)
+	{
+		version = sqlite3_column_int(statement, 0);
+	}
+	sqlite3_reset(statement);
+	
+	if (version < 0)
+	{
+		XMPPLogWarn(@"%@: Error reading database %@ - %s", [self class], path, sqlite3_errmsg(database));
+		
+		[self closeDatabase];
+		return NO;
+	}
+	
+	if (version == 0)
+	{
+		BOOL created = [self executeSQL:@"BEGIN IMMEDIATE"] && [self createSchema];
+		
+		if (created)
+		{
+			NSString *sql = [NSString stringWithFormat:@"PRAGMA user_version = %d", [self schemaVersion]];
+			
+			created = [self executeSQL:sql] && [self executeSQL:@"COMMIT"];
+		}
+		
+		if (!created)
+		{
+			XMPPLogWarn(@"%@: Error creating schema in database %@", [self class], path);
+			
+			[self closeDatabase];
+			return NO;
+		}
+	}
+	else if (version != [self schemaVersion])
+	{
+		XMPPLogWarn(@"%@: Database %@ has schema version %d, expected %d", [self class], path,
+		            version, [self schemaVersion]);
+		
+		[self closeDatabase];
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (void)closeDatabase
+{
+	for (NSValue *value in [statements objectEnumerator])
+	{
+		sqlite3_finalize((sqlite3_stmt *)[value pointerValue]);
+	}
+	[statements removeAllObjects];
+	
+	if (database)
+	{
+		sqlite3_close(database);
+		database = NULL;
+	}
+	
+	inTransaction = NO;
+	unsavedChanges = 0;
+}
+
+- (BOOL)executeSQL:(NSString *)sql
+{
+	// Not going through the database property, as this method is used while the database is being opened.
+	
+	if (database == NULL) return NO;
+	
+	char *errmsg = NULL;
+	
+	if (sqlite3_exec(database, [sql UTF8String], NULL, NULL, &errmsg) != SQLITE_OK)
+	{
+		XMPPLogWarn(@"%@: Error executing \"%@\" - %s", [self class], sql, errmsg);
+		
+		sqlite3_free(errmsg);
+		return NO;
+	}
+	
+	return YES;
+}
+
+- (sqlite3_stmt *)statementForSQL:(NSString *)sql
+{
+	// The database is opened upon first use
+	if (database == NULL && [self database] == NULL) return NULL;
+	
+	sqlite3_stmt *statement = (sqlite3_stmt *)[[statements objectForKey:sql] pointerValue];
+	
+	if (statement)
+	{
+		sqlite3_reset(statement);
+		sqlite3_clear_bindings(statement);
+	}
+	else
+	{
+		if (sqlite3_prepare_v2(database, [sql UTF8String], -1, &statement, NULL) != SQLITE_OK)
+		{
+			XMPPLogWarn(@"%@: Error preparing \"%@\" - %s", [self class], sql, sqlite3_errmsg(database));
+			
+			sqlite3_finalize(statement);
+			return NULL;
+		}
+		
+		[statements setObject:[NSValue valueWithPointer:statement] forKey:sql];
+	}
+	
+	return statement;
+}
+
+- (BOOL)executeUpdateStatement:(sqlite3_stmt *)statement
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (statement == NULL) return NO;
+	
+	if (!inTransaction)
+	{
+		if (![self executeSQL:@"BEGIN IMMEDIATE"])
+		{
+			sqlite3_reset(statement);
+			return NO;
+		}
+		
+		inTransaction = YES;
+	}
+	
+	int status = sqlite3_step(statement);
+	
+	if (status != SQLITE_DONE)
+	{
+		XMPPLogWarn(@"%@: Error executing \"%s\" - %s", [self class], sqlite3_sql(statement), sqlite3_errmsg(database));
+	}
+	else
+	{
+		unsavedChanges += sqlite3_changes(database);
+	}
+	
+	sqlite3_reset(statement);
+	
+	return (status == SQLITE_DONE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Utilities
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)numberOfUnsavedChanges
+{
+	return unsavedChanges;
+}
+
+- (void)save
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (!inTransaction) return;
+	
+	if (![self executeSQL:@"COMMIT"])
+	{
+		[self executeSQL:@"ROLLBACK"];
+	}
+	
+	inTransaction = NO;
+	unsavedChanges = 0;
+	firstUnsavedChangeTime = 0.0;
+}
+
+- (void)maybeSave:(int32_t)currentPendingRequests
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	
+	if (inTransaction)
+	{
+		if (currentPendingRequests == 0)
+		{
+			XMPPLogVerbose(@"%@: Triggering save (pendingRequests=%i)", [self class], currentPendingRequests);
+			
+			[self save];
+		}
+		else if (unsavedChanges >= saveThreshold)
+		{
+			XMPPLogVerbose(@"%@: Triggering save (unsavedCount=%lu)", [self class], (unsigned long)unsavedChanges);
+			
+			[self save];
+		}
+		else if (firstUnsavedChangeTime == 0.0)
+		{
+			firstUnsavedChangeTime = CFAbsoluteTimeGetCurrent();
+			
+			[self scheduleCommitDeadline];
+		}
+		else if ((maxCommitLatency > 0.0) &&
+		         (CFAbsoluteTimeGetCurrent() - firstUnsavedChangeTime) >= maxCommitLatency)
+		{
+			XMPPLogVerbose(@"%@: Triggering save (maxCommitLatency)", [self class]);
+			
+			[self save];
+		}
+	}
+}
+
+- (void)scheduleCommitDeadline
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (maxCommitLatency <= 0.0) return;
+	
+	CFAbsoluteTime changeTime = firstUnsavedChangeTime;
+	
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(maxCommitLatency * NSEC_PER_SEC));
+	dispatch_after(tt, storageQueue, ^{ @autoreleasepool {
+		
+		// Ignore the timer if the changes it was scheduled for have been committed since
+		
+		if ((firstUnsavedChangeTime == changeTime) && inTransaction)
+		{
+			XMPPLogVerbose(@"%@: Triggering save (maxCommitLatency)", [self class]);
+			
+			[self save];
+		}
+	}});
+}
+
+- (void)maybeSave
+{
+	// Convenience method in the very rare case that a subclass would need to invoke maybeSave manually.
+	
+	[self maybeSave:OSAtomicAdd32(0, &pendingRequests)];
+}
+
+- (void)executeBlock:(dispatch_block_t)block
+{
+	// By design this method should not be invoked from the storageQueue.
+	//
+	// If you remove the assert statement below, you are destroying the sole purpose for this class,
+	// which is to optimize the disk IO by batching writes into transactions.
+	//
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	OSAtomicIncrement32(&pendingRequests);
+	dispatch_sync(storageQueue, ^{ @autoreleasepool {
+		
+		block();
+		
+		// Since this is a synchronous request, we want to return as quickly as possible.
+		// So we delay the maybeSave operation til later.
+		
+		dispatch_async(storageQueue, ^{ @autoreleasepool {
+			
+			[self maybeSave:OSAtomicDecrement32(&pendingRequests)];
+		}});
+		
+	}});
+}
+
+- (void)scheduleBlock:(dispatch_block_t)block
+{
+	// By design this method should not be invoked from the storageQueue.
+	//
+	// If you remove the assert statement below, you are destroying the sole purpose for this class,
+	// which is to optimize the disk IO by batching writes into transactions.
+	//
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	OSAtomicIncrement32(&pendingRequests);
+	dispatch_async(storageQueue, ^{ @autoreleasepool {
+		
+		block();
+		[self maybeSave:OSAtomicDecrement32(&pendingRequests)];
+	}});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Memory Management
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	
+	// Every block on the storageQueue retains self, so the queue is idle by now.
+	
+	if (inTransaction)
+	{
+		[self executeSQL:@"COMMIT"];
+	}
+	
+	[self closeDatabase];
+	
+	if (databaseFileName)
+	{
+		[[self class] unregisterDatabaseFileName:databaseFileName];
+	}
+	
+	#if !OS_OBJECT_USE_OBJC
+	if (storageQueue)
+		dispatch_release(storageQueue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XMPPSQLiteBindString(sqlite3_stmt *statement, int index, NSString *string)
+{
+	if (string)
+		sqlite3_bind_text(statement, index, [string UTF8String], -1, SQLITE_TRANSIENT);
+	else
+		sqlite3_bind_null(statement, index);
+}
+
+NSString *XMPPSQLiteColumnString(sqlite3_stmt *statement, int column)
+{
+	const unsigned char *text = sqlite3_column_text(statement, column);
+	if (text == NULL) return nil;
+	
+	return [[NSString alloc] initWithBytes:text
+	                                length:sqlite3_column_bytes(statement, column)
+	                              encoding:NSUTF8StringEncoding];
+}
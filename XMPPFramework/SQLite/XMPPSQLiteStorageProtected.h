@@ -0,0 +1,211 @@
+#import "XMPPSQLiteStorage.h"
+
+@class XMPPJID;
+@class XMPPStream;
+
+/**
+ * The methods in this class are to be used ONLY by subclasses of XMPPSQLiteStorage.
+**/
+
+@interface XMPPSQLiteStorage (Protected)
+
+#pragma mark Override Me
+
+/**
+ * If your subclass needs to do anything for init, it can do so easily by overriding this method.
+ * All public init methods will invoke this method at the end of their implementation.
+ *
+ * Important: If overriden you must invoke [super commonInit] at some point.
+**/
+- (void)commonInit;
+
+/**
+ * Override me, if needed, to provide customized behavior.
+ *
+ * This method is queried if the initWithDatabaseFileName method is invoked with a nil parameter.
+ *
+ * The default implementation returns the name of the subclass, stripping any suffix of "SQLiteStorage",
+ * with the sqlite file extension.
+ * E.g., if your subclass was named "XMPPExtensionSQLiteStorage", then this method would return "XMPPExtension.sqlite".
+ *
+ * Note that the Core Data storage classes use the same default names, but a different file format.
+ * So if you use both for the same extension, at least one of them needs a different filename.
+**/
+- (NSString *)defaultDatabaseFileName;
+
+/**
+ * Override me to provide the version of your schema.
+ *
+ * The version is stored in the database file (as the user_version).
+ * A database file with a different version can't be used, and is recreated if autoRecreateDatabaseFile is set.
+ *
+ * The default implementation returns 1.
+**/
+- (int)schemaVersion;
+
+/**
+ * Override me to create your tables and indexes.
+ *
+ * This method is invoked (within a transaction) whenever a new database is created.
+ * Use the executeSQL: method below, and return NO if any of the statements fail.
+ *
+ * The default implementation does nothing, and returns YES.
+**/
+- (BOOL)createSchema;
+
+/**
+ * Override me, if needed, to provide customized behavior.
+ *
+ * If you are using a database file with pure non-persistent data (e.g. for memory optimization purposes on iOS),
+ * you may want to delete the database file if it already exists on disk.
+ *
+ * If this instance was created via initWithDatabaseFilename, then the path parameter will be non-nil.
+ * If this instance was created via initWithInMemoryStore, then the path parameter will be nil.
+ *
+ * The default implementation does nothing.
+**/
+- (void)willOpenDatabaseWithPath:(NSString *)path;
+
+/**
+ * Override me, if needed, to provide customized behavior.
+ *
+ * For example, you may want to perform cleanup of any non-persistent data before you start using the database.
+ *
+ * This method will be invoked on the storageQueue.
+ * The default implementation does nothing.
+**/
+- (void)didOpenDatabase;
+
+#pragma mark Setup
+
+/**
+ * This is the standard configure method used by xmpp extensions to configure a storage class.
+ *
+ * Feel free to override this method if needed,
+ * and just invoke super at some point to make sure everything is kosher at this level as well.
+ *
+ * Note that the default implementation allows the storage class to be used by multiple xmpp streams.
+**/
+- (BOOL)configureWithParent:(id)aParent queue:(dispatch_queue_t)queue;
+
+#pragma mark Stream JID caching
+
+/**
+ * Works exactly like the equivalent method of XMPPCoreDataStorage.
+ * Please see the XMPPCoreDataStorageProtected header file for a full discussion.
+**/
+- (XMPPJID *)myJIDForXMPPStream:(XMPPStream *)stream;
+
+/**
+ * Returns the value to store in (and query) a streamBareJidStr column for the given stream.
+ * 
+ * This is the bare myJID of the stream, or an empty string if there's no stream, or it has no myJID.
+ * Never store (or bind) NULL instead, as NULL is never equal to anything in SQL (not even NULL),
+ * so such rows would never be found again, and would never conflict in a UNIQUE index.
+ * The empty string matches the behavior of the Core Data storage classes, which look up such objects via "== nil".
+**/
+- (NSString *)streamBareJidStrForXMPPStream:(XMPPStream *)stream;
+
+/**
+ * This method is invoked if the cached myJID changes for a particular xmpp stream.
+ *
+ * This method will be invoked on the storageQueue.
+ * The default implementation does nothing.
+**/
+- (void)didChangeCachedMyJID:(XMPPJID *)cachedMyJID forXMPPStream:(XMPPStream *)stream;
+
+#pragma mark Database
+
+/**
+ * The standard persistentStoreDirectory method.
+**/
+- (NSString *)persistentStoreDirectory;
+
+/**
+ * Provides access to the database connection, which is opened (and created if needed) upon first access.
+ * Returns NULL if the database couldn't be opened.
+ *
+ * The connection is NOT thread-safe (it's opened in the multi-thread mode of SQLite).
+ * So you can ONLY access this property from within the context of the storageQueue.
+ *
+ * Important:
+ * Don't begin or commit transactions yourself.
+ * Use executeUpdateStatement: below for every write, which takes care of batching them into transactions.
+**/
+@property (readonly) sqlite3 *database;
+
+/**
+ * Executes the given SQL directly (without preparing and caching a statement).
+ * Intended for creating the schema, and for pragmas.
+ *
+ * Returns NO (and logs a warning) if the SQL failed.
+**/
+- (BOOL)executeSQL:(NSString *)sql;
+
+/**
+ * Returns a prepared statement for the given SQL.
+ *
+ * Statements are prepared once, and cached for the lifetime of the database connection.
+ * So the given SQL should be a constant (use bindings for the values).
+ *
+ * The returned statement has been reset, and its bindings have been cleared.
+ * Returns NULL (and logs a warning) if the statement can't be prepared.
+**/
+- (sqlite3_stmt *)statementForSQL:(NSString *)sql;
+
+/**
+ * Executes the given (bound) INSERT, UPDATE or DELETE statement, and resets it.
+ *
+ * If no transaction is in progress, one is started.
+ * It's committed by the save method below, which is invoked at appropriate and optimized times.
+ *
+ * Returns NO (and logs a warning) if the statement failed.
+**/
+- (BOOL)executeUpdateStatement:(sqlite3_stmt *)statement;
+
+#pragma mark Performance Optimizations
+
+/**
+ * Returns the number of rows changed by the transaction in progress.
+**/
+- (NSUInteger)numberOfUnsavedChanges;
+
+/**
+ * Commits the transaction in progress (if any).
+ *
+ * You will not often need to manually call this method.
+ * It is called automatically, at appropriate and optimized times, via the executeBlock and scheduleBlock methods.
+**/
+- (void)save;
+
+/**
+ * Commits the transaction in progress, if appropriate.
+ * Works exactly like the equivalent method of XMPPCoreDataStorage.
+**/
+- (void)maybeSave;
+
+/**
+ * These methods work exactly like the equivalent methods of XMPPCoreDataStorage.
+ * Please see the XMPPCoreDataStorageProtected header file for a full discussion.
+ *
+ * In short, every protocol method should run its queries within one of these methods,
+ * and internal utility methods should assert that they're running on the storageQueue.
+**/
+- (void)executeBlock:(dispatch_block_t)block;
+- (void)scheduleBlock:(dispatch_block_t)block;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Binds the given string, or NULL if the string is nil.
+**/
+void XMPPSQLiteBindString(sqlite3_stmt *statement, int index, NSString *string);
+
+/**
+ * Returns the string value of the given column, or nil if the value is NULL.
+**/
+NSString *XMPPSQLiteColumnString(sqlite3_stmt *statement, int column);
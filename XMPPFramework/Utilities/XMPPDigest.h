@@ -0,0 +1,80 @@
+#import <Foundation/Foundation.h>
+
+enum XMPPDigestAlgorithm
+{
+	XMPPDigestAlgorithmMD5,
+	XMPPDigestAlgorithmSHA1,
+	XMPPDigestAlgorithmSHA256,
+};
+typedef enum XMPPDigestAlgorithm XMPPDigestAlgorithm;
+
+/**
+ * XMPPDigest is an incremental (streaming) message digest.
+ *
+ * Rather than hashing an entire payload at once (which requires the entire payload to be in memory),
+ * a digest can be fed chunks of data as they are sent or received. For example:
+ *
+ * XMPPDigest *digest = [XMPPDigest digestWithAlgorithm:XMPPDigestAlgorithmSHA1];
+ * [digest updateWithData:chunk1];
+ * [digest updateWithData:chunk2];
+ * NSString *hash = [digest hexDigest];
+ *
+ * Asking for the digest doesn't end the computation. More data may be added afterwards,
+ * so the digest of a prefix of the data can be inspected at any time.
+ * A digest may also be copied, in which case the copy continues independently from the current state.
+ *
+ * The actual hashing is done by CommonCrypto, which uses the hardware accelerated implementations
+ * (e.g. the ARMv8 and SHA-NI instructions) where the CPU supports them.
+ *
+ * This class is NOT thread-safe.
+ * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+@interface XMPPDigest : NSObject <NSCopying>
+
++ (XMPPDigest *)digestWithAlgorithm:(XMPPDigestAlgorithm)algorithm;
+
+- (id)initWithAlgorithm:(XMPPDigestAlgorithm)algorithm;
+
+@property (nonatomic, readonly) XMPPDigestAlgorithm algorithm;
+
+/**
+ * The size of the digest in bytes (16 for MD5, 20 for SHA-1, 32 for SHA-256).
+**/
+@property (nonatomic, readonly) NSUInteger digestLength;
+
+/**
+ * The total number of bytes that have been fed to the digest.
+**/
+@property (nonatomic, readonly) uint64_t length;
+
+- (void)updateWithBytes:(const void *)bytes length:(NSUInteger)length;
+- (void)updateWithData:(NSData *)data;
+
+/**
+ * Feeds the UTF-8 representation of the given string.
+**/
+- (void)updateWithString:(NSString *)string;
+
+/**
+ * Returns the digest of all the data that has been fed so far.
+ * These methods don't affect the state of the receiver.
+**/
+- (NSData *)digest;
+- (NSString *)hexDigest;
+
+/**
+ * Clears the digest, as if no data had been fed.
+**/
+- (void)reset;
+
+/**
+ * Computes the digest of the contents of the given file.
+ * The file is read in chunks, so it never has to fit in memory.
+ *
+ * Returns nil (and sets the error) if the file couldn't be read.
+**/
++ (XMPPDigest *)digestWithAlgorithm:(XMPPDigestAlgorithm)algorithm
+                  ofContentsOfURL:(NSURL *)url
+                            error:(NSError **)errPtr;
+
+@end
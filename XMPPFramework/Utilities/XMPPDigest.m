@@ -0,0 +1,232 @@
+#import "XMPPDigest.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// The size of the (heap allocated) buffer used to read files
+#define XMPP_DIGEST_FILE_CHUNK_SIZE  (64 * 1024)
+
+// CommonCrypto takes 32 bit lengths
+#define XMPP_DIGEST_MAX_UPDATE_LENGTH  ((NSUInteger)UINT32_MAX)
+
+union XMPPDigestContext {
+	CC_MD5_CTX md5;
+	CC_SHA1_CTX sha1;
+	CC_SHA256_CTX sha256;
+};
+typedef union XMPPDigestContext XMPPDigestContext;
+
+
+@implementation XMPPDigest
+{
+	XMPPDigestContext context;
+}
+
+@synthesize algorithm;
+@synthesize length;
+
++ (XMPPDigest *)digestWithAlgorithm:(XMPPDigestAlgorithm)algorithm
+{
+	return [[XMPPDigest alloc] initWithAlgorithm:algorithm];
+}
+
+- (id)init
+{
+	return [self initWithAlgorithm:XMPPDigestAlgorithmSHA1];
+}
+
+- (id)initWithAlgorithm:(XMPPDigestAlgorithm)inAlgorithm
+{
+	if ((self = [super init]))
+	{
+		algorithm = inAlgorithm;
+		[self reset];
+	}
+	return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+	XMPPDigest *copy = [[[self class] alloc] initWithAlgorithm:algorithm];
+	
+	// The CommonCrypto contexts are plain structs, without any pointers to external state
+	copy->context = context;
+	copy->length = length;
+	
+	return copy;
+}
+
+- (NSUInteger)digestLength
+{
+	switch (algorithm)
+	{
+		case XMPPDigestAlgorithmMD5    : return CC_MD5_DIGEST_LENGTH;
+		case XMPPDigestAlgorithmSHA1   : return CC_SHA1_DIGEST_LENGTH;
+		case XMPPDigestAlgorithmSHA256 : return CC_SHA256_DIGEST_LENGTH;
+	}
+	
+	return 0;
+}
+
+- (void)reset
+{
+	switch (algorithm)
+	{
+		case XMPPDigestAlgorithmMD5    : CC_MD5_Init(&context.md5);       break;
+		case XMPPDigestAlgorithmSHA1   : CC_SHA1_Init(&context.sha1);     break;
+		case XMPPDigestAlgorithmSHA256 : CC_SHA256_Init(&context.sha256); break;
+	}
+	
+	length = 0;
+}
+
+- (void)updateWithBytes:(const void *)bytes length:(NSUInteger)bytesLength
+{
+	const uint8_t *ptr = bytes;
+	
+	while (bytesLength > 0)
+	{
+		CC_LONG chunkLength = (CC_LONG)MIN(bytesLength, XMPP_DIGEST_MAX_UPDATE_LENGTH);
+		
+		switch (algorithm)
+		{
+			case XMPPDigestAlgorithmMD5    : CC_MD5_Update(&context.md5, ptr, chunkLength);       break;
+			case XMPPDigestAlgorithmSHA1   : CC_SHA1_Update(&context.sha1, ptr, chunkLength);     break;
+			case XMPPDigestAlgorithmSHA256 : CC_SHA256_Update(&context.sha256, ptr, chunkLength); break;
+		}
+		
+		ptr += chunkLength;
+		bytesLength -= chunkLength;
+		length += chunkLength;
+	}
+}
+
+- (void)updateWithData:(NSData *)data
+{
+	[self updateWithBytes:[data bytes] length:[data length]];
+}
+
+- (void)updateWithString:(NSString *)string
+{
+	CFStringRef cfStr = (__bridge CFStringRef)string;
+	
+	const char *cStr = CFStringGetCStringPtr(cfStr, kCFStringEncodingUTF8);
+	if (cStr)
+	{
+		[self updateWithBytes:cStr length:strlen(cStr)];
+		return;
+	}
+	
+	// Convert through a stack buffer, one piece at a time
+	
+	uint8_t buf[256];
+	
+	CFIndex strLength = CFStringGetLength(cfStr);
+	CFIndex offset = 0;
+	
+	while (offset < strLength)
+	{
+		CFIndex usedLength = 0;
+		CFIndex converted = CFStringGetBytes(cfStr, CFRangeMake(offset, strLength - offset), kCFStringEncodingUTF8,
+		                                     0, false, buf, sizeof(buf), &usedLength);
+		if (converted == 0)
+		{
+			// Shouldn't happen (every character fits into the buffer), but just in case...
+			
+			NSData *data = [[string substringFromIndex:offset] dataUsingEncoding:NSUTF8StringEncoding];
+			[self updateWithData:data];
+			break;
+		}
+		
+		[self updateWithBytes:buf length:usedLength];
+		offset += converted;
+	}
+}
+
+- (NSData *)digest
+{
+	// Finalize a copy of the context, so the receiver can continue to be updated
+	
+	XMPPDigestContext finalContext = context;
+	unsigned char result[CC_SHA256_DIGEST_LENGTH];
+	
+	switch (algorithm)
+	{
+		case XMPPDigestAlgorithmMD5    : CC_MD5_Final(result, &finalContext.md5);       break;
+		case XMPPDigestAlgorithmSHA1   : CC_SHA1_Final(result, &finalContext.sha1);     break;
+		case XMPPDigestAlgorithmSHA256 : CC_SHA256_Final(result, &finalContext.sha256); break;
+	}
+	
+	return [NSData dataWithBytes:result length:[self digestLength]];
+}
+
+- (NSString *)hexDigest
+{
+	static const char hexTable[16] = "0123456789abcdef";
+	
+	NSData *digest = [self digest];
+	
+	const uint8_t *bytes = [digest bytes];
+	NSUInteger digestLength = [digest length];
+	
+	char hex[CC_SHA256_DIGEST_LENGTH * 2];
+	
+	NSUInteger i;
+	for (i = 0; i < digestLength; i++)
+	{
+		hex[(i * 2)    ] = hexTable[bytes[i] >> 4];
+		hex[(i * 2) + 1] = hexTable[bytes[i] & 0x0F];
+	}
+	
+	return [[NSString alloc] initWithBytes:hex length:(digestLength * 2) encoding:NSASCIIStringEncoding];
+}
+
++ (XMPPDigest *)digestWithAlgorithm:(XMPPDigestAlgorithm)algorithm
+                  ofContentsOfURL:(NSURL *)url
+                            error:(NSError **)errPtr
+{
+	NSInputStream *stream = [NSInputStream inputStreamWithURL:url];
+	[stream open];
+	
+	if (stream == nil || [stream streamStatus] == NSStreamStatusError)
+	{
+		if (errPtr)
+		{
+			NSError *error = [stream streamError];
+			if (error == nil)
+			{
+				NSString *errMsg = @"Unable to open file for reading.";
+				NSDictionary *info = [NSDictionary dictionaryWithObject:errMsg forKey:NSLocalizedDescriptionKey];
+				
+				error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:info];
+			}
+			*errPtr = error;
+		}
+		return nil;
+	}
+	
+	XMPPDigest *digest = [[XMPPDigest alloc] initWithAlgorithm:algorithm];
+	
+	uint8_t *buffer = malloc(XMPP_DIGEST_FILE_CHUNK_SIZE);
+	NSInteger result;
+	
+	while ((result = [stream read:buffer maxLength:XMPP_DIGEST_FILE_CHUNK_SIZE]) > 0)
+	{
+		[digest updateWithBytes:buffer length:(NSUInteger)result];
+	}
+	
+	free(buffer);
+	
+	if (result < 0)
+	{
+		if (errPtr) *errPtr = [stream streamError];
+		digest = nil;
+	}
+	
+	[stream close];
+	return digest;
+}
+
+@end
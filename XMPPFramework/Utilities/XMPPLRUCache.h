@@ -0,0 +1,50 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * XMPPLRUCache is a bounded dictionary that evicts its least recently used entries.
+ *
+ * Looking up an entry (with objectForKey:) or setting it marks it as the most recently used.
+ * Once the cache holds more than countLimit entries, the least recently used ones are evicted.
+ * All operations are O(1).
+ *
+ * Unlike NSCache, eviction is deterministic (it never happens in the background),
+ * so the cache may be used to front another store, as long as the owner keeps the two in sync.
+ *
+ * Keys are copied, and objects are retained.
+ *
+ * This class is NOT thread-safe.
+ * It is designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+@interface XMPPLRUCache : NSObject
+
+- (id)initWithCountLimit:(NSUInteger)countLimit;
+
+/**
+ * The maximum number of entries.
+ * Lowering the limit evicts the least recently used entries right away.
+ *
+ * The default value is 100.
+**/
+@property (nonatomic, readwrite) NSUInteger countLimit;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+- (id)objectForKey:(id)key;
+
+/**
+ * Setting a nil object removes the entry.
+**/
+- (void)setObject:(id)object forKey:(id <NSCopying>)key;
+
+- (void)removeObjectForKey:(id)key;
+- (void)removeAllObjects;
+
+/**
+ * Statistics, useful for tuning the countLimit.
+ * A lookup is a hit if it returned an object.
+**/
+@property (nonatomic, readonly) uint64_t hitCount;
+@property (nonatomic, readonly) uint64_t missCount;
+@property (nonatomic, readonly) uint64_t evictionCount;
+
+@end
@@ -0,0 +1,208 @@
+#import "XMPPLRUCache.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+
+@interface XMPPLRUCacheEntry : NSObject
+{
+  @public
+	id key;
+	id object;
+	
+	// The list is ordered from most recently used (head) to least recently used (tail).
+	// The next pointers own the entries, the prev pointers are weak to avoid retain cycles.
+	XMPPLRUCacheEntry *next;
+	__unsafe_unretained XMPPLRUCacheEntry *prev;
+}
+@end
+
+@implementation XMPPLRUCacheEntry
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPLRUCache
+{
+	NSMutableDictionary *entries;
+	
+	XMPPLRUCacheEntry *head;
+	__unsafe_unretained XMPPLRUCacheEntry *tail;
+}
+
+@synthesize countLimit;
+@synthesize hitCount;
+@synthesize missCount;
+@synthesize evictionCount;
+
+- (id)init
+{
+	return [self initWithCountLimit:100];
+}
+
+- (id)initWithCountLimit:(NSUInteger)aCountLimit
+{
+	if ((self = [super init]))
+	{
+		countLimit = MAX(aCountLimit, (NSUInteger)1);
+		
+		entries = [[NSMutableDictionary alloc] init];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	// Break the chain iteratively.
+	// Otherwise releasing the head would release the entire list recursively.
+	
+	while (head)
+	{
+		XMPPLRUCacheEntry *entry = head;
+		head = entry->next;
+		entry->next = nil;
+	}
+}
+
+- (NSUInteger)count
+{
+	return [entries count];
+}
+
+- (void)unlinkEntry:(XMPPLRUCacheEntry *)entry
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		head = entry->next;
+	
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		tail = entry->prev;
+	
+	entry->next = nil;
+	entry->prev = nil;
+}
+
+- (void)insertEntryAtHead:(XMPPLRUCacheEntry *)entry
+{
+	entry->prev = nil;
+	entry->next = head;
+	
+	if (head)
+		head->prev = entry;
+	else
+		tail = entry;
+	
+	head = entry;
+}
+
+- (void)evictToCountLimit
+{
+	while ([entries count] > countLimit && tail)
+	{
+		XMPPLRUCacheEntry *entry = tail;
+		
+		[self unlinkEntry:entry];
+		[entries removeObjectForKey:entry->key];
+		
+		evictionCount++;
+	}
+}
+
+- (void)setCountLimit:(NSUInteger)newCountLimit
+{
+	countLimit = MAX(newCountLimit, (NSUInteger)1);
+	
+	[self evictToCountLimit];
+}
+
+- (id)objectForKey:(id)key
+{
+	if (key == nil) return nil;
+	
+	XMPPLRUCacheEntry *entry = [entries objectForKey:key];
+	if (entry == nil)
+	{
+		missCount++;
+		return nil;
+	}
+	
+	hitCount++;
+	
+	if (entry != head)
+	{
+		// Unlinking the entry releases it (via the next pointer of its predecessor),
+		// but the dictionary keeps it alive.
+		
+		[self unlinkEntry:entry];
+		[self insertEntryAtHead:entry];
+	}
+	
+	return entry->object;
+}
+
+- (void)setObject:(id)object forKey:(id <NSCopying>)key
+{
+	if (key == nil) return;
+	
+	if (object == nil)
+	{
+		[self removeObjectForKey:key];
+		return;
+	}
+	
+	XMPPLRUCacheEntry *entry = [entries objectForKey:key];
+	if (entry)
+	{
+		entry->object = object;
+		
+		if (entry != head)
+		{
+			[self unlinkEntry:entry];
+			[self insertEntryAtHead:entry];
+		}
+	}
+	else
+	{
+		entry = [[XMPPLRUCacheEntry alloc] init];
+		entry->key = [(id)key copy];
+		entry->object = object;
+		
+		[entries setObject:entry forKey:entry->key];
+		[self insertEntryAtHead:entry];
+		
+		[self evictToCountLimit];
+	}
+}
+
+- (void)removeObjectForKey:(id)key
+{
+	if (key == nil) return;
+	
+	XMPPLRUCacheEntry *entry = [entries objectForKey:key];
+	if (entry)
+	{
+		[self unlinkEntry:entry];
+		[entries removeObjectForKey:key];
+	}
+}
+
+- (void)removeAllObjects
+{
+	while (head)
+	{
+		XMPPLRUCacheEntry *entry = head;
+		head = entry->next;
+		entry->next = nil;
+	}
+	tail = nil;
+	
+	[entries removeAllObjects];
+}
+
+@end
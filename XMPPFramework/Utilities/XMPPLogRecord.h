@@ -0,0 +1,122 @@
+#import <Foundation/Foundation.h>
+
+@class XMPPLogRecord;
+
+typedef NSString *(^XMPPLogFormatBlock)(void);
+
+/**
+ * A log record, as produced by the deferred logging macros (e.g. XMPPLogDeferredVerbose, see XMPPLogging.h).
+ *
+ * A record captures the arguments of the log statement, but the message isn't formatted
+ * until somebody asks for it. So log statements are cheap, and if a record is never looked at
+ * (e.g. it's dropped from a ring buffer before the buffer is dumped), its message is never formatted at all.
+ *
+ * The message is formatted (at most) once, and may be requested from any thread.
+**/
+@interface XMPPLogRecord : NSObject
+
+- (id)initWithFlag:(int)flag
+           context:(int)context
+              file:(const char *)file
+          function:(const char *)function
+              line:(int)line
+         formatter:(XMPPLogFormatBlock)formatter;
+
+@property (nonatomic, readonly) int flag;
+@property (nonatomic, readonly) int context;
+
+/**
+ * The file and function are expected to be string literals (__FILE__, sel_getName(_cmd), __FUNCTION__),
+ * and aren't copied.
+**/
+@property (nonatomic, readonly) const char *file;
+@property (nonatomic, readonly) const char *function;
+@property (nonatomic, readonly) int line;
+
+@property (nonatomic, readonly) CFAbsoluteTime timestamp;
+
+/**
+ * Formats the message (upon first request).
+**/
+- (NSString *)message;
+
+/**
+ * Sinks receive every deferred log record.
+ * A sink may be invoked from any thread, and should do as little work as possible.
+ * In particular, it shouldn't ask for the message unless it really needs it.
+**/
++ (void)addSink:(id <NSObject>)sink;
++ (void)removeSink:(id <NSObject>)sink;
+
+/**
+ * By default, deferred log records are also handed to Lumberjack (like the regular XMPPLog statements),
+ * which means their messages are formatted right away.
+ *
+ * If only the sinks should receive the records (e.g. a ring buffer in production builds),
+ * disable this, and the messages are only formatted when the sinks ask for them.
+ *
+ * The default value is YES.
+**/
++ (BOOL)forwardsToLumberjack;
++ (void)setForwardsToLumberjack:(BOOL)flag;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@protocol XMPPLogSink <NSObject>
+
+- (void)logRecord:(XMPPLogRecord *)record;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A sink that keeps the most recent records in a fixed size buffer, suitable for tracing in production builds.
+ * Older records are dropped (without ever being formatted) as new records arrive.
+ *
+ * The buffer can be inspected at any time, e.g. to attach the recent log to a bug report.
+ *
+ * Keep in mind that the records retain the arguments of their log statements until they're dropped.
+ *
+ * This class is thread-safe.
+**/
+@interface XMPPRingBufferLogSink : NSObject <XMPPLogSink>
+
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/**
+ * The number of records the sink has received, including the ones that have since been dropped.
+**/
+@property (nonatomic, readonly) uint64_t totalCount;
+
+/**
+ * The records currently in the buffer, oldest first.
+**/
+- (NSArray *)records;
+
+/**
+ * The formatted messages of the records currently in the buffer, oldest first.
+**/
+- (NSArray *)messages;
+
+- (void)removeAllRecords;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Used by the deferred logging macros in XMPPLogging.h.
+**/
+void XMPPLogDeferred(BOOL async, int flag, int context,
+                     const char *file, const char *function, int line, XMPPLogFormatBlock formatter);
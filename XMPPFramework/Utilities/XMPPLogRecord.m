@@ -0,0 +1,273 @@
+#import "XMPPLogRecord.h"
+#import "XMPPLogging.h"
+#import <libkern/OSAtomic.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// The registered sinks.
+// The array is immutable, and replaced whenever a sink is added or removed.
+static NSArray *sinks;
+static OSSpinLock sinksLock = OS_SPINLOCK_INIT;
+
+static volatile BOOL forwardsToLumberjack = YES;
+
+
+@implementation XMPPLogRecord
+{
+	XMPPLogFormatBlock formatter;
+	NSString *message;
+	OSSpinLock messageLock;
+}
+
+@synthesize flag;
+@synthesize context;
+@synthesize file;
+@synthesize function;
+@synthesize line;
+@synthesize timestamp;
+
+- (id)initWithFlag:(int)aFlag
+           context:(int)aContext
+              file:(const char *)aFile
+          function:(const char *)aFunction
+              line:(int)aLine
+         formatter:(XMPPLogFormatBlock)aFormatter
+{
+	if ((self = [super init]))
+	{
+		flag = aFlag;
+		context = aContext;
+		file = aFile;
+		function = aFunction;
+		line = aLine;
+		
+		timestamp = CFAbsoluteTimeGetCurrent();
+		
+		formatter = [aFormatter copy];
+		messageLock = OS_SPINLOCK_INIT;
+	}
+	return self;
+}
+
+- (NSString *)message
+{
+	OSSpinLockLock(&messageLock);
+	XMPPLogFormatBlock block = formatter;
+	NSString *result = message;
+	OSSpinLockUnlock(&messageLock);
+	
+	if (result) return result;
+	
+	// Format outside the lock (the description methods of the arguments may take a while).
+	// If two threads race, they produce the same message, and the first one wins.
+	
+	result = block ? block() : @"";
+	
+	OSSpinLockLock(&messageLock);
+	if (message == nil)
+	{
+		message = result;
+		
+		// The arguments are no longer needed
+		formatter = nil;
+	}
+	result = message;
+	OSSpinLockUnlock(&messageLock);
+	
+	return result;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPLogRecord[%p]: %s:%d %@>", self, function, line, [self message]];
+}
+
++ (void)addSink:(id <NSObject>)sink
+{
+	if (sink == nil) return;
+	
+	OSSpinLockLock(&sinksLock);
+	sinks = sinks ? [sinks arrayByAddingObject:sink] : [NSArray arrayWithObject:sink];
+	OSSpinLockUnlock(&sinksLock);
+}
+
++ (void)removeSink:(id <NSObject>)sink
+{
+	if (sink == nil) return;
+	
+	OSSpinLockLock(&sinksLock);
+	
+	NSMutableArray *newSinks = [sinks mutableCopy];
+	[newSinks removeObjectIdenticalTo:sink];
+	
+	sinks = [newSinks count] > 0 ? [newSinks copy] : nil;
+	
+	OSSpinLockUnlock(&sinksLock);
+}
+
++ (BOOL)forwardsToLumberjack
+{
+	return forwardsToLumberjack;
+}
+
++ (void)setForwardsToLumberjack:(BOOL)flag
+{
+	forwardsToLumberjack = flag;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPRingBufferLogSink
+{
+	NSMutableArray *buffer;
+	NSUInteger head; // Index of the oldest record, once the buffer is full
+	OSSpinLock lock;
+}
+
+@synthesize capacity;
+@synthesize totalCount;
+
+- (id)init
+{
+	return [self initWithCapacity:1000];
+}
+
+- (id)initWithCapacity:(NSUInteger)aCapacity
+{
+	if ((self = [super init]))
+	{
+		capacity = MAX(aCapacity, (NSUInteger)1);
+		
+		buffer = [[NSMutableArray alloc] initWithCapacity:capacity];
+		lock = OS_SPINLOCK_INIT;
+	}
+	return self;
+}
+
+- (void)logRecord:(XMPPLogRecord *)record
+{
+	XMPPLogRecord *droppedRecord = nil;
+	
+	OSSpinLockLock(&lock);
+	
+	if ([buffer count] < capacity)
+	{
+		[buffer addObject:record];
+	}
+	else
+	{
+		droppedRecord = [buffer objectAtIndex:head];
+		[buffer replaceObjectAtIndex:head withObject:record];
+		
+		head = (head + 1) % capacity;
+	}
+	
+	totalCount++;
+	
+	OSSpinLockUnlock(&lock);
+	
+	// The dropped record (and the arguments it retains) is released outside the lock
+	droppedRecord = nil;
+}
+
+- (NSArray *)records
+{
+	OSSpinLockLock(&lock);
+	
+	NSUInteger count = [buffer count];
+	
+	NSMutableArray *result = [NSMutableArray arrayWithCapacity:count];
+	[result addObjectsFromArray:[buffer subarrayWithRange:NSMakeRange(head, count - head)]];
+	[result addObjectsFromArray:[buffer subarrayWithRange:NSMakeRange(0, head)]];
+	
+	OSSpinLockUnlock(&lock);
+	
+	return result;
+}
+
+- (NSArray *)messages
+{
+	// Format outside the lock
+	
+	NSArray *records = [self records];
+	NSMutableArray *result = [NSMutableArray arrayWithCapacity:[records count]];
+	
+	for (XMPPLogRecord *record in records)
+	{
+		[result addObject:[record message]];
+	}
+	
+	return result;
+}
+
+- (void)removeAllRecords
+{
+	NSMutableArray *oldBuffer;
+	
+	OSSpinLockLock(&lock);
+	
+	oldBuffer = buffer;
+	buffer = [[NSMutableArray alloc] initWithCapacity:capacity];
+	head = 0;
+	
+	OSSpinLockUnlock(&lock);
+	
+	oldBuffer = nil;
+}
+
+- (uint64_t)totalCount
+{
+	OSSpinLockLock(&lock);
+	uint64_t result = totalCount;
+	OSSpinLockUnlock(&lock);
+	
+	return result;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XMPPLogDeferred(BOOL async, int flag, int context,
+                     const char *file, const char *function, int line, XMPPLogFormatBlock formatter)
+{
+	OSSpinLockLock(&sinksLock);
+	NSArray *currentSinks = sinks;
+	OSSpinLockUnlock(&sinksLock);
+	
+	BOOL forward = forwardsToLumberjack;
+	
+	if (currentSinks == nil && !forward)
+	{
+		// Nobody is interested, so the record isn't even created
+		return;
+	}
+	
+	XMPPLogRecord *record = [[XMPPLogRecord alloc] initWithFlag:flag
+	                                                    context:context
+	                                                       file:file
+	                                                   function:function
+	                                                       line:line
+	                                                  formatter:formatter];
+	
+	for (id <XMPPLogSink> sink in currentSinks)
+	{
+		[sink logRecord:record];
+	}
+	
+	if (forward)
+	{
+		// Lumberjack wants a formatted message.
+		// Note that the file & line reported to Lumberjack are those of this function.
+		
+		LOG_MAYBE(async, flag, flag, context, function, @"%@", [record message]);
+	}
+}
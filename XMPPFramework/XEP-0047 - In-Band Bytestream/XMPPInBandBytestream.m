@@ -75,7 +75,9 @@ static inline NSUInteger XMPPIBBValidatedBlockSize(NSUInteger size) {
 		if (!open) return nil;
 		// Validate the block size to ensure that the size is acceptable given
 		// the minimum and maximum limits
-		_blockSize = XMPPIBBValidatedBlockSize([open attributeUnsignedIntegerValueForName:@"block-size"]);
+		NSUInteger blockSize = 0;
+		[open getAttributeUnsignedIntegerValue:&blockSize forName:@"block-size"];
+		_blockSize = XMPPIBBValidatedBlockSize(blockSize);
 		// Unique identifier used in close, open, and data elements
 		_sid = [open attributeStringValueForName:@"sid"];
 		_outgoing = NO;
@@ -0,0 +1,51 @@
+#import <Foundation/Foundation.h>
+
+#import "XMPPvCardTempModule.h"
+#import "XMPPSQLiteStorage.h"
+
+/**
+ * This class is an implementation of XMPPvCardTempModuleStorage using SQLite directly (without Core Data).
+ *
+ * The vCards are kept in the database file between sessions (and between launches).
+ * The storage may be shared by multiple xmpp streams, but the vCards are kept separate between streams.
+**/
+
+@interface XMPPvCardSQLiteStorage : XMPPSQLiteStorage <XMPPvCardTempModuleStorage>
+{
+	/* Inherited protected variables from XMPPSQLiteStorage
+	
+	NSString *databaseFileName;
+	NSUInteger saveThreshold;
+	
+	dispatch_queue_t storageQueue;
+	
+	*/
+}
+
+/**
+ * Convenience method to get an instance with the default database name.
+ *
+ * IMPORTANT:
+ * You are NOT required to use the sharedInstance.
+ *
+ * If your application uses multiple xmppStreams, and you use a sharedInstance of this class,
+ * this doesn't mean that all of those xmppStreams will share the same vCards.
+ * The vCards are kept separate between streams.
+**/
++ (XMPPvCardSQLiteStorage *)sharedInstance;
+
+
+/* Inherited from XMPPSQLiteStorage
+ * Please see the XMPPSQLiteStorage header file for extensive documentation.
+
+- (id)initWithDatabaseFilename:(NSString *)databaseFileName;
+- (id)initWithInMemoryStore;
+
+@property (readonly) NSString *databaseFileName;
+
+@property (readwrite) NSUInteger saveThreshold;
+@property (readwrite) NSTimeInterval maxCommitLatency;
+
+*/
+
+@end
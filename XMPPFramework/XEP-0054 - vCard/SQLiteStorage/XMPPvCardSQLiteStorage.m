@@ -0,0 +1,196 @@
+#import "XMPPvCardSQLiteStorage.h"
+#import "XMPPSQLiteStorageProtected.h"
+#import "XMPPvCardTemp.h"
+#import "XMPP.h"
+#import "XMPPLogging.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+
+@implementation XMPPvCardSQLiteStorage
+
+static XMPPvCardSQLiteStorage *sharedInstance;
+
++ (XMPPvCardSQLiteStorage *)sharedInstance
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		sharedInstance = [[XMPPvCardSQLiteStorage alloc] initWithDatabaseFilename:nil];
+	});
+	
+	return sharedInstance;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Setup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)configureWithParent:(XMPPvCardTempModule *)aParent queue:(dispatch_queue_t)queue
+{
+	return [super configureWithParent:aParent queue:queue];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Overrides
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)createSchema
+{
+	// A row without a vCard is a vCard that's being fetched (or couldn't be fetched).
+	
+	return [self executeSQL:@"CREATE TABLE IF NOT EXISTS vcards ("
+	                        @"id INTEGER PRIMARY KEY, "
+	                        @"streamBareJidStr TEXT NOT NULL, "
+	                        @"jidStr TEXT NOT NULL, "
+	                        @"vCardTempStr TEXT, "
+	                        @"waitingForFetch INTEGER NOT NULL DEFAULT 0)"]
+	    && [self executeSQL:@"CREATE UNIQUE INDEX IF NOT EXISTS vcards_jid ON vcards (streamBareJidStr, jidStr)"];
+}
+
+- (void)didOpenDatabase
+{
+	// This method is overriden from the XMPPSQLiteStorage superclass.
+	//
+	// Any fetches from a previous launch are no longer in progress.
+	
+	[self executeUpdateStatement:[self statementForSQL:@"UPDATE vcards SET waitingForFetch = 0 WHERE waitingForFetch != 0"]];
+	
+	// Databases created by earlier versions may contain rows stored without a stream JID (NULL),
+	// which can never be found again. (See streamBareJidStrForXMPPStream:)
+	
+	[self executeUpdateStatement:[self statementForSQL:@"DELETE FROM vcards WHERE streamBareJidStr IS NULL"]];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Protocol Private API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (XMPPvCardTemp *)vCardTempForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	if (jid == nil) return nil;
+	
+	__block NSString *vCardTempStr = nil;
+	
+	[self executeBlock:^{
+		
+		sqlite3_stmt *statement =
+		    [self statementForSQL:@"SELECT vCardTempStr FROM vcards WHERE streamBareJidStr = ? AND jidStr = ?"];
+		
+		if (statement == NULL) return;
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		
+		if (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			vCardTempStr = XMPPSQLiteColumnString(statement, 0);
+		}
+		
+		sqlite3_reset(statement);
+	}];
+	
+	if (vCardTempStr == nil) return nil;
+	
+	// The vCard is parsed outside the storageQueue
+	
+	NSXMLElement *element = [[NSXMLElement alloc] initWithXMLString:vCardTempStr error:nil];
+	if (element == nil) return nil;
+	
+	return [XMPPvCardTemp vCardTempFromElement:element];
+}
+
+- (void)setvCardTemp:(XMPPvCardTemp *)vCardTemp forJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	if (jid == nil) return;
+	
+	NSString *vCardTempStr = [vCardTemp compactXMLString];
+	
+	[self scheduleBlock:^{
+		
+		sqlite3_stmt *statement =
+		    [self statementForSQL:@"INSERT OR REPLACE INTO vcards "
+		                          @"(streamBareJidStr, jidStr, vCardTempStr, waitingForFetch) VALUES (?, ?, ?, 0)"];
+		
+		XMPPSQLiteBindString(statement, 1, [self streamBareJidStrForXMPPStream:stream]);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		XMPPSQLiteBindString(statement, 3, vCardTempStr);
+		
+		[self executeUpdateStatement:statement];
+	}];
+}
+
+- (XMPPvCardTemp *)myvCardTempForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	return [self vCardTempForJID:[[self myJIDForXMPPStream:stream] bareJID] xmppStream:stream];
+}
+
+- (BOOL)shouldFetchvCardTempForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	if (jid == nil) return NO;
+	
+	__block BOOL result = NO;
+	
+	[self executeBlock:^{
+		
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		
+		sqlite3_stmt *statement =
+		    [self statementForSQL:@"SELECT waitingForFetch FROM vcards WHERE streamBareJidStr = ? AND jidStr = ?"];
+		
+		if (statement == NULL) return;
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		
+		BOOL exists = NO;
+		BOOL waitingForFetch = NO;
+		
+		if (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			exists = YES;
+			waitingForFetch = (sqlite3_column_int(statement, 0) != 0);
+		}
+		
+		sqlite3_reset(statement);
+		
+		if (waitingForFetch) return;
+		
+		if (exists)
+		{
+			statement = [self statementForSQL:@"UPDATE vcards SET waitingForFetch = 1 "
+			                                  @"WHERE streamBareJidStr = ? AND jidStr = ?"];
+		}
+		else
+		{
+			statement = [self statementForSQL:@"INSERT INTO vcards (streamBareJidStr, jidStr, waitingForFetch) "
+			                                  @"VALUES (?, ?, 1)"];
+		}
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		XMPPSQLiteBindString(statement, 2, [jid bare]);
+		
+		result = [self executeUpdateStatement:statement];
+	}];
+	
+	return result;
+}
+
+@end
@@ -7,6 +7,12 @@ extern NSString* const XMLNSJabberChatStates;
 
 - (BOOL)hasChatState;
 
+/**
+ * Returns the chat state of the message (XMPPAtomActive, XMPPAtomComposing, XMPPAtomPaused, XMPPAtomInactive
+ * or XMPPAtomGone), or XMPPAtomNone if the message doesn't contain a chat state.
+**/
+- (XMPPAtom)chatState;
+
 - (BOOL)isActiveChatState;
 - (BOOL)isComposingChatState;
 - (BOOL)isPausedChatState;
@@ -3,107 +3,95 @@
 
 NSString * const XMLNSJabberChatStates = @"http://jabber.org/protocol/chatstates";
 
-static NSString * const XMPPChatStateActive = @"active";
-static NSString * const XMPPChatStateComposing = @"composing";
-static NSString * const XMPPChatStatePaused = @"paused";
-static NSString * const XMPPChatStateInactive = @"inactive";
-static NSString * const XMPPChatStateGone = @"gone";
-
-static NSArray *_prefixes = nil;
-static NSArray *_permittedElementList = nil;
+static inline BOOL XMPPAtomIsChatState(XMPPAtom atom)
+{
+	return (atom >= XMPPAtomActive) && (atom <= XMPPAtomGone);
+}
 
 @implementation XMPPMessage (XEP_0085)
 
-+ (void)load
+- (BOOL)hasChatState
 {
-	_prefixes = @[@"", @"cha:"];
-	NSArray *elements = @[XMPPChatStateActive, XMPPChatStateComposing, XMPPChatStatePaused, XMPPChatStateInactive, XMPPChatStateGone];
-	
-	NSMutableArray *permitted = [NSMutableArray arrayWithCapacity:elements.count * _prefixes.count];
-	for (NSString *element in elements) {
-		for (NSString *prefix in _prefixes) {
-			[permitted addObject:[prefix stringByAppendingString:element]];
+	for (NSXMLNode *node in self.children) {
+		if ([node isKindOfClass:[NSXMLElement class]]) {
+			NSXMLElement *element = (NSXMLElement *)node;
+			if (XMPPAtomIsChatState(XMPPAtomForString(element.localName))) {
+				return YES;
+			}
 		}
 	}
-	_permittedElementList = permitted;
+	return NO;
 }
 
-- (BOOL)hasChatState
+- (XMPPAtom)chatState
 {
+	// A single pass over the children, comparing atoms rather than strings.
+	// The namespace is only checked for elements that are named like a chat state.
+	
 	for (NSXMLNode *node in self.children) {
 		if ([node isKindOfClass:[NSXMLElement class]]) {
 			NSXMLElement *element = (NSXMLElement *)node;
-			if ([_permittedElementList containsObject:element.name]) {
-				return YES;
+			XMPPAtom atom = XMPPAtomForString(element.localName);
+			if (XMPPAtomIsChatState(atom) && XMPPAtomForString(element.URI) == XMPPAtomChatStatesNamespace) {
+				return atom;
 			}
 		}
 	}
-	return NO;
+	return XMPPAtomNone;
 }
 
 - (BOOL)isActiveChatState
 {
-	return [self hasChatStateElementsForName:XMPPChatStateActive];
+	return [self chatState] == XMPPAtomActive;
 }
 
 - (BOOL)isComposingChatState
 {
-	return [self hasChatStateElementsForName:XMPPChatStateComposing];
+	return [self chatState] == XMPPAtomComposing;
 }
 
 - (BOOL)isPausedChatState
 {
-	return [self hasChatStateElementsForName:XMPPChatStatePaused];
+	return [self chatState] == XMPPAtomPaused;
 }
 
 - (BOOL)isInactiveChatState
 {
-	return [self hasChatStateElementsForName:XMPPChatStateInactive];
+	return [self chatState] == XMPPAtomInactive;
 }
 
 - (BOOL)isGoneChatState
 {
-	return [self hasChatStateElementsForName:XMPPChatStateGone];
+	return [self chatState] == XMPPAtomGone;
 }
 
 - (void)addActiveChatState
 {
-	[self addChatStateElementsForName:XMPPChatStateActive];
+	[self addChatStateElementsForName:XMPPAtomString(XMPPAtomActive)];
 }
 
 - (void)addComposingChatState
 {
-	[self addChatStateElementsForName:XMPPChatStateComposing];
+	[self addChatStateElementsForName:XMPPAtomString(XMPPAtomComposing)];
 }
 
 - (void)addPausedChatState
 {
-	[self addChatStateElementsForName:XMPPChatStatePaused];
+	[self addChatStateElementsForName:XMPPAtomString(XMPPAtomPaused)];
 }
 
 - (void)addInactiveChatState
 {
-	[self addChatStateElementsForName:XMPPChatStateInactive];
+	[self addChatStateElementsForName:XMPPAtomString(XMPPAtomInactive)];
 }
 
 - (void)addGoneChatState
 {
-	[self addChatStateElementsForName:XMPPChatStateGone];
+	[self addChatStateElementsForName:XMPPAtomString(XMPPAtomGone)];
 }
 
 #pragma mark - Private
 
-- (BOOL)hasChatStateElementsForName:(NSString *)name
-{
-	for (NSString *prefix in _prefixes) {
-		NSString *elementName = [prefix stringByAppendingString:name];
-		if ([self elementForName:elementName xmlns:XMLNSJabberChatStates]) {
-			return YES;
-		}
-	}
-	return NO;
-}
-
 - (void)addChatStateElementsForName:(NSString *)name
 {
 	NSXMLElement *child = [NSXMLElement elementWithName:name xmlns:XMLNSJabberChatStates];
@@ -10,22 +10,39 @@
 
 NSString* const XMLNSJabberIQVersion = @"jabber:iq:version";
 
+@interface XMPPSoftwareVersion () <XMPPIQHandler>
+@end
+
 @implementation XMPPSoftwareVersion {
 	NSString *_applicationName;
 	NSString *_applicationVersion;
 }
 
-#pragma mark - XMPPStream
+#pragma mark - XMPPModule
+
+- (BOOL)activate:(XMPPStream *)aXmppStream
+{
+	if ([super activate:aXmppStream]) {
+		[xmppStream addIQHandler:self handlerQueue:moduleQueue forElementName:@"query" xmlns:XMLNSJabberIQVersion];
+		return YES;
+	}
+	return NO;
+}
+
+- (void)deactivate
+{
+	[xmppStream removeIQHandler:self];
+	[super deactivate];
+}
+
+#pragma mark - XMPPIQHandler
 
 /*
- * Check for incoming requests for jabber:iq:version and respond to them
+ * Respond to incoming requests for jabber:iq:version
  */
-- (BOOL)xmppStream:(XMPPStream *)sender didReceiveIQ:(XMPPIQ *)iq
+- (BOOL)xmppStream:(XMPPStream *)sender handleIQRequest:(XMPPIQ *)iq
 {
-	NSXMLElement *query = [iq elementForName:@"query" xmlns:XMLNSJabberIQVersion];
-	if (!query) return NO;
-	NSString *type = [[query attributeStringValueForName:@"type"] lowercaseString];
-	if ([type isEqualToString:@"get"]) {
+	if ([iq isGetIQ]) {
 		[self handleSoftwareVersionRequest:iq];
 		return YES;
 	}
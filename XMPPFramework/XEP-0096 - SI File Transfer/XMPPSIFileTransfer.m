@@ -11,7 +11,7 @@
 #import "NSData+XMPP.h"
 #import "TURNSocket.h"
 #import "XMPPInBandBytestream.h"
-#import "FileMD5Hash.h"
+#import "XMPPDigest.h"
 
 NSString* const XMLNSJabberSI = @"http://jabber.org/protocol/si";
 NSString* const XMLNSJabberSIFileTransfer = @"http://jabber.org/protocol/si/profile/file-transfer";
@@ -110,7 +110,11 @@ static NSArray *_supportedTransferMechanisms = nil;
 		NSString *fileName = URL.lastPathComponent ?: @"untitled";
 		[file addAttributeWithName:@"name" stringValue:fileName];
 		
-		NSString *hash = (__bridge_transfer NSString *)FileMD5HashCreateWithPath((__bridge CFStringRef)URL.path, FileHashDefaultChunkSizeForReadingData);
+		XMPPDigest *digest = [XMPPDigest digestWithAlgorithm:XMPPDigestAlgorithmMD5 ofContentsOfURL:URL error:error];
+		if (!digest) {
+			return;
+		}
+		NSString *hash = [digest hexDigest];
 		[file addAttributeWithName:@"hash" stringValue:hash];
 		
 		NSNumber *fileSize = nil;
@@ -583,6 +587,7 @@ static NSArray *_supportedTransferMechanisms = nil;
 	dispatch_queue_t _transferCallbackQueue;
 	NSFileHandle *_fileHandle;
 	double _remainingBytesForCurrentWrite;
+	XMPPDigest *_receivedDataDigest;
 }
 
 #pragma mark - Initializers
@@ -618,6 +623,11 @@ static NSArray *_supportedTransferMechanisms = nil;
 		
 		[NSFileManager.defaultManager createFileAtPath:self.URL.path contents:nil attributes:nil];
 		_fileHandle = [NSFileHandle fileHandleForWritingToURL:self.URL error:&error];
+		
+		// Hash the received data as it arrives, rather than reading the file back in once it's complete
+		if ([self.MD5Hash length]) {
+			_receivedDataDigest = [XMPPDigest digestWithAlgorithm:XMPPDigestAlgorithmMD5];
+		}
 	}
 	if (!_fileHandle) {
 		[self delegateTransferFailedWithError:error];
@@ -692,10 +702,10 @@ static NSArray *_supportedTransferMechanisms = nil;
 {
     [self incrementTransferredBytesBy:[data length]];
 	[_fileHandle writeData:data];
+	[_receivedDataDigest updateWithData:data];
     if (self.transferredBytes == self.totalBytes) {
-		if ([self.MD5Hash length]) {
-			NSString *MD5 = [(__bridge_transfer NSString *)FileMD5HashCreateWithPath((__bridge CFStringRef)self.URL.path, FileHashDefaultChunkSizeForReadingData) lowercaseString];
-			if (![self.MD5Hash.lowercaseString isEqualToString:MD5]) {
+		if (_receivedDataDigest) {
+			if (![self receivedDataMatchesHash]) {
 				_transferError = [self.class hashMismatchError];
 			} else {
 				_transferComplete = YES;
@@ -726,6 +736,7 @@ static NSArray *_supportedTransferMechanisms = nil;
 {
 	[self incrementTransferredBytesBy:data.length];
 	[_fileHandle writeData:data];
+	[_receivedDataDigest updateWithData:data];
 }
 
 - (void)xmppIBBTransfer:(XMPPInBandBytestream *)stream failedWithError:(NSError *)error
@@ -736,6 +747,10 @@ static NSArray *_supportedTransferMechanisms = nil;
 - (void)xmppIBBTransferDidEnd:(XMPPInBandBytestream *)stream
 {
 	[_fileHandle closeFile];
+	if (_receivedDataDigest && ![self receivedDataMatchesHash]) {
+		[self delegateTransferFailedWithError:[self.class hashMismatchError]];
+		return;
+	}
 	[self.delegate xmppTransferDidEnd:self];
 }
 
@@ -782,6 +797,11 @@ static NSArray *_supportedTransferMechanisms = nil;
 	return NO;
 }
 
+- (BOOL)receivedDataMatchesHash
+{
+	return [[_receivedDataDigest hexDigest] isEqualToString:self.MD5Hash.lowercaseString];
+}
+
 - (void)readBytesFromSocket
 {
 	[_asyncSocket readDataWithTimeout:XMPPSIFileTransferReadTimeout tag:0];
@@ -4,6 +4,8 @@
 #import "XMPPCapabilities.h"
 #import "XMPPCoreDataStorage.h"
 
+@class XMPPLRUCache;
+
 /**
  * This class is an example implementation of XMPPCapabilitiesStorage using core data.
  * You are free to substitute your own storage class.
@@ -19,6 +21,13 @@
 	dispatch_queue_t storageQueue;
 	 
 	*/
+	
+  @private
+	
+	XMPPLRUCache *capsCache;
+	XMPPLRUCache *resourceCache;
+	
+	NSMutableSet *resourceIDsPendingDeletion;
 }
 
 /**
@@ -33,6 +42,19 @@
 **/
 + (XMPPCapabilitiesCoreDataStorage *)sharedInstance;
 
+/**
+ * Every presence with capabilities requires a lookup of the resource (by full jid),
+ * and often a lookup of the capabilities (by hash & algorithm).
+ * In practice a small number of distinct hashes covers a large number of resources,
+ * so the most recently used objects are kept in memory in front of core data.
+ * 
+ * These are the maximum number of entries in each of the caches.
+ * 
+ * The default capsCacheLimit is 100, and the default resourceCacheLimit is 1000.
+**/
+@property (readwrite) NSUInteger capsCacheLimit;
+@property (readwrite) NSUInteger resourceCacheLimit;
+
 
 /* Inherited from XMPPCoreDataStorage
  * Please see the XMPPCoreDataStorage header file for extensive documentation.
@@ -4,6 +4,7 @@
 #import "XMPP.h"
 #import "XMPPCoreDataStorageProtected.h"
 #import "XMPPLogging.h"
+#import "XMPPLRUCache.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -37,7 +38,73 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 	[super commonInit];
 
 	autoRecreateDatabaseFile = YES;
+	
+	capsCache = [[XMPPLRUCache alloc] initWithCountLimit:100];
+	resourceCache = [[XMPPLRUCache alloc] initWithCountLimit:1000];
+	
+	resourceIDsPendingDeletion = [[NSMutableSet alloc] init];
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Configuration
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)capsCacheLimit
+{
+	__block NSUInteger result;
+	
+	dispatch_block_t block = ^{
+		result = capsCache.countLimit;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+	
+	return result;
+}
+
+- (void)setCapsCacheLimit:(NSUInteger)newCapsCacheLimit
+{
+	dispatch_block_t block = ^{
+		capsCache.countLimit = newCapsCacheLimit;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
+- (NSUInteger)resourceCacheLimit
+{
+	__block NSUInteger result;
+	
+	dispatch_block_t block = ^{
+		result = resourceCache.countLimit;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_sync(storageQueue, block);
+	
+	return result;
+}
+
+- (void)setResourceCacheLimit:(NSUInteger)newResourceCacheLimit
+{
+	dispatch_block_t block = ^{
+		resourceCache.countLimit = newResourceCacheLimit;
+	};
+	
+	if (dispatch_get_specific(storageQueueTag))
+		block();
+	else
+		dispatch_async(storageQueue, block);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Setup
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -51,6 +118,53 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 #pragma mark Utilities
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * The caches hold managed objects of our managedObjectContext, and are only accessed from within the storageQueue.
+ * 
+ * The caps cache also remembers unknown hashes (as NSNull), since a hash is usually broadcast by several
+ * resources before we've fetched the corresponding capabilities.
+ * This is safe because capabilities with a hash are only ever created in setCapabilities:forHash:algorithm:,
+ * which writes through to the cache.
+ * 
+ * Deleted objects are removed from the caches explicitly.
+ * As a safety net, cached objects are also checked upon every hit.
+**/
+
+static NSString *CapsCacheKey(NSString *hash, NSString *hashAlg)
+{
+	return [NSString stringWithFormat:@"%@ %@", hashAlg, hash];
+}
+
+static NSString *ResourceCacheKey(NSString *streamBareJidStr, NSString *jidStr)
+{
+	if (streamBareJidStr == nil || jidStr == nil) return nil;
+	
+	return [NSString stringWithFormat:@"%@ %@", streamBareJidStr, jidStr];
+}
+
+static BOOL IsLiveObject(NSManagedObject *object)
+{
+	return ([object managedObjectContext] != nil) && ![object isDeleted];
+}
+
+- (void)cacheResource:(XMPPCapsResourceCoreDataStorageObject *)resource
+{
+	NSString *key = ResourceCacheKey(resource.streamBareJidStr, resource.jidStr);
+	if (key)
+	{
+		[resourceCache setObject:resource forKey:key];
+	}
+}
+
+- (void)uncacheResource:(XMPPCapsResourceCoreDataStorageObject *)resource
+{
+	NSString *key = ResourceCacheKey(resource.streamBareJidStr, resource.jidStr);
+	if (key)
+	{
+		[resourceCache removeObjectForKey:key];
+	}
+}
+
 - (XMPPCapsResourceCoreDataStorageObject *)resourceForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
 {
 	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
@@ -59,6 +173,29 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 	
 	if (jid == nil) return nil;
 	
+	NSString *streamBareJidStr = nil;
+	NSString *cacheKey = nil;
+	
+	if (stream)
+	{
+		// Without a stream, the lookup may match a resource of any stream, so it isn't cached.
+		
+		streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
+		cacheKey = ResourceCacheKey(streamBareJidStr, [jid full]);
+		
+		XMPPCapsResourceCoreDataStorageObject *resource = [resourceCache objectForKey:cacheKey];
+		if (resource)
+		{
+			if (IsLiveObject(resource) && ![resourceIDsPendingDeletion containsObject:[resource objectID]])
+			{
+				XMPPLogVerbose(@"%@: %@ - %@ (cached)", THIS_FILE, THIS_METHOD, resource);
+				return resource;
+			}
+			
+			[resourceCache removeObjectForKey:cacheKey];
+		}
+	}
+	
 	NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPCapsResourceCoreDataStorageObject"
 	                                          inManagedObjectContext:[self managedObjectContext]];
 	
@@ -67,16 +204,44 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 		predicate = [NSPredicate predicateWithFormat:@"jidStr == %@", [jid full]];
 	else
 		predicate = [NSPredicate predicateWithFormat:@"jidStr == %@ AND streamBareJidStr == %@",
-					                                     [jid full], [[self myJIDForXMPPStream:stream] bare]];
+					                                     [jid full], streamBareJidStr];
 	
 	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
 	[fetchRequest setEntity:entity];
 	[fetchRequest setPredicate:predicate];
-	[fetchRequest setFetchLimit:1];
 	
-	NSArray *results = [[self managedObjectContext] executeFetchRequest:fetchRequest error:nil];
+	NSArray *results;
+	XMPPCapsResourceCoreDataStorageObject *resource = nil;
+	
+	if ([resourceIDsPendingDeletion count] == 0)
+	{
+		[fetchRequest setFetchLimit:1];
+		
+		results = [[self managedObjectContext] executeFetchRequest:fetchRequest error:nil];
+		resource = [results lastObject];
+	}
+	else
+	{
+		// A bulk delete is in progress (see _clearAllNonPersistentCapabilitiesForXMPPStream:).
+		// The resources it hasn't gotten to yet are already considered gone.
+		// A new resource may have been created for the same jid in the meantime.
+		
+		results = [[self managedObjectContext] executeFetchRequest:fetchRequest error:nil];
+		
+		for (XMPPCapsResourceCoreDataStorageObject *result in results)
+		{
+			if (![resourceIDsPendingDeletion containsObject:[result objectID]])
+			{
+				resource = result;
+				break;
+			}
+		}
+	}
 	
-	XMPPCapsResourceCoreDataStorageObject *resource = [results lastObject];
+	if (resource && cacheKey)
+	{
+		[resourceCache setObject:resource forKey:cacheKey];
+	}
 	
 	XMPPLogVerbose(@"%@: %@ - %@", THIS_FILE, THIS_METHOD, resource);
 	return resource;
@@ -91,6 +256,26 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 	if (hash == nil) return nil;
 	if (hashAlg == nil) return nil;
 	
+	NSString *cacheKey = CapsCacheKey(hash, hashAlg);
+	
+	id cachedCaps = [capsCache objectForKey:cacheKey];
+	if (cachedCaps)
+	{
+		if (cachedCaps == [NSNull null])
+		{
+			XMPPLogVerbose(@"%@: %@ - nil (cached)", THIS_FILE, THIS_METHOD);
+			return nil;
+		}
+		
+		if (IsLiveObject(cachedCaps))
+		{
+			XMPPLogVerbose(@"%@: %@ - %@ (cached)", THIS_FILE, THIS_METHOD, cachedCaps);
+			return cachedCaps;
+		}
+		
+		[capsCache removeObjectForKey:cacheKey];
+	}
+	
 	NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPCapsCoreDataStorageObject"
 	                                          inManagedObjectContext:[self managedObjectContext]];
 	
@@ -106,6 +291,8 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 	
 	XMPPCapsCoreDataStorageObject *caps = [results lastObject];
 	
+	[capsCache setObject:(caps ? (id)caps : (id)[NSNull null]) forKey:cacheKey];
+	
 	XMPPLogVerbose(@"%@: %@ - %@", THIS_FILE, THIS_METHOD, caps);
 	return caps;
 }
@@ -114,48 +301,64 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 {
 	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
 	
-	NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPCapsResourceCoreDataStorageObject"
-	                                          inManagedObjectContext:[self managedObjectContext]];
+	// With a large number of resources (e.g. a big roster), fetching all of them into the managedObjectContext
+	// to delete them one by one would take a lot of memory, and stall the storageQueue for a long time.
+	// So we only fetch the objectIDs here, and delete the objects in chunks.
+	// 
+	// Non-persistent capabilities are the ones without a hash (see setCapabilities:forJID:xmppStream:).
+	// They're deleted before the resources, as the predicate for a specific stream goes through the resources.
 	
-	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
-	[fetchRequest setEntity:entity];
-	[fetchRequest setFetchBatchSize:saveThreshold];
+	// Save any pending changes first, so all the objectIDs we fetch are permanent.
 	
-	if (stream)
+	if ([[self managedObjectContext] hasChanges])
 	{
-		NSPredicate *predicate = [NSPredicate predicateWithFormat:@"streamBareJidStr == %@",
-								  [[self myJIDForXMPPStream:stream] bare]];
-		
-		[fetchRequest setPredicate:predicate];
+		[self save];
 	}
 	
-	NSArray *results = [[self managedObjectContext] executeFetchRequest:fetchRequest error:nil];
-	
-	NSUInteger unsavedCount = [self numberOfUnsavedChanges];
+	NSPredicate *capsPredicate;
+	NSPredicate *resourcePredicate;
 	
-	for (XMPPCapsResourceCoreDataStorageObject *resource in results)
+	if (stream)
 	{
-		NSString *hash = resource.hashStr;
-		NSString *hashAlg = resource.hashAlgorithm;
-		
-		BOOL nonPersistentCapabilities = ((hash == nil) || (hashAlg == nil));
+		NSString *streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
 		
-		if (nonPersistentCapabilities)
-		{
-			XMPPCapsCoreDataStorageObject *caps = resource.caps;
-			if (caps)
-			{
-				[[self managedObjectContext] deleteObject:caps];
-			}
-		}
+		capsPredicate = [NSPredicate predicateWithFormat:
+		    @"(hashStr == nil OR hashAlgorithm == nil) AND ANY resources.streamBareJidStr == %@", streamBareJidStr];
 		
-		[[self managedObjectContext] deleteObject:resource];
-		
-		if (++unsavedCount >= saveThreshold)
-		{
-			[self save];
-		}
+		resourcePredicate = [NSPredicate predicateWithFormat:@"streamBareJidStr == %@", streamBareJidStr];
+	}
+	else
+	{
+		capsPredicate = [NSPredicate predicateWithFormat:@"hashStr == nil OR hashAlgorithm == nil"];
+		resourcePredicate = nil;
 	}
+	
+	NSArray *capsIDs = [self objectIDsForEntityName:@"XMPPCapsCoreDataStorageObject"
+	                                      predicate:capsPredicate];
+	
+	NSArray *resourceIDs = [self objectIDsForEntityName:@"XMPPCapsResourceCoreDataStorageObject"
+	                                          predicate:resourcePredicate];
+	
+	if ([capsIDs count] == 0 && [resourceIDs count] == 0) return;
+	
+	XMPPLogVerbose(@"%@: Clearing %lu capabilities and %lu resources", THIS_FILE,
+	               (unsigned long)[capsIDs count], (unsigned long)[resourceIDs count]);
+	
+	// Until the bulk delete has completed, resourceForJID:xmppStream: ignores the resources that are yet to be deleted.
+	
+	NSSet *pendingResourceIDs = [NSSet setWithArray:resourceIDs];
+	[resourceIDsPendingDeletion unionSet:pendingResourceIDs];
+	
+	[resourceCache removeAllObjects];
+	
+	NSMutableArray *objectIDs = [NSMutableArray arrayWithCapacity:([capsIDs count] + [resourceIDs count])];
+	[objectIDs addObjectsFromArray:capsIDs];
+	[objectIDs addObjectsFromArray:resourceIDs];
+	
+	[self deleteObjectsWithIDs:objectIDs completionBlock:^{
+		
+		[resourceIDsPendingDeletion minusSet:pendingResourceIDs];
+	}];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -281,6 +484,8 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 			resource.hashStr = hash;
 			resource.hashAlgorithm = hashAlg;
 			
+			[self cacheResource:resource];
+			
 			hashChange = ((hash != nil) || (hashAlg != nil));
 		}
 		
@@ -465,6 +670,9 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 			caps.hashAlgorithm = hashAlg;
 			
 			caps.capabilities = capabilities;
+			
+			// Write through (this also replaces a cached miss)
+			[capsCache setObject:caps forKey:CapsCacheKey(hash, hashAlg)];
 		}
 		
 		NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPCapsResourceCoreDataStorageObject"
@@ -519,6 +727,8 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 													 inManagedObjectContext:[self managedObjectContext]];
 			resource.jidStr = [jid full];
 			resource.streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
+			
+			[self cacheResource:resource];
 		}
 		
 		resource.caps = caps;
@@ -578,6 +788,7 @@ static XMPPCapabilitiesCoreDataStorage *sharedInstance;
 				}
 			}
 			
+			[self uncacheResource:resource];
 			[[self managedObjectContext] deleteObject:resource];
 		}
 		
@@ -0,0 +1,52 @@
+#import <Foundation/Foundation.h>
+
+#import "XMPPCapabilities.h"
+#import "XMPPSQLiteStorage.h"
+
+/**
+ * This class is an implementation of XMPPCapabilitiesStorage using SQLite directly (without Core Data).
+ * It works exactly like XMPPCapabilitiesCoreDataStorage, and may be used as a drop-in replacement.
+ *
+ * Every lookup is a single indexed query, and linking all the resources with a given hash
+ * to newly discovered capabilities is a single UPDATE statement.
+**/
+
+@interface XMPPCapabilitiesSQLiteStorage : XMPPSQLiteStorage <XMPPCapabilitiesStorage>
+{
+	/* Inherited protected variables from XMPPSQLiteStorage
+	
+	NSString *databaseFileName;
+	NSUInteger saveThreshold;
+	
+	dispatch_queue_t storageQueue;
+	
+	*/
+}
+
+/**
+ * XEP-0115 provides a mechanism for hashing a list of capabilities.
+ * Clients then broadcast this hash instead of the entire list to save bandwidth.
+ * Because the hashing is standardized, it is safe to persistently store the linked hash & capabilities.
+ *
+ * For this reason, it is recommended you use this sharedInstance across all your xmppStreams.
+ * This way all streams can shared a knowledgebase concerning known hashes.
+ *
+ * All other aspects of capabilities handling (such as JID's, lookup failures, etc) are kept separate between streams.
+**/
++ (XMPPCapabilitiesSQLiteStorage *)sharedInstance;
+
+
+/* Inherited from XMPPSQLiteStorage
+ * Please see the XMPPSQLiteStorage header file for extensive documentation.
+
+- (id)initWithDatabaseFilename:(NSString *)databaseFileName;
+- (id)initWithInMemoryStore;
+
+@property (readonly) NSString *databaseFileName;
+
+@property (readwrite) NSUInteger saveThreshold;
+@property (readwrite) NSTimeInterval maxCommitLatency;
+
+*/
+
+@end
@@ -0,0 +1,698 @@
+#import "XMPPCapabilitiesSQLiteStorage.h"
+#import "XMPPSQLiteStorageProtected.h"
+#import "XMPP.h"
+#import "XMPPLogging.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+/**
+ * A row of the resources table.
+ * The capsID is zero if the resource isn't linked to any capabilities.
+**/
+@interface XMPPCapsSQLiteResource : NSObject
+{
+  @public
+	sqlite3_int64 rowID;
+	sqlite3_int64 capsID;
+	BOOL failed;
+	
+	NSString *node;
+	NSString *ver;
+	NSString *ext;
+	NSString *hashStr;
+	NSString *hashAlgorithm;
+}
+@end
+
+@implementation XMPPCapsSQLiteResource
+@end
+
+static void BindRowID(sqlite3_stmt *statement, int index, sqlite3_int64 rowID)
+{
+	if (rowID > 0)
+		sqlite3_bind_int64(statement, index, rowID);
+	else
+		sqlite3_bind_null(statement, index);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPCapabilitiesSQLiteStorage
+
+static XMPPCapabilitiesSQLiteStorage *sharedInstance;
+
++ (XMPPCapabilitiesSQLiteStorage *)sharedInstance
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		sharedInstance = [[XMPPCapabilitiesSQLiteStorage alloc] initWithDatabaseFilename:nil];
+	});
+	
+	return sharedInstance;
+}
+
+- (void)commonInit
+{
+	XMPPLogTrace();
+	[super commonInit];
+	
+	autoRecreateDatabaseFile = YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Setup
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)configureWithParent:(XMPPCapabilities *)aParent queue:(dispatch_queue_t)queue
+{
+	return [super configureWithParent:aParent queue:queue];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Overrides
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)createSchema
+{
+	// The capabilities without a hash are the non-persistent ones (see setCapabilities:forJID:xmppStream:).
+	// Each of them is linked to a single resource.
+	
+	return [self executeSQL:@"CREATE TABLE IF NOT EXISTS caps ("
+	                        @"id INTEGER PRIMARY KEY, "
+	                        @"hashStr TEXT, "
+	                        @"hashAlgorithm TEXT, "
+	                        @"capabilitiesStr TEXT)"]
+	    && [self executeSQL:@"CREATE INDEX IF NOT EXISTS caps_hash ON caps (hashStr, hashAlgorithm)"]
+	    && [self executeSQL:@"CREATE TABLE IF NOT EXISTS resources ("
+	                        @"id INTEGER PRIMARY KEY, "
+	                        @"jidStr TEXT NOT NULL, "
+	                        @"streamBareJidStr TEXT NOT NULL, "
+	                        @"node TEXT, "
+	                        @"ver TEXT, "
+	                        @"ext TEXT, "
+	                        @"hashStr TEXT, "
+	                        @"hashAlgorithm TEXT, "
+	                        @"failed INTEGER NOT NULL DEFAULT 0, "
+	                        @"capsId INTEGER)"]
+	    && [self executeSQL:@"CREATE UNIQUE INDEX IF NOT EXISTS resources_jid ON resources (jidStr, streamBareJidStr)"]
+	    && [self executeSQL:@"CREATE INDEX IF NOT EXISTS resources_hash ON resources (hashStr, hashAlgorithm)"]
+	    && [self executeSQL:@"CREATE INDEX IF NOT EXISTS resources_stream ON resources (streamBareJidStr)"];
+}
+
+- (void)didOpenDatabase
+{
+	// This method is overriden from the XMPPSQLiteStorage superclass.
+	
+	[self _clearAllNonPersistentCapabilitiesForXMPPStream:nil];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Utilities
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (XMPPCapsSQLiteResource *)resourceForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace2(@"%@: %@ %@", THIS_FILE, THIS_METHOD, jid);
+	
+	if (jid == nil) return nil;
+	
+	sqlite3_stmt *statement;
+	
+	if (stream == nil)
+	{
+		statement = [self statementForSQL:@"SELECT id, capsId, failed, node, ver, ext, hashStr, hashAlgorithm "
+		                                  @"FROM resources WHERE jidStr = ? LIMIT 1"];
+		
+		XMPPSQLiteBindString(statement, 1, [jid full]);
+	}
+	else
+	{
+		statement = [self statementForSQL:@"SELECT id, capsId, failed, node, ver, ext, hashStr, hashAlgorithm "
+		                                  @"FROM resources WHERE jidStr = ? AND streamBareJidStr = ? LIMIT 1"];
+		
+		XMPPSQLiteBindString(statement, 1, [jid full]);
+		XMPPSQLiteBindString(statement, 2, [self streamBareJidStrForXMPPStream:stream]);
+	}
+	
+	if (statement == NULL) return nil;
+	
+	XMPPCapsSQLiteResource *resource = nil;
+	
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		resource = [[XMPPCapsSQLiteResource alloc] init];
+		
+		resource->rowID         = sqlite3_column_int64(statement, 0);
+		resource->capsID        = sqlite3_column_int64(statement, 1);
+		resource->failed        = sqlite3_column_int(statement, 2) != 0;
+		resource->node          = XMPPSQLiteColumnString(statement, 3);
+		resource->ver           = XMPPSQLiteColumnString(statement, 4);
+		resource->ext           = XMPPSQLiteColumnString(statement, 5);
+		resource->hashStr       = XMPPSQLiteColumnString(statement, 6);
+		resource->hashAlgorithm = XMPPSQLiteColumnString(statement, 7);
+	}
+	
+	sqlite3_reset(statement);
+	
+	XMPPLogVerbose(@"%@: %@ - %lld", THIS_FILE, THIS_METHOD, resource ? resource->rowID : 0);
+	return resource;
+}
+
+- (sqlite3_int64)insertResourceForJID:(XMPPJID *)jid
+                           xmppStream:(XMPPStream *)stream
+                                 node:(NSString *)node
+                                  ver:(NSString *)ver
+                                  ext:(NSString *)ext
+                                 hash:(NSString *)hash
+                            algorithm:(NSString *)hashAlg
+                               capsID:(sqlite3_int64)capsID
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	sqlite3_stmt *statement =
+	    [self statementForSQL:@"INSERT INTO resources "
+	                          @"(jidStr, streamBareJidStr, node, ver, ext, hashStr, hashAlgorithm, capsId) "
+	                          @"VALUES (?, ?, ?, ?, ?, ?, ?, ?)"];
+	
+	XMPPSQLiteBindString(statement, 1, [jid full]);
+	XMPPSQLiteBindString(statement, 2, [self streamBareJidStrForXMPPStream:stream]);
+	XMPPSQLiteBindString(statement, 3, node);
+	XMPPSQLiteBindString(statement, 4, ver);
+	XMPPSQLiteBindString(statement, 5, ext);
+	XMPPSQLiteBindString(statement, 6, hash);
+	XMPPSQLiteBindString(statement, 7, hashAlg);
+	BindRowID(statement, 8, capsID);
+	
+	if (![self executeUpdateStatement:statement]) return 0;
+	
+	return sqlite3_last_insert_rowid([self database]);
+}
+
+- (sqlite3_int64)capsIDForHash:(NSString *)hash algorithm:(NSString *)hashAlg
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace2(@"%@: capsIDForHash:%@ algorithm:%@", THIS_FILE, hash, hashAlg);
+	
+	if (hash == nil) return 0;
+	if (hashAlg == nil) return 0;
+	
+	sqlite3_stmt *statement =
+	    [self statementForSQL:@"SELECT id FROM caps WHERE hashStr = ? AND hashAlgorithm = ? LIMIT 1"];
+	
+	if (statement == NULL) return 0;
+	
+	XMPPSQLiteBindString(statement, 1, hash);
+	XMPPSQLiteBindString(statement, 2, hashAlg);
+	
+	sqlite3_int64 capsID = 0;
+	
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		capsID = sqlite3_column_int64(statement, 0);
+	}
+	
+	sqlite3_reset(statement);
+	
+	return capsID;
+}
+
+- (NSXMLElement *)capabilitiesForCapsID:(sqlite3_int64)capsID
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	if (capsID <= 0) return nil;
+	
+	sqlite3_stmt *statement = [self statementForSQL:@"SELECT capabilitiesStr FROM caps WHERE id = ?"];
+	
+	if (statement == NULL) return nil;
+	
+	sqlite3_bind_int64(statement, 1, capsID);
+	
+	NSString *capabilitiesStr = nil;
+	
+	if (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		capabilitiesStr = XMPPSQLiteColumnString(statement, 0);
+	}
+	
+	sqlite3_reset(statement);
+	
+	if (capabilitiesStr == nil) return nil;
+	
+	return [[NSXMLElement alloc] initWithXMLString:capabilitiesStr error:nil];
+}
+
+- (void)_clearAllNonPersistentCapabilitiesForXMPPStream:(XMPPStream *)stream
+{
+	NSAssert(dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	// Non-persistent capabilities are the ones without a hash.
+	// They're deleted before the resources, as the statement for a specific stream goes through the resources.
+	
+	sqlite3_stmt *statement;
+	
+	if (stream)
+	{
+		NSString *streamBareJidStr = [self streamBareJidStrForXMPPStream:stream];
+		
+		statement = [self statementForSQL:@"DELETE FROM caps WHERE (hashStr IS NULL OR hashAlgorithm IS NULL) "
+		                                  @"AND id IN (SELECT capsId FROM resources WHERE streamBareJidStr = ?)"];
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		[self executeUpdateStatement:statement];
+		
+		statement = [self statementForSQL:@"DELETE FROM resources WHERE streamBareJidStr = ?"];
+		
+		XMPPSQLiteBindString(statement, 1, streamBareJidStr);
+		[self executeUpdateStatement:statement];
+	}
+	else
+	{
+		statement = [self statementForSQL:@"DELETE FROM caps WHERE hashStr IS NULL OR hashAlgorithm IS NULL"];
+		[self executeUpdateStatement:statement];
+		
+		statement = [self statementForSQL:@"DELETE FROM resources"];
+		[self executeUpdateStatement:statement];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Protocol Public API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)areCapabilitiesKnownForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	__block BOOL result;
+	
+	[self executeBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		result = (resource != nil) && (resource->capsID != 0);
+		
+	}];
+	
+	return result;
+}
+
+- (NSXMLElement *)capabilitiesForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	return [self capabilitiesForJID:jid ext:nil xmppStream:stream];
+}
+
+- (NSXMLElement *)capabilitiesForJID:(XMPPJID *)jid ext:(NSString **)extPtr xmppStream:(XMPPStream *)stream
+{
+	// By design this method should not be invoked from the storageQueue.
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	__block NSXMLElement *result = nil;
+	__block NSString *ext = nil;
+	
+	[self executeBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		
+		if (resource)
+		{
+			result = [self capabilitiesForCapsID:resource->capsID];
+			ext = resource->ext;
+		}
+		
+	}];
+	
+	if (extPtr)
+		*extPtr = ext;
+	
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Protocol Private API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)setCapabilitiesNode:(NSString *)node
+                        ver:(NSString *)ver
+                        ext:(NSString *)ext
+                       hash:(NSString *)hash
+                  algorithm:(NSString *)hashAlg
+                     forJID:(XMPPJID *)jid
+                 xmppStream:(XMPPStream *)stream
+      andGetNewCapabilities:(NSXMLElement **)newCapabilitiesPtr
+{
+	XMPPLogTrace();
+	
+	__block BOOL result = NO;
+	__block NSXMLElement *newCapabilities = nil;
+	
+	[self executeBlock:^{
+		
+		BOOL hashChange = NO;
+		sqlite3_int64 capsID = 0;
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		if (resource)
+		{
+			hashChange = ![hash isEqual:resource->hashStr] || ![hashAlg isEqual:resource->hashAlgorithm];
+			
+			capsID = hashChange ? [self capsIDForHash:hash algorithm:hashAlg] : resource->capsID;
+			
+			sqlite3_stmt *statement =
+			    [self statementForSQL:@"UPDATE resources SET node = ?, ver = ?, ext = ?, "
+			                          @"hashStr = ?, hashAlgorithm = ?, capsId = ? WHERE id = ?"];
+			
+			XMPPSQLiteBindString(statement, 1, node);
+			XMPPSQLiteBindString(statement, 2, ver);
+			XMPPSQLiteBindString(statement, 3, ext);
+			XMPPSQLiteBindString(statement, 4, hash);
+			XMPPSQLiteBindString(statement, 5, hashAlg);
+			BindRowID(statement, 6, capsID);
+			sqlite3_bind_int64(statement, 7, resource->rowID);
+			
+			[self executeUpdateStatement:statement];
+		}
+		else
+		{
+			hashChange = ((hash != nil) || (hashAlg != nil));
+			
+			capsID = [self capsIDForHash:hash algorithm:hashAlg];
+			
+			[self insertResourceForJID:jid
+			                xmppStream:stream
+			                      node:node
+			                       ver:ver
+			                       ext:ext
+			                      hash:hash
+			                 algorithm:hashAlg
+			                    capsID:capsID];
+		}
+		
+		if (hashChange)
+		{
+			newCapabilities = [self capabilitiesForCapsID:capsID];
+		}
+		
+		// Return whether or not the capabilities are known for the given jid
+		
+		result = (capsID != 0);
+		
+	}];
+	
+	
+	if (newCapabilitiesPtr)
+		*newCapabilitiesPtr = newCapabilities;
+	
+	return result;
+}
+
+- (BOOL)getCapabilitiesHash:(NSString **)hashPtr
+                  algorithm:(NSString **)hashAlgPtr
+                     forJID:(XMPPJID *)jid
+                 xmppStream:(XMPPStream *)stream
+{
+	// By design this method should not be invoked from the storageQueue.
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	__block BOOL result = NO;
+	__block NSString *hash = nil;
+	__block NSString *hashAlg = nil;
+	
+	[self executeBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		if (resource)
+		{
+			hash = resource->hashStr;
+			hashAlg = resource->hashAlgorithm;
+			
+			result = (hash && hashAlg);
+		}
+		
+	}];
+	
+	
+	if (hashPtr)
+		*hashPtr = hash;
+	
+	if (hashAlgPtr)
+		*hashAlgPtr = hashAlg;
+	
+	return result;
+}
+
+- (void)clearCapabilitiesHashAndAlgorithmForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		if (resource)
+		{
+			BOOL clearCaps = (resource->hashStr && resource->hashAlgorithm);
+			
+			sqlite3_stmt *statement =
+			    [self statementForSQL:@"UPDATE resources SET hashStr = NULL, hashAlgorithm = NULL, capsId = ? "
+			                          @"WHERE id = ?"];
+			
+			BindRowID(statement, 1, clearCaps ? 0 : resource->capsID);
+			sqlite3_bind_int64(statement, 2, resource->rowID);
+			
+			[self executeUpdateStatement:statement];
+		}
+		
+	}];
+}
+
+- (void)getCapabilitiesKnown:(BOOL *)areCapabilitiesKnownPtr
+                      failed:(BOOL *)haveFailedFetchingBeforePtr
+                        node:(NSString **)nodePtr
+                         ver:(NSString **)verPtr
+                         ext:(NSString **)extPtr
+                        hash:(NSString **)hashPtr
+                   algorithm:(NSString **)hashAlgPtr
+                      forJID:(XMPPJID *)jid
+                  xmppStream:(XMPPStream *)stream
+{
+	// By design this method should not be invoked from the storageQueue.
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	__block XMPPCapsSQLiteResource *resource = nil;
+	
+	[self executeBlock:^{
+		
+		resource = [self resourceForJID:jid xmppStream:stream];
+		
+	}];
+	
+	// If we don't know anything about the given jid, everything is NO / nil
+	
+	if (areCapabilitiesKnownPtr)     *areCapabilitiesKnownPtr     = resource ? (resource->capsID != 0) : NO;
+	if (haveFailedFetchingBeforePtr) *haveFailedFetchingBeforePtr = resource ? resource->failed : NO;
+	
+	if (nodePtr)    *nodePtr    = resource ? resource->node          : nil;
+	if (verPtr)     *verPtr     = resource ? resource->ver           : nil;
+	if (extPtr)     *extPtr     = resource ? resource->ext           : nil;
+	if (hashPtr)    *hashPtr    = resource ? resource->hashStr       : nil;
+	if (hashAlgPtr) *hashAlgPtr = resource ? resource->hashAlgorithm : nil;
+}
+
+- (void)setCapabilities:(NSXMLElement *)capabilities forHash:(NSString *)hash algorithm:(NSString *)hashAlg
+{
+	XMPPLogTrace();
+	
+	if (hash == nil) return;
+	if (hashAlg == nil) return;
+	
+	[self scheduleBlock:^{
+		
+		NSString *capabilitiesStr = [capabilities compactXMLString];
+		sqlite3_stmt *statement;
+		
+		sqlite3_int64 capsID = [self capsIDForHash:hash algorithm:hashAlg];
+		if (capsID)
+		{
+			statement = [self statementForSQL:@"UPDATE caps SET capabilitiesStr = ? WHERE id = ?"];
+			
+			XMPPSQLiteBindString(statement, 1, capabilitiesStr);
+			sqlite3_bind_int64(statement, 2, capsID);
+			
+			[self executeUpdateStatement:statement];
+		}
+		else
+		{
+			statement = [self statementForSQL:@"INSERT INTO caps (hashStr, hashAlgorithm, capabilitiesStr) "
+			                                  @"VALUES (?, ?, ?)"];
+			
+			XMPPSQLiteBindString(statement, 1, hash);
+			XMPPSQLiteBindString(statement, 2, hashAlg);
+			XMPPSQLiteBindString(statement, 3, capabilitiesStr);
+			
+			if (![self executeUpdateStatement:statement]) return;
+			
+			capsID = sqlite3_last_insert_rowid([self database]);
+		}
+		
+		// Link every resource with the given hash in a single statement
+		
+		statement = [self statementForSQL:@"UPDATE resources SET capsId = ? WHERE hashStr = ? AND hashAlgorithm = ?"];
+		
+		sqlite3_bind_int64(statement, 1, capsID);
+		XMPPSQLiteBindString(statement, 2, hash);
+		XMPPSQLiteBindString(statement, 3, hashAlg);
+		
+		[self executeUpdateStatement:statement];
+		
+	}];
+}
+
+- (void)setCapabilities:(NSXMLElement *)capabilities forJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	// By design this method should not be invoked from the storageQueue.
+	NSAssert(!dispatch_get_specific(storageQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	if (jid == nil) return;
+	
+	[self scheduleBlock:^{
+		
+		sqlite3_stmt *statement = [self statementForSQL:@"INSERT INTO caps (capabilitiesStr) VALUES (?)"];
+		
+		XMPPSQLiteBindString(statement, 1, [capabilities compactXMLString]);
+		
+		if (![self executeUpdateStatement:statement]) return;
+		
+		sqlite3_int64 capsID = sqlite3_last_insert_rowid([self database]);
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		
+		if (resource == nil)
+		{
+			[self insertResourceForJID:jid
+			                xmppStream:stream
+			                      node:nil
+			                       ver:nil
+			                       ext:nil
+			                      hash:nil
+			                 algorithm:nil
+			                    capsID:capsID];
+		}
+		else
+		{
+			statement = [self statementForSQL:@"UPDATE resources SET capsId = ? WHERE id = ?"];
+			
+			sqlite3_bind_int64(statement, 1, capsID);
+			sqlite3_bind_int64(statement, 2, resource->rowID);
+			
+			[self executeUpdateStatement:statement];
+			
+			// Non-persistent capabilities belong to a single resource.
+			// So if the resource was linked to any, they're no longer referenced.
+			
+			if (resource->capsID)
+			{
+				statement = [self statementForSQL:@"DELETE FROM caps WHERE id = ? "
+				                                  @"AND (hashStr IS NULL OR hashAlgorithm IS NULL)"];
+				
+				sqlite3_bind_int64(statement, 1, resource->capsID);
+				
+				[self executeUpdateStatement:statement];
+			}
+		}
+		
+	}];
+}
+
+- (void)setCapabilitiesFetchFailedForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		if (resource)
+		{
+			sqlite3_stmt *statement = [self statementForSQL:@"UPDATE resources SET failed = 1 WHERE id = ?"];
+			
+			sqlite3_bind_int64(statement, 1, resource->rowID);
+			
+			[self executeUpdateStatement:statement];
+		}
+		
+	}];
+}
+
+- (void)clearAllNonPersistentCapabilitiesForXMPPStream:(XMPPStream *)stream
+{
+	// This method is called for the protocol,
+	// but is also called when we first open the database file.
+	
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		[self _clearAllNonPersistentCapabilitiesForXMPPStream:stream];
+		
+	}];
+}
+
+- (void)clearNonPersistentCapabilitiesForJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		XMPPCapsSQLiteResource *resource = [self resourceForJID:jid xmppStream:stream];
+		
+		if (resource != nil)
+		{
+			sqlite3_stmt *statement;
+			
+			if (resource->hashStr && resource->hashAlgorithm)
+			{
+				// The associated capabilities are persistent
+			}
+			else if (resource->capsID)
+			{
+				statement = [self statementForSQL:@"DELETE FROM caps WHERE id = ?"];
+				
+				sqlite3_bind_int64(statement, 1, resource->capsID);
+				
+				[self executeUpdateStatement:statement];
+			}
+			
+			statement = [self statementForSQL:@"DELETE FROM resources WHERE id = ?"];
+			
+			sqlite3_bind_int64(statement, 1, resource->rowID);
+			
+			[self executeUpdateStatement:statement];
+		}
+		
+	}];
+}
+
+@end
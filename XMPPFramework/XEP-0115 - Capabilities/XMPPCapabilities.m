@@ -2,6 +2,7 @@
 #import "XMPPLogging.h"
 #import "XMPPCapabilities.h"
 #import "NSData+XMPP.h"
+#import "XMPPDigest.h"
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -468,7 +469,9 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 	
 	NSMutableSet *set = [NSMutableSet set];
 	
-	NSMutableString *s = [NSMutableString string];
+	// The verification string is fed straight into the digest, rather than building it up in memory first.
+	
+	XMPPDigest *digest = [XMPPDigest digestWithAlgorithm:XMPPDigestAlgorithmSHA1];
 	
 	NSArray *identities = [[query elementsForName:@"identity"] sortedArrayUsingFunction:sortIdentities context:NULL];
 	for (NSXMLElement *identity in identities)
@@ -501,7 +504,7 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 			[set addObject:mash];
 		}
 		
-		[s appendString:mash];
+		[digest updateWithString:mash];
 	}
 	
 	[set removeAllObjects];
@@ -530,7 +533,7 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 			[set addObject:mash];
 		}
 		
-		[s appendString:mash];
+		[digest updateWithString:mash];
 	}
 	
 	[set removeAllObjects];
@@ -554,7 +557,7 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 		
 		// Note: The formTypeValue is properly encoded and contains the trailing '<' character.
 		
-		[s appendString:formTypeValue];
+		[digest updateWithString:formTypeValue];
 		
 		NSArray *fields = [[form elementsForName:@"field"] sortedArrayUsingFunction:sortFormFields context:NULL];
 		for (NSXMLElement *field in fields)
@@ -574,7 +577,8 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 				continue;
 			}
 			
-			[s appendFormat:@"%@<", var];
+			[digest updateWithString:var];
+			[digest updateWithBytes:"<" length:1];
 			
 			NSArray *values = [[field elementsForName:@"value"] sortedArrayUsingFunction:sortFieldValues context:NULL];
 			for (NSXMLElement *value in values)
@@ -587,13 +591,13 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 				
 				str = encodeLt(str);
 				
-				[s appendFormat:@"%@<", str];
+				[digest updateWithString:str];
+				[digest updateWithBytes:"<" length:1];
 			}
 		}
 	}
 	
-	NSData *data = [s dataUsingEncoding:NSUTF8StringEncoding];
-	NSData *hash = [data sha1Digest];
+	NSData *hash = [digest digest];
 	
 	return [hash base64Encoded];
 }
@@ -1454,7 +1458,7 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 	//       ver="QgayPKawpkPSDYmwT/WM94uA1u0="/>
 	// </presence>
 	
-	NSString *type = [presence type];
+	XMPPAtom type = [presence typeAtom];
 	
 	XMPPJID *myJID = xmppStream.myJID;
 	if ([myJID isEqual:[presence from]])
@@ -1463,11 +1467,11 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 		return;
 	}
 	
-	if ([type isEqualToString:@"unavailable"])
+	if (type == XMPPAtomUnavailable)
 	{
 		[xmppCapabilitiesStorage clearNonPersistentCapabilitiesForJID:[presence from] xmppStream:xmppStream];
 	}
-	else if ([type isEqualToString:@"available"])
+	else if (type == XMPPAtomAvailable)
 	{
 		NSXMLElement *c = [presence elementForName:@"c" xmlns:XMLNS_CAPS];
 		if (c == nil)
@@ -1518,8 +1522,8 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 		return NO;
 	}
 	
-	NSString *type = [[iq attributeStringValueForName:@"type"] lowercaseString];
-	if ([type isEqualToString:@"get"])
+	XMPPAtom type = [iq typeAtom];
+	if (type == XMPPAtomGet)
 	{
 		NSString *node = [query attributeStringValueForName:@"node"];
 		
@@ -1532,11 +1536,11 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 			return NO;
 		}
 	}
-	else if ([type isEqualToString:@"result"])
+	else if (type == XMPPAtomResult)
 	{
 		[self handleDiscoResponse:query fromJID:from];
 	}
-	else if ([type isEqualToString:@"error"])
+	else if (type == XMPPAtomError)
 	{
 		[self handleDiscoErrorResponse:query fromJID:from];
 	}
@@ -1552,13 +1556,13 @@ static NSInteger sortFieldValues(NSXMLElement *value1, NSXMLElement *value2, voi
 {
 	// This method is invoked on the moduleQueue.
 	
-	NSString *type = [presence type];
+	XMPPAtom type = [presence typeAtom];
 	
-	if ([type isEqualToString:@"unavailable"])
+	if (type == XMPPAtomUnavailable)
 	{
 		[xmppCapabilitiesStorage clearAllNonPersistentCapabilitiesForXMPPStream:xmppStream];
 	}
-	else if ([type isEqualToString:@"available"])
+	else if (type == XMPPAtomAvailable)
 	{
 		if (myCapabilitiesQuery == nil)
 		{
@@ -1,6 +1,7 @@
 #import <Foundation/Foundation.h>
 #import "XMPPModule.h"
 #import "XMPPPing.h"
+#import "XMPPLivenessScheduler.h"
 
 #define _XMPP_AUTO_PING_H
 
@@ -23,7 +24,7 @@
 	NSString *targetJIDStr;
 	
 	NSTimeInterval lastReceiveTime;
-	dispatch_source_t pingIntervalTimer;
+	XMPPLivenessEntry *pingIntervalEntry;
 	
 	BOOL awaitingPingResponse;
 	XMPPPing *xmppPing;
@@ -32,10 +33,10 @@
 /**
  * How often to send a ping.
  * 
- * The internal timer fires every (pingInterval / 4) seconds.
- * Upon firing it checks when data was last received from the target,
- * and sends a ping if the elapsed time has exceeded the pingInterval.
- * Thus the effective resolution of the timer is based on the configured interval.
+ * Pings are scheduled with the process-wide XMPPLivenessScheduler.
+ * The scheduler tracks when data was last received from the target,
+ * and only wakes the module once the elapsed time has exceeded the pingInterval.
+ * Thus a ping is sent within one scheduler bucket (plus a small jitter) of the interval.
  * 
  * To temporarily disable auto-ping, set the interval to zero.
  * 
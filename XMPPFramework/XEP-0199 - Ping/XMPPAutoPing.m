@@ -16,7 +16,6 @@
 #endif
 
 @interface XMPPAutoPing ()
-- (void)updatePingIntervalTimer;
 - (void)startPingIntervalTimer;
 - (void)stopPingIntervalTimer;
 @end
@@ -273,35 +272,6 @@
 	}
 }
 
-- (void)updatePingIntervalTimer
-{
-	XMPPLogTrace();
-	
-	NSAssert(pingIntervalTimer != NULL, @"Broken logic (1)");
-	NSAssert(pingInterval > 0, @"Broken logic (2)");
-	
-	// The timer fires every (pingInterval / 4) seconds.
-	// Upon firing it checks when data was last received from the target,
-	// and sends a ping if the elapsed time has exceeded the pingInterval.
-	// Thus the effective resolution of the timer is based on the configured pingInterval.
-	
-	uint64_t interval = ((pingInterval / 4.0) * NSEC_PER_SEC);
-	
-	// The timer's first fire should occur 'interval' after lastReceiveTime.
-	// If there is no lastReceiveTime, then the timer's first fire should occur 'interval' after now.
-	
-	NSTimeInterval diff;
-	if (lastReceiveTime == 0)
-		diff = 0.0;
-	else
-		diff = lastReceiveTime - [NSDate timeIntervalSinceReferenceDate];;
-	
-	dispatch_time_t bt = dispatch_time(DISPATCH_TIME_NOW, (diff * NSEC_PER_SEC));
-	dispatch_time_t tt = dispatch_time(bt, interval);
-	
-	dispatch_source_set_timer(pingIntervalTimer, tt, interval, 0);
-}
-
 - (void)startPingIntervalTimer
 {
 	XMPPLogTrace();
@@ -312,38 +282,31 @@
 		return;
 	}
 	
-	BOOL newTimer = NO;
+	// The liveness scheduler invokes us once pingInterval has elapsed without activity.
+	// The interval of an entry is fixed, so a new interval requires a new entry.
 	
-	if (pingIntervalTimer == NULL)
-	{
-		newTimer = YES;
-		pingIntervalTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
-		
-		dispatch_source_set_event_handler(pingIntervalTimer, ^{ @autoreleasepool {
-			
-			[self handlePingIntervalTimerFire];
-			
-		}});
-	}
+	[self stopPingIntervalTimer];
 	
-	[self updatePingIntervalTimer];
+	pingIntervalEntry = [[XMPPLivenessScheduler sharedScheduler] scheduleWithInterval:pingInterval
+	                                                                           queue:moduleQueue
+	                                                                           block:^{ @autoreleasepool {
+		
+		[self handlePingIntervalTimerFire];
+		
+	}}];
 	
-	if (newTimer)
-	{
-		dispatch_resume(pingIntervalTimer);
-	}
+	// Note: The new entry considers 'now' its last activity,
+	// so the first fire occurs no earlier than 'interval' after now.
 }
 
 - (void)stopPingIntervalTimer
 {
 	XMPPLogTrace();
 	
-	if (pingIntervalTimer)
+	if (pingIntervalEntry)
 	{
-		#if !OS_OBJECT_USE_OBJC
-		dispatch_release(pingIntervalTimer);
-		#endif
-		pingIntervalTimer = NULL;
+		[[XMPPLivenessScheduler sharedScheduler] cancelEntry:pingIntervalEntry];
+		pingIntervalEntry = nil;
 	}
 }
 
@@ -384,6 +347,7 @@
 	if (targetJID == nil || [targetJIDStr isEqualToString:[iq fromStr]])
 	{
 		lastReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+		[pingIntervalEntry noteActivityAtTime:lastReceiveTime];
 	}
 	
 	return NO;
@@ -394,6 +358,7 @@
 	if (targetJID == nil || [targetJIDStr isEqualToString:[message fromStr]])
 	{
 		lastReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+		[pingIntervalEntry noteActivityAtTime:lastReceiveTime];
 	}
 }
 
@@ -402,6 +367,7 @@
 	if (targetJID == nil || [targetJIDStr isEqualToString:[presence fromStr]])
 	{
 		lastReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+		[pingIntervalEntry noteActivityAtTime:lastReceiveTime];
 	}
 }
 
@@ -30,6 +30,9 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+@interface XMPPPing () <XMPPIQHandler>
+@end
+
 @implementation XMPPPing
 
 - (id)init
@@ -56,6 +59,11 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 		
 		pingTracker = [[XMPPIDTracker alloc] initWithDispatchQueue:moduleQueue];
 		
+		if (respondsToQueries)
+		{
+			[xmppStream addIQHandler:self handlerQueue:moduleQueue forElementName:@"ping" xmlns:XMLNSXMPPPing];
+		}
+		
 		return YES;
 	}
 	
@@ -70,6 +78,8 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 	
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
+		[xmppStream removeIQHandler:self];
+		
 		[pingTracker removeAllIDs];
 		pingTracker = nil;
 		
@@ -109,6 +119,11 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 		{
 			respondsToQueries = flag;
 			
+			if (respondsToQueries)
+				[xmppStream addIQHandler:self handlerQueue:moduleQueue forElementName:@"ping" xmlns:XMLNSXMPPPing];
+			else
+				[xmppStream removeIQHandler:self];
+			
 		#ifdef _XMPP_CAPABILITIES_H
 			@autoreleasepool {
 				// Capabilities may have changed, need to notify others.
@@ -237,7 +252,17 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 		
 		return [pingTracker invokeForID:[iq elementID] withObject:iq];
 	}
-	else if (respondsToQueries && [type isEqualToString:@"get"])
+	
+	// Incoming ping queries are routed to xmppStream:handleIQRequest: below.
+	
+	return NO;
+}
+
+- (BOOL)xmppStream:(XMPPStream *)sender handleIQRequest:(XMPPIQ *)iq
+{
+	// This method is invoked on the moduleQueue.
+	
+	if (respondsToQueries && [iq isGetIQ])
 	{
 		// Example:
 		// 
@@ -245,15 +270,11 @@ NSString* const XMLNSXMPPPing = @"urn:xmpp:ping";
 		//   <ping xmlns="urn:xmpp:ping"/>
 		// </iq>
 		
-		NSXMLElement *ping = [iq elementForName:@"ping" xmlns:@"urn:xmpp:ping"];
-		if (ping)
-		{
-			XMPPIQ *pong = [XMPPIQ iqWithType:@"result" to:[iq from] elementID:[iq elementID]];
-			
-			[sender sendElement:pong];
-			
-			return YES;
-		}
+		XMPPIQ *pong = [XMPPIQ iqWithType:@"result" to:[iq from] elementID:[iq elementID]];
+		
+		[sender sendElement:pong];
+		
+		return YES;
 	}
 	
 	return NO;
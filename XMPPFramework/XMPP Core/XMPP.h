@@ -4,6 +4,12 @@
 
 #import "XMPPJID.h"
 #import "XMPPStream.h"
+#import "XMPPStreamHost.h"
+#import "XMPPStreamInstrumentation.h"
+#import "XMPPLivenessScheduler.h"
+#import "XMPPReceivedStanza.h"
+#import "XMPPAtoms.h"
+#import "XMPPBinaryCoding.h"
 #import "XMPPElement.h"
 #import "XMPPIQ.h"
 #import "XMPPMessage.h"
@@ -0,0 +1,157 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * XMPPAtom is a small integer that stands for one of the well-known strings of the XMPP vocabulary:
+ * stanza and element names, attribute names, common attribute values and namespaces.
+ *
+ * Atoms allow the stack to route and classify stanzas with integer comparisons,
+ * rather than comparing the same handful of strings over and over again.
+ * For example:
+ *
+ * switch ([presence typeAtom])
+ * {
+ *     case XMPPAtomUnavailable : ...
+ *     case XMPPAtomSubscribe   : ...
+ * }
+ *
+ * Atoms are strings, not roles. The same atom is used for the same string in every context.
+ * E.g. XMPPAtomError stands for both the <error/> element and the 'error' type attribute value.
+ *
+ * The parser uses the shared atom strings (see XMPPAtomString) for every element name, attribute and namespace
+ * that matches an atom, so received elements don't allocate these strings, and looking them up is cheap.
+**/
+enum XMPPAtom
+{
+	XMPPAtomNone = 0,
+	
+	// Stanzas & stream elements
+	
+	XMPPAtomIQ,
+	XMPPAtomMessage,
+	XMPPAtomPresence,
+	XMPPAtomStreamFeatures,
+	XMPPAtomFeatures,
+	XMPPAtomStreamError,
+	XMPPAtomError,
+	
+	// Common child elements
+	
+	XMPPAtomBody,
+	XMPPAtomSubject,
+	XMPPAtomThread,
+	XMPPAtomShow,
+	XMPPAtomStatus,
+	XMPPAtomPriority,
+	XMPPAtomQuery,
+	XMPPAtomItem,
+	XMPPAtomGroup,
+	XMPPAtomX,
+	XMPPAtomC,
+	XMPPAtomDelay,
+	XMPPAtomPing,
+	
+	// Common attribute names
+	
+	XMPPAtomType,
+	XMPPAtomID,
+	XMPPAtomTo,
+	XMPPAtomFrom,
+	XMPPAtomXmlns,
+	XMPPAtomJid,
+	XMPPAtomName,
+	XMPPAtomSubscription,
+	XMPPAtomAsk,
+	XMPPAtomNode,
+	XMPPAtomVer,
+	XMPPAtomHash,
+	
+	// IQ types
+	
+	XMPPAtomGet,
+	XMPPAtomSet,
+	XMPPAtomResult,
+	
+	// Presence types
+	
+	XMPPAtomAvailable,
+	XMPPAtomUnavailable,
+	XMPPAtomSubscribe,
+	XMPPAtomSubscribed,
+	XMPPAtomUnsubscribe,
+	XMPPAtomUnsubscribed,
+	XMPPAtomProbe,
+	
+	// Message types
+	
+	XMPPAtomNormal,
+	XMPPAtomChat,
+	XMPPAtomGroupchat,
+	XMPPAtomHeadline,
+	
+	// Presence show values (in addition to XMPPAtomChat)
+	
+	XMPPAtomAway,
+	XMPPAtomXA,
+	XMPPAtomDND,
+	
+	// Chat states (XEP-0085)
+	
+	XMPPAtomActive,
+	XMPPAtomComposing,
+	XMPPAtomPaused,
+	XMPPAtomInactive,
+	XMPPAtomGone,
+	
+	// Namespaces
+	
+	XMPPAtomJabberClientNamespace,       // jabber:client
+	XMPPAtomStreamsNamespace,            // http://etherx.jabber.org/streams
+	XMPPAtomStreamErrorsNamespace,       // urn:ietf:params:xml:ns:xmpp-streams
+	XMPPAtomStanzaErrorsNamespace,       // urn:ietf:params:xml:ns:xmpp-stanzas
+	XMPPAtomTLSNamespace,                // urn:ietf:params:xml:ns:xmpp-tls
+	XMPPAtomSASLNamespace,               // urn:ietf:params:xml:ns:xmpp-sasl
+	XMPPAtomBindNamespace,               // urn:ietf:params:xml:ns:xmpp-bind
+	XMPPAtomSessionNamespace,            // urn:ietf:params:xml:ns:xmpp-session
+	XMPPAtomRosterNamespace,             // jabber:iq:roster
+	XMPPAtomChatStatesNamespace,         // http://jabber.org/protocol/chatstates
+	XMPPAtomCapsNamespace,               // http://jabber.org/protocol/caps
+	XMPPAtomDiscoInfoNamespace,          // http://jabber.org/protocol/disco#info
+	XMPPAtomPingNamespace,               // urn:xmpp:ping
+	XMPPAtomDelayNamespace,              // urn:xmpp:delay
+	XMPPAtomLegacyDelayNamespace,        // jabber:x:delay
+	XMPPAtomVCardNamespace,              // vcard-temp
+	
+	XMPPAtomCount
+};
+typedef enum XMPPAtom XMPPAtom;
+
+/**
+ * Returns the atom for the given string, or XMPPAtomNone if the string isn't part of the vocabulary.
+ *
+ * The shared atom strings are recognized by pointer, without looking at their characters.
+**/
+XMPPAtom XMPPAtomForString(NSString *str);
+
+/**
+ * Same as XMPPAtomForString, but ignores the case of ASCII characters.
+ * This is intended for attribute values (such as type='result'), which the stanza accessors treat case-insensitively.
+**/
+XMPPAtom XMPPAtomForCaseInsensitiveString(NSString *str);
+
+/**
+ * Returns the atom for the given UTF-8 bytes, or XMPPAtomNone if they aren't part of the vocabulary.
+ * The cString variant expects a NULL terminated string, but never reads past the length of the longest atom.
+**/
+XMPPAtom XMPPAtomForUTF8Bytes(const char *bytes, size_t length);
+XMPPAtom XMPPAtomForCString(const char *cString);
+
+/**
+ * Returns the shared (immutable) string instance for the given atom, or nil for XMPPAtomNone.
+**/
+NSString *XMPPAtomString(XMPPAtom atom);
+
+/**
+ * Returns the (NULL terminated) UTF-8 bytes of the given atom, and sets the length if lengthPtr is non-NULL.
+ * Returns NULL for XMPPAtomNone (or any other value that isn't an atom).
+**/
+const char *XMPPAtomUTF8String(XMPPAtom atom, size_t *lengthPtr);
@@ -0,0 +1,311 @@
+#import "XMPPAtoms.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// No atom is longer than this (checked when the tables are built)
+#define XMPP_ATOM_MAX_LENGTH  48
+
+// Both lookup tables are open addressed (linear probing), and must stay well below full
+#define XMPP_ATOM_TABLE_SIZE  256
+
+static NSString *const atomStrings[XMPPAtomCount] = {
+	
+	[XMPPAtomNone]                  = nil,
+	
+	[XMPPAtomIQ]                    = @"iq",
+	[XMPPAtomMessage]               = @"message",
+	[XMPPAtomPresence]              = @"presence",
+	[XMPPAtomStreamFeatures]        = @"stream:features",
+	[XMPPAtomFeatures]              = @"features",
+	[XMPPAtomStreamError]           = @"stream:error",
+	[XMPPAtomError]                 = @"error",
+	
+	[XMPPAtomBody]                  = @"body",
+	[XMPPAtomSubject]               = @"subject",
+	[XMPPAtomThread]                = @"thread",
+	[XMPPAtomShow]                  = @"show",
+	[XMPPAtomStatus]                = @"status",
+	[XMPPAtomPriority]              = @"priority",
+	[XMPPAtomQuery]                 = @"query",
+	[XMPPAtomItem]                  = @"item",
+	[XMPPAtomGroup]                 = @"group",
+	[XMPPAtomX]                     = @"x",
+	[XMPPAtomC]                     = @"c",
+	[XMPPAtomDelay]                 = @"delay",
+	[XMPPAtomPing]                  = @"ping",
+	
+	[XMPPAtomType]                  = @"type",
+	[XMPPAtomID]                    = @"id",
+	[XMPPAtomTo]                    = @"to",
+	[XMPPAtomFrom]                  = @"from",
+	[XMPPAtomXmlns]                 = @"xmlns",
+	[XMPPAtomJid]                   = @"jid",
+	[XMPPAtomName]                  = @"name",
+	[XMPPAtomSubscription]          = @"subscription",
+	[XMPPAtomAsk]                   = @"ask",
+	[XMPPAtomNode]                  = @"node",
+	[XMPPAtomVer]                   = @"ver",
+	[XMPPAtomHash]                  = @"hash",
+	
+	[XMPPAtomGet]                   = @"get",
+	[XMPPAtomSet]                   = @"set",
+	[XMPPAtomResult]                = @"result",
+	
+	[XMPPAtomAvailable]             = @"available",
+	[XMPPAtomUnavailable]           = @"unavailable",
+	[XMPPAtomSubscribe]             = @"subscribe",
+	[XMPPAtomSubscribed]            = @"subscribed",
+	[XMPPAtomUnsubscribe]           = @"unsubscribe",
+	[XMPPAtomUnsubscribed]          = @"unsubscribed",
+	[XMPPAtomProbe]                 = @"probe",
+	
+	[XMPPAtomNormal]                = @"normal",
+	[XMPPAtomChat]                  = @"chat",
+	[XMPPAtomGroupchat]             = @"groupchat",
+	[XMPPAtomHeadline]              = @"headline",
+	
+	[XMPPAtomAway]                  = @"away",
+	[XMPPAtomXA]                    = @"xa",
+	[XMPPAtomDND]                   = @"dnd",
+	
+	[XMPPAtomActive]                = @"active",
+	[XMPPAtomComposing]             = @"composing",
+	[XMPPAtomPaused]                = @"paused",
+	[XMPPAtomInactive]              = @"inactive",
+	[XMPPAtomGone]                  = @"gone",
+	
+	[XMPPAtomJabberClientNamespace] = @"jabber:client",
+	[XMPPAtomStreamsNamespace]      = @"http://etherx.jabber.org/streams",
+	[XMPPAtomStreamErrorsNamespace] = @"urn:ietf:params:xml:ns:xmpp-streams",
+	[XMPPAtomStanzaErrorsNamespace] = @"urn:ietf:params:xml:ns:xmpp-stanzas",
+	[XMPPAtomTLSNamespace]          = @"urn:ietf:params:xml:ns:xmpp-tls",
+	[XMPPAtomSASLNamespace]         = @"urn:ietf:params:xml:ns:xmpp-sasl",
+	[XMPPAtomBindNamespace]         = @"urn:ietf:params:xml:ns:xmpp-bind",
+	[XMPPAtomSessionNamespace]      = @"urn:ietf:params:xml:ns:xmpp-session",
+	[XMPPAtomRosterNamespace]       = @"jabber:iq:roster",
+	[XMPPAtomChatStatesNamespace]   = @"http://jabber.org/protocol/chatstates",
+	[XMPPAtomCapsNamespace]         = @"http://jabber.org/protocol/caps",
+	[XMPPAtomDiscoInfoNamespace]    = @"http://jabber.org/protocol/disco#info",
+	[XMPPAtomPingNamespace]         = @"urn:xmpp:ping",
+	[XMPPAtomDelayNamespace]        = @"urn:xmpp:delay",
+	[XMPPAtomLegacyDelayNamespace]  = @"jabber:x:delay",
+	[XMPPAtomVCardNamespace]        = @"vcard-temp",
+};
+
+static const char *atomBytes[XMPPAtomCount];
+static size_t atomLengths[XMPPAtomCount];
+
+// Maps the bytes of an atom to the atom (zero marks an empty slot)
+static uint8_t bytesTable[XMPP_ATOM_TABLE_SIZE];
+
+// Maps the address of a shared atom string to the atom
+static const void *pointerTableKeys[XMPP_ATOM_TABLE_SIZE];
+static uint8_t pointerTableValues[XMPP_ATOM_TABLE_SIZE];
+
+static dispatch_once_t atomTablesOnceToken;
+
+static inline uint32_t XMPPAtomHashBytes(const char *bytes, size_t length)
+{
+	// FNV-1a
+	
+	uint32_t hash = 2166136261U;
+	
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)bytes[i];
+		hash *= 16777619U;
+	}
+	
+	return hash;
+}
+
+static inline uint32_t XMPPAtomHashPointer(const void *ptr)
+{
+	uintptr_t value = (uintptr_t)ptr;
+	
+	return (uint32_t)(((value >> 3) * 2654435761U) >> 8);
+}
+
+static void XMPPAtomBuildTables(void)
+{
+	NSCAssert(XMPPAtomCount < UINT8_MAX, @"Atoms no longer fit in the lookup tables");
+	
+	int atom;
+	for (atom = 1; atom < XMPPAtomCount; atom++)
+	{
+		NSString *str = atomStrings[atom];
+		NSCAssert(str != nil, @"Missing string for atom %d", atom);
+		
+		atomBytes[atom] = [str UTF8String];
+		atomLengths[atom] = strlen(atomBytes[atom]);
+		
+		NSCAssert(atomLengths[atom] <= XMPP_ATOM_MAX_LENGTH, @"Atom longer than XMPP_ATOM_MAX_LENGTH: %@", str);
+		
+		uint32_t i = XMPPAtomHashBytes(atomBytes[atom], atomLengths[atom]) % XMPP_ATOM_TABLE_SIZE;
+		while (bytesTable[i] != 0)
+		{
+			i = (i + 1) % XMPP_ATOM_TABLE_SIZE;
+		}
+		bytesTable[i] = (uint8_t)atom;
+		
+		uint32_t j = XMPPAtomHashPointer((__bridge const void *)str) % XMPP_ATOM_TABLE_SIZE;
+		while (pointerTableKeys[j] != NULL)
+		{
+			j = (j + 1) % XMPP_ATOM_TABLE_SIZE;
+		}
+		pointerTableKeys[j] = (__bridge const void *)str;
+		pointerTableValues[j] = (uint8_t)atom;
+	}
+}
+
+static inline void XMPPAtomInitialize(void)
+{
+	dispatch_once(&atomTablesOnceToken, ^{
+		
+		XMPPAtomBuildTables();
+	});
+}
+
+static XMPPAtom XMPPAtomLookupBytes(const char *bytes, size_t length)
+{
+	if (length == 0 || length > XMPP_ATOM_MAX_LENGTH) return XMPPAtomNone;
+	
+	uint32_t i = XMPPAtomHashBytes(bytes, length) % XMPP_ATOM_TABLE_SIZE;
+	uint8_t atom;
+	
+	while ((atom = bytesTable[i]) != 0)
+	{
+		if (atomLengths[atom] == length && memcmp(atomBytes[atom], bytes, length) == 0)
+		{
+			return (XMPPAtom)atom;
+		}
+		
+		i = (i + 1) % XMPP_ATOM_TABLE_SIZE;
+	}
+	
+	return XMPPAtomNone;
+}
+
+static XMPPAtom XMPPAtomLookupPointer(const void *ptr)
+{
+	uint32_t i = XMPPAtomHashPointer(ptr) % XMPP_ATOM_TABLE_SIZE;
+	const void *key;
+	
+	while ((key = pointerTableKeys[i]) != NULL)
+	{
+		if (key == ptr)
+		{
+			return (XMPPAtom)pointerTableValues[i];
+		}
+		
+		i = (i + 1) % XMPP_ATOM_TABLE_SIZE;
+	}
+	
+	return XMPPAtomNone;
+}
+
+/**
+ * Looks up the given string by its characters.
+ * Every atom is plain ASCII, so anything else can't be an atom.
+**/
+static XMPPAtom XMPPAtomLookupString(NSString *str, BOOL foldCase)
+{
+	CFStringRef cfStr = (__bridge CFStringRef)str;
+	
+	CFIndex length = CFStringGetLength(cfStr);
+	if (length == 0 || length > XMPP_ATOM_MAX_LENGTH) return XMPPAtomNone;
+	
+	char buf[XMPP_ATOM_MAX_LENGTH];
+	
+	const char *cStr = CFStringGetCStringPtr(cfStr, kCFStringEncodingASCII);
+	if (cStr == NULL)
+	{
+		CFIndex usedLength = 0;
+		CFIndex converted = CFStringGetBytes(cfStr, CFRangeMake(0, length), kCFStringEncodingASCII, 0, false,
+		                                     (UInt8 *)buf, sizeof(buf), &usedLength);
+		
+		if (converted != length) return XMPPAtomNone;
+		
+		cStr = buf;
+	}
+	
+	if (foldCase)
+	{
+		CFIndex i;
+		for (i = 0; i < length; i++)
+		{
+			char c = cStr[i];
+			buf[i] = (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+		}
+		
+		cStr = buf;
+	}
+	
+	return XMPPAtomLookupBytes(cStr, (size_t)length);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Public API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+XMPPAtom XMPPAtomForString(NSString *str)
+{
+	if (str == nil) return XMPPAtomNone;
+	
+	XMPPAtomInitialize();
+	
+	XMPPAtom atom = XMPPAtomLookupPointer((__bridge const void *)str);
+	if (atom != XMPPAtomNone) return atom;
+	
+	return XMPPAtomLookupString(str, NO);
+}
+
+XMPPAtom XMPPAtomForCaseInsensitiveString(NSString *str)
+{
+	if (str == nil) return XMPPAtomNone;
+	
+	XMPPAtomInitialize();
+	
+	XMPPAtom atom = XMPPAtomLookupPointer((__bridge const void *)str);
+	if (atom != XMPPAtomNone) return atom;
+	
+	return XMPPAtomLookupString(str, YES);
+}
+
+XMPPAtom XMPPAtomForUTF8Bytes(const char *bytes, size_t length)
+{
+	if (bytes == NULL) return XMPPAtomNone;
+	
+	XMPPAtomInitialize();
+	
+	return XMPPAtomLookupBytes(bytes, length);
+}
+
+XMPPAtom XMPPAtomForCString(const char *cString)
+{
+	if (cString == NULL) return XMPPAtomNone;
+	
+	XMPPAtomInitialize();
+	
+	return XMPPAtomLookupBytes(cString, strnlen(cString, XMPP_ATOM_MAX_LENGTH + 1));
+}
+
+NSString *XMPPAtomString(XMPPAtom atom)
+{
+	if (atom <= XMPPAtomNone || atom >= XMPPAtomCount) return nil;
+	
+	return atomStrings[atom];
+}
+
+const char *XMPPAtomUTF8String(XMPPAtom atom, size_t *lengthPtr)
+{
+	if (atom <= XMPPAtomNone || atom >= XMPPAtomCount) return NULL;
+	
+	XMPPAtomInitialize();
+	
+	if (lengthPtr) *lengthPtr = atomLengths[atom];
+	return atomBytes[atom];
+}
@@ -0,0 +1,153 @@
+#import <Foundation/Foundation.h>
+
+#if TARGET_OS_IPHONE
+  #import "DDXML.h"
+#endif
+
+@class XMPPJID;
+@class XMPPReceivedStanza;
+
+/**
+ * XMPPBinaryEncoder & XMPPBinaryDecoder implement a compact binary format for elements (stanzas), JIDs & roster items.
+ *
+ * The format is intended for local persistence (e.g. a cache of stored messages),
+ * and for handing stanzas from one process to another.
+ * Compared to archiving elements as XML strings (which is what NSCoding does):
+ *
+ * - Names, namespaces and common values (the XMPP vocabulary, see XMPPAtoms.h) are stored as small integers.
+ * - Decoding an element doesn't involve an XML parser.
+ *   An element is decoded straight into an XMPPReceivedStanza, which is a single allocation,
+ *   and the DOM is only created if somebody asks for it.
+ * - Records are length prefixed, so the decoder only has to scan the record headers up front.
+ *   Every record is decoded lazily, upon request, directly from the (optionally memory mapped) data.
+ *
+ * Since the vocabulary is part of the format, data can only be decoded by a version of the framework
+ * with the same vocabulary. (The decoder checks this, and refuses data it can't decode.)
+ * So the format is well suited for caches and IPC, but not as a long-term archive or interchange format.
+ *
+ * Neither class is thread-safe.
+ * They are designed to be used within a thread-safe context (e.g. within a single dispatch_queue).
+**/
+
+extern NSString *const XMPPBinaryCodingErrorDomain;
+
+enum XMPPBinaryCodingErrorCode
+{
+	XMPPBinaryCodingInvalidFormatError,           // The data isn't in the binary format, or is corrupt
+	XMPPBinaryCodingIncompatibleVocabularyError,  // The data was encoded with a different version of the vocabulary
+};
+typedef enum XMPPBinaryCodingErrorCode XMPPBinaryCodingErrorCode;
+
+enum XMPPBinaryRecordType
+{
+	XMPPBinaryRecordTypeUnknown = 0,
+	XMPPBinaryRecordTypeElement,
+	XMPPBinaryRecordTypeJID,
+	XMPPBinaryRecordTypeRosterItem,
+};
+typedef enum XMPPBinaryRecordType XMPPBinaryRecordType;
+
+
+@interface XMPPBinaryEncoder : NSObject
+
+/**
+ * Each of the encode methods appends a single record to the data, and returns YES.
+ * 
+ * A record may not exceed 16 MB (the decoder refuses anything larger).
+ * If it would, nothing is appended and NO is returned. (Nor is anything appended for nil.)
+**/
+
+/**
+ * Only element, text and attribute nodes (and namespace declarations) are encoded.
+ * Comments and processing instructions are skipped.
+**/
+- (BOOL)encodeElement:(NSXMLElement *)element;
+
+/**
+ * The stanza is encoded directly from its compact representation, without promoting it.
+**/
+- (BOOL)encodeReceivedStanza:(XMPPReceivedStanza *)stanza;
+
+- (BOOL)encodeJID:(XMPPJID *)jid;
+
+/**
+ * A roster item is a (bare) jid along with the attributes of its roster <item/> (name, subscription, ask, etc).
+ * 
+ * The attribute names must be strings. The values may be strings or numbers (including booleans),
+ * and are decoded with the same type (integers are stored as 64 bit signed integers).
+ * If any attribute is of another type, nothing is appended and NO is returned.
+**/
+- (BOOL)encodeRosterItemWithJID:(XMPPJID *)jid attributes:(NSDictionary *)attributes;
+
+/**
+ * The number of records that have been encoded.
+**/
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ * Returns all the records encoded so far (along with the header).
+ * The encoder may continue to be used afterwards.
+**/
+- (NSData *)data;
+
+@end
+
+
+@interface XMPPBinaryDecoder : NSObject
+
+/**
+ * Scans the record headers of the given data.
+ * The records themselves aren't decoded until they're requested.
+ *
+ * Returns nil (and sets the error) if the data isn't valid.
+ * Since every record is located via the length of the previous ones, a single record with a corrupt header
+ * (or a truncated last record) makes the rest of the data unusable, so the entire data is rejected.
+ * A record whose payload is corrupt is only detected when it's decoded,
+ * in which case the methods below return nil (or NO) for that record alone.
+**/
+- (id)initWithData:(NSData *)data error:(NSError **)errPtr;
+
+/**
+ * Memory maps the given file (if possible), and scans its record headers.
+**/
++ (XMPPBinaryDecoder *)decoderWithContentsOfFile:(NSString *)path error:(NSError **)errPtr;
+
+/**
+ * The number of records.
+**/
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ * Returns the type of the record at the given index.
+ * Records of types unknown to this version of the framework are skipped by the decoder,
+ * and reported as XMPPBinaryRecordTypeUnknown.
+**/
+- (XMPPBinaryRecordType)typeOfRecordAtIndex:(NSUInteger)index;
+
+/**
+ * Decodes the element at the given index into an XMPPReceivedStanza.
+ * This is the cheapest way to inspect a stored element, as no DOM is created unless asked for.
+ *
+ * Returns nil if the record isn't an element, or is corrupt.
+**/
+- (XMPPReceivedStanza *)stanzaAtIndex:(NSUInteger)index;
+
+/**
+ * Decodes the element at the given index into a regular element.
+ * If the element is an iq, message or presence, an XMPPIQ, XMPPMessage or XMPPPresence is returned.
+ *
+ * Returns nil if the record isn't an element, or is corrupt.
+**/
+- (NSXMLElement *)elementAtIndex:(NSUInteger)index;
+
+/**
+ * Returns nil if the record isn't a JID, or is corrupt.
+**/
+- (XMPPJID *)jidAtIndex:(NSUInteger)index;
+
+/**
+ * Returns NO if the record isn't a roster item, or is corrupt.
+**/
+- (BOOL)decodeRosterItemAtIndex:(NSUInteger)index jid:(XMPPJID **)jidPtr attributes:(NSDictionary **)attributesPtr;
+
+@end
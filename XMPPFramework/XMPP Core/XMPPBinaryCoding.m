@@ -0,0 +1,1087 @@
+#import "XMPPBinaryCoding.h"
+#import "XMPPInternal.h"
+#import "XMPPAtoms.h"
+#import "XMPPJID.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+/**
+ * The format:
+ *
+ * data     := header record*
+ * header   := 'X' 'M' 'P' 'B'  version (1 byte)  0 0 0  vocabulary hash (4 bytes, little endian)
+ * record   := type (1 byte)  length (varint)  payload (length bytes)
+ *
+ * element  := name  count (prefix uri)*  count (name value)*  count child*
+ * child    := 0 element
+ *           | 1 text
+ * jid      := user domain resource
+ * roster   := jid  count (name value)*
+ * value    := 0 string
+ *           | 1 int64 (8 bytes, little endian)
+ *           | 2 double (8 bytes, IEEE 754, little endian)
+ *           | 3 bool (1 byte)
+ *
+ * Every count and length is an unsigned LEB128 varint (of at most 32 bits).
+ * Every string is a varint reference:
+ *
+ * 0      : nil
+ * odd n  : an inline UTF-8 string of (n >> 1) bytes, which immediately follow
+ * even n : the atom (n >> 1), i.e. one of the well-known strings of the XMPP vocabulary
+ *
+ * Atoms are numbered by their position in the XMPPAtom enum,
+ * so the header includes a hash of the vocabulary, and the decoder rejects data encoded with a different one.
+**/
+
+#define XMPP_BINARY_VERSION  2
+
+#define XMPP_BINARY_HEADER_LENGTH  12
+
+// Atoms expand to at most 48 bytes, so the decoded arena of a record this size still fits in 32 bits
+#define XMPP_BINARY_MAX_RECORD_LENGTH  (16 * 1024 * 1024)
+
+// Protects the (recursive) decoder from maliciously deep elements
+#define XMPP_BINARY_MAX_DEPTH  256
+
+NSString *const XMPPBinaryCodingErrorDomain = @"XMPPBinaryCodingErrorDomain";
+
+enum XMPPBinaryChildKind
+{
+	XMPPBinaryChildKindElement = 0,
+	XMPPBinaryChildKindText    = 1,
+};
+
+enum XMPPBinaryValueKind
+{
+	XMPPBinaryValueKindString  = 0,
+	XMPPBinaryValueKindInteger = 1,
+	XMPPBinaryValueKindDouble  = 2,
+	XMPPBinaryValueKindBool    = 3,
+};
+
+static uint32_t XMPPBinaryVocabularyHash(void)
+{
+	static uint32_t vocabularyHash;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		
+		// FNV-1a over every atom (including its terminating NULL)
+		
+		uint32_t hash = 2166136261U;
+		
+		int atom;
+		for (atom = 1; atom < XMPPAtomCount; atom++)
+		{
+			size_t length = 0;
+			const char *bytes = XMPPAtomUTF8String((XMPPAtom)atom, &length);
+			
+			size_t i;
+			for (i = 0; i <= length; i++)
+			{
+				hash ^= (uint8_t)bytes[i];
+				hash *= 16777619U;
+			}
+		}
+		
+		vocabularyHash = hash;
+	});
+	
+	return vocabularyHash;
+}
+
+static NSError *XMPPBinaryError(XMPPBinaryCodingErrorCode code, NSString *errMsg)
+{
+	NSDictionary *info = [NSDictionary dictionaryWithObject:errMsg forKey:NSLocalizedDescriptionKey];
+	
+	return [NSError errorWithDomain:XMPPBinaryCodingErrorDomain code:code userInfo:info];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Writing
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	uint8_t *bytes;
+	size_t length;
+	size_t capacity;
+	BOOL overflow; // Something didn't fit into a record (see appendRecordWithType:)
+} XMPPBinaryBuffer;
+
+static inline void XMPPBinaryBufferReserve(XMPPBinaryBuffer *buffer, size_t extra)
+{
+	if (buffer->length + extra <= buffer->capacity) return;
+	
+	size_t capacity = MAX(MAX(buffer->capacity * 2, buffer->length + extra), 256);
+	
+	buffer->bytes = reallocf(buffer->bytes, capacity);
+	buffer->capacity = capacity;
+	
+	NSCAssert(buffer->bytes != NULL, @"Unable to allocate binary buffer");
+}
+
+static inline void XMPPBinaryAppendBytes(XMPPBinaryBuffer *buffer, const void *bytes, size_t length)
+{
+	XMPPBinaryBufferReserve(buffer, length);
+	
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+}
+
+static inline void XMPPBinaryAppendVarint(XMPPBinaryBuffer *buffer, uint32_t value)
+{
+	XMPPBinaryBufferReserve(buffer, 5);
+	
+	while (value >= 0x80)
+	{
+		buffer->bytes[buffer->length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer->bytes[buffer->length++] = (uint8_t)value;
+}
+
+static void XMPPBinaryAppendSpan(XMPPBinaryBuffer *buffer, const char *bytes, size_t length)
+{
+	XMPPAtom atom = XMPPAtomForUTF8Bytes(bytes, length);
+	if (atom != XMPPAtomNone)
+	{
+		XMPPBinaryAppendVarint(buffer, (uint32_t)atom << 1);
+		return;
+	}
+	
+	if (length > XMPP_BINARY_MAX_RECORD_LENGTH)
+	{
+		buffer->overflow = YES;
+		return;
+	}
+	
+	XMPPBinaryAppendVarint(buffer, ((uint32_t)length << 1) | 1);
+	XMPPBinaryAppendBytes(buffer, bytes, length);
+}
+
+static void XMPPBinaryAppendString(XMPPBinaryBuffer *buffer, NSString *str)
+{
+	if (str == nil)
+	{
+		XMPPBinaryAppendVarint(buffer, 0);
+		return;
+	}
+	
+	XMPPAtom atom = XMPPAtomForString(str);
+	if (atom != XMPPAtomNone)
+	{
+		XMPPBinaryAppendVarint(buffer, (uint32_t)atom << 1);
+		return;
+	}
+	
+	const char *cStr = CFStringGetCStringPtr((__bridge CFStringRef)str, kCFStringEncodingUTF8);
+	if (cStr == NULL)
+	{
+		cStr = [str UTF8String];
+	}
+	
+	size_t length = strlen(cStr);
+	
+	if (length > XMPP_BINARY_MAX_RECORD_LENGTH)
+	{
+		buffer->overflow = YES;
+		return;
+	}
+	
+	XMPPBinaryAppendVarint(buffer, ((uint32_t)length << 1) | 1);
+	XMPPBinaryAppendBytes(buffer, cStr, length);
+}
+
+static void XMPPBinaryAppendElement(XMPPBinaryBuffer *buffer, NSXMLElement *element)
+{
+	XMPPBinaryAppendString(buffer, [element name]);
+	
+	NSArray *namespaces = [element namespaces];
+	
+	XMPPBinaryAppendVarint(buffer, (uint32_t)[namespaces count]);
+	for (NSXMLNode *ns in namespaces)
+	{
+		XMPPBinaryAppendString(buffer, [ns name] ?: @"");
+		XMPPBinaryAppendString(buffer, [ns stringValue] ?: @"");
+	}
+	
+	NSArray *attributes = [element attributes];
+	
+	XMPPBinaryAppendVarint(buffer, (uint32_t)[attributes count]);
+	for (NSXMLNode *attribute in attributes)
+	{
+		XMPPBinaryAppendString(buffer, [attribute name]);
+		XMPPBinaryAppendString(buffer, [attribute stringValue] ?: @"");
+	}
+	
+	NSArray *children = [element children];
+	uint32_t childCount = 0;
+	
+	for (NSXMLNode *child in children)
+	{
+		NSXMLNodeKind kind = [child kind];
+		
+		if (kind == NSXMLElementKind || kind == NSXMLTextKind)
+			childCount++;
+	}
+	
+	XMPPBinaryAppendVarint(buffer, childCount);
+	for (NSXMLNode *child in children)
+	{
+		NSXMLNodeKind kind = [child kind];
+		
+		if (kind == NSXMLElementKind)
+		{
+			XMPPBinaryAppendVarint(buffer, XMPPBinaryChildKindElement);
+			XMPPBinaryAppendElement(buffer, (NSXMLElement *)child);
+		}
+		else if (kind == NSXMLTextKind)
+		{
+			XMPPBinaryAppendVarint(buffer, XMPPBinaryChildKindText);
+			XMPPBinaryAppendString(buffer, [child stringValue] ?: @"");
+		}
+	}
+}
+
+static void XMPPBinaryAppendArenaElement(XMPPBinaryBuffer *buffer, const XMPPStanzaArena *arena, uint32_t index)
+{
+	const XMPPStanzaNode *node = &arena->nodes[index];
+	
+	XMPPBinaryAppendSpan(buffer, arena->bytes + node->offset, node->length);
+	
+	// The arena stores the namespaces of an element ahead of its attributes
+	
+	uint32_t firstAttribute = node->firstAttribute;
+	uint32_t lastAttribute = node->firstAttribute + node->attributeCount;
+	
+	uint32_t namespaceCount = 0;
+	while (namespaceCount < node->attributeCount &&
+	       arena->attributes[firstAttribute + namespaceCount].kind == XMPPStanzaAttributeKindNamespace)
+	{
+		namespaceCount++;
+	}
+	
+	uint32_t i;
+	
+	XMPPBinaryAppendVarint(buffer, namespaceCount);
+	for (i = firstAttribute; i < firstAttribute + namespaceCount; i++)
+	{
+		const XMPPStanzaAttribute *attr = &arena->attributes[i];
+		
+		XMPPBinaryAppendSpan(buffer, arena->bytes + attr->nameOffset, attr->nameLength);
+		XMPPBinaryAppendSpan(buffer, arena->bytes + attr->valueOffset, attr->valueLength);
+	}
+	
+	XMPPBinaryAppendVarint(buffer, node->attributeCount - namespaceCount);
+	for (i = firstAttribute + namespaceCount; i < lastAttribute; i++)
+	{
+		const XMPPStanzaAttribute *attr = &arena->attributes[i];
+		
+		XMPPBinaryAppendSpan(buffer, arena->bytes + attr->nameOffset, attr->nameLength);
+		XMPPBinaryAppendSpan(buffer, arena->bytes + attr->valueOffset, attr->valueLength);
+	}
+	
+	uint32_t childCount = 0;
+	uint32_t child;
+	
+	for (child = node->firstChild; child != XMPP_STANZA_NONE; child = arena->nodes[child].nextSibling)
+	{
+		childCount++;
+	}
+	
+	XMPPBinaryAppendVarint(buffer, childCount);
+	for (child = node->firstChild; child != XMPP_STANZA_NONE; child = arena->nodes[child].nextSibling)
+	{
+		const XMPPStanzaNode *childNode = &arena->nodes[child];
+		
+		if (childNode->kind == XMPPStanzaNodeKindElement)
+		{
+			XMPPBinaryAppendVarint(buffer, XMPPBinaryChildKindElement);
+			XMPPBinaryAppendArenaElement(buffer, arena, child);
+		}
+		else
+		{
+			XMPPBinaryAppendVarint(buffer, XMPPBinaryChildKindText);
+			XMPPBinaryAppendSpan(buffer, arena->bytes + childNode->offset, childNode->length);
+		}
+	}
+}
+
+static void XMPPBinaryAppendUInt64(XMPPBinaryBuffer *buffer, uint64_t value)
+{
+	uint8_t bytes[8];
+	
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		bytes[i] = (uint8_t)(value >> (8 * i));
+	}
+	
+	XMPPBinaryAppendBytes(buffer, bytes, sizeof(bytes));
+}
+
+/**
+ * Appends a string or number (including booleans), along with its kind.
+ * Returns NO (without appending anything) for any other type of value.
+**/
+static BOOL XMPPBinaryAppendValue(XMPPBinaryBuffer *buffer, id value)
+{
+	uint8_t kind;
+	
+	if ([value isKindOfClass:[NSString class]])
+	{
+		kind = XMPPBinaryValueKindString;
+		XMPPBinaryAppendBytes(buffer, &kind, 1);
+		XMPPBinaryAppendString(buffer, value);
+		
+		return YES;
+	}
+	
+	if (![value isKindOfClass:[NSNumber class]])
+	{
+		return NO;
+	}
+	
+	CFNumberRef number = (__bridge CFNumberRef)value;
+	
+	if (CFGetTypeID(number) == CFBooleanGetTypeID())
+	{
+		uint8_t boolByte = [value boolValue] ? 1 : 0;
+		
+		kind = XMPPBinaryValueKindBool;
+		XMPPBinaryAppendBytes(buffer, &kind, 1);
+		XMPPBinaryAppendBytes(buffer, &boolByte, 1);
+	}
+	else if (CFNumberIsFloatType(number))
+	{
+		double d = [value doubleValue];
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		
+		kind = XMPPBinaryValueKindDouble;
+		XMPPBinaryAppendBytes(buffer, &kind, 1);
+		XMPPBinaryAppendUInt64(buffer, bits);
+	}
+	else
+	{
+		kind = XMPPBinaryValueKindInteger;
+		XMPPBinaryAppendBytes(buffer, &kind, 1);
+		XMPPBinaryAppendUInt64(buffer, (uint64_t)[value longLongValue]);
+	}
+	
+	return YES;
+}
+
+static void XMPPBinaryAppendJID(XMPPBinaryBuffer *buffer, XMPPJID *jid)
+{
+	XMPPBinaryAppendString(buffer, [jid user]);
+	XMPPBinaryAppendString(buffer, [jid domain]);
+	XMPPBinaryAppendString(buffer, [jid resource]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Reading
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const uint8_t *bytes;
+	const uint8_t *end;
+} XMPPBinaryReader;
+
+/**
+ * A string reference, resolved to its bytes.
+ * The bytes are NULL for a nil string.
+**/
+typedef struct {
+	const char *bytes;
+	uint32_t length;
+	XMPPAtom atom;
+} XMPPBinaryString;
+
+static BOOL XMPPBinaryReadVarint(XMPPBinaryReader *reader, uint32_t *valuePtr)
+{
+	uint32_t value = 0;
+	int shift = 0;
+	
+	while (reader->bytes < reader->end)
+	{
+		uint8_t byte = *reader->bytes++;
+		
+		if (shift == 28 && (byte & 0xF0))
+		{
+			// More than 32 bits
+			return NO;
+		}
+		
+		value |= (uint32_t)(byte & 0x7F) << shift;
+		
+		if ((byte & 0x80) == 0)
+		{
+			*valuePtr = value;
+			return YES;
+		}
+		
+		shift += 7;
+	}
+	
+	return NO;
+}
+
+static BOOL XMPPBinaryReadString(XMPPBinaryReader *reader, XMPPBinaryString *strPtr)
+{
+	uint32_t ref;
+	if (!XMPPBinaryReadVarint(reader, &ref)) return NO;
+	
+	if (ref == 0)
+	{
+		strPtr->bytes = NULL;
+		strPtr->length = 0;
+		strPtr->atom = XMPPAtomNone;
+		return YES;
+	}
+	
+	if (ref & 1)
+	{
+		uint32_t length = ref >> 1;
+		if ((size_t)(reader->end - reader->bytes) < length) return NO;
+		
+		strPtr->bytes = (const char *)reader->bytes;
+		strPtr->length = length;
+		strPtr->atom = XMPPAtomNone;
+		
+		reader->bytes += length;
+		return YES;
+	}
+	
+	size_t length = 0;
+	const char *bytes = XMPPAtomUTF8String((XMPPAtom)(ref >> 1), &length);
+	if (bytes == NULL) return NO;
+	
+	strPtr->bytes = bytes;
+	strPtr->length = (uint32_t)length;
+	strPtr->atom = (XMPPAtom)(ref >> 1);
+	return YES;
+}
+
+/**
+ * Reads a string reference as an NSString.
+ * Atoms resolve to the shared atom strings, so they don't allocate anything.
+**/
+static BOOL XMPPBinaryReadNSString(XMPPBinaryReader *reader, NSString **strPtr)
+{
+	XMPPBinaryString str;
+	if (!XMPPBinaryReadString(reader, &str)) return NO;
+	
+	if (str.bytes == NULL)
+	{
+		*strPtr = nil;
+		return YES;
+	}
+	
+	if (str.atom != XMPPAtomNone)
+	{
+		*strPtr = XMPPAtomString(str.atom);
+		return YES;
+	}
+	
+	*strPtr = [[NSString alloc] initWithBytes:str.bytes length:str.length encoding:NSUTF8StringEncoding];
+	
+	return (*strPtr != nil);
+}
+
+static BOOL XMPPBinaryReadUInt64(XMPPBinaryReader *reader, uint64_t *valuePtr)
+{
+	if ((size_t)(reader->end - reader->bytes) < 8) return NO;
+	
+	uint64_t value = 0;
+	
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		value |= (uint64_t)reader->bytes[i] << (8 * i);
+	}
+	
+	reader->bytes += 8;
+	
+	*valuePtr = value;
+	return YES;
+}
+
+/**
+ * Reads a value written by XMPPBinaryAppendValue, as an NSString or NSNumber.
+**/
+static BOOL XMPPBinaryReadValue(XMPPBinaryReader *reader, id *valuePtr)
+{
+	if (reader->bytes >= reader->end) return NO;
+	
+	uint8_t kind = *reader->bytes++;
+	uint64_t bits;
+	
+	switch (kind)
+	{
+		case XMPPBinaryValueKindString:
+		{
+			NSString *str = nil;
+			if (!XMPPBinaryReadNSString(reader, &str) || str == nil) return NO;
+			
+			*valuePtr = str;
+			return YES;
+		}
+		case XMPPBinaryValueKindInteger:
+		{
+			if (!XMPPBinaryReadUInt64(reader, &bits)) return NO;
+			
+			*valuePtr = [NSNumber numberWithLongLong:(long long)bits];
+			return YES;
+		}
+		case XMPPBinaryValueKindDouble:
+		{
+			if (!XMPPBinaryReadUInt64(reader, &bits)) return NO;
+			
+			double d;
+			memcpy(&d, &bits, sizeof(d));
+			
+			*valuePtr = [NSNumber numberWithDouble:d];
+			return YES;
+		}
+		case XMPPBinaryValueKindBool:
+		{
+			if (reader->bytes >= reader->end) return NO;
+			
+			*valuePtr = [NSNumber numberWithBool:(*reader->bytes++ != 0)];
+			return YES;
+		}
+		default:
+		{
+			return NO;
+		}
+	}
+}
+
+/**
+ * First pass: validate the element, and figure out how much space its arena needs.
+**/
+static BOOL XMPPBinaryMeasureElement(XMPPBinaryReader *reader, XMPPStanzaArena *arena, int depth)
+{
+	if (depth > XMPP_BINARY_MAX_DEPTH) return NO;
+	
+	XMPPBinaryString name;
+	if (!XMPPBinaryReadString(reader, &name) || name.bytes == NULL) return NO;
+	
+	arena->nodeCount++;
+	arena->byteCount += name.length;
+	
+	// Namespaces, then attributes
+	
+	int pass;
+	for (pass = 0; pass < 2; pass++)
+	{
+		uint32_t count;
+		if (!XMPPBinaryReadVarint(reader, &count)) return NO;
+		
+		uint32_t i;
+		for (i = 0; i < count; i++)
+		{
+			XMPPBinaryString attrName;
+			XMPPBinaryString attrValue;
+			
+			if (!XMPPBinaryReadString(reader, &attrName)) return NO;
+			if (!XMPPBinaryReadString(reader, &attrValue)) return NO;
+			
+			arena->attributeCount++;
+			arena->byteCount += attrName.length + attrValue.length;
+		}
+	}
+	
+	uint32_t childCount;
+	if (!XMPPBinaryReadVarint(reader, &childCount)) return NO;
+	
+	uint32_t i;
+	for (i = 0; i < childCount; i++)
+	{
+		uint32_t kind;
+		if (!XMPPBinaryReadVarint(reader, &kind)) return NO;
+		
+		if (kind == XMPPBinaryChildKindElement)
+		{
+			if (!XMPPBinaryMeasureElement(reader, arena, depth + 1)) return NO;
+		}
+		else if (kind == XMPPBinaryChildKindText)
+		{
+			XMPPBinaryString text;
+			if (!XMPPBinaryReadString(reader, &text)) return NO;
+			
+			arena->nodeCount++;
+			arena->byteCount += text.length;
+		}
+		else
+		{
+			return NO;
+		}
+	}
+	
+	return YES;
+}
+
+static uint32_t XMPPBinaryFillSpan(XMPPStanzaArena *arena, XMPPBinaryString *str)
+{
+	uint32_t offset = arena->byteCount;
+	
+	if (str->length > 0)
+	{
+		memcpy(arena->bytes + offset, str->bytes, str->length);
+		arena->byteCount += str->length;
+	}
+	
+	return offset;
+}
+
+/**
+ * Second pass: copy the (already validated) element into the arena.
+ * Returns the index of the node.
+**/
+static uint32_t XMPPBinaryFillElement(XMPPBinaryReader *reader, XMPPStanzaArena *arena)
+{
+	uint32_t index = arena->nodeCount++;
+	
+	XMPPBinaryString name;
+	XMPPBinaryReadString(reader, &name);
+	
+	XMPPStanzaNode *node = &arena->nodes[index];
+	node->kind = XMPPStanzaNodeKindElement;
+	node->firstChild = XMPP_STANZA_NONE;
+	node->nextSibling = XMPP_STANZA_NONE;
+	node->offset = XMPPBinaryFillSpan(arena, &name);
+	node->length = name.length;
+	node->firstAttribute = arena->attributeCount;
+	
+	const uint32_t kinds[2] = { XMPPStanzaAttributeKindNamespace, XMPPStanzaAttributeKindAttribute };
+	
+	int pass;
+	for (pass = 0; pass < 2; pass++)
+	{
+		uint32_t count = 0;
+		XMPPBinaryReadVarint(reader, &count);
+		
+		uint32_t i;
+		for (i = 0; i < count; i++)
+		{
+			XMPPBinaryString attrName;
+			XMPPBinaryString attrValue;
+			
+			XMPPBinaryReadString(reader, &attrName);
+			XMPPBinaryReadString(reader, &attrValue);
+			
+			XMPPStanzaAttribute *attr = &arena->attributes[arena->attributeCount++];
+			attr->kind = kinds[pass];
+			attr->nameOffset = XMPPBinaryFillSpan(arena, &attrName);
+			attr->nameLength = attrName.length;
+			attr->valueOffset = XMPPBinaryFillSpan(arena, &attrValue);
+			attr->valueLength = attrValue.length;
+		}
+	}
+	
+	node->attributeCount = arena->attributeCount - node->firstAttribute;
+	
+	uint32_t childCount = 0;
+	XMPPBinaryReadVarint(reader, &childCount);
+	
+	uint32_t lastChild = XMPP_STANZA_NONE;
+	
+	uint32_t i;
+	for (i = 0; i < childCount; i++)
+	{
+		uint32_t kind = 0;
+		XMPPBinaryReadVarint(reader, &kind);
+		
+		uint32_t childIndex;
+		
+		if (kind == XMPPBinaryChildKindElement)
+		{
+			childIndex = XMPPBinaryFillElement(reader, arena);
+		}
+		else
+		{
+			XMPPBinaryString text;
+			XMPPBinaryReadString(reader, &text);
+			
+			childIndex = arena->nodeCount++;
+			
+			XMPPStanzaNode *textNode = &arena->nodes[childIndex];
+			textNode->kind = XMPPStanzaNodeKindText;
+			textNode->firstChild = XMPP_STANZA_NONE;
+			textNode->nextSibling = XMPP_STANZA_NONE;
+			textNode->firstAttribute = 0;
+			textNode->attributeCount = 0;
+			textNode->offset = XMPPBinaryFillSpan(arena, &text);
+			textNode->length = text.length;
+		}
+		
+		if (lastChild == XMPP_STANZA_NONE)
+			node->firstChild = childIndex;
+		else
+			arena->nodes[lastChild].nextSibling = childIndex;
+		
+		lastChild = childIndex;
+	}
+	
+	return index;
+}
+
+static BOOL XMPPBinaryReadJID(XMPPBinaryReader *reader, XMPPJID **jidPtr)
+{
+	NSString *user;
+	NSString *domain;
+	NSString *resource;
+	
+	if (!XMPPBinaryReadNSString(reader, &user)) return NO;
+	if (!XMPPBinaryReadNSString(reader, &domain)) return NO;
+	if (!XMPPBinaryReadNSString(reader, &resource)) return NO;
+	
+	// The data may have come from another process, so the parts are validated just like any other jid
+	
+	*jidPtr = [XMPPJID jidWithUser:user domain:domain resource:resource];
+	
+	return (*jidPtr != nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPBinaryEncoder
+{
+	XMPPBinaryBuffer buffer;
+	XMPPBinaryBuffer record;
+}
+
+@synthesize count;
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		uint32_t vocabularyHash = XMPPBinaryVocabularyHash();
+		
+		uint8_t header[XMPP_BINARY_HEADER_LENGTH] = {
+			'X', 'M', 'P', 'B', XMPP_BINARY_VERSION, 0, 0, 0,
+			(uint8_t)(vocabularyHash      ), (uint8_t)(vocabularyHash >>  8),
+			(uint8_t)(vocabularyHash >> 16), (uint8_t)(vocabularyHash >> 24)
+		};
+		
+		XMPPBinaryAppendBytes(&buffer, header, sizeof(header));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(buffer.bytes);
+	free(record.bytes);
+}
+
+/**
+ * The payload of a record is built in a separate (reused) buffer,
+ * as its length has to be known before it can be appended.
+ * 
+ * Records that are too long for the decoder (see XMPP_BINARY_MAX_RECORD_LENGTH) are dropped,
+ * and NO is returned.
+**/
+- (BOOL)appendRecordWithType:(XMPPBinaryRecordType)type
+{
+	if (record.overflow || record.length > XMPP_BINARY_MAX_RECORD_LENGTH)
+	{
+		record.length = 0;
+		record.overflow = NO;
+		
+		return NO;
+	}
+	
+	uint8_t typeByte = (uint8_t)type;
+	
+	XMPPBinaryAppendBytes(&buffer, &typeByte, 1);
+	XMPPBinaryAppendVarint(&buffer, (uint32_t)record.length);
+	XMPPBinaryAppendBytes(&buffer, record.bytes, record.length);
+	
+	record.length = 0;
+	count++;
+	
+	return YES;
+}
+
+- (BOOL)encodeElement:(NSXMLElement *)element
+{
+	if (element == nil) return NO;
+	
+	XMPPBinaryAppendElement(&record, element);
+	return [self appendRecordWithType:XMPPBinaryRecordTypeElement];
+}
+
+- (BOOL)encodeReceivedStanza:(XMPPReceivedStanza *)stanza
+{
+	if (stanza == nil) return NO;
+	
+	XMPPBinaryAppendArenaElement(&record, [stanza arena], 0);
+	return [self appendRecordWithType:XMPPBinaryRecordTypeElement];
+}
+
+- (BOOL)encodeJID:(XMPPJID *)jid
+{
+	if (jid == nil) return NO;
+	
+	XMPPBinaryAppendJID(&record, jid);
+	return [self appendRecordWithType:XMPPBinaryRecordTypeJID];
+}
+
+- (BOOL)encodeRosterItemWithJID:(XMPPJID *)jid attributes:(NSDictionary *)attributes
+{
+	if (jid == nil) return NO;
+	
+	XMPPBinaryAppendJID(&record, jid);
+	
+	XMPPBinaryAppendVarint(&record, (uint32_t)[attributes count]);
+	
+	for (id key in attributes)
+	{
+		if (![key isKindOfClass:[NSString class]])
+		{
+			record.length = 0;
+			record.overflow = NO;
+			return NO;
+		}
+		
+		XMPPBinaryAppendString(&record, key);
+		
+		if (!XMPPBinaryAppendValue(&record, [attributes objectForKey:key]))
+		{
+			record.length = 0;
+			record.overflow = NO;
+			return NO;
+		}
+	}
+	
+	return [self appendRecordWithType:XMPPBinaryRecordTypeRosterItem];
+}
+
+- (NSData *)data
+{
+	return [NSData dataWithBytes:buffer.bytes length:buffer.length];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPBinaryDecoder
+{
+	NSData *data;
+	
+	NSUInteger *recordOffsets;
+	uint32_t *recordLengths;
+	uint8_t *recordTypes;
+}
+
+@synthesize count;
+
++ (XMPPBinaryDecoder *)decoderWithContentsOfFile:(NSString *)path error:(NSError **)errPtr
+{
+	NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:errPtr];
+	if (data == nil)
+	{
+		return nil;
+	}
+	
+	return [[XMPPBinaryDecoder alloc] initWithData:data error:errPtr];
+}
+
+- (id)initWithData:(NSData *)inData error:(NSError **)errPtr
+{
+	if ((self = [super init]))
+	{
+		data = inData;
+		
+		const uint8_t *bytes = [data bytes];
+		NSUInteger length = [data length];
+		
+		if (length < XMPP_BINARY_HEADER_LENGTH || memcmp(bytes, "XMPB", 4) != 0 || bytes[4] != XMPP_BINARY_VERSION)
+		{
+			if (errPtr) *errPtr = XMPPBinaryError(XMPPBinaryCodingInvalidFormatError, @"Unrecognized data format.");
+			return nil;
+		}
+		
+		uint32_t vocabularyHash = (uint32_t)bytes[8]         | ((uint32_t)bytes[9]  <<  8) |
+		                          ((uint32_t)bytes[10] << 16) | ((uint32_t)bytes[11] << 24);
+		
+		if (vocabularyHash != XMPPBinaryVocabularyHash())
+		{
+			if (errPtr) *errPtr = XMPPBinaryError(XMPPBinaryCodingIncompatibleVocabularyError,
+			                                      @"Data was encoded with a different XMPP vocabulary.");
+			return nil;
+		}
+		
+		// Scan the record headers
+		
+		XMPPBinaryReader reader = { bytes + XMPP_BINARY_HEADER_LENGTH, bytes + length };
+		NSUInteger capacity = 0;
+		
+		while (reader.bytes < reader.end)
+		{
+			uint8_t type = *reader.bytes++;
+			uint32_t recordLength;
+			
+			if (!XMPPBinaryReadVarint(&reader, &recordLength) ||
+			    recordLength > XMPP_BINARY_MAX_RECORD_LENGTH ||
+			    (size_t)(reader.end - reader.bytes) < recordLength)
+			{
+				if (errPtr) *errPtr = XMPPBinaryError(XMPPBinaryCodingInvalidFormatError, @"Truncated or corrupt record.");
+				return nil;
+			}
+			
+			if (count == capacity)
+			{
+				capacity = MAX(capacity * 2, 64);
+				
+				recordOffsets = reallocf(recordOffsets, capacity * sizeof(NSUInteger));
+				recordLengths = reallocf(recordLengths, capacity * sizeof(uint32_t));
+				recordTypes   = reallocf(recordTypes,   capacity * sizeof(uint8_t));
+				
+				if (!recordOffsets || !recordLengths || !recordTypes)
+				{
+					if (errPtr) *errPtr = XMPPBinaryError(XMPPBinaryCodingInvalidFormatError, @"Out of memory.");
+					return nil;
+				}
+			}
+			
+			if (type > XMPPBinaryRecordTypeRosterItem)
+			{
+				// From a newer version of the format
+				type = XMPPBinaryRecordTypeUnknown;
+			}
+			
+			recordOffsets[count] = (NSUInteger)(reader.bytes - bytes);
+			recordLengths[count] = recordLength;
+			recordTypes[count] = type;
+			count++;
+			
+			reader.bytes += recordLength;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(recordOffsets);
+	free(recordLengths);
+	free(recordTypes);
+}
+
+- (XMPPBinaryRecordType)typeOfRecordAtIndex:(NSUInteger)index
+{
+	if (index >= count) return XMPPBinaryRecordTypeUnknown;
+	
+	return (XMPPBinaryRecordType)recordTypes[index];
+}
+
+- (BOOL)getReader:(XMPPBinaryReader *)reader forRecordAtIndex:(NSUInteger)index type:(XMPPBinaryRecordType)type
+{
+	if (index >= count || recordTypes[index] != type) return NO;
+	
+	const uint8_t *bytes = (const uint8_t *)[data bytes] + recordOffsets[index];
+	
+	reader->bytes = bytes;
+	reader->end = bytes + recordLengths[index];
+	
+	return YES;
+}
+
+- (XMPPReceivedStanza *)stanzaAtIndex:(NSUInteger)index
+{
+	XMPPBinaryReader reader;
+	if (![self getReader:&reader forRecordAtIndex:index type:XMPPBinaryRecordTypeElement]) return nil;
+	
+	XMPPBinaryReader fillReader = reader;
+	
+	XMPPStanzaArena measured;
+	memset(&measured, 0, sizeof(measured));
+	
+	if (!XMPPBinaryMeasureElement(&reader, &measured, 0))
+	{
+		return nil;
+	}
+	
+	// A single allocation for the whole stanza, just like a received one
+	
+	size_t nodesSize = measured.nodeCount * sizeof(XMPPStanzaNode);
+	size_t attributesSize = measured.attributeCount * sizeof(XMPPStanzaAttribute);
+	
+	void *block = malloc(nodesSize + attributesSize + measured.byteCount);
+	if (block == NULL)
+	{
+		return nil;
+	}
+	
+	XMPPStanzaArena filled;
+	memset(&filled, 0, sizeof(filled));
+	
+	filled.nodes = (XMPPStanzaNode *)block;
+	filled.attributes = (XMPPStanzaAttribute *)((char *)block + nodesSize);
+	filled.bytes = (char *)block + nodesSize + attributesSize;
+	
+	XMPPBinaryFillElement(&fillReader, &filled);
+	
+	return [[XMPPReceivedStanza alloc] initWithArena:filled block:block];
+}
+
+- (NSXMLElement *)elementAtIndex:(NSUInteger)index
+{
+	return [[self stanzaAtIndex:index] element];
+}
+
+- (XMPPJID *)jidAtIndex:(NSUInteger)index
+{
+	XMPPBinaryReader reader;
+	if (![self getReader:&reader forRecordAtIndex:index type:XMPPBinaryRecordTypeJID]) return nil;
+	
+	XMPPJID *jid = nil;
+	XMPPBinaryReadJID(&reader, &jid);
+	
+	return jid;
+}
+
+- (BOOL)decodeRosterItemAtIndex:(NSUInteger)index jid:(XMPPJID **)jidPtr attributes:(NSDictionary **)attributesPtr
+{
+	XMPPBinaryReader reader;
+	if (![self getReader:&reader forRecordAtIndex:index type:XMPPBinaryRecordTypeRosterItem]) return NO;
+	
+	XMPPJID *jid = nil;
+	if (!XMPPBinaryReadJID(&reader, &jid)) return NO;
+	
+	uint32_t attributeCount;
+	if (!XMPPBinaryReadVarint(&reader, &attributeCount)) return NO;
+	
+	NSMutableDictionary *attributes = [NSMutableDictionary dictionaryWithCapacity:MIN(attributeCount, 8)];
+	
+	uint32_t i;
+	for (i = 0; i < attributeCount; i++)
+	{
+		NSString *key;
+		id value;
+		
+		if (!XMPPBinaryReadNSString(&reader, &key) || key == nil) return NO;
+		if (!XMPPBinaryReadValue(&reader, &value)) return NO;
+		
+		[attributes setObject:value forKey:key];
+	}
+	
+	if (jidPtr) *jidPtr = jid;
+	if (attributesPtr) *attributesPtr = attributes;
+	
+	return YES;
+}
+
+@end
@@ -1,5 +1,6 @@
 #import <Foundation/Foundation.h>
 #import "XMPPJID.h"
+#import "XMPPAtoms.h"
 
 #if TARGET_OS_IPHONE
   #import "DDXML.h"
@@ -26,6 +27,15 @@
 - (NSString *)toStr;
 - (NSString *)fromStr;
 
+/**
+ * Returns the atom for the element name (e.g. XMPPAtomMessage),
+ * and for the (case-insensitive) value of the type attribute (e.g. XMPPAtomChat).
+ * 
+ * Returns XMPPAtomNone if the value isn't part of the XMPP vocabulary, or if there is no type attribute.
+**/
+- (XMPPAtom)nameAtom;
+- (XMPPAtom)typeAtom;
+
 #pragma mark To and From Methods
 
 - (BOOL)isTo:(XMPPJID *)to;
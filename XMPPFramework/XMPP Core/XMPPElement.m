@@ -100,11 +100,21 @@
 	return [[self attributeForName:@"from"] stringValue];
 }
 
+- (XMPPAtom)nameAtom
+{
+	return XMPPAtomForString([self name]);
+}
+
+- (XMPPAtom)typeAtom
+{
+	return XMPPAtomForCaseInsensitiveString([self attributeStringValueForName:@"type"]);
+}
+
 - (XMPPJID *)from
 {
 	NSString *from = [self attributeStringValueForName:@"from"];
 	if ([from length])
-		return [XMPPJID jidWithString:from];
+		return [XMPPJID internedJIDWithString:from];
 	return nil;
 }
 
@@ -119,7 +129,7 @@
 {
 	NSString *to = [self attributeStringValueForName:@"to"];
 	if ([to length])
-		return [XMPPJID jidWithString:to];
+		return [XMPPJID internedJIDWithString:to];
 	return nil;
 }
 
@@ -149,22 +149,22 @@
 
 - (BOOL)isGetIQ
 {
-	return [[self type] isEqualToString:@"get"];
+	return [self typeAtom] == XMPPAtomGet;
 }
 
 - (BOOL)isSetIQ
 {
-	return [[self type] isEqualToString:@"set"];
+	return [self typeAtom] == XMPPAtomSet;
 }
 
 - (BOOL)isResultIQ
 {
-	return [[self type] isEqualToString:@"result"];
+	return [self typeAtom] == XMPPAtomResult;
 }
 
 - (BOOL)isErrorIQ
 {
-	return [[self type] isEqualToString:@"error"];
+	return [self typeAtom] == XMPPAtomError;
 }
 
 - (BOOL)requiresResponse
@@ -4,6 +4,11 @@
 
 #import "XMPPStream.h"
 #import "XMPPModule.h"
+#import "XMPPStreamHost.h"
+#import "XMPPStreamInstrumentation.h"
+#import "XMPPReceivedStanza.h"
+
+struct _xmlNode;
 
 // Define the various states we'll use to track our progress
 enum XMPPStreamState
@@ -73,3 +78,182 @@ extern NSString *const XMPPStreamDidChangeMyJIDNotification;
 - (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue synchronously:(BOOL)synchronously;
 
 @end
+
+/**
+ * The layout of an XMPPReceivedStanza.
+ * It's shared with XMPPBinaryEncoder & XMPPBinaryDecoder, which convert directly between it and the binary format.
+**/
+
+#define XMPP_STANZA_NONE  UINT32_MAX
+
+enum XMPPStanzaNodeKind
+{
+	XMPPStanzaNodeKindElement,
+	XMPPStanzaNodeKindText,
+};
+
+enum XMPPStanzaAttributeKind
+{
+	XMPPStanzaAttributeKindAttribute,
+	XMPPStanzaAttributeKindNamespace,
+};
+
+/**
+ * Nodes are stored in document order (so the stanza element itself is always node zero).
+ * Element nodes point to their qualified name (e.g. "stream:error") within the byte arena,
+ * text nodes point to their text content.
+**/
+typedef struct {
+	uint32_t kind;
+	uint32_t firstChild;
+	uint32_t nextSibling;
+	uint32_t firstAttribute;
+	uint32_t attributeCount;
+	uint32_t offset;
+	uint32_t length;
+} XMPPStanzaNode;
+
+/**
+ * Attributes and namespace declarations of an element are stored contiguously.
+ * For namespace declarations, the name is the prefix (empty for the default namespace).
+**/
+typedef struct {
+	uint32_t kind;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t valueOffset;
+	uint32_t valueLength;
+} XMPPStanzaAttribute;
+
+typedef struct {
+	XMPPStanzaNode *nodes;
+	XMPPStanzaAttribute *attributes;
+	char *bytes;
+	
+	uint32_t nodeCount;
+	uint32_t attributeCount;
+	uint32_t byteCount;
+} XMPPStanzaArena;
+
+@interface XMPPReceivedStanza (/* Internal */)
+
+/**
+ * Used by XMPPParser.
+ * Copies the given libxml element (including its entire subtree).
+**/
+- (id)initWithLibxmlNode:(struct _xmlNode *)node;
+
+/**
+ * Used by XMPPStream, for stanzas that were parsed into a full DOM (and possibly altered by filters).
+ * The stanza is built from the serialized element, and the given element is returned by the element method.
+**/
+- (id)initWithElement:(XMPPElement *)element;
+
+/**
+ * Used by XMPPBinaryDecoder.
+ * The block is a single allocation holding the nodes, attributes and bytes of the arena (in that order).
+ * The stanza takes ownership of the block, and frees it when deallocated.
+**/
+- (id)initWithArena:(XMPPStanzaArena)arena block:(void *)block;
+
+/**
+ * Used by XMPPBinaryEncoder.
+**/
+- (const XMPPStanzaArena *)arena;
+
+@end
+
+@interface XMPPStreamHost (/* Internal */)
+
+/**
+ * Used by XMPPStream when it's initialized with a host.
+ * A stream is attached to a single worker for its entire lifetime,
+ * and uses that worker's queues for its xmppQueue, socket, parser and element filters.
+**/
+- (NSUInteger)attachStream;
+- (void)detachStreamFromWorker:(NSUInteger)workerIndex;
+
+- (dispatch_queue_t)streamQueueForWorker:(NSUInteger)workerIndex;
+- (void *)streamQueueTagForWorker:(NSUInteger)workerIndex;
+
+- (dispatch_queue_t)ioQueueForWorker:(NSUInteger)workerIndex;
+- (void *)ioQueueTagForWorker:(NSUInteger)workerIndex;
+
+- (dispatch_queue_t)filterQueueForWorker:(NSUInteger)workerIndex;
+
+@end
+
+/**
+ * The points in the stanza pipeline at which XMPPStream takes a timestamp (when instrumentation is enabled).
+ * See XMPPStanzaLatencyStage for how they map to the recorded stages.
+**/
+enum XMPPStanzaTracePoint
+{
+	XMPPStanzaTracePointRead,
+	XMPPStanzaTracePointParsed,
+	XMPPStanzaTracePointReceiveFiltered,
+	XMPPStanzaTracePointDispatched,
+	XMPPStanzaTracePointCompleted,
+	
+	XMPPStanzaTracePointSent,
+	XMPPStanzaTracePointSendFiltered,
+	XMPPStanzaTracePointSerialized,
+	XMPPStanzaTracePointWritten,
+	
+	XMPPStanzaTracePointCount
+};
+typedef enum XMPPStanzaTracePoint XMPPStanzaTracePoint;
+
+/**
+ * Returns the current time in the units used by XMPPStanzaTrace (mach absolute time).
+**/
+uint64_t XMPPInstrumentationTime(void);
+
+/**
+ * Holds the timestamps of a single stanza as it travels through the pipeline.
+ * 
+ * The trace is attached to the element itself (as an associated object),
+ * so it follows the element through the various queues without changing any method signatures.
+ * A trace is only ever touched by one queue at a time (it's handed off along with the element),
+ * so it requires no synchronization of its own.
+**/
+@interface XMPPStanzaTrace : NSObject
+
+/**
+ * Returns the trace attached to the given element, if any.
+**/
++ (XMPPStanzaTrace *)traceForElement:(NSXMLElement *)element;
+
+/**
+ * Creates a trace for the given element and attaches it.
+ * Returns nil if instrumentation is nil, or if the element isn't an iq, message or presence.
+**/
++ (XMPPStanzaTrace *)attachTraceToElement:(NSXMLElement *)element
+                          instrumentation:(XMPPStreamInstrumentation *)instrumentation
+                                     time:(uint64_t)time
+                                 forPoint:(XMPPStanzaTracePoint)point;
+
+/**
+ * Used when a filter replaces an element with a different instance.
+**/
+- (void)attachToElement:(NSXMLElement *)element;
+- (void)detachFromElement:(NSXMLElement *)element;
+
+- (void)markPoint:(XMPPStanzaTracePoint)point;
+- (void)markPoint:(XMPPStanzaTracePoint)point element:(NSXMLElement *)element;
+- (void)setTime:(uint64_t)time forPoint:(XMPPStanzaTracePoint)point;
+
+/**
+ * Marks the dispatched point, and returns a group that every delegate invocation should be dispatched with.
+ * Once all of them have been dispatched, invoke endDelegateDispatch,
+ * which records the receive stages after the last delegate invocation has returned.
+**/
+- (dispatch_group_t)beginDelegateDispatch;
+- (void)endDelegateDispatch;
+
+/**
+ * Marks the written point, and records the send stages.
+**/
+- (void)finishSend;
+
+@end
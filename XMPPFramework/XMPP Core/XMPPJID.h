@@ -12,17 +12,45 @@ enum XMPPJIDCompareOptions
 typedef enum XMPPJIDCompareOptions XMPPJIDCompareOptions;
 
 
+/**
+ * XMPPJID is immutable and thread-safe.
+ * 
+ * Internally the user, domain and resource are stored within a single string (the full JID),
+ * along with the lengths needed to extract them. So full and description never allocate,
+ * and neither do bare and bareJID on bare JIDs. For full JIDs, the bareJID is created once and then cached.
+ * The hash is also computed once and cached.
+**/
 @interface XMPPJID : NSObject <NSCoding, NSCopying>
 {
-	__strong NSString *user;
-	__strong NSString *domain;
-	__strong NSString *resource;
+	__strong NSString *full;
+	void *volatile bareJIDRef;
+	NSUInteger cachedHash;
+	uint32_t userLength;
+	uint32_t domainLength;
+	uint8_t flags;
 }
 
 + (XMPPJID *)jidWithString:(NSString *)jidStr;
 + (XMPPJID *)jidWithString:(NSString *)jidStr resource:(NSString *)resource;
 + (XMPPJID *)jidWithUser:(NSString *)user domain:(NSString *)domain resource:(NSString *)resource;
 
+/**
+ * Returns the canonical JID for the given string, from a process-wide intern table.
+ * 
+ * The result is equal to [XMPPJID jidWithString:jidStr], but repeated lookups for the same string
+ * skip parsing and stringprep entirely, and return the very same instance.
+ * Raw strings that differ only in ways stringprep normalizes away (e.g. case in the domain)
+ * also map to the same instance, so isEqualToJID: can usually be answered with a pointer comparison.
+ * 
+ * The table is bounded, and is safe to use from any thread.
+ * It isn't a strict LRU cache: entries are kept in two generations, and whenever the young generation fills up,
+ * the old one is dropped (along with any JIDs that haven't been used since it was young).
+ * So a JID stays interned as long as it's looked up at least once per generation.
+ * It's intended for the JIDs of received stanzas, which repeat the same handful of peers over and over again.
+ * Invalid JIDs are not cached.
+**/
++ (XMPPJID *)internedJIDWithString:(NSString *)jidStr;
+
 @property (strong, readonly) NSString *user;
 @property (strong, readonly) NSString *domain;
 @property (strong, readonly) NSString *resource;
@@ -1,10 +1,39 @@
 #import "XMPPJID.h"
 #import "LibIDN.h"
 
+#import <libkern/OSAtomic.h>
+
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+/**
+ * The intern table is split into shards (by string hash), each with its own spin lock,
+ * so concurrent streams rarely contend with each other.
+ * 
+ * Each shard holds two generations of entries.
+ * New (and recently used) entries go into the young generation.
+ * When the young generation fills up, the old generation is dropped, and the young one takes its place.
+ * Thus the table holds at most (SHARD_COUNT * 2 * GENERATION_CAPACITY) entries,
+ * and an entry survives as long as it's used at least once per generation.
+**/
+#define JID_INTERN_SHARD_COUNT           16
+#define JID_INTERN_GENERATION_CAPACITY  512
+
+typedef struct {
+	OSSpinLock lock;
+	CFMutableDictionaryRef young;
+	CFMutableDictionaryRef old;
+} XMPPJIDInternShard;
+
+static XMPPJIDInternShard internShards[JID_INTERN_SHARD_COUNT];
+
+enum XMPPJIDFlags
+{
+	kXMPPJIDHasUser     = 1 << 0,  // If set, the JID has a user (possibly an empty one)
+	kXMPPJIDHasResource = 1 << 1,  // If set, the JID has a resource
+};
+
 
 @implementation XMPPJID
 
@@ -108,6 +137,53 @@
 	return NO;
 }
 
+/**
+ * Designated initializer.
+ * The parts must already be prepped and validated.
+ * 
+ * All three parts are stored in a single string (the full JID), along with the lengths needed to find them again.
+**/
+- (id)initWithPrevalidatedUser:(NSString *)user domain:(NSString *)domain resource:(NSString *)resource
+{
+	if ((self = [super init]))
+	{
+		NSUInteger uLength = [user length];
+		NSUInteger dLength = [domain length];
+		NSUInteger rLength = [resource length];
+		
+		NSMutableString *str = [[NSMutableString alloc] initWithCapacity:(uLength + dLength + rLength + 2)];
+		
+		if (user)
+		{
+			[str appendString:user];
+			[str appendString:@"@"];
+			flags |= kXMPPJIDHasUser;
+		}
+		
+		[str appendString:domain];
+		
+		if (resource)
+		{
+			[str appendString:@"/"];
+			[str appendString:resource];
+			flags |= kXMPPJIDHasResource;
+		}
+		
+		full = [str copy];
+		userLength = (uint32_t)uLength;
+		domainLength = (uint32_t)dLength;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (bareJIDRef)
+	{
+		CFRelease(bareJIDRef);
+	}
+}
+
 + (XMPPJID *)jidWithString:(NSString *)jidStr
 {
 	NSString *user;
@@ -116,12 +192,7 @@
 	
 	if ([XMPPJID parse:jidStr outUser:&user outDomain:&domain outResource:&resource])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [user copy];
-		jid->domain = [domain copy];
-		jid->resource = [resource copy];
-		
-		return jid;
+		return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:resource];
 	}
 	
 	return nil;
@@ -137,12 +208,7 @@
 	
 	if ([XMPPJID parse:jidStr outUser:&user outDomain:&domain outResource:nil])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [user copy];
-		jid->domain = [domain copy];
-		jid->resource = [prepResource copy];
-		
-		return jid;
+		return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:prepResource];
 	}
 	
 	return nil;
@@ -156,29 +222,159 @@
 	
 	if ([XMPPJID validateUser:prepUser domain:prepDomain resource:prepResource])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [prepUser copy];
-		jid->domain = [prepDomain copy];
-		jid->resource = [prepResource copy];
-		
-		return jid;
+		return [[XMPPJID alloc] initWithPrevalidatedUser:prepUser domain:prepDomain resource:prepResource];
 	}
 	
 	return nil;
 }
 
-+ (XMPPJID *)jidWithPrevalidatedUser:(NSString *)user
-                  prevalidatedDomain:(NSString *)domain
-                prevalidatedResource:(NSString *)resource
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Interning:
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
++ (void)initialize
+{
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		
+		NSUInteger i;
+		for (i = 0; i < JID_INTERN_SHARD_COUNT; i++)
+		{
+			internShards[i].lock = OS_SPINLOCK_INIT;
+			internShards[i].young = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks,
+			                                                           &kCFTypeDictionaryValueCallBacks);
+			internShards[i].old = NULL;
+		}
+	});
+}
+
+static XMPPJIDInternShard *XMPPJIDInternShardForString(NSString *jidStr)
+{
+	return &internShards[[jidStr hash] % JID_INTERN_SHARD_COUNT];
+}
+
+/**
+ * Must be invoked with the shard locked.
+ * 
+ * If the young generation was full, the old generation is dropped, and returned.
+ * The caller must release it once it has unlocked the shard.
+ * (Releasing it releases every JID in it, which is far too much work to do while holding a spin lock.)
+**/
+static CFMutableDictionaryRef XMPPJIDInternShardSetValue(XMPPJIDInternShard *shard, NSString *jidStr, XMPPJID *jid)
+{
+	CFMutableDictionaryRef dropped = NULL;
+	
+	if (CFDictionaryGetCount(shard->young) >= JID_INTERN_GENERATION_CAPACITY)
+	{
+		dropped = shard->old;
+		
+		shard->old = shard->young;
+		shard->young = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks,
+		                                                  &kCFTypeDictionaryValueCallBacks);
+	}
+	
+	CFDictionarySetValue(shard->young, (__bridge const void *)jidStr, (__bridge const void *)jid);
+	
+	return dropped;
+}
+
+/**
+ * Returns the interned JID for the given string, or nil if there isn't one.
+**/
+static XMPPJID *XMPPJIDInternLookup(NSString *jidStr)
+{
+	XMPPJIDInternShard *shard = XMPPJIDInternShardForString(jidStr);
+	CFMutableDictionaryRef dropped = NULL;
+	XMPPJID *result;
+	
+	OSSpinLockLock(&shard->lock);
+	{
+		result = (__bridge XMPPJID *)CFDictionaryGetValue(shard->young, (__bridge const void *)jidStr);
+		
+		if (result == nil && shard->old)
+		{
+			result = (__bridge XMPPJID *)CFDictionaryGetValue(shard->old, (__bridge const void *)jidStr);
+			
+			if (result)
+			{
+				// Still in use, so move it into the young generation
+				
+				NSString *key = [jidStr copy];
+				dropped = XMPPJIDInternShardSetValue(shard, key, result);
+			}
+		}
+	}
+	OSSpinLockUnlock(&shard->lock);
+	
+	if (dropped) CFRelease(dropped);
+	
+	return result;
+}
+
+/**
+ * Interns the given JID for the given string.
+ * If another thread beat us to it, the already interned JID is returned instead,
+ * so there's only ever one instance per string in the table.
+**/
+static XMPPJID *XMPPJIDInternInsert(NSString *jidStr, XMPPJID *jid)
 {
-	XMPPJID *jid = [[XMPPJID alloc] init];
-	jid->user = [user copy];
-	jid->domain = [domain copy];
-	jid->resource = [resource copy];
+	XMPPJIDInternShard *shard = XMPPJIDInternShardForString(jidStr);
+	NSString *key = [jidStr copy];
+	CFMutableDictionaryRef dropped = NULL;
+	XMPPJID *result;
+	
+	OSSpinLockLock(&shard->lock);
+	{
+		result = (__bridge XMPPJID *)CFDictionaryGetValue(shard->young, (__bridge const void *)key);
+		
+		if (result == nil && shard->old)
+		{
+			result = (__bridge XMPPJID *)CFDictionaryGetValue(shard->old, (__bridge const void *)key);
+		}
+		
+		if (result == nil)
+		{
+			result = jid;
+		}
+		
+		dropped = XMPPJIDInternShardSetValue(shard, key, result);
+	}
+	OSSpinLockUnlock(&shard->lock);
+	
+	if (dropped) CFRelease(dropped);
+	
+	return result;
+}
+
++ (XMPPJID *)internedJIDWithString:(NSString *)jidStr
+{
+	if (jidStr == nil) return nil;
+	
+	XMPPJID *jid = XMPPJIDInternLookup(jidStr);
+	if (jid) return jid;
+	
+	jid = [XMPPJID jidWithString:jidStr];
+	if (jid == nil) return nil;
+	
+	// Precompute the hash, so hash lookups and isEqualToJID: never have to touch the strings again
+	[jid hash];
 	
-	return jid;
+	// If the raw string wasn't already canonical (e.g. "User@Example.com"),
+	// make sure it maps to the same instance as the canonical string.
+	
+	NSString *canonical = [jid full];
+	if (![canonical isEqualToString:jidStr])
+	{
+		jid = XMPPJIDInternInsert(canonical, jid);
+	}
+	
+	return XMPPJIDInternInsert(jidStr, jid);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Prevalidated:
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 + (XMPPJID *)jidWithPrevalidatedUser:(NSString *)user
                   prevalidatedDomain:(NSString *)domain
                             resource:(NSString *)resource
@@ -186,12 +382,7 @@
 	NSString *prepResource = [LibIDN prepResource:resource];
 	if (![self validateResource:prepResource]) return nil;
 	
-	XMPPJID *jid = [[XMPPJID alloc] init];
-	jid->user = [user copy];
-	jid->domain = [domain copy];
-	jid->resource = [prepResource copy];
-	
-	return jid;
+	return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:prepResource];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -209,39 +400,48 @@
 }
 #endif
 
+// The archived format predates the compact layout, and is kept as-is (three separate parts),
+// so archives are interchangeable between versions.
+
 - (id)initWithCoder:(NSCoder *)coder
 {
-	if ((self = [super init]))
+	NSString *aUser;
+	NSString *aDomain;
+	NSString *aResource;
+	
+	if ([coder allowsKeyedCoding])
 	{
-		if ([coder allowsKeyedCoding])
-		{
-			user     = [[coder decodeObjectForKey:@"user"] copy];
-			domain   = [[coder decodeObjectForKey:@"domain"] copy];
-			resource = [[coder decodeObjectForKey:@"resource"] copy];
-		}
-		else
-		{
-			user     = [[coder decodeObject] copy];
-			domain   = [[coder decodeObject] copy];
-			resource = [[coder decodeObject] copy];
-		}
+		aUser     = [coder decodeObjectForKey:@"user"];
+		aDomain   = [coder decodeObjectForKey:@"domain"];
+		aResource = [coder decodeObjectForKey:@"resource"];
 	}
-	return self;
+	else
+	{
+		aUser     = [coder decodeObject];
+		aDomain   = [coder decodeObject];
+		aResource = [coder decodeObject];
+	}
+	
+	return [self initWithPrevalidatedUser:aUser domain:(aDomain ?: @"") resource:aResource];
 }
 
 - (void)encodeWithCoder:(NSCoder *)coder
 {
+	NSString *aUser = [self user];
+	NSString *aDomain = [self domain];
+	NSString *aResource = [self resource];
+	
 	if ([coder allowsKeyedCoding])
 	{
-		[coder encodeObject:user     forKey:@"user"];
-		[coder encodeObject:domain   forKey:@"domain"];
-		[coder encodeObject:resource forKey:@"resource"];
+		[coder encodeObject:aUser     forKey:@"user"];
+		[coder encodeObject:aDomain   forKey:@"domain"];
+		[coder encodeObject:aResource forKey:@"resource"];
 	}
 	else
 	{
-		[coder encodeObject:user];
-		[coder encodeObject:domain];
-		[coder encodeObject:resource];
+		[coder encodeObject:aUser];
+		[coder encodeObject:aDomain];
+		[coder encodeObject:aResource];
 	}
 }
 
@@ -259,77 +459,116 @@
 #pragma mark Normal Methods:
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Why didn't we just synthesize these properties?
+// The parts are stored back to back within the full JID:
+// 
+// [user "@"] domain ["/" resource]
 // 
-// Since these variables are readonly within the class,
-// we want the synthesized methods to work like a nonatomic property.
-// In order to do this, we have to mark the properties as nonatomic in the header.
-// However we don't like marking the property as nonatomic in the header because
-// then people might think it's not thread-safe when in fact it is.
+// The user and resource are extracted on demand.
+// Short ASCII parts typically end up as tagged pointers, so this rarely allocates anything.
+
+static inline NSRange XMPPJIDUserRange(XMPPJID *jid)
+{
+	return NSMakeRange(0, jid->userLength);
+}
+
+static inline NSRange XMPPJIDDomainRange(XMPPJID *jid)
+{
+	NSUInteger location = (jid->flags & kXMPPJIDHasUser) ? (jid->userLength + 1) : 0;
+	
+	return NSMakeRange(location, jid->domainLength);
+}
+
+static inline NSRange XMPPJIDBareRange(XMPPJID *jid)
+{
+	return NSMakeRange(0, NSMaxRange(XMPPJIDDomainRange(jid)));
+}
+
+static inline NSRange XMPPJIDResourceRange(XMPPJID *jid)
+{
+	NSUInteger location = NSMaxRange(XMPPJIDDomainRange(jid)) + 1;
+	
+	return NSMakeRange(location, [jid->full length] - location);
+}
 
 - (NSString *)user
 {
-	return user; // Why didn't we just synthesize this? See comment above.
+	if (!(flags & kXMPPJIDHasUser)) return nil;
+	
+	return [full substringWithRange:XMPPJIDUserRange(self)];
 }
 
 - (NSString *)domain
 {
-	return domain; // Why didn't we just synthesize this? See comment above.
+	if (!(flags & (kXMPPJIDHasUser | kXMPPJIDHasResource))) return full;
+	
+	return [full substringWithRange:XMPPJIDDomainRange(self)];
 }
 
 - (NSString *)resource
 {
-	return resource; // Why didn't we just synthesize this? See comment above.
+	if (!(flags & kXMPPJIDHasResource)) return nil;
+	
+	return [full substringWithRange:XMPPJIDResourceRange(self)];
 }
 
 - (XMPPJID *)bareJID
 {
-	if (resource == nil)
+	if (!(flags & kXMPPJIDHasResource))
 	{
 		return self;
 	}
-	else
+	
+	// The bare JID is cached, as it's requested over and over again for the same full JIDs (roster, presence, etc).
+	// The JID is otherwise immutable, so we publish it with a single compare-and-swap instead of a lock.
+	
+	XMPPJID *result = (__bridge XMPPJID *)bareJIDRef;
+	if (result == nil)
 	{
-		return [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain prevalidatedResource:nil];
+		XMPPJID *newBareJID = [[XMPPJID alloc] init];
+		newBareJID->full = [full substringWithRange:XMPPJIDBareRange(self)];
+		newBareJID->userLength = userLength;
+		newBareJID->domainLength = domainLength;
+		newBareJID->flags = (flags & kXMPPJIDHasUser);
+		
+		void *newBareJIDRef = (__bridge_retained void *)newBareJID;
+		
+		if (OSAtomicCompareAndSwapPtrBarrier(NULL, newBareJIDRef, &bareJIDRef))
+		{
+			result = newBareJID;
+		}
+		else
+		{
+			CFRelease(newBareJIDRef);
+			result = (__bridge XMPPJID *)bareJIDRef;
+		}
 	}
+	
+	return result;
 }
 
 - (XMPPJID *)domainJID
 {
-	if (user == nil && resource == nil)
+	if (!(flags & (kXMPPJIDHasUser | kXMPPJIDHasResource)))
 	{
 		return self;
 	}
 	else
 	{
-		return [XMPPJID jidWithPrevalidatedUser:nil prevalidatedDomain:domain prevalidatedResource:nil];
+		return [[XMPPJID alloc] initWithPrevalidatedUser:nil domain:[self domain] resource:nil];
 	}
 }
 
 - (NSString *)bare
 {
-	if (user)
-		return [NSString stringWithFormat:@"%@@%@", user, domain];
+	if (!(flags & kXMPPJIDHasResource))
+		return full;
 	else
-		return domain;
+		return [full substringWithRange:XMPPJIDBareRange(self)];
 }
 
 - (NSString *)full
 {
-	if (user)
-	{
-		if (resource)
-			return [NSString stringWithFormat:@"%@@%@/%@", user, domain, resource];
-		else
-			return [NSString stringWithFormat:@"%@@%@", user, domain];
-	}
-	else
-	{
-		if (resource)
-			return [NSString stringWithFormat:@"%@/%@", domain, resource];
-		else
-			return domain;
-	}
+	return full;
 }
 
 - (BOOL)isBare
@@ -339,12 +578,12 @@
 	// The term "bare JID" refers to an XMPP address of the form <localpart@domainpart> (for an account at a server)
 	// or of the form <domainpart> (for a server).
 	
-	return (resource == nil);
+	return !(flags & kXMPPJIDHasResource);
 }
 
 - (BOOL)isBareWithUser
 {
-	return (user != nil && resource == nil);
+	return (flags & (kXMPPJIDHasUser | kXMPPJIDHasResource)) == kXMPPJIDHasUser;
 }
 
 - (BOOL)isFull
@@ -355,22 +594,22 @@
 	// <localpart@domainpart/resourcepart> (for a particular authorized client or device associated with an account)
 	// or of the form <domainpart/resourcepart> (for a particular resource or script associated with a server).
 	
-	return (resource != nil);
+	return (flags & kXMPPJIDHasResource) != 0;
 }
 
 - (BOOL)isFullWithUser
 {
-	return (user != nil && resource != nil);
+	return (flags & (kXMPPJIDHasUser | kXMPPJIDHasResource)) == (kXMPPJIDHasUser | kXMPPJIDHasResource);
 }
 
 - (BOOL)isServer
 {
-	return (user == nil);
+	return !(flags & kXMPPJIDHasUser);
 }
 
 - (XMPPJID *)jidWithNewResource:(NSString *)newResource
 {
-	return [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain resource:newResource];
+	return [XMPPJID jidWithPrevalidatedUser:[self user] prevalidatedDomain:[self domain] resource:newResource];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -379,153 +618,18 @@
 
 - (NSUInteger)hash
 {
-	// We used to do this:
-	// return [[self full] hash];
-	//
-	// It was functional but less than optimal because it required the creation of a new NSString everytime.
-	// Now the hashing of a string itself is extremely fast,
-	// so combining 3 hashes is much faster than creating a new string.
-	// To accomplish this we use the murmur hashing algorithm.
+	// The JID is immutable, so the hash is only computed once.
+	// Racing threads compute the same value, so there's no need for synchronization.
 	// 
-	// MurmurHash2 was written by Austin Appleby, and is placed in the public domain.
-	// http://code.google.com/p/smhasher
+	// Equal JIDs have equal full strings, so hashing the full string is all we need.
+	// (We used to combine the hashes of the 3 parts via MurmurHash2, which required 3 string hashes per call.)
 	
-	NSUInteger uhash = [user hash];
-	NSUInteger dhash = [domain hash];
-	NSUInteger rhash = [resource hash];
-	
-	if (NSUIntegerMax == UINT32_MAX) // Should be optimized out via compiler since these are constants
+	if (cachedHash == 0)
 	{
-		// MurmurHash2 (32-bit)
-		//
-		// uint32_t MurmurHash2 ( const void * key, int len, uint32_t seed )
-		// 
-		// Normally one would pass a chunk of data ('key') and associated data chunk length ('len').
-		// Instead we're going to use our 3 hashes.
-		// And we're going to randomly make up a 'seed'.
-		
-		const uint32_t seed = 0xa2f1b6f; // Some random value I made up
-		const uint32_t len = 12;         // 3 hashes, each 4 bytes = 12 bytes
-		
-		// 'm' and 'r' are mixing constants generated offline.
-		// They're not really 'magic', they just happen to work well.
-		
-		const uint32_t m = 0x5bd1e995;
-		const int r = 24;
-		
-		// Initialize the hash to a 'random' value
-		
-		uint32_t h = seed ^ len;
-		uint32_t k;
-		
-		// Mix uhash
-		
-		k = uhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Mix dhash
-		
-		k = dhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Mix rhash
-		
-		k = rhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Do a few final mixes of the hash to ensure the last few
-		// bytes are well-incorporated.
-		
-		h ^= h >> 13;
-		h *= m;
-		h ^= h >> 15;
-		
-		return (NSUInteger)h;
-	}
-	else
-	{
-		// MurmurHash2 (64-bit)
-		// 
-		// uint64_t MurmurHash64A ( const void * key, int len, uint64_t seed )
-		// 
-		// Normally one would pass a chunk of data ('key') and associated data chunk length ('len').
-		// Instead we're going to use our 3 hashes.
-		// And we're going to randomly make up a 'seed'.
-		
-		const uint32_t seed = 0xa2f1b6f; // Some random value I made up
-		const uint32_t len = 24;         // 3 hashes, each 8 bytes = 24 bytes
-		
-		// 'm' and 'r' are mixing constants generated offline.
-		// They're not really 'magic', they just happen to work well.
-		
-		const uint64_t m = 0xc6a4a7935bd1e995LLU;
-		const int r = 47;
-		
-		// Initialize the hash to a 'random' value
-		
-		uint64_t h = seed ^ (len * m);
-		uint64_t k;
-		
-		// Mix uhash
-		
-		k = uhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Mix dhash
-		
-		k = dhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Mix rhash
-		
-		k = rhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Do a few final mixes of the hash to ensure the last few
-		// bytes are well-incorporated.
-		
-		h ^= h >> r;
-		h *= m;
-		h ^= h >> r;
-		
-		return (NSUInteger)h;
+		cachedHash = [full hash];
 	}
+	
+	return cachedHash;
 }
 
 - (BOOL)isEqual:(id)anObject
@@ -542,37 +646,81 @@
 	return [self isEqualToJID:aJID options:XMPPJIDCompareFull];
 }
 
+/**
+ * Compares a range of one string to a range of another, without creating any substrings.
+**/
+static BOOL XMPPJIDRangesAreEqual(NSString *str1, NSRange range1, NSString *str2, NSRange range2)
+{
+	if (range1.length != range2.length) return NO;
+	
+	#define COMPARE_CHUNK_SIZE 32
+	unichar buf1[COMPARE_CHUNK_SIZE];
+	unichar buf2[COMPARE_CHUNK_SIZE];
+	
+	NSUInteger offset = 0;
+	while (offset < range1.length)
+	{
+		NSUInteger length = MIN(range1.length - offset, COMPARE_CHUNK_SIZE);
+		
+		[str1 getCharacters:buf1 range:NSMakeRange(range1.location + offset, length)];
+		[str2 getCharacters:buf2 range:NSMakeRange(range2.location + offset, length)];
+		
+		if (memcmp(buf1, buf2, length * sizeof(unichar)) != 0) return NO;
+		
+		offset += length;
+	}
+	#undef COMPARE_CHUNK_SIZE
+	
+	return YES;
+}
+
 - (BOOL)isEqualToJID:(XMPPJID *)aJID options:(XMPPJIDCompareOptions)mask
 {
 	if (aJID == nil) return NO;
 	
+	// Interned JIDs make this the common case
+	if (aJID == self) return YES;
+	
+	if (mask == XMPPJIDCompareFull)
+	{
+		// If both hashes have already been computed, differing hashes mean differing JIDs
+		
+		if (cachedHash && aJID->cachedHash && (cachedHash != aJID->cachedHash)) return NO;
+		
+		// The lengths disambiguate the (pathological) case of a domain containing a slash
+		
+		if (flags != aJID->flags) return NO;
+		if (userLength != aJID->userLength) return NO;
+		if (domainLength != aJID->domainLength) return NO;
+		
+		return [full isEqualToString:aJID->full];
+	}
+	
 	if (mask & XMPPJIDCompareUser)
 	{
-		if (user) {
-			if (![user isEqualToString:aJID->user]) return NO;
-		}
-		else {
-			if (aJID->user) return NO;
+		if ((flags & kXMPPJIDHasUser) != (aJID->flags & kXMPPJIDHasUser)) return NO;
+		
+		if (flags & kXMPPJIDHasUser)
+		{
+			if (!XMPPJIDRangesAreEqual(full, XMPPJIDUserRange(self), aJID->full, XMPPJIDUserRange(aJID))) return NO;
 		}
 	}
 	
 	if (mask & XMPPJIDCompareDomain)
 	{
-		if (domain) {
-			if (![domain isEqualToString:aJID->domain]) return NO;
-		}
-		else {
-			if (aJID->domain) return NO;
-		}
+		if (!XMPPJIDRangesAreEqual(full, XMPPJIDDomainRange(self), aJID->full, XMPPJIDDomainRange(aJID))) return NO;
 	}
 	
 	if (mask & XMPPJIDCompareResource)
 	{
-		if (resource) {
-			if (![resource isEqualToString:aJID->resource]) return NO;
-		}
-		else {
-			if (aJID->resource) return NO;
+		if ((flags & kXMPPJIDHasResource) != (aJID->flags & kXMPPJIDHasResource)) return NO;
+		
+		if (flags & kXMPPJIDHasResource)
+		{
+			NSRange range1 = XMPPJIDResourceRange(self);
+			NSRange range2 = XMPPJIDResourceRange(aJID);
+			
+			if (!XMPPJIDRangesAreEqual(full, range1, aJID->full, range2)) return NO;
 		}
 	}
 	
@@ -581,7 +729,7 @@
 
 - (NSString *)description
 {
-	return [self full];
+	return full;
 }
 
 
@@ -0,0 +1,115 @@
+#import <Foundation/Foundation.h>
+
+@class XMPPLivenessEntry;
+
+/**
+ * XMPPLivenessScheduler is a process-wide scheduler for idle checks such as keep alives and pings.
+ *
+ * Both XMPPStream (whitespace keep alive) and XMPPAutoPing (XEP-0199 ping) need to do something
+ * only when a connection has been idle for a given interval.
+ * Giving every stream its own periodic timer means N independent timers, all firing at different phases,
+ * most of which wake up only to discover there's been recent traffic.
+ *
+ * The scheduler instead:
+ *
+ * - Rounds every deadline up to a bucket boundary (the bucketInterval).
+ *   A single timer is armed for the earliest non-empty bucket,
+ *   so the process wakes at most once per bucket, no matter how many entries there are.
+ *
+ * - Skips entries that have seen activity since they were armed.
+ *   Such entries are silently moved to the bucket of (lastActivity + interval),
+ *   without ever touching the owner's queue.
+ *
+ * - Dispatches all remaining due entries in the bucket as one batch.
+ *
+ * - Adds a random jitter to every deadline, so entries created at the same moment
+ *   (e.g. thousands of streams reconnecting after a network change) spread out over time.
+ *   The jitter only ever delays a deadline, so nothing fires before its interval has elapsed.
+ *
+ * The owner informs the entry of activity via noteActivity, which is cheap and may be called from any thread.
+**/
+
+@interface XMPPLivenessScheduler : NSObject
+
+/**
+ * The process-wide scheduler, used by XMPPStream and XMPPAutoPing.
+**/
++ (XMPPLivenessScheduler *)sharedScheduler;
+
+/**
+ * Creates a new scheduler with the given bucket interval (in seconds).
+ * Most applications should simply use the shared scheduler.
+**/
+- (id)initWithBucketInterval:(NSTimeInterval)bucketInterval;
+
+/**
+ * The granularity of deadlines.
+ * Entries fire within one bucketInterval (plus jitter) after becoming idle.
+ *
+ * The default (shared scheduler) is 1 second.
+**/
+@property (readonly) NSTimeInterval bucketInterval;
+
+/**
+ * The maximum jitter added to a deadline, as a fraction of the entry's interval.
+ * For example, with a jitter of 0.1 an entry with an interval of 60 seconds fires between 60 and 66 seconds of idleness.
+ *
+ * The default is 0.05.
+**/
+@property (readwrite) double jitter;
+
+/**
+ * The number of scheduled entries.
+**/
+@property (readonly) NSUInteger numberOfEntries;
+
+/**
+ * Schedules an idle check.
+ *
+ * The block is dispatched to the given queue whenever interval seconds have passed without activity
+ * (as reported via [entry noteActivity]). After it fires, the entry is re-armed for another interval.
+ * This continues until the entry is cancelled.
+ *
+ * The entry starts out with its last activity set to now.
+ *
+ * This method is thread-safe.
+**/
+- (XMPPLivenessEntry *)scheduleWithInterval:(NSTimeInterval)interval
+                                      queue:(dispatch_queue_t)queue
+                                      block:(dispatch_block_t)block;
+
+/**
+ * Cancels the given entry.
+ * Once this method returns, the block will not be invoked again.
+ * (Unless it's currently executing on the target queue, in which case that invocation completes normally.)
+ *
+ * This method is thread-safe.
+**/
+- (void)cancelEntry:(XMPPLivenessEntry *)entry;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPLivenessEntry : NSObject
+
+/**
+ * Records activity (e.g. data sent or received) at the current time.
+ * This method is thread-safe and lock-free, so it may be invoked for every read and write.
+**/
+- (void)noteActivity;
+
+/**
+ * Records activity at the given time (as returned by [NSDate timeIntervalSinceReferenceDate]).
+ * Activity older than the currently recorded activity is ignored.
+**/
+- (void)noteActivityAtTime:(NSTimeInterval)time;
+
+/**
+ * The time of the most recently recorded activity.
+**/
+@property (readonly) NSTimeInterval lastActivityTime;
+
+@end
@@ -0,0 +1,415 @@
+#import "XMPPLivenessScheduler.h"
+#import "XMPPLogging.h"
+
+#import <libkern/OSAtomic.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+#define DEFAULT_BUCKET_INTERVAL  1.0  // seconds
+#define DEFAULT_JITTER           0.05 // fraction of entry interval
+
+#define USEC_PER_SEC_F  1000000.0
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPLivenessEntry ()
+{
+  @public
+
+	// Only accessed from within the scheduler's queue
+	dispatch_queue_t queue;
+	dispatch_block_t block;
+	NSTimeInterval interval;
+	NSUInteger bucket;
+
+	// Accessed from any thread
+	volatile int32_t cancelled;
+	volatile int64_t lastActivity; // microseconds since reference date
+}
+@end
+
+@implementation XMPPLivenessEntry
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (queue)
+		dispatch_release(queue);
+	#endif
+}
+
+- (void)noteActivity
+{
+	[self noteActivityAtTime:[NSDate timeIntervalSinceReferenceDate]];
+}
+
+- (void)noteActivityAtTime:(NSTimeInterval)time
+{
+	int64_t newValue = (int64_t)(time * USEC_PER_SEC_F);
+	int64_t oldValue;
+
+	do
+	{
+		oldValue = lastActivity;
+
+		if (newValue <= oldValue) return;
+
+	} while (!OSAtomicCompareAndSwap64Barrier(oldValue, newValue, &lastActivity));
+}
+
+- (NSTimeInterval)lastActivityTime
+{
+	return OSAtomicAdd64Barrier(0, &lastActivity) / USEC_PER_SEC_F;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPLivenessScheduler
+{
+	dispatch_queue_t schedulerQueue;
+	void *schedulerQueueTag;
+
+	dispatch_source_t timer;
+	NSUInteger timerBucket;
+
+	NSTimeInterval bucketInterval;
+	double jitter;
+
+	NSMutableDictionary *buckets;     // bucket number -> NSMutableArray of entries
+	NSMutableIndexSet *bucketNumbers; // sorted set of non-empty bucket numbers
+	NSUInteger numberOfEntries;
+}
+
+@synthesize bucketInterval;
+
++ (XMPPLivenessScheduler *)sharedScheduler
+{
+	static XMPPLivenessScheduler *sharedScheduler;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		sharedScheduler = [[XMPPLivenessScheduler alloc] initWithBucketInterval:DEFAULT_BUCKET_INTERVAL];
+	});
+
+	return sharedScheduler;
+}
+
+- (id)init
+{
+	return [self initWithBucketInterval:DEFAULT_BUCKET_INTERVAL];
+}
+
+- (id)initWithBucketInterval:(NSTimeInterval)interval
+{
+	if ((self = [super init]))
+	{
+		bucketInterval = (interval > 0.0) ? interval : DEFAULT_BUCKET_INTERVAL;
+		jitter = DEFAULT_JITTER;
+
+		buckets = [[NSMutableDictionary alloc] init];
+		bucketNumbers = [[NSMutableIndexSet alloc] init];
+
+		schedulerQueueTag = &schedulerQueueTag;
+		schedulerQueue = dispatch_queue_create("xmpp.liveness", NULL);
+		dispatch_queue_set_specific(schedulerQueue, schedulerQueueTag, schedulerQueueTag, NULL);
+
+		timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, schedulerQueue);
+		timerBucket = NSNotFound;
+
+		#if __has_feature(objc_arc_weak)
+		__weak XMPPLivenessScheduler *weakSelf = self;
+		#else
+		__unsafe_unretained XMPPLivenessScheduler *weakSelf = self;
+		#endif
+
+		dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+
+			XMPPLivenessScheduler *strongSelf = weakSelf;
+			[strongSelf processDueBuckets];
+		}});
+
+		dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		dispatch_resume(timer);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_source_cancel(timer);
+
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(timer);
+	dispatch_release(schedulerQueue);
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Properties
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (double)jitter
+{
+	__block double result = 0.0;
+
+	dispatch_block_t block = ^{
+		result = jitter;
+	};
+
+	if (dispatch_get_specific(schedulerQueueTag))
+		block();
+	else
+		dispatch_sync(schedulerQueue, block);
+
+	return result;
+}
+
+- (void)setJitter:(double)newJitter
+{
+	dispatch_block_t block = ^{
+		jitter = MAX(0.0, newJitter);
+	};
+
+	if (dispatch_get_specific(schedulerQueueTag))
+		block();
+	else
+		dispatch_async(schedulerQueue, block);
+}
+
+- (NSUInteger)numberOfEntries
+{
+	__block NSUInteger result = 0;
+
+	dispatch_block_t block = ^{
+		result = numberOfEntries;
+	};
+
+	if (dispatch_get_specific(schedulerQueueTag))
+		block();
+	else
+		dispatch_sync(schedulerQueue, block);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Scheduling
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (XMPPLivenessEntry *)scheduleWithInterval:(NSTimeInterval)interval
+                                      queue:(dispatch_queue_t)queue
+                                      block:(dispatch_block_t)block
+{
+	if (interval <= 0.0 || queue == NULL || block == nil) return nil;
+
+	XMPPLivenessEntry *entry = [[XMPPLivenessEntry alloc] init];
+
+	entry->queue = queue;
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_retain(queue);
+	#endif
+
+	entry->block = [block copy];
+	entry->interval = interval;
+	entry->bucket = NSNotFound;
+
+	[entry noteActivity];
+
+	dispatch_block_t scheduleBlock = ^{
+
+		numberOfEntries++;
+
+		[self insertEntry:entry deadline:([entry lastActivityTime] + interval)];
+		[self updateTimer];
+	};
+
+	if (dispatch_get_specific(schedulerQueueTag))
+		scheduleBlock();
+	else
+		dispatch_async(schedulerQueue, scheduleBlock);
+
+	return entry;
+}
+
+- (void)cancelEntry:(XMPPLivenessEntry *)entry
+{
+	if (entry == nil) return;
+
+	// Setting the flag prevents any invocation that's already been dispatched to the target queue
+
+	if (!OSAtomicCompareAndSwap32Barrier(0, 1, &entry->cancelled)) return;
+
+	dispatch_block_t block = ^{
+
+		if (entry->bucket != NSNotFound)
+		{
+			[self removeEntry:entry];
+		}
+
+		entry->block = nil;
+		numberOfEntries--;
+
+		// We don't bother updating the timer here.
+		// At worst it fires once for a bucket that's now empty.
+	};
+
+	if (dispatch_get_specific(schedulerQueueTag))
+		block();
+	else
+		dispatch_async(schedulerQueue, block);
+}
+
+- (void)insertEntry:(XMPPLivenessEntry *)entry deadline:(NSTimeInterval)deadline
+{
+	NSAssert(dispatch_get_specific(schedulerQueueTag), @"Invoked on incorrect queue");
+
+	if (jitter > 0.0)
+	{
+		deadline += entry->interval * jitter * (arc4random_uniform(1001) / 1000.0);
+	}
+
+	// Round up, so an entry never fires before its deadline
+
+	NSUInteger bucket = (NSUInteger)ceil(deadline / bucketInterval);
+	NSNumber *key = [NSNumber numberWithUnsignedInteger:bucket];
+
+	NSMutableArray *entries = [buckets objectForKey:key];
+	if (entries == nil)
+	{
+		entries = [[NSMutableArray alloc] init];
+
+		[buckets setObject:entries forKey:key];
+		[bucketNumbers addIndex:bucket];
+	}
+
+	[entries addObject:entry];
+	entry->bucket = bucket;
+}
+
+- (void)removeEntry:(XMPPLivenessEntry *)entry
+{
+	NSAssert(dispatch_get_specific(schedulerQueueTag), @"Invoked on incorrect queue");
+
+	NSNumber *key = [NSNumber numberWithUnsignedInteger:entry->bucket];
+
+	NSMutableArray *entries = [buckets objectForKey:key];
+	[entries removeObjectIdenticalTo:entry];
+
+	if ([entries count] == 0)
+	{
+		[buckets removeObjectForKey:key];
+		[bucketNumbers removeIndex:entry->bucket];
+	}
+
+	entry->bucket = NSNotFound;
+}
+
+- (void)updateTimer
+{
+	NSAssert(dispatch_get_specific(schedulerQueueTag), @"Invoked on incorrect queue");
+
+	NSUInteger firstBucket = [bucketNumbers firstIndex];
+
+	if (firstBucket == timerBucket) return;
+	timerBucket = firstBucket;
+
+	if (firstBucket == NSNotFound)
+	{
+		dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		return;
+	}
+
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	NSTimeInterval delay = MAX(0.0, (firstBucket * bucketInterval) - now);
+
+	// Allow the system to coalesce our wakeup with others, as long as it stays within the bucket
+
+	uint64_t leeway = (uint64_t)((bucketInterval / 4.0) * NSEC_PER_SEC);
+
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC));
+	dispatch_source_set_timer(timer, tt, DISPATCH_TIME_FOREVER, leeway);
+}
+
+- (void)processDueBuckets
+{
+	NSAssert(dispatch_get_specific(schedulerQueueTag), @"Invoked on incorrect queue");
+
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	NSUInteger nowBucket = (NSUInteger)floor(now / bucketInterval);
+
+	NSUInteger skipped = 0;
+	NSUInteger fired = 0;
+
+	timerBucket = NSNotFound;
+
+	NSUInteger bucket;
+	while ((bucket = [bucketNumbers firstIndex]) != NSNotFound && bucket <= nowBucket)
+	{
+		NSNumber *key = [NSNumber numberWithUnsignedInteger:bucket];
+		NSMutableArray *entries = [buckets objectForKey:key];
+
+		[buckets removeObjectForKey:key];
+		[bucketNumbers removeIndex:bucket];
+
+		for (XMPPLivenessEntry *entry in entries)
+		{
+			entry->bucket = NSNotFound;
+
+			if (entry->cancelled)
+			{
+				// The cancel block is still on its way, and will finish up the entry
+				continue;
+			}
+
+			NSTimeInterval idleDeadline = [entry lastActivityTime] + entry->interval;
+
+			if (idleDeadline > now)
+			{
+				// There's been activity since the entry was armed.
+				// Move it to the bucket where it would become idle, without bothering the owner.
+
+				skipped++;
+				[self insertEntry:entry deadline:idleDeadline];
+			}
+			else
+			{
+				fired++;
+
+				dispatch_block_t block = entry->block;
+
+				dispatch_async(entry->queue, ^{ @autoreleasepool {
+
+					if (!entry->cancelled)
+					{
+						block();
+					}
+				}});
+
+				[self insertEntry:entry deadline:(now + entry->interval)];
+			}
+		}
+	}
+
+	XMPPLogVerbose(@"%@: Processed liveness buckets: fired(%lu) skipped(%lu)",
+	               THIS_FILE, (unsigned long)fired, (unsigned long)skipped);
+
+	[self updateTimer];
+}
+
+@end
@@ -60,6 +60,7 @@
 **/
 
 #import "DDLog.h"
+#import "XMPPLogRecord.h"
 
 // Global flag to enable/disable logging throughout the entire xmpp framework.
 
@@ -165,10 +166,36 @@
 #define XMPPLogCTrace2(frmt, ...)     XMPP_LOG_C_MAYBE(XMPP_LOG_ASYNC_TRACE,   xmppLogLevel, XMPP_LOG_FLAG_TRACE, \
                                                   XMPP_LOG_CONTEXT, frmt, ##__VA_ARGS__)
 
+// Deferred logging.
+// 
+// The statements above format their message right away (if the log level is enabled).
+// The deferred statements below only capture their arguments (in a block), and produce an XMPPLogRecord.
+// The message is formatted when (and if) somebody asks for it. See XMPPLogRecord.h for the details.
+// 
+// Since the message may be formatted later, and on another thread,
+// the arguments must not change afterwards. So don't pass mutable objects (or ivars, which capture self).
+
+#define XMPP_LOG_DEFERRED_MAYBE(async, lvl, flg, ctx, frmt, ...) \
+    do{ if(XMPP_LOGGING_ENABLED && ((lvl) & (flg))) \
+            XMPPLogDeferred(async, flg, ctx, __FILE__, sel_getName(_cmd), __LINE__, \
+                            ^NSString *{ return [NSString stringWithFormat:(frmt), ##__VA_ARGS__]; }); } while(0)
+
+#define XMPPLogDeferredError(frmt, ...)    XMPP_LOG_DEFERRED_MAYBE(XMPP_LOG_ASYNC_ERROR,   xmppLogLevel, \
+                                                  XMPP_LOG_FLAG_ERROR,   XMPP_LOG_CONTEXT, frmt, ##__VA_ARGS__)
+
+#define XMPPLogDeferredWarn(frmt, ...)     XMPP_LOG_DEFERRED_MAYBE(XMPP_LOG_ASYNC_WARN,    xmppLogLevel, \
+                                                  XMPP_LOG_FLAG_WARN,    XMPP_LOG_CONTEXT, frmt, ##__VA_ARGS__)
+
+#define XMPPLogDeferredInfo(frmt, ...)     XMPP_LOG_DEFERRED_MAYBE(XMPP_LOG_ASYNC_INFO,    xmppLogLevel, \
+                                                  XMPP_LOG_FLAG_INFO,    XMPP_LOG_CONTEXT, frmt, ##__VA_ARGS__)
+
+#define XMPPLogDeferredVerbose(frmt, ...)  XMPP_LOG_DEFERRED_MAYBE(XMPP_LOG_ASYNC_VERBOSE, xmppLogLevel, \
+                                                  XMPP_LOG_FLAG_VERBOSE, XMPP_LOG_CONTEXT, frmt, ##__VA_ARGS__)
+
 // Setup logging for XMPPStream (and subclasses such as XMPPStreamFacebook)
 
 #define XMPP_LOG_FLAG_SEND      (1 << 5)
-#define XMPP_LOG_FLAG_RECV_PRE  (1 << 6) // Prints data before it goes to the parser
+#define XMPP_LOG_FLAG_RECV_PRE  (1 << 6) // Prints data before it goes to the parser (deferred)
 #define XMPP_LOG_FLAG_RECV_POST (1 << 7) // Prints data as it comes out of the parser
 
 #define XMPP_LOG_FLAG_SEND_RECV (XMPP_LOG_FLAG_SEND | XMPP_LOG_FLAG_RECV_POST)
@@ -184,7 +211,7 @@
 #define XMPPLogSend(format, ...)     XMPP_LOG_OBJC_MAYBE(XMPP_LOG_ASYNC_SEND, xmppLogLevel, \
                                                 XMPP_LOG_FLAG_SEND, XMPP_LOG_CONTEXT, format, ##__VA_ARGS__)
 
-#define XMPPLogRecvPre(format, ...)  XMPP_LOG_OBJC_MAYBE(XMPP_LOG_ASYNC_RECV_PRE, xmppLogLevel, \
+#define XMPPLogRecvPre(format, ...)  XMPP_LOG_DEFERRED_MAYBE(XMPP_LOG_ASYNC_RECV_PRE, xmppLogLevel, \
                                                 XMPP_LOG_FLAG_RECV_PRE, XMPP_LOG_CONTEXT, format, ##__VA_ARGS__)
 
 #define XMPPLogRecvPost(format, ...) XMPP_LOG_OBJC_MAYBE(XMPP_LOG_ASYNC_RECV_POST, xmppLogLevel, \
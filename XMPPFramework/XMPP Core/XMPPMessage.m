@@ -155,7 +155,7 @@
 
 - (BOOL)isChatMessage
 {
-	return [[[self attributeForName:@"type"] stringValue] isEqualToString:@"chat"];
+	return XMPPAtomForString([[self attributeForName:@"type"] stringValue]) == XMPPAtomChat;
 }
 
 - (BOOL)isChatMessageWithBody
@@ -169,7 +169,7 @@
 }
 
 - (BOOL)isErrorMessage {
-    return [[[self attributeForName:@"type"] stringValue] isEqualToString:@"error"];
+    return XMPPAtomForString([[self attributeForName:@"type"] stringValue]) == XMPPAtomError;
 }
 
 - (NSError *)errorMessage {
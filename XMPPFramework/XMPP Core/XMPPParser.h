@@ -4,14 +4,40 @@
   #import "DDXML.h"
 #endif
 
+@class XMPPReceivedStanza;
+
 
 @interface XMPPParser : NSObject
 
 - (id)initWithDelegate:(id)delegate delegateQueue:(dispatch_queue_t)dq;
 - (id)initWithDelegate:(id)delegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq;
 
+/**
+ * Use this method if the parserQueue is shared between multiple parsers (or other objects).
+ * The given tag must already be set on the parserQueue via dispatch_queue_set_specific.
+ * 
+ * Otherwise every parser would add its own tag to the shared queue,
+ * and the queue's list of specific keys would grow with every parser created.
+**/
+- (id)initWithDelegate:(id)delegate
+         delegateQueue:(dispatch_queue_t)dq
+           parserQueue:(dispatch_queue_t)pq
+        parserQueueTag:(void *)pqTag;
+
 - (void)setDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue;
 
+/**
+ * If enabled, message (or presence) elements are reported via xmppParser:didReadStanza: (as XMPPReceivedStanza),
+ * instead of via xmppParser:didReadElement:. All other elements (including every iq) are reported as usual.
+ * 
+ * The delegate should only enable these if it won't need the full DOM for the stanza,
+ * as creating it afterwards means the stanza is built twice.
+ * 
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL readsCompactMessages;
+@property (readwrite, assign) BOOL readsCompactPresences;
+
 /**
  * Asynchronously parses the given data.
  * The delegate methods will be dispatch_async'd as events occur.
@@ -31,6 +57,8 @@
 
 - (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element;
 
+- (void)xmppParser:(XMPPParser *)sender didReadStanza:(XMPPReceivedStanza *)stanza;
+
 - (void)xmppParserDidEnd:(XMPPParser *)sender;
 
 - (void)xmppParser:(XMPPParser *)sender didFail:(NSError *)error;
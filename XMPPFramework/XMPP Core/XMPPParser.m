@@ -1,4 +1,6 @@
 #import "XMPPParser.h"
+#import "XMPPInternal.h"
+#import "XMPPAtoms.h"
 #import "XMPPLogging.h"
 #import <libxml/parser.h>
 #import <libxml/parserInternals.h>
@@ -45,6 +47,9 @@
 	BOOL hasReportedRoot;
 	unsigned depth;
 	
+	BOOL readsCompactMessages;
+	BOOL readsCompactPresences;
+	
 	xmlParserCtxt *parserCtxt;
 }
 
@@ -121,6 +126,22 @@ static void xmpp_onDidReadElement(XMPPParser *parser, xmlNodePtr child)
 
 #else
 
+/**
+ * Returns the shared atom string if the given string is part of the XMPP vocabulary,
+ * or a new string otherwise. So all the common names and values of received elements
+ * are the very same string instances, which can be resolved to atoms by pointer.
+**/
+static NSString *xmpp_newString(const xmlChar *str)
+{
+	NSString *atomString = XMPPAtomString(XMPPAtomForCString((const char *)str));
+	if (atomString)
+	{
+		return atomString;
+	}
+	
+	return [[NSString alloc] initWithUTF8String:(const char *)str];
+}
+
 static void xmpp_setName(NSXMLElement *element, xmlNodePtr node)
 {
 	// Remember: The NSString initWithUTF8String raises an exception if passed NULL
@@ -144,7 +165,7 @@ static void xmpp_setName(NSXMLElement *element, xmlNodePtr node)
 	}
 	else
 	{
-		NSString *elementName = [[NSString alloc] initWithUTF8String:(const char *)node->name];
+		NSString *elementName = xmpp_newString(node->name);
 		[element setName:elementName];
 	}
 }
@@ -177,7 +198,7 @@ static void xmpp_addNamespaces(NSXMLElement *element, xmlNodePtr node)
 				[ns setName:@""];
 			}
 			
-			NSString *nsValue = [[NSString alloc] initWithUTF8String:(const char *)nsNode->href];
+			NSString *nsValue = xmpp_newString(nsNode->href);
 			[ns setStringValue:nsValue];
 			
 			[element addNamespace:ns];
@@ -202,7 +223,7 @@ static void xmpp_addChildren(NSXMLElement *element, xmlNodePtr node)
 		{
 			if (childNode->content != NULL)
 			{
-				NSString *value = [[NSString alloc] initWithUTF8String:(const char *)childNode->content];
+				NSString *value = xmpp_newString(childNode->content);
 				[element setStringValue:value];
 			}
 		}
@@ -247,11 +268,11 @@ static void xmpp_addAttributes(NSXMLElement *element, xmlNodePtr node)
 			}
 			else
 			{
-				NSString *attrName = [[NSString alloc] initWithUTF8String:(const char *)attrNode->name];
+				NSString *attrName = xmpp_newString(attrNode->name);
 				[attr setName:attrName];
 			}
 			
-			NSString *attrValue = [[NSString alloc] initWithUTF8String:(const char *)attrNode->children->content];
+			NSString *attrValue = xmpp_newString(attrNode->children->content);
 			[attr setStringValue:attrValue];
 			
 			[element addAttribute:attr];
@@ -346,6 +367,42 @@ static void xmpp_onDidReadElement(XMPPParser *parser, xmlNodePtr child)
 #pragma mark Common
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static BOOL xmpp_readsCompactStanza(XMPPParser *parser, xmlNodePtr node)
+{
+	// Every iq requires a response, which is handled by the regular (DOM) pipeline.
+	// So iq stanzas are never read into compact form, as they'd be promoted right away.
+	
+	if (node->name == NULL) return NO;
+	if ((node->ns != NULL) && (node->ns->prefix != NULL)) return NO;
+	
+	if (parser->readsCompactMessages && xmlStrEqual(node->name, BAD_CAST "message")) return YES;
+	if (parser->readsCompactPresences && xmlStrEqual(node->name, BAD_CAST "presence")) return YES;
+	
+	return NO;
+}
+
+static void xmpp_onDidReadStanza(XMPPParser *parser, xmlNodePtr child)
+{
+	if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParser:didReadStanza:)])
+	{
+		// The stanza copies everything it needs into its own (single) allocation,
+		// so the libxml node can be freed right away, and no NSXMLElement is ever created.
+		
+		XMPPReceivedStanza *stanza = [[XMPPReceivedStanza alloc] initWithLibxmlNode:child];
+		
+		__strong id theDelegate = parser->delegate;
+		
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadStanza:stanza];
+		}});
+	}
+	
+	// Detach and free child to keep memory footprint small
+	xmlUnlinkNode(child);
+	xmlFreeNode(child);
+}
+
 /**
  * This method is called at the end of the xmlStartElement method.
  * This allows us to inspect the parser and xml tree, and determine if we need to invoke any delegate methods.
@@ -395,7 +452,10 @@ static void xmpp_postEndElement(xmlParserCtxt *ctxt)
 		{
 			if (child->type == XML_ELEMENT_NODE)
 			{
-				xmpp_onDidReadElement(parser, child);
+				if (xmpp_readsCompactStanza(parser, child))
+					xmpp_onDidReadStanza(parser, child);
+				else
+					xmpp_onDidReadElement(parser, child);
 				
 				// Exit while loop
 				break;
@@ -694,6 +754,16 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 
 - (id)initWithDelegate:(id)aDelegate delegateQueue:(dispatch_queue_t)dq parserQueue:(dispatch_queue_t)pq
 {
+	return [self initWithDelegate:aDelegate delegateQueue:dq parserQueue:pq parserQueueTag:NULL];
+}
+
+- (id)initWithDelegate:(id)aDelegate
+         delegateQueue:(dispatch_queue_t)dq
+           parserQueue:(dispatch_queue_t)pq
+        parserQueueTag:(void *)pqTag
+{
+	NSAssert(pq || !pqTag, @"A parserQueueTag requires a parserQueue");
+	
 	if ((self = [super init]))
 	{
 		delegate = aDelegate;
@@ -715,8 +785,13 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 			parserQueue = dispatch_queue_create("xmpp.parser", NULL);
 		}
 		
-		xmppParserQueueTag = &xmppParserQueueTag;
-		dispatch_queue_set_specific(parserQueue, xmppParserQueueTag, xmppParserQueueTag, NULL);
+		if (pqTag) {
+			xmppParserQueueTag = pqTag;
+		}
+		else {
+			xmppParserQueueTag = &xmppParserQueueTag;
+			dispatch_queue_set_specific(parserQueue, xmppParserQueueTag, xmppParserQueueTag, NULL);
+		}
 		
 		hasReportedRoot = NO;
 		depth  = 0;
@@ -795,6 +870,62 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 		dispatch_async(parserQueue, block);
 }
 
+- (BOOL)readsCompactMessages
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = readsCompactMessages;
+	};
+	
+	if (dispatch_get_specific(xmppParserQueueTag))
+		block();
+	else
+		dispatch_sync(parserQueue, block);
+	
+	return result;
+}
+
+- (void)setReadsCompactMessages:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		readsCompactMessages = flag;
+	};
+	
+	if (dispatch_get_specific(xmppParserQueueTag))
+		block();
+	else
+		dispatch_async(parserQueue, block);
+}
+
+- (BOOL)readsCompactPresences
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = readsCompactPresences;
+	};
+	
+	if (dispatch_get_specific(xmppParserQueueTag))
+		block();
+	else
+		dispatch_sync(parserQueue, block);
+	
+	return result;
+}
+
+- (void)setReadsCompactPresences:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		readsCompactPresences = flag;
+	};
+	
+	if (dispatch_get_specific(xmppParserQueueTag))
+		block();
+	else
+		dispatch_async(parserQueue, block);
+}
+
 - (void)parseData:(NSData *)data
 {
 	dispatch_block_t block = ^{ @autoreleasepool {
@@ -124,7 +124,10 @@
 
 - (NSInteger)priority
 {
-	return [[[self elementForName:@"priority"] stringValue] integerValue];
+	NSInteger priority = 0;
+	[[self elementForName:@"priority"] getStringValueAsNSInteger:&priority];
+	
+	return priority;
 }
 
 - (void)setPriority:(NSInteger)priority
@@ -139,16 +142,18 @@
 
 - (XMPPPresenceShowType)showType
 {
-	NSString *show = [self show];
-	if ([show isEqualToString:@"dnd"])
-		return XMPPPresenceShowBusy;
-	if ([show isEqualToString:@"xa"])
-		return XMPPPresenceShowExtendedAway;
-	if ([show isEqualToString:@"away"])
-		return XMPPPresenceShowAway;
-	if ([show isEqualToString:@"chat"])
-		return XMPPPresenceShowChat;
-	return XMPPPresenceShowNone;
+	switch (XMPPAtomForString([self show])) {
+		case XMPPAtomDND:
+			return XMPPPresenceShowBusy;
+		case XMPPAtomXA:
+			return XMPPPresenceShowExtendedAway;
+		case XMPPAtomAway:
+			return XMPPPresenceShowAway;
+		case XMPPAtomChat:
+			return XMPPPresenceShowChat;
+		default:
+			return XMPPPresenceShowNone;
+	}
 }
 
 - (void)setShowType:(XMPPPresenceShowType)showType
@@ -156,16 +161,16 @@
 	NSString *show = nil;
 	switch (showType) {
 		case XMPPPresenceShowBusy:
-			show = @"dnd";
+			show = XMPPAtomString(XMPPAtomDND);
 			break;
 		case XMPPPresenceShowExtendedAway:
-			show = @"xa";
+			show = XMPPAtomString(XMPPAtomXA);
 			break;
 		case XMPPPresenceShowAway:
-			show = @"away";
+			show = XMPPAtomString(XMPPAtomAway);
 			break;
 		case XMPPPresenceShowChat:
-			show = @"chat";
+			show = XMPPAtomString(XMPPAtomChat);
 			break;
 		default:
 			break;
@@ -175,9 +180,7 @@
 
 - (BOOL)available
 {
-	if (self.type)
-		return ![self.type isEqualToString:@"unavailable"];
-	return YES;
+	return [self typeAtom] != XMPPAtomUnavailable;
 }
 
 - (void)setAvailable:(BOOL)available
@@ -187,22 +190,22 @@
 
 - (int)intShow
 {
-	NSString *show = [self show];
-	
-	if ([show isEqualToString:@"dnd"])
-		return 0;
-	if ([show isEqualToString:@"xa"])
-		return 1;
-	if ([show isEqualToString:@"away"])
-		return 2;
-	if ([show isEqualToString:@"chat"])
-		return 4;
-	
-	return 3;
+	switch (XMPPAtomForString([self show])) {
+		case XMPPAtomDND:
+			return 0;
+		case XMPPAtomXA:
+			return 1;
+		case XMPPAtomAway:
+			return 2;
+		case XMPPAtomChat:
+			return 4;
+		default:
+			return 3;
+	}
 }
 
 - (BOOL)isErrorPresence
 {
-	return [[self type] isEqualToString:@"error"];
+	return [self typeAtom] == XMPPAtomError;
 }
 @end
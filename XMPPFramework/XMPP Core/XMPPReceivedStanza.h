@@ -0,0 +1,93 @@
+#import <Foundation/Foundation.h>
+#import "XMPPAtoms.h"
+
+#if TARGET_OS_IPHONE
+  #import "DDXML.h"
+#endif
+
+@class XMPPJID;
+@class XMPPElement;
+
+/**
+ * XMPPReceivedStanza is a compact, read-only representation of a received iq, message or presence stanza.
+ *
+ * A regular received stanza (XMPPIQ, XMPPMessage, XMPPPresence) is a full mutable DOM,
+ * with an object for every element, attribute, namespace and text node.
+ * An XMPPReceivedStanza instead stores the entire stanza in a single flat allocation:
+ * an array of nodes, an array of attributes, and the UTF-8 bytes they point into.
+ * Strings are only created when asked for, and the DOM is only created if somebody actually needs it.
+ *
+ * Received stanzas are delivered in this form via xmppStream:didReceiveStanza:,
+ * if the stream's receivesCompactStanzas property is enabled.
+ *
+ * XMPPReceivedStanza is immutable and thread-safe.
+**/
+@interface XMPPReceivedStanza : NSObject
+
+/**
+ * The name of the stanza element: "iq", "message" or "presence".
+**/
+@property (nonatomic, readonly) NSString *name;
+
+- (BOOL)isIQ;
+- (BOOL)isMessage;
+- (BOOL)isPresence;
+
+/**
+ * The atom for the stanza name (resolved once, when the stanza is parsed),
+ * and for the (case-insensitive) value of the type attribute.
+**/
+- (XMPPAtom)nameAtom;
+- (XMPPAtom)typeAtom;
+
+/**
+ * Typed accessors for the common stanza attributes.
+**/
+
+- (NSString *)type;
+- (NSString *)elementID;
+
+- (NSString *)toStr;
+- (NSString *)fromStr;
+
+- (XMPPJID *)to;
+- (XMPPJID *)from;
+
+- (NSString *)attributeStringValueForName:(NSString *)name;
+
+/**
+ * Compares an attribute to the given value, without creating any strings.
+**/
+- (BOOL)attributeForName:(NSString *)name isEqualToString:(NSString *)value;
+
+/**
+ * Returns the text of the message body (the first <body/> child), if any.
+**/
+- (NSString *)body;
+
+/**
+ * Returns the name and xmlns of the first child element, if any.
+ * For an iq, this is the child element that designates its payload.
+**/
+- (NSString *)childElementName;
+- (NSString *)childElementXmlns;
+
+/**
+ * Returns whether the stanza has a child element with the given name and xmlns (which may be nil).
+ * This method doesn't create any strings.
+**/
+- (BOOL)hasChildElementWithName:(NSString *)name xmlns:(NSString *)xmlns;
+
+/**
+ * Returns the stanza as a regular (mutable) element, which is an XMPPIQ, XMPPMessage or XMPPPresence.
+ *
+ * The element is created upon the first invocation of this method, and the same instance is returned thereafter.
+**/
+- (XMPPElement *)element;
+
+/**
+ * Returns YES if the element has been created.
+**/
+- (BOOL)isPromoted;
+
+@end
@@ -0,0 +1,651 @@
+#import "XMPPReceivedStanza.h"
+#import "XMPPInternal.h"
+#import "XMPPJID.h"
+#import "XMPPIQ.h"
+#import "XMPPMessage.h"
+#import "XMPPPresence.h"
+#import "NSXMLElement+XMPP.h"
+
+#import <libxml/tree.h>
+#import <libxml/parser.h>
+#import <libkern/OSAtomic.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Building
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t XMPPStanzaQualifiedNameLength(xmlNsPtr ns, const xmlChar *name)
+{
+	size_t length = name ? strlen((const char *)name) : 0;
+	
+	if (ns && ns->prefix)
+	{
+		length += strlen((const char *)ns->prefix) + 1;
+	}
+	
+	return length;
+}
+
+/**
+ * First pass: figure out how much space the stanza needs.
+**/
+static void XMPPStanzaMeasure(xmlNodePtr node, XMPPStanzaArena *arena)
+{
+	arena->nodeCount++;
+	arena->byteCount += XMPPStanzaQualifiedNameLength(node->ns, node->name);
+	
+	xmlNsPtr nsNode;
+	for (nsNode = node->nsDef; nsNode != NULL; nsNode = nsNode->next)
+	{
+		if (nsNode->href == NULL) continue;
+		
+		arena->attributeCount++;
+		arena->byteCount += strlen((const char *)nsNode->href);
+		
+		if (nsNode->prefix)
+			arena->byteCount += strlen((const char *)nsNode->prefix);
+	}
+	
+	xmlAttrPtr attrNode;
+	for (attrNode = node->properties; attrNode != NULL; attrNode = attrNode->next)
+	{
+		if (attrNode->name == NULL || attrNode->children == NULL || attrNode->children->content == NULL) continue;
+		
+		arena->attributeCount++;
+		arena->byteCount += XMPPStanzaQualifiedNameLength(attrNode->ns, attrNode->name);
+		arena->byteCount += strlen((const char *)attrNode->children->content);
+	}
+	
+	xmlNodePtr child;
+	for (child = node->children; child != NULL; child = child->next)
+	{
+		if (child->type == XML_ELEMENT_NODE)
+		{
+			XMPPStanzaMeasure(child, arena);
+		}
+		else if ((child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE) && child->content)
+		{
+			arena->nodeCount++;
+			arena->byteCount += strlen((const char *)child->content);
+		}
+	}
+}
+
+static uint32_t XMPPStanzaAppendBytes(XMPPStanzaArena *arena, const xmlChar *str)
+{
+	uint32_t offset = arena->byteCount;
+	
+	if (str)
+	{
+		size_t length = strlen((const char *)str);
+		memcpy(arena->bytes + offset, str, length);
+		
+		arena->byteCount += (uint32_t)length;
+	}
+	
+	return offset;
+}
+
+static uint32_t XMPPStanzaAppendQualifiedName(XMPPStanzaArena *arena, xmlNsPtr ns, const xmlChar *name)
+{
+	uint32_t offset = arena->byteCount;
+	
+	if (ns && ns->prefix)
+	{
+		XMPPStanzaAppendBytes(arena, ns->prefix);
+		arena->bytes[arena->byteCount++] = ':';
+	}
+	
+	XMPPStanzaAppendBytes(arena, name);
+	
+	return offset;
+}
+
+/**
+ * Second pass: copy the stanza into the arena.
+ * Returns the index of the node.
+**/
+static uint32_t XMPPStanzaFill(xmlNodePtr node, XMPPStanzaArena *arena)
+{
+	uint32_t index = arena->nodeCount++;
+	
+	XMPPStanzaNode *stanzaNode = &arena->nodes[index];
+	stanzaNode->kind = XMPPStanzaNodeKindElement;
+	stanzaNode->firstChild = XMPP_STANZA_NONE;
+	stanzaNode->nextSibling = XMPP_STANZA_NONE;
+	stanzaNode->offset = XMPPStanzaAppendQualifiedName(arena, node->ns, node->name);
+	stanzaNode->length = arena->byteCount - stanzaNode->offset;
+	stanzaNode->firstAttribute = arena->attributeCount;
+	
+	xmlNsPtr nsNode;
+	for (nsNode = node->nsDef; nsNode != NULL; nsNode = nsNode->next)
+	{
+		if (nsNode->href == NULL) continue;
+		
+		XMPPStanzaAttribute *attr = &arena->attributes[arena->attributeCount++];
+		attr->kind = XMPPStanzaAttributeKindNamespace;
+		attr->nameOffset = XMPPStanzaAppendBytes(arena, nsNode->prefix);
+		attr->nameLength = arena->byteCount - attr->nameOffset;
+		attr->valueOffset = XMPPStanzaAppendBytes(arena, nsNode->href);
+		attr->valueLength = arena->byteCount - attr->valueOffset;
+	}
+	
+	xmlAttrPtr attrNode;
+	for (attrNode = node->properties; attrNode != NULL; attrNode = attrNode->next)
+	{
+		if (attrNode->name == NULL || attrNode->children == NULL || attrNode->children->content == NULL) continue;
+		
+		XMPPStanzaAttribute *attr = &arena->attributes[arena->attributeCount++];
+		attr->kind = XMPPStanzaAttributeKindAttribute;
+		attr->nameOffset = XMPPStanzaAppendQualifiedName(arena, attrNode->ns, attrNode->name);
+		attr->nameLength = arena->byteCount - attr->nameOffset;
+		attr->valueOffset = XMPPStanzaAppendBytes(arena, attrNode->children->content);
+		attr->valueLength = arena->byteCount - attr->valueOffset;
+	}
+	
+	stanzaNode->attributeCount = arena->attributeCount - stanzaNode->firstAttribute;
+	
+	uint32_t lastChild = XMPP_STANZA_NONE;
+	
+	xmlNodePtr child;
+	for (child = node->children; child != NULL; child = child->next)
+	{
+		uint32_t childIndex;
+		
+		if (child->type == XML_ELEMENT_NODE)
+		{
+			childIndex = XMPPStanzaFill(child, arena);
+		}
+		else if ((child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE) && child->content)
+		{
+			childIndex = arena->nodeCount++;
+			
+			XMPPStanzaNode *textNode = &arena->nodes[childIndex];
+			textNode->kind = XMPPStanzaNodeKindText;
+			textNode->firstChild = XMPP_STANZA_NONE;
+			textNode->nextSibling = XMPP_STANZA_NONE;
+			textNode->firstAttribute = 0;
+			textNode->attributeCount = 0;
+			textNode->offset = XMPPStanzaAppendBytes(arena, child->content);
+			textNode->length = arena->byteCount - textNode->offset;
+		}
+		else
+		{
+			continue;
+		}
+		
+		if (lastChild == XMPP_STANZA_NONE)
+			stanzaNode->firstChild = childIndex;
+		else
+			arena->nodes[lastChild].nextSibling = childIndex;
+		
+		lastChild = childIndex;
+	}
+	
+	return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Comparing
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Compares a span of UTF-8 bytes to the given string, without creating any objects.
+**/
+static BOOL XMPPStanzaSpanEqualsString(const char *bytes, uint32_t length, NSString *str)
+{
+	if (str == nil) return NO;
+	
+	CFStringRef cfStr = (__bridge CFStringRef)str;
+	
+	const char *cStr = CFStringGetCStringPtr(cfStr, kCFStringEncodingUTF8);
+	if (cStr)
+	{
+		return (strlen(cStr) == length) && (memcmp(cStr, bytes, length) == 0);
+	}
+	
+	CFIndex strLength = CFStringGetLength(cfStr);
+	if ((NSUInteger)strLength > length) return NO; // Every character takes at least one byte
+	
+	uint8_t buf[256];
+	CFIndex usedLength = 0;
+	CFIndex converted = CFStringGetBytes(cfStr, CFRangeMake(0, strLength), kCFStringEncodingUTF8, 0, false,
+	                                     buf, sizeof(buf), &usedLength);
+	
+	if (converted == strLength)
+	{
+		return ((uint32_t)usedLength == length) && (memcmp(buf, bytes, length) == 0);
+	}
+	
+	// Too long for the stack buffer
+	
+	cStr = [str UTF8String];
+	return (strlen(cStr) == length) && (memcmp(cStr, bytes, length) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPReceivedStanza
+{
+	XMPPStanzaArena arena;
+	void *arenaBlock;
+	
+	XMPPAtom nameAtom;
+	
+	OSSpinLock elementLock;
+	XMPPElement *element;
+}
+
+- (id)initWithLibxmlNode:(struct _xmlNode *)node
+{
+	XMPPStanzaArena measured;
+	memset(&measured, 0, sizeof(measured));
+	
+	XMPPStanzaMeasure(node, &measured);
+	
+	// A single allocation for the whole stanza
+	
+	size_t nodesSize = measured.nodeCount * sizeof(XMPPStanzaNode);
+	size_t attributesSize = measured.attributeCount * sizeof(XMPPStanzaAttribute);
+	
+	void *block = malloc(nodesSize + attributesSize + measured.byteCount);
+	if (block == NULL)
+	{
+		return nil;
+	}
+	
+	XMPPStanzaArena filled;
+	memset(&filled, 0, sizeof(filled));
+	
+	filled.nodes = (XMPPStanzaNode *)block;
+	filled.attributes = (XMPPStanzaAttribute *)((char *)block + nodesSize);
+	filled.bytes = (char *)block + nodesSize + attributesSize;
+	
+	XMPPStanzaFill(node, &filled);
+	
+	return [self initWithArena:filled block:block];
+}
+
+- (id)initWithElement:(XMPPElement *)anElement
+{
+	// The DOM may be a libxml tree (DDXML) or not (NSXML), so the element is serialized and parsed again.
+	// This is only done for stanzas that are delivered both ways, after the filters have run.
+	
+	NSData *data = [[anElement compactXMLString] dataUsingEncoding:NSUTF8StringEncoding];
+	
+	xmlDocPtr doc = xmlReadMemory([data bytes], (int)[data length], NULL, "UTF-8", XML_PARSE_NONET);
+	xmlNodePtr root = doc ? xmlDocGetRootElement(doc) : NULL;
+	
+	if (root == NULL)
+	{
+		if (doc) xmlFreeDoc(doc);
+		return nil;
+	}
+	
+	self = [self initWithLibxmlNode:root];
+	xmlFreeDoc(doc);
+	
+	if (self)
+	{
+		element = anElement;
+	}
+	return self;
+}
+
+- (id)initWithArena:(XMPPStanzaArena)inArena block:(void *)block
+{
+	if ((self = [super init]))
+	{
+		arena = inArena;
+		arenaBlock = block;
+		
+		nameAtom = XMPPAtomForUTF8Bytes(arena.bytes + arena.nodes[0].offset, arena.nodes[0].length);
+		
+		elementLock = OS_SPINLOCK_INIT;
+	}
+	else
+	{
+		free(block);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(arenaBlock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Internal
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (const XMPPStanzaArena *)arena
+{
+	return &arena;
+}
+
+- (NSString *)stringWithOffset:(uint32_t)offset length:(uint32_t)length
+{
+	return [[NSString alloc] initWithBytes:(arena.bytes + offset) length:length encoding:NSUTF8StringEncoding];
+}
+
+- (XMPPStanzaAttribute *)attributeForName:(NSString *)name kind:(uint32_t)kind ofNode:(uint32_t)index
+{
+	XMPPStanzaNode *node = &arena.nodes[index];
+	
+	uint32_t i;
+	for (i = node->firstAttribute; i < node->firstAttribute + node->attributeCount; i++)
+	{
+		XMPPStanzaAttribute *attr = &arena.attributes[i];
+		
+		if (attr->kind == kind && XMPPStanzaSpanEqualsString(arena.bytes + attr->nameOffset, attr->nameLength, name))
+		{
+			return attr;
+		}
+	}
+	
+	return NULL;
+}
+
+- (uint32_t)firstChildElementOfNode:(uint32_t)index
+{
+	uint32_t child = arena.nodes[index].firstChild;
+	
+	while (child != XMPP_STANZA_NONE && arena.nodes[child].kind != XMPPStanzaNodeKindElement)
+	{
+		child = arena.nodes[child].nextSibling;
+	}
+	
+	return child;
+}
+
+- (BOOL)node:(uint32_t)index hasName:(NSString *)name
+{
+	XMPPStanzaNode *node = &arena.nodes[index];
+	
+	return XMPPStanzaSpanEqualsString(arena.bytes + node->offset, node->length, name);
+}
+
+- (NSString *)textOfNode:(uint32_t)index
+{
+	NSString *result = nil;
+	NSMutableString *mResult = nil;
+	
+	uint32_t child;
+	for (child = arena.nodes[index].firstChild; child != XMPP_STANZA_NONE; child = arena.nodes[child].nextSibling)
+	{
+		XMPPStanzaNode *node = &arena.nodes[child];
+		if (node->kind != XMPPStanzaNodeKindText) continue;
+		
+		NSString *text = [self stringWithOffset:node->offset length:node->length];
+		
+		if (result == nil)
+		{
+			result = text;
+		}
+		else
+		{
+			if (mResult == nil)
+			{
+				mResult = [result mutableCopy];
+				result = mResult;
+			}
+			[mResult appendString:text];
+		}
+	}
+	
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Accessors
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)name
+{
+	NSString *atomString = XMPPAtomString(nameAtom);
+	if (atomString) return atomString;
+	
+	return [self stringWithOffset:arena.nodes[0].offset length:arena.nodes[0].length];
+}
+
+- (BOOL)isIQ
+{
+	return nameAtom == XMPPAtomIQ;
+}
+
+- (BOOL)isMessage
+{
+	return nameAtom == XMPPAtomMessage;
+}
+
+- (BOOL)isPresence
+{
+	return nameAtom == XMPPAtomPresence;
+}
+
+- (XMPPAtom)nameAtom
+{
+	return nameAtom;
+}
+
+- (XMPPAtom)typeAtom
+{
+	XMPPStanzaAttribute *attr = [self attributeForName:@"type" kind:XMPPStanzaAttributeKindAttribute ofNode:0];
+	if (attr == NULL) return XMPPAtomNone;
+	
+	uint32_t length = attr->valueLength;
+	if (length > 32) return XMPPAtomNone; // Longer than any type value
+	
+	char buf[32];
+	
+	uint32_t i;
+	for (i = 0; i < length; i++)
+	{
+		char c = arena.bytes[attr->valueOffset + i];
+		buf[i] = (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+	}
+	
+	return XMPPAtomForUTF8Bytes(buf, length);
+}
+
+- (NSString *)attributeStringValueForName:(NSString *)name
+{
+	XMPPStanzaAttribute *attr = [self attributeForName:name kind:XMPPStanzaAttributeKindAttribute ofNode:0];
+	if (attr == NULL) return nil;
+	
+	return [self stringWithOffset:attr->valueOffset length:attr->valueLength];
+}
+
+- (BOOL)attributeForName:(NSString *)name isEqualToString:(NSString *)value
+{
+	XMPPStanzaAttribute *attr = [self attributeForName:name kind:XMPPStanzaAttributeKindAttribute ofNode:0];
+	if (attr == NULL) return NO;
+	
+	return XMPPStanzaSpanEqualsString(arena.bytes + attr->valueOffset, attr->valueLength, value);
+}
+
+- (NSString *)type
+{
+	return [self attributeStringValueForName:@"type"];
+}
+
+- (NSString *)elementID
+{
+	return [self attributeStringValueForName:@"id"];
+}
+
+- (NSString *)toStr
+{
+	return [self attributeStringValueForName:@"to"];
+}
+
+- (NSString *)fromStr
+{
+	return [self attributeStringValueForName:@"from"];
+}
+
+- (XMPPJID *)to
+{
+	return [XMPPJID internedJIDWithString:[self toStr]];
+}
+
+- (XMPPJID *)from
+{
+	return [XMPPJID internedJIDWithString:[self fromStr]];
+}
+
+- (NSString *)body
+{
+	uint32_t child;
+	for (child = arena.nodes[0].firstChild; child != XMPP_STANZA_NONE; child = arena.nodes[child].nextSibling)
+	{
+		if (arena.nodes[child].kind == XMPPStanzaNodeKindElement && [self node:child hasName:@"body"])
+		{
+			return [self textOfNode:child];
+		}
+	}
+	
+	return nil;
+}
+
+- (NSString *)childElementName
+{
+	uint32_t child = [self firstChildElementOfNode:0];
+	if (child == XMPP_STANZA_NONE) return nil;
+	
+	return [self stringWithOffset:arena.nodes[child].offset length:arena.nodes[child].length];
+}
+
+- (NSString *)childElementXmlns
+{
+	uint32_t child = [self firstChildElementOfNode:0];
+	if (child == XMPP_STANZA_NONE) return nil;
+	
+	XMPPStanzaAttribute *attr = [self attributeForName:@"" kind:XMPPStanzaAttributeKindNamespace ofNode:child];
+	if (attr == NULL) return nil;
+	
+	return [self stringWithOffset:attr->valueOffset length:attr->valueLength];
+}
+
+- (BOOL)hasChildElementWithName:(NSString *)name xmlns:(NSString *)xmlns
+{
+	uint32_t child;
+	for (child = arena.nodes[0].firstChild; child != XMPP_STANZA_NONE; child = arena.nodes[child].nextSibling)
+	{
+		if (arena.nodes[child].kind != XMPPStanzaNodeKindElement) continue;
+		if (![self node:child hasName:name]) continue;
+		
+		if (xmlns == nil) return YES;
+		
+		XMPPStanzaAttribute *attr = [self attributeForName:@"" kind:XMPPStanzaAttributeKindNamespace ofNode:child];
+		
+		if (attr && XMPPStanzaSpanEqualsString(arena.bytes + attr->valueOffset, attr->valueLength, xmlns))
+		{
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Promotion
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSXMLElement *)newElementForNode:(uint32_t)index
+{
+	XMPPStanzaNode *node = &arena.nodes[index];
+	
+	NSXMLElement *result = [[NSXMLElement alloc] initWithName:[self stringWithOffset:node->offset length:node->length]];
+	
+	uint32_t i;
+	for (i = node->firstAttribute; i < node->firstAttribute + node->attributeCount; i++)
+	{
+		XMPPStanzaAttribute *attr = &arena.attributes[i];
+		
+		NSString *attrName = [self stringWithOffset:attr->nameOffset length:attr->nameLength];
+		NSString *attrValue = [self stringWithOffset:attr->valueOffset length:attr->valueLength];
+		
+		if (attr->kind == XMPPStanzaAttributeKindNamespace)
+			[result addNamespace:[NSXMLNode namespaceWithName:attrName stringValue:attrValue]];
+		else
+			[result addAttribute:[NSXMLNode attributeWithName:attrName stringValue:attrValue]];
+	}
+	
+	uint32_t child;
+	for (child = node->firstChild; child != XMPP_STANZA_NONE; child = arena.nodes[child].nextSibling)
+	{
+		XMPPStanzaNode *childNode = &arena.nodes[child];
+		
+		if (childNode->kind == XMPPStanzaNodeKindElement)
+		{
+			[result addChild:[self newElementForNode:child]];
+		}
+		else
+		{
+			NSString *text = [self stringWithOffset:childNode->offset length:childNode->length];
+			[result addChild:[NSXMLNode textWithStringValue:text]];
+		}
+	}
+	
+	return result;
+}
+
+- (XMPPElement *)element
+{
+	XMPPElement *result;
+	
+	OSSpinLockLock(&elementLock);
+	result = element;
+	OSSpinLockUnlock(&elementLock);
+	
+	if (result) return result;
+	
+	// Build it outside the lock, as it may take a while.
+	// If another thread beats us to it, we use theirs, so there's only ever one element per stanza.
+	
+	NSXMLElement *newElement = [self newElementForNode:0];
+	
+	if ([self isIQ])
+		result = [XMPPIQ iqFromElement:newElement];
+	else if ([self isMessage])
+		result = [XMPPMessage messageFromElement:newElement];
+	else if ([self isPresence])
+		result = [XMPPPresence presenceFromElement:newElement];
+	else
+		result = (XMPPElement *)newElement;
+	
+	OSSpinLockLock(&elementLock);
+	if (element == nil)
+		element = result;
+	else
+		result = element;
+	OSSpinLockUnlock(&elementLock);
+	
+	return result;
+}
+
+- (BOOL)isPromoted
+{
+	BOOL result;
+	
+	OSSpinLockLock(&elementLock);
+	result = (element != nil);
+	OSSpinLockUnlock(&elementLock);
+	
+	return result;
+}
+
+- (NSString *)description
+{
+	return [[self element] compactXMLString];
+}
+
+@end
@@ -15,7 +15,11 @@
 @class XMPPPresence;
 @class XMPPModule;
 @class XMPPElementReceipt;
+@class XMPPStreamHost;
+@class XMPPStreamInstrumentation;
+@class XMPPReceivedStanza;
 @protocol XMPPStreamDelegate;
+@protocol XMPPIQHandler;
 
 #if TARGET_OS_IPHONE
   #define MIN_KEEPALIVE_INTERVAL      20.0 // 20 Seconds
@@ -25,6 +29,8 @@
   #define DEFAULT_KEEPALIVE_INTERVAL 300.0 //  5 Minutes
 #endif
 
+#define MAX_RECEIVE_LANE_COUNT 32
+
 extern NSString *const XMPPStreamErrorDomain;
 
 enum XMPPStreamErrorCode
@@ -56,6 +62,21 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 - (id)initP2PFrom:(XMPPJID *)myJID;
 
+/**
+ * Hosted XMPP initialization.
+ * The stream is a standard client to server connection,
+ * but shares its dispatch queues and timers with all other streams of the given host.
+ * 
+ * This is intended for processes that maintain a large number of simultaneous streams.
+ * See XMPPStreamHost for details.
+**/
+- (id)initWithHost:(XMPPStreamHost *)host;
+
+/**
+ * The host the stream was initialized with, or nil for a standalone stream.
+**/
+@property (strong, readonly) XMPPStreamHost *host;
+
 /**
  * XMPPStream uses a multicast delegate.
  * This allows one to add multiple delegates to a single XMPPStream instance,
@@ -154,10 +175,10 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
  * 
  * To disable keep-alive, set the interval to zero (or any non-positive number).
  * 
- * The keep-alive timer (if enabled) fires every (keepAliveInterval / 4) seconds.
- * Upon firing it checks when data was last sent/received,
- * and sends keep-alive data if the elapsed time has exceeded the keepAliveInterval.
- * Thus the effective resolution of the keepalive timer is based on the interval.
+ * Keep-alives are scheduled with the process-wide XMPPLivenessScheduler.
+ * The scheduler tracks when data was last sent/received,
+ * and only wakes the stream once the elapsed time has exceeded the keepAliveInterval.
+ * Thus keep-alive data is sent within one scheduler bucket (plus a small jitter) of the interval.
  * 
  * @see keepAliveWhitespaceCharacter
 **/
@@ -208,6 +229,66 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 @property (readwrite, assign) BOOL resetByteCountPerConnection;
 
+/**
+ * Enables the per-conversation receive pipeline.
+ * 
+ * By default, every received stanza is filtered (xmppStream:willReceiveX:) and broadcast (xmppStream:didReceiveX:)
+ * via the single xmppQueue, plus a single filter queue per stanza type.
+ * This is ideal for a typical client, but limits high fan-in streams (e.g. components) to a single core.
+ * 
+ * If set to a value greater than 1, received iq, message and presence stanzas are instead hashed
+ * (by the bare JID of the sender) onto the given number of serial receive lanes,
+ * which are processed concurrently.
+ * The filters and the broadcast to delegates run on the lane.
+ * 
+ * Ordering guarantees:
+ * - Stanzas from the same bare JID are always filtered and delivered in the order they were received.
+ * - Stanzas from different bare JIDs may be delivered in any order relative to each other.
+ * 
+ * Since filters for different conversations may now run concurrently,
+ * xmppStream:willReceiveX: implementations must be thread-safe with respect to each other.
+ * (Each individual invocation is still dispatched onto the delegate's own queue.)
+ * 
+ * The value is capped at MAX_RECEIVE_LANE_COUNT. Zero or one disables the receive lanes.
+ * It should be set before connecting the stream.
+ * 
+ * The default value is zero.
+**/
+@property (readwrite, assign) NSUInteger receiveLaneCount;
+
+/**
+ * Optional latency instrumentation.
+ * 
+ * When set, every iq, message and presence stanza is timestamped as it passes through the stream:
+ * read from the socket, parsed, filtered, dispatched and handled by delegates (or, when sending,
+ * filtered, serialized and written to the socket). The resulting latencies are recorded into the
+ * histograms of the given XMPPStreamInstrumentation instance, which may be shared by several streams.
+ * 
+ * Stream negotiation elements are not traced.
+ * 
+ * The default value is nil, in which case the stream does no timing whatsoever.
+**/
+@property (readwrite, strong) XMPPStreamInstrumentation *instrumentation;
+
+/**
+ * If enabled, received message and presence stanzas are parsed into compact XMPPReceivedStanza instances
+ * (a single allocation per stanza), instead of into a full DOM, and are delivered via xmppStream:didReceiveStanza:.
+ * 
+ * Compact stanzas are only used if no delegate (or module) implements the classic
+ * willReceiveMessage:/didReceiveMessage: (or willReceivePresence:/didReceivePresence:) methods.
+ * Otherwise the stanza is parsed into a full DOM as usual, and is delivered both ways:
+ * the compact form is created after the willReceive filters have run, and reflects their changes
+ * (a stanza dropped by a filter isn't delivered at all).
+ * Received iq stanzas are never delivered in compact form,
+ * as every iq requires a response, which is handled by the regular pipeline.
+ * 
+ * Compact stanzas are not traced by the stream's instrumentation.
+ * 
+ * This property should be set before connecting.
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL receivesCompactStanzas;
+
 /**
  * The tag property allows you to associate user defined information with the stream.
  * Tag values are not used internally, and should not be used by xmpp modules.
@@ -639,6 +720,43 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 - (void)enumerateModulesOfClass:(Class)aClass withBlock:(void (^)(XMPPModule *module, NSUInteger idx, BOOL *stop))block;
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark IQ Handlers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Registers a handler for incoming IQ requests (type 'get' or 'set')
+ * whose child element has the given name and namespace.
+ * 
+ * For example, a module that implements XEP-0199 would register for ("ping", "urn:xmpp:ping").
+ * 
+ * Incoming IQ requests are routed via a single dictionary lookup on their child element.
+ * If a handler is registered for the child element, the request is dispatched (asynchronously) to that handler
+ * and no other delegate is asked whether it will respond to the request.
+ * If the handler returns NO, the stream immediately sends back a feature-not-implemented error.
+ * 
+ * Only one handler may be registered for any given (elementName, xmlns) pair.
+ * Registering a second handler for the same pair replaces the first.
+ * 
+ * The handler is not retained. The handlerQueue is retained until the handler is removed.
+ * 
+ * IQ requests that don't match a registered handler fall back to the xmppStream:didReceiveIQ: delegate method.
+ * If no delegate implements that method, the error response is sent immediately.
+ * 
+ * All IQs (including those routed to a registered handler) are still broadcast to the
+ * xmppStream:didReceiveIQ: delegate method. In the case of routed IQs the return value is ignored.
+ * 
+ * These methods are thread-safe, and may be invoked from any thread/queue.
+ * The add method is asynchronous. The remove methods are synchronous.
+**/
+- (void)addIQHandler:(id <XMPPIQHandler>)handler
+        handlerQueue:(dispatch_queue_t)handlerQueue
+      forElementName:(NSString *)elementName
+               xmlns:(NSString *)xmlns;
+
+- (void)removeIQHandler:(id <XMPPIQHandler>)handler forElementName:(NSString *)elementName xmlns:(NSString *)xmlns;
+- (void)removeIQHandler:(id <XMPPIQHandler>)handler;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Utilities
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -694,6 +812,26 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+@protocol XMPPIQHandler <NSObject>
+@required
+
+/**
+ * Invoked on the handlerQueue for each incoming IQ request (type 'get' or 'set')
+ * whose child element matches the (elementName, xmlns) pair the handler was registered for.
+ * 
+ * Return YES if you have or will respond to the IQ (with a result or error).
+ * If you return NO, the xmpp stream will immediately send a feature-not-implemented error response.
+ * 
+ * @see addIQHandler:handlerQueue:forElementName:xmlns:
+**/
+- (BOOL)xmppStream:(XMPPStream *)sender handleIQRequest:(XMPPIQ *)iq;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @protocol XMPPStreamDelegate
 @optional
 
@@ -835,6 +973,11 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
  * If the IQ is of type 'get' or 'set', and no delegates respond to the IQ,
  * then xmpp stream will automatically send an error response.
  * 
+ * If the IQ request was routed to a registered IQ handler, the return value is ignored.
+ * New code that answers IQ requests should prefer registering an XMPPIQHandler.
+ * 
+ * @see addIQHandler:handlerQueue:forElementName:xmlns:
+ * 
  * Concerning thread-safety, delegates shouldn't modify the given elements.
  * As documented in NSXML / KissXML, elements are read-access thread-safe, but write-access thread-unsafe.
  * If you have need to modify an element for any reason,
@@ -844,6 +987,17 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message;
 - (void)xmppStream:(XMPPStream *)sender didReceivePresence:(XMPPPresence *)presence;
 
+/**
+ * This method is called for every received message and presence stanza
+ * if the receivesCompactStanzas property is enabled (see that property for details).
+ * 
+ * Delegates that only need to peek at a few attributes or child elements should use this method,
+ * and avoid implementing the classic didReceive methods, as that forces the creation of the full DOM.
+ * 
+ * XMPPReceivedStanza is immutable, and may safely be retained and passed to other threads.
+**/
+- (void)xmppStream:(XMPPStream *)sender didReceiveStanza:(XMPPReceivedStanza *)stanza;
+
 /**
  * This method is called if an XMPP error is received.
  * In other words, a <stream:error/>.
@@ -3,6 +3,8 @@
 #import "XMPPLogging.h"
 #import "XMPPInternal.h"
 #import "XMPPSRVResolver.h"
+#import "XMPPStreamHost.h"
+#import "XMPPLivenessScheduler.h"
 #import "NSData+XMPP.h"
 
 #import <objc/runtime.h>
@@ -43,6 +45,12 @@
 #define TAG_XMPP_WRITE_STREAM       201
 #define TAG_XMPP_WRITE_RECEIPT      202
 
+// Or'd into the write tag of stanzas that carry an XMPPStanzaTrace (see pendingWriteTraces)
+#define TAG_XMPP_WRITE_TRACED       (1 << 16)
+
+// The number of outstanding socket reads whose timestamps we remember for instrumentation
+#define READ_TIME_RING_SIZE         16
+
 // Define the timeouts (in seconds) for SRV
 #define TIMEOUT_SRV_RESOLUTION 30.0
 
@@ -51,6 +59,17 @@ NSString *const XMPPStreamDidChangeMyJIDNotification = @"XMPPStreamDidChangeMyJI
 
 const NSTimeInterval XMPPStreamTimeoutNone = -1;
 
+/**
+ * Dispatches the block asynchronously, as part of the given group (if any).
+**/
+static inline void XMPPDispatchAsync(dispatch_group_t group, dispatch_queue_t queue, dispatch_block_t block)
+{
+	if (group)
+		dispatch_group_async(group, queue, block);
+	else
+		dispatch_async(queue, block);
+}
+
 enum XMPPStreamFlags
 {
 	kP2PInitiator                 = 1 << 0,  // If set, we are the P2P initializer
@@ -77,6 +96,10 @@ enum XMPPStreamConfig
 	dispatch_queue_t xmppQueue;
 	void *xmppQueueTag;
 	
+	XMPPStreamHost *host;
+	NSUInteger hostWorkerIndex;
+	id hostConnectTimer;
+	
 	dispatch_queue_t willSendIqQueue;
 	dispatch_queue_t willSendMessageQueue;
 	dispatch_queue_t willSendPresenceQueue;
@@ -84,12 +107,22 @@ enum XMPPStreamConfig
 	dispatch_queue_t willReceiveIqQueue;
 	dispatch_queue_t willReceiveMessageQueue;
 	dispatch_queue_t willReceivePresenceQueue;
-	
-	dispatch_queue_t didReceiveIqQueue;
     
     dispatch_source_t connectTimer;
 	
 	GCDMulticastDelegate <XMPPStreamDelegate> *multicastDelegate;
+	NSMutableDictionary *iqHandlers;
+	
+	dispatch_queue_t receiveLanes[MAX_RECEIVE_LANE_COUNT];
+	NSUInteger receiveLaneCount;
+	
+	XMPPStreamInstrumentation *instrumentation;
+	uint64_t readTimes[READ_TIME_RING_SIZE];
+	NSUInteger readTimesIndex;
+	NSUInteger readTimesCount;
+	NSMutableArray *pendingWriteTraces;
+	
+	BOOL receivesCompactStanzas;
 	
 	int state;
 	
@@ -118,7 +151,7 @@ enum XMPPStreamConfig
 	NSXMLElement *rootElement;
 	
 	NSTimeInterval keepAliveInterval;
-	dispatch_source_t keepAliveTimer;
+	XMPPLivenessEntry *keepAliveEntry;
 	NSTimeInterval lastSendReceiveTime;
 	NSData *keepAliveData;
 	
@@ -153,6 +186,37 @@ enum XMPPStreamConfig
 - (void)continueReceiveMessage:(XMPPMessage *)message;
 - (void)continueReceiveIQ:(XMPPIQ *)iq;
 - (void)continueReceivePresence:(XMPPPresence *)presence;
+- (GCDMulticastDelegateEnumerator *)compactStanzaDelegateEnumerator;
+- (void)deliverCompactStanzaForElement:(XMPPElement *)element
+                    delegateEnumerator:(GCDMulticastDelegateEnumerator *)delegateEnumerator;
+- (void)sendErrorResponseForUnhandledIQ:(XMPPIQ *)iq;
+
+- (void)laneReceiveIQ:(XMPPIQ *)iq;
+- (void)laneReceiveMessage:(XMPPMessage *)message;
+- (void)laneReceivePresence:(XMPPPresence *)presence;
+
+@end
+
+@interface XMPPIQHandlerNode : NSObject
+{
+  #if __has_feature(objc_arc_weak)
+	__weak id <XMPPIQHandler> handler;
+  #else
+	__unsafe_unretained id <XMPPIQHandler> handler;
+  #endif
+	
+	dispatch_queue_t handlerQueue;
+}
+
+- (id)initWithHandler:(id <XMPPIQHandler>)handler handlerQueue:(dispatch_queue_t)handlerQueue;
+
+#if __has_feature(objc_arc_weak)
+@property (/* atomic */ readwrite, weak) id <XMPPIQHandler> handler;
+#else
+@property (/* atomic */ readwrite, unsafe_unretained) id <XMPPIQHandler> handler;
+#endif
+
+@property (nonatomic, readonly) dispatch_queue_t handlerQueue;
 
 @end
 
@@ -176,21 +240,53 @@ enum XMPPStreamConfig
 **/
 - (void)commonInit
 {
-	xmppQueueTag = &xmppQueueTag;
-	xmppQueue = dispatch_queue_create("xmpp", NULL);
-	dispatch_queue_set_specific(xmppQueue, xmppQueueTag, xmppQueueTag, NULL);
-	
-	willSendIqQueue = dispatch_queue_create("xmpp.willSendIq", NULL);
-	willSendMessageQueue = dispatch_queue_create("xmpp.willSendMessage", NULL);
-	willSendPresenceQueue = dispatch_queue_create("xmpp.willSendPresence", NULL);
-	
-	willReceiveIqQueue = dispatch_queue_create("xmpp.willReceiveIq", NULL);
-	willReceiveMessageQueue = dispatch_queue_create("xmpp.willReceiveMessage", NULL);
-	willReceivePresenceQueue = dispatch_queue_create("xmpp.willReceivePresence", NULL);
-	
-	didReceiveIqQueue = dispatch_queue_create("xmpp.didReceiveIq", NULL);
+	if (host)
+	{
+		// Hosted stream: borrow the queues of one of the host's workers.
+		// We retain each queue individually so dealloc is the same for hosted and standalone streams.
+		
+		hostWorkerIndex = [host attachStream];
+		
+		xmppQueueTag = [host streamQueueTagForWorker:hostWorkerIndex];
+		xmppQueue = [host streamQueueForWorker:hostWorkerIndex];
+		
+		dispatch_queue_t filterQueue = [host filterQueueForWorker:hostWorkerIndex];
+		
+		willSendIqQueue = filterQueue;
+		willSendMessageQueue = filterQueue;
+		willSendPresenceQueue = filterQueue;
+		
+		willReceiveIqQueue = filterQueue;
+		willReceiveMessageQueue = filterQueue;
+		willReceivePresenceQueue = filterQueue;
+		
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_retain(xmppQueue);
+		dispatch_retain(willSendIqQueue);
+		dispatch_retain(willSendMessageQueue);
+		dispatch_retain(willSendPresenceQueue);
+		dispatch_retain(willReceiveIqQueue);
+		dispatch_retain(willReceiveMessageQueue);
+		dispatch_retain(willReceivePresenceQueue);
+		#endif
+	}
+	else
+	{
+		xmppQueueTag = &xmppQueueTag;
+		xmppQueue = dispatch_queue_create("xmpp", NULL);
+		dispatch_queue_set_specific(xmppQueue, xmppQueueTag, xmppQueueTag, NULL);
+		
+		willSendIqQueue = dispatch_queue_create("xmpp.willSendIq", NULL);
+		willSendMessageQueue = dispatch_queue_create("xmpp.willSendMessage", NULL);
+		willSendPresenceQueue = dispatch_queue_create("xmpp.willSendPresence", NULL);
+		
+		willReceiveIqQueue = dispatch_queue_create("xmpp.willReceiveIq", NULL);
+		willReceiveMessageQueue = dispatch_queue_create("xmpp.willReceiveMessage", NULL);
+		willReceivePresenceQueue = dispatch_queue_create("xmpp.willReceivePresence", NULL);
+	}
 	
 	multicastDelegate = (GCDMulticastDelegate <XMPPStreamDelegate> *)[[GCDMulticastDelegate alloc] init];
+	iqHandlers = [[NSMutableDictionary alloc] init];
 	
 	state = STATE_XMPP_DISCONNECTED;
 	
@@ -208,6 +304,7 @@ enum XMPPStreamConfig
 	autoDelegateDict = [[NSMutableDictionary alloc] init];
 	
 	receipts = [[NSMutableArray alloc] init];
+	pendingWriteTraces = [[NSMutableArray alloc] init];
 }
 
 /**
@@ -222,7 +319,7 @@ enum XMPPStreamConfig
 		[self commonInit];
 		
 		// Initialize socket
-		asyncSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:xmppQueue];
+		asyncSocket = [self newSocket];
 	}
 	return self;
 }
@@ -249,6 +346,121 @@ enum XMPPStreamConfig
 	return self;
 }
 
+/**
+ * Hosted XMPP initialization.
+ * The stream is a standard client to server connection, using the shared resources of the given host.
+**/
+- (id)initWithHost:(XMPPStreamHost *)aHost
+{
+	if (aHost == nil)
+	{
+		return [self init];
+	}
+	
+	if ((self = [super init]))
+	{
+		host = aHost;
+		
+		// Common initialization
+		[self commonInit];
+		
+		// Initialize socket
+		asyncSocket = [self newSocket];
+	}
+	return self;
+}
+
+/**
+ * Creates a socket for the stream.
+ * 
+ * Hosted streams give their socket its own serial queue, targeted at the io queue of their worker.
+ * GCDAsyncSocket sets a queue specific key on its socket queue,
+ * so sharing the worker queue itself would pile up one (ambiguous) key per socket.
+**/
+- (GCDAsyncSocket *)newSocket
+{
+	if (host)
+	{
+		dispatch_queue_t socketQueue = dispatch_queue_create("xmpp.socket", NULL);
+		dispatch_set_target_queue(socketQueue, [host ioQueueForWorker:hostWorkerIndex]);
+		
+		GCDAsyncSocket *socket = [[GCDAsyncSocket alloc] initWithDelegate:self
+		                                                    delegateQueue:xmppQueue
+		                                                      socketQueue:socketQueue];
+		
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_release(socketQueue);
+		#endif
+		
+		return socket;
+	}
+	else
+	{
+		return [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:xmppQueue];
+	}
+}
+
+/**
+ * Creates a parser for the stream.
+ * Hosted streams use the io queue of their worker as the parser queue.
+**/
+- (XMPPParser *)newParser
+{
+	XMPPParser *newParser;
+	
+	if (host)
+	{
+		dispatch_queue_t parserQueue = [host ioQueueForWorker:hostWorkerIndex];
+		void *parserQueueTag = [host ioQueueTagForWorker:hostWorkerIndex];
+		
+		newParser = [[XMPPParser alloc] initWithDelegate:self
+		                                   delegateQueue:xmppQueue
+		                                     parserQueue:parserQueue
+		                                  parserQueueTag:parserQueueTag];
+	}
+	else
+	{
+		newParser = [[XMPPParser alloc] initWithDelegate:self delegateQueue:xmppQueue];
+	}
+	
+	[self updateCompactStanzasForParser:newParser];
+	
+	return newParser;
+}
+
+/**
+ * Returns whether any delegate (or module) needs received messages (or presences) as a full DOM,
+ * either to filter them, or to receive them via the classic didReceive methods.
+**/
+- (BOOL)needsElementForReceivedMessages
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	return [multicastDelegate hasDelegateThatRespondsToSelector:@selector(xmppStream:willReceiveMessage:)] ||
+	       [multicastDelegate hasDelegateThatRespondsToSelector:@selector(xmppStream:didReceiveMessage:)];
+}
+
+- (BOOL)needsElementForReceivedPresences
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	return [multicastDelegate hasDelegateThatRespondsToSelector:@selector(xmppStream:willReceivePresence:)] ||
+	       [multicastDelegate hasDelegateThatRespondsToSelector:@selector(xmppStream:didReceivePresence:)];
+}
+
+/**
+ * The parser only reads messages (or presences) into compact form if nobody needs the full DOM,
+ * so each stanza is only ever built once.
+ * This is re-evaluated whenever the delegates change.
+**/
+- (void)updateCompactStanzasForParser:(XMPPParser *)aParser
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	[aParser setReadsCompactMessages:(receivesCompactStanzas && ![self needsElementForReceivedMessages])];
+	[aParser setReadsCompactPresences:(receivesCompactStanzas && ![self needsElementForReceivedPresences])];
+}
+
 /**
  * Standard deallocation method.
  * Every object variable declared in the header file should be released here.
@@ -263,7 +475,12 @@ enum XMPPStreamConfig
 	dispatch_release(willReceiveIqQueue);
 	dispatch_release(willReceiveMessageQueue);
 	dispatch_release(willReceivePresenceQueue);
-	dispatch_release(didReceiveIqQueue);
+	
+	NSUInteger i;
+	for (i = 0; i < receiveLaneCount; i++)
+	{
+		dispatch_release(receiveLanes[i]);
+	}
 	#endif
 	
 	[asyncSocket setDelegate:nil delegateQueue:NULL];
@@ -271,11 +488,15 @@ enum XMPPStreamConfig
 	
 	[parser setDelegate:nil delegateQueue:NULL];
 	
-	if (keepAliveTimer)
+	[[XMPPLivenessScheduler sharedScheduler] cancelEntry:keepAliveEntry];
+    
+	if (host)
 	{
-		dispatch_source_cancel(keepAliveTimer);
+		[host cancelTimer:hostConnectTimer];
+		
+		[host detachStreamFromWorker:hostWorkerIndex];
 	}
-    
+	
 	for (XMPPElementReceipt *receipt in receipts)
 	{
 		[receipt signalFailure];
@@ -288,6 +509,7 @@ enum XMPPStreamConfig
 
 @synthesize xmppQueue;
 @synthesize xmppQueueTag;
+@synthesize host;
 
 - (XMPPStreamState)state
 {
@@ -664,6 +886,122 @@ enum XMPPStreamConfig
 
 #endif
 
+- (NSUInteger)receiveLaneCount
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		result = receiveLaneCount;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setReceiveLaneCount:(NSUInteger)count
+{
+	dispatch_block_t block = ^{
+		
+		NSUInteger newCount = MIN(count, MAX_RECEIVE_LANE_COUNT);
+		if (newCount < 2)
+		{
+			// A single lane would just be a slower version of the standard pipeline.
+			newCount = 0;
+		}
+		
+		NSUInteger i;
+		for (i = receiveLaneCount; i < newCount; i++)
+		{
+			receiveLanes[i] = dispatch_queue_create("xmpp.receiveLane", NULL);
+		}
+		for (i = newCount; i < receiveLaneCount; i++)
+		{
+			// Any blocks already queued on the lane keep it alive until they've run.
+			
+			#if !OS_OBJECT_USE_OBJC
+			dispatch_release(receiveLanes[i]);
+			#endif
+			receiveLanes[i] = NULL;
+		}
+		
+		receiveLaneCount = newCount;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (BOOL)receivesCompactStanzas
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = receivesCompactStanzas;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setReceivesCompactStanzas:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		
+		receivesCompactStanzas = flag;
+		[self updateCompactStanzasForParser:parser];
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (XMPPStreamInstrumentation *)instrumentation
+{
+	__block XMPPStreamInstrumentation *result = nil;
+	
+	dispatch_block_t block = ^{
+		result = instrumentation;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setInstrumentation:(XMPPStreamInstrumentation *)newInstrumentation
+{
+	dispatch_block_t block = ^{
+		
+		instrumentation = newInstrumentation;
+		
+		// Any remembered read times were only recorded for the previous instrumentation (if any).
+		// Stanzas that are already in flight keep reporting to the instrumentation they were traced with.
+		
+		readTimesIndex = 0;
+		readTimesCount = 0;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Configuration
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -674,6 +1012,7 @@ enum XMPPStreamConfig
 	
 	dispatch_block_t block = ^{
 		[multicastDelegate addDelegate:delegate delegateQueue:delegateQueue];
+		[self updateCompactStanzasForParser:parser];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -688,6 +1027,7 @@ enum XMPPStreamConfig
 	
 	dispatch_block_t block = ^{
 		[multicastDelegate removeDelegate:delegate delegateQueue:delegateQueue];
+		[self updateCompactStanzasForParser:parser];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -702,6 +1042,7 @@ enum XMPPStreamConfig
 	
 	dispatch_block_t block = ^{
 		[multicastDelegate removeDelegate:delegate];
+		[self updateCompactStanzasForParser:parser];
 	};
 	
 	if (dispatch_get_specific(xmppQueueTag))
@@ -862,7 +1203,20 @@ enum XMPPStreamConfig
 {
     XMPPLogTrace();
 
-	if (timeout >= 0.0 && !connectTimer)
+	if (timeout >= 0.0 && host)
+	{
+		if (!hostConnectTimer)
+		{
+			hostConnectTimer = [host scheduleTimerWithInterval:timeout
+			                                           repeats:NO
+			                                             queue:xmppQueue
+			                                             block:^{ @autoreleasepool {
+				
+				[self doConnectTimeout];
+			}}];
+		}
+	}
+	else if (timeout >= 0.0 && !connectTimer)
 	{
 		connectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
 		
@@ -899,6 +1253,12 @@ enum XMPPStreamConfig
 		dispatch_source_cancel(connectTimer);
 		connectTimer = NULL;
 	}
+	
+	if (hostConnectTimer)
+	{
+		[host cancelTimer:hostConnectTimer];
+		hostConnectTimer = nil;
+	}
 }
 
 /**
@@ -1161,7 +1521,7 @@ enum XMPPStreamConfig
 		state = STATE_XMPP_CONNECTING;
 		
 		// Initailize socket
-		asyncSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:xmppQueue];
+		asyncSocket = [self newSocket];
 		
 		NSError *connectErr = nil;
 		result = [asyncSocket connectToAddress:remoteAddr error:&connectErr];
@@ -2074,6 +2434,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:iq] markPoint:XMPPStanzaTracePointSendFiltered];
+		
 		[self continueSendIQ:iq withTag:tag];
 	}
 	else
@@ -2082,6 +2444,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:iq];
 		
 		dispatch_async(willSendIqQueue, ^{ @autoreleasepool {
 			
@@ -2116,6 +2479,8 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointSendFiltered element:modifiedIQ];
+			
 			if (modifiedIQ)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
@@ -2144,6 +2509,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:message] markPoint:XMPPStanzaTracePointSendFiltered];
+		
 		[self continueSendMessage:message withTag:tag];
 	}
 	else
@@ -2152,6 +2519,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:message];
 		
 		dispatch_async(willSendMessageQueue, ^{ @autoreleasepool {
 			
@@ -2186,6 +2554,8 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointSendFiltered element:modifiedMessage];
+			
 			if (modifiedMessage)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
@@ -2214,6 +2584,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:presence] markPoint:XMPPStanzaTracePointSendFiltered];
+		
 		[self continueSendPresence:presence withTag:tag];
 	}
 	else
@@ -2222,6 +2594,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:presence];
 		
 		dispatch_async(willSendPresenceQueue, ^{ @autoreleasepool {
 			
@@ -2256,6 +2629,8 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointSendFiltered element:modifiedPresence];
+			
 			if (modifiedPresence)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
@@ -2282,7 +2657,7 @@ enum XMPPStreamConfig
 	
 	[asyncSocket writeData:outgoingData
 	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	                   tag:[self writeTagForTracedElement:iq tag:tag]];
 	
 	[multicastDelegate xmppStream:self didSendIQ:iq];
 }
@@ -2300,7 +2675,7 @@ enum XMPPStreamConfig
 	
 	[asyncSocket writeData:outgoingData
 	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	                   tag:[self writeTagForTracedElement:message tag:tag]];
 	
 	[multicastDelegate xmppStream:self didSendMessage:message];
 }
@@ -2318,7 +2693,7 @@ enum XMPPStreamConfig
 	
 	[asyncSocket writeData:outgoingData
 	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	                   tag:[self writeTagForTracedElement:presence tag:tag]];
 	
 	// Update myPresence if this is a normal presence element.
 	// In other words, ignore presence subscription stuff, MUC room stuff, etc.
@@ -2326,8 +2701,8 @@ enum XMPPStreamConfig
 	// We use the built-in [presence type] which guarantees lowercase strings,
 	// and will return @"available" if there was no set type (as available is implicit).
 	
-	NSString *type = [presence type];
-	if ([type isEqualToString:@"available"] || [type isEqualToString:@"unavailable"])
+	XMPPAtom type = [presence typeAtom];
+	if (type == XMPPAtomAvailable || type == XMPPAtomUnavailable)
 	{
 		if ([presence toStr] == nil && myPresence != presence)
 		{
@@ -2406,10 +2781,13 @@ enum XMPPStreamConfig
 {
 	if (element == nil) return;
 	
+	uint64_t sendTime = XMPPInstrumentationTime();
+	
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
 		if (state == STATE_XMPP_CONNECTED)
 		{
+			[self traceSentElement:element sendTime:sendTime];
 			[self sendElement:element withTag:TAG_XMPP_WRITE_STREAM];
 		}
 	}};
@@ -2439,6 +2817,8 @@ enum XMPPStreamConfig
 	{
 		__block XMPPElementReceipt *receipt = nil;
 		
+		uint64_t sendTime = XMPPInstrumentationTime();
+		
 		dispatch_block_t block = ^{ @autoreleasepool {
 			
 			if (state == STATE_XMPP_CONNECTED)
@@ -2446,6 +2826,7 @@ enum XMPPStreamConfig
 				receipt = [[XMPPElementReceipt alloc] init];
 				[receipts addObject:receipt];
 				
+				[self traceSentElement:element sendTime:sendTime];
 				[self sendElement:element withTag:TAG_XMPP_WRITE_RECEIPT];
 			}
 		}};
@@ -2467,7 +2848,7 @@ enum XMPPStreamConfig
 {
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
-		if (myPresence && [[myPresence type] isEqualToString:@"available"])
+		if (myPresence && [myPresence typeAtom] == XMPPAtomAvailable)
 		{
 			[self sendElement:myPresence];
 		}
@@ -2517,6 +2898,14 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (receiveLaneCount > 0)
+	{
+		// Per-conversation receive pipeline (see receiveLaneCount)
+		
+		[self laneReceiveIQ:iq];
+		return;
+	}
+	
 	// We're getting ready to receive an IQ.
 	// Notify delegates to allow them to optionally alter/filter the incoming IQ element.
 	
@@ -2527,6 +2916,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:iq] markPoint:XMPPStanzaTracePointReceiveFiltered];
+		
 		[self continueReceiveIQ:iq];
 	}
 	else
@@ -2535,6 +2926,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:iq];
 		
 		dispatch_async(willReceiveIqQueue, ^{ @autoreleasepool {
 			
@@ -2554,6 +2946,8 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedIQ];
+			
 			if (modifiedIQ)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
@@ -2572,6 +2966,14 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (receiveLaneCount > 0)
+	{
+		// Per-conversation receive pipeline (see receiveLaneCount)
+		
+		[self laneReceiveMessage:message];
+		return;
+	}
+	
 	// We're getting ready to receive a message.
 	// Notify delegates to allow them to optionally alter/filter the incoming message.
 	
@@ -2582,6 +2984,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:message] markPoint:XMPPStanzaTracePointReceiveFiltered];
+		
 		[self continueReceiveMessage:message];
 	}
 	else
@@ -2590,6 +2994,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:message];
 		
 		dispatch_async(willReceiveMessageQueue, ^{ @autoreleasepool {
 			
@@ -2609,6 +3014,8 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedMessage];
+			
 			if (modifiedMessage)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
@@ -2627,6 +3034,14 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
+	if (receiveLaneCount > 0)
+	{
+		// Per-conversation receive pipeline (see receiveLaneCount)
+		
+		[self laneReceivePresence:presence];
+		return;
+	}
+	
 	// We're getting ready to receive a presence element.
 	// Notify delegates to allow them to optionally alter/filter the incoming presence.
 	
@@ -2637,6 +3052,8 @@ enum XMPPStreamConfig
 		// None of the delegates implement the method.
 		// Use a shortcut.
 		
+		[[self traceForElement:presence] markPoint:XMPPStanzaTracePointReceiveFiltered];
+		
 		[self continueReceivePresence:presence];
 	}
 	else
@@ -2645,6 +3062,7 @@ enum XMPPStreamConfig
 		// This must be done serially to allow them to alter the element in a thread-safe manner.
 		
 		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		XMPPStanzaTrace *trace = [self traceForElement:presence];
 		
 		dispatch_async(willSendPresenceQueue, ^{ @autoreleasepool {
 			
@@ -2664,12 +3082,14 @@ enum XMPPStreamConfig
 				}});
 			}
 			
+			[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedPresence];
+			
 			if (modifiedPresence)
 			{
 				dispatch_async(xmppQueue, ^{ @autoreleasepool {
 					
 					if (state == STATE_XMPP_CONNECTED) {
-						[self continueReceivePresence:presence];
+						[self continueReceivePresence:modifiedPresence];
 					}
 				}});
 			}
@@ -2679,112 +3099,259 @@ enum XMPPStreamConfig
 
 - (void)continueReceiveIQ:(XMPPIQ *)iq
 {
-	if ([iq requiresResponse])
-	{
-		// As per the XMPP specificiation, if the IQ requires a response,
-		// and we don't have any delegates or modules that can properly respond to the IQ,
-		// we MUST send back and error IQ.
-		//
-		// So we notifiy all interested delegates and modules about the received IQ,
-		// keeping track of whether or not any of them have handled it.
-		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
-		
-		id del;
-		dispatch_queue_t dq;
-		
-		SEL selector = @selector(xmppStream:didReceiveIQ:);
-		
-		dispatch_semaphore_t delSemaphore = dispatch_semaphore_create(0);
-		dispatch_group_t delGroup = dispatch_group_create();
-		
-		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
-		{
-			dispatch_group_async(delGroup, dq, ^{ @autoreleasepool {
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPIQHandlerNode *node = [iq requiresResponse] ? [self handlerNodeForIQ:iq] : nil;
+	
+	[self continueReceiveIQ:iq
+	            handlerNode:node
+	     delegateEnumerator:[multicastDelegate delegateEnumerator]
+	                  trace:[self traceForElement:iq]];
+}
+
+/**
+ * Returns the registered handler node for the given IQ request, or nil if there isn't one.
+ * This method must be invoked on the xmppQueue.
+**/
+- (XMPPIQHandlerNode *)handlerNodeForIQ:(XMPPIQ *)iq
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	NSXMLElement *iqChild = [iq childElement];
+	if (iqChild == nil) return nil;
+	
+	NSString *xmlns = [iqChild xmlns];
+	NSString *name = [iqChild name];
+	
+	if (xmlns == nil || name == nil) return nil;
+	
+	return [[iqHandlers objectForKey:xmlns] objectForKey:name];
+}
+
+/**
+ * Delivers a (filtered) received IQ.
+ * 
+ * This method only touches the given handler node, delegate enumerator and trace
+ * (all of which are fetched on the xmppQueue beforehand), so it may be invoked on the xmppQueue or on a receive lane.
+**/
+- (void)continueReceiveIQ:(XMPPIQ *)iq
+              handlerNode:(XMPPIQHandlerNode *)node
+       delegateEnumerator:(GCDMulticastDelegateEnumerator *)delegateEnumerator
+                    trace:(XMPPStanzaTrace *)trace
+{
+	// Every module and delegate probes received stanzas for the child elements it cares about,
+	// so it pays to index the children.
+	// The index is only enabled here, after the filters have had their chance to modify the stanza,
+	// and it's built lazily by the first delegate that looks something up.
+	
+	[iq enableChildIndex];
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	SEL selector = @selector(xmppStream:didReceiveIQ:);
+	
+	dispatch_group_t group = [trace beginDelegateDispatch];
+	
+	if ([iq requiresResponse])
+	{
+		// As per the XMPP specificiation, if the IQ requires a response,
+		// and we don't have any delegates or modules that can properly respond to the IQ,
+		// we MUST send back and error IQ.
+		//
+		// First we check to see if a handler has been registered for the IQ's child element.
+		// If so, the handler (and only the handler) is responsible for responding.
+		
+		id <XMPPIQHandler> handler = node.handler;
+		if (handler)
+		{
+			XMPPDispatchAsync(group, node.handlerQueue, ^{ @autoreleasepool {
 				
-				if ([del xmppStream:self didReceiveIQ:iq])
+				if (![handler xmppStream:self handleIQRequest:iq])
 				{
-					dispatch_semaphore_signal(delSemaphore);
+					[self sendErrorResponseForUnhandledIQ:iq];
 				}
-				
 			}});
-		}
-		
-		dispatch_async(didReceiveIqQueue, ^{ @autoreleasepool {
 			
-			dispatch_group_wait(delGroup, DISPATCH_TIME_FOREVER);
+			// Delegates are still notified, but are no longer responsible for the response.
 			
-			// Did any of the delegates handle the IQ? (handle == will response)
-			
-			BOOL handled = (dispatch_semaphore_wait(delSemaphore, DISPATCH_TIME_NOW) == 0);
+			while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+			{
+				XMPPDispatchAsync(group, dq, ^{ @autoreleasepool {
+					
+					[del xmppStream:self didReceiveIQ:iq];
+				}});
+			}
 			
-			// An entity that receives an IQ request of type "get" or "set" MUST reply
-			// with an IQ response of type "result" or "error".
-			//
-			// The response MUST preserve the 'id' attribute of the request.
+			[trace endDelegateDispatch];
+			return;
+		}
+		
+		// No registered handler.
+		// So we notifiy all interested delegates and modules about the received IQ,
+		// keeping track of whether or not any of them have handled it.
+		//
+		// Rather than blocking a queue until every delegate has returned,
+		// we keep a count of outstanding delegate invocations.
+		// Whichever invocation finishes last sends the error response (if nobody handled the IQ).
+		// The count starts at 1 on behalf of this method, which releases it after the loop.
+		
+		__block int32_t pendingCount = 1;
+		__block int32_t handledCount = 0;
+		
+		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+		{
+			OSAtomicIncrement32Barrier(&pendingCount);
 			
-			if (!handled)
-			{
-				// Return error message:
-				//
-				// <iq to="jid" type="error" id="id">
-				//   <query xmlns="ns"/>
-				//   <error type="cancel" code="501">
-				//     <feature-not-implemented xmlns="urn:ietf:params:xml:ns:xmpp-stanzas"/>
-				//   </error>
-				// </iq>
-				
-				NSXMLElement *reason = [NSXMLElement elementWithName:@"feature-not-implemented"
-				                                               xmlns:@"urn:ietf:params:xml:ns:xmpp-stanzas"];
-				
-				NSXMLElement *error = [NSXMLElement elementWithName:@"error"];
-				[error addAttributeWithName:@"type" stringValue:@"cancel"];
-				[error addAttributeWithName:@"code" stringValue:@"501"];
-				[error addChild:reason];
-				
-				XMPPIQ *iqResponse = [XMPPIQ iqWithType:@"error"
-				                                     to:[iq from]
-				                              elementID:[iq elementID]
-				                                  child:error];
+			XMPPDispatchAsync(group, dq, ^{ @autoreleasepool {
 				
-				NSXMLElement *iqChild = [iq childElement];
-				if (iqChild)
+				if ([del xmppStream:self didReceiveIQ:iq])
 				{
-					NSXMLNode *iqChildCopy = [iqChild copy];
-					[iqResponse insertChild:iqChildCopy atIndex:0];
+					OSAtomicIncrement32Barrier(&handledCount);
 				}
 				
-				// Purposefully go through the sendElement: method
-				// so that it gets dispatched onto the xmppQueue,
-				// and so that modules may get notified of the outgoing error message.
-				
-				[self sendElement:iqResponse];
-			}
-			
-			#if !OS_OBJECT_USE_OBJC
-			dispatch_release(delSemaphore);
-			dispatch_release(delGroup);
-			#endif
-			
-		}});
+				if (OSAtomicDecrement32Barrier(&pendingCount) == 0 && OSAtomicAdd32Barrier(0, &handledCount) == 0)
+				{
+					[self sendErrorResponseForUnhandledIQ:iq];
+				}
+			}});
+		}
+		
+		if (OSAtomicDecrement32Barrier(&pendingCount) == 0 && OSAtomicAdd32Barrier(0, &handledCount) == 0)
+		{
+			[self sendErrorResponseForUnhandledIQ:iq];
+		}
 	}
 	else
 	{
 		// The IQ doesn't require a response.
 		// So we can just fire the delegate method and ignore the responses.
 		
-		[multicastDelegate xmppStream:self didReceiveIQ:iq];
+		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+		{
+			XMPPDispatchAsync(group, dq, ^{ @autoreleasepool {
+				
+				[del xmppStream:self didReceiveIQ:iq];
+			}});
+		}
 	}
+	
+	[trace endDelegateDispatch];
+}
+
+/**
+ * Sends a feature-not-implemented error in response to an IQ request that nobody handled.
+ * This method may be invoked on any thread/queue.
+**/
+- (void)sendErrorResponseForUnhandledIQ:(XMPPIQ *)iq
+{
+	// An entity that receives an IQ request of type "get" or "set" MUST reply
+	// with an IQ response of type "result" or "error".
+	//
+	// The response MUST preserve the 'id' attribute of the request.
+	//
+	// Return error message:
+	//
+	// <iq to="jid" type="error" id="id">
+	//   <query xmlns="ns"/>
+	//   <error type="cancel" code="501">
+	//     <feature-not-implemented xmlns="urn:ietf:params:xml:ns:xmpp-stanzas"/>
+	//   </error>
+	// </iq>
+	
+	NSXMLElement *reason = [NSXMLElement elementWithName:@"feature-not-implemented"
+	                                               xmlns:@"urn:ietf:params:xml:ns:xmpp-stanzas"];
+	
+	NSXMLElement *error = [NSXMLElement elementWithName:@"error"];
+	[error addAttributeWithName:@"type" stringValue:@"cancel"];
+	[error addAttributeWithName:@"code" stringValue:@"501"];
+	[error addChild:reason];
+	
+	XMPPIQ *iqResponse = [XMPPIQ iqWithType:@"error"
+	                                     to:[iq from]
+	                              elementID:[iq elementID]
+	                                  child:error];
+	
+	NSXMLElement *iqChild = [iq childElement];
+	if (iqChild)
+	{
+		NSXMLNode *iqChildCopy = [iqChild copy];
+		[iqResponse insertChild:iqChildCopy atIndex:0];
+	}
+	
+	// Purposefully go through the sendElement: method
+	// so that it gets dispatched onto the xmppQueue,
+	// and so that modules may get notified of the outgoing error message.
+	
+	[self sendElement:iqResponse];
 }
 
 - (void)continueReceiveMessage:(XMPPMessage *)message
 {
-	[multicastDelegate xmppStream:self didReceiveMessage:message];
+	[message enableChildIndex]; // See continueReceiveIQ:handlerNode:delegateEnumerator:trace:
+	
+	[self deliverCompactStanzaForElement:message delegateEnumerator:[self compactStanzaDelegateEnumerator]];
+	
+	XMPPStanzaTrace *trace = [self traceForElement:message];
+	if (trace == nil)
+	{
+		[multicastDelegate xmppStream:self didReceiveMessage:message];
+		return;
+	}
+	
+	// Instrumented: fan out to the delegates ourselves, so we know when the last of them has returned
+	
+	dispatch_group_t group = [trace beginDelegateDispatch];
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	SEL selector = @selector(xmppStream:didReceiveMessage:);
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+	{
+		dispatch_group_async(group, dq, ^{ @autoreleasepool {
+			
+			[del xmppStream:self didReceiveMessage:message];
+		}});
+	}
+	
+	[trace endDelegateDispatch];
 }
 
 - (void)continueReceivePresence:(XMPPPresence *)presence
 {
-	[multicastDelegate xmppStream:self didReceivePresence:presence];
+	[presence enableChildIndex]; // See continueReceiveIQ:handlerNode:delegateEnumerator:trace:
+	
+	[self deliverCompactStanzaForElement:presence delegateEnumerator:[self compactStanzaDelegateEnumerator]];
+	
+	XMPPStanzaTrace *trace = [self traceForElement:presence];
+	if (trace == nil)
+	{
+		[multicastDelegate xmppStream:self didReceivePresence:presence];
+		return;
+	}
+	
+	// Instrumented: fan out to the delegates ourselves, so we know when the last of them has returned
+	
+	dispatch_group_t group = [trace beginDelegateDispatch];
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	SEL selector = @selector(xmppStream:didReceivePresence:);
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+	{
+		dispatch_group_async(group, dq, ^{ @autoreleasepool {
+			
+			[del xmppStream:self didReceivePresence:presence];
+		}});
+	}
+	
+	[trace endDelegateDispatch];
 }
 
 /**
@@ -2816,17 +3383,17 @@ enum XMPPStreamConfig
 		}
 		else
 		{
-			NSString *elementName = [element name];
+			XMPPAtom elementAtom = XMPPAtomForString([element name]);
 			
-			if ([elementName isEqualToString:@"iq"])
+			if (elementAtom == XMPPAtomIQ)
 			{
 				[self receiveIQ:[XMPPIQ iqFromElement:element]];
 			}
-			else if ([elementName isEqualToString:@"message"])
+			else if (elementAtom == XMPPAtomMessage)
 			{
 				[self receiveMessage:[XMPPMessage messageFromElement:element]];
 			}
-			else if ([elementName isEqualToString:@"presence"])
+			else if (elementAtom == XMPPAtomPresence)
 			{
 				[self receivePresence:[XMPPPresence presenceFromElement:element]];
 			}
@@ -2843,6 +3410,262 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Receive Lanes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the receive lane for the given stanza.
+ * 
+ * Stanzas are hashed by the bare JID of the sender,
+ * so all traffic from a given peer (across all of its resources) is processed serially, in order.
+ * The JID is normalized first, so differently cased spellings of the same peer end up in the same lane.
+ * Stanzas without a (valid) 'from' attribute (i.e. from our own server/account) go to the first lane.
+**/
+- (dispatch_queue_t)receiveLaneForElement:(XMPPElement *)element
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	NSString *bare = [[element from] bare];
+	if (bare == nil)
+	{
+		return receiveLanes[0];
+	}
+	
+	return receiveLanes[[bare hash] % receiveLaneCount];
+}
+
+- (void)laneReceiveIQ:(XMPPIQ *)iq
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	// The multicastDelegate and the handler registry may only be accessed from within the xmppQueue.
+	// So we snapshot everything the lane will need before handing the IQ off.
+	// 
+	// Note: The handler lookup is performed on the IQ as received (before any willReceiveIQ: filters).
+	
+	SEL filterSelector = @selector(xmppStream:willReceiveIQ:);
+	
+	GCDMulticastDelegateEnumerator *filterEnumerator = nil;
+	if ([multicastDelegate hasDelegateThatRespondsToSelector:filterSelector])
+	{
+		filterEnumerator = [multicastDelegate delegateEnumerator];
+	}
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	XMPPStanzaTrace *trace = [self traceForElement:iq];
+	XMPPIQHandlerNode *node = [iq requiresResponse] ? [self handlerNodeForIQ:iq] : nil;
+	
+	// The state may only be accessed from within the xmppQueue as well.
+	// Like the delegate blocks dispatched by the xmppQueue itself, the lane delivers stanzas it has been handed
+	// even if the stream disconnects in the meantime.
+	int stateAtDispatch = state;
+	
+	dispatch_async([self receiveLaneForElement:iq], ^{ @autoreleasepool {
+		
+		// Allow delegates to modify and/or filter incoming element
+		
+		__block XMPPIQ *modifiedIQ = iq;
+		
+		id del;
+		dispatch_queue_t dq;
+		
+		while (modifiedIQ && [filterEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:filterSelector])
+		{
+			dispatch_sync(dq, ^{ @autoreleasepool {
+				
+				modifiedIQ = [del xmppStream:self willReceiveIQ:modifiedIQ];
+				
+			}});
+		}
+		
+		[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedIQ];
+		
+		if (modifiedIQ && (stateAtDispatch == STATE_XMPP_CONNECTED))
+		{
+			[self continueReceiveIQ:modifiedIQ handlerNode:node delegateEnumerator:delegateEnumerator trace:trace];
+		}
+	}});
+}
+
+- (void)laneReceiveMessage:(XMPPMessage *)message
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	SEL filterSelector = @selector(xmppStream:willReceiveMessage:);
+	
+	GCDMulticastDelegateEnumerator *filterEnumerator = nil;
+	if ([multicastDelegate hasDelegateThatRespondsToSelector:filterSelector])
+	{
+		filterEnumerator = [multicastDelegate delegateEnumerator];
+	}
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	GCDMulticastDelegateEnumerator *stanzaEnumerator = [self compactStanzaDelegateEnumerator];
+	XMPPStanzaTrace *trace = [self traceForElement:message];
+	int stateAtDispatch = state; // See laneReceiveIQ:
+	
+	dispatch_async([self receiveLaneForElement:message], ^{ @autoreleasepool {
+		
+		// Allow delegates to modify and/or filter incoming element
+		
+		__block XMPPMessage *modifiedMessage = message;
+		
+		id del;
+		dispatch_queue_t dq;
+		
+		while (modifiedMessage && [filterEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:filterSelector])
+		{
+			dispatch_sync(dq, ^{ @autoreleasepool {
+				
+				modifiedMessage = [del xmppStream:self willReceiveMessage:modifiedMessage];
+				
+			}});
+		}
+		
+		[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedMessage];
+		
+		if (modifiedMessage == nil || stateAtDispatch != STATE_XMPP_CONNECTED)
+		{
+			return_from_block;
+		}
+		
+		[modifiedMessage enableChildIndex]; // See continueReceiveIQ:handlerNode:delegateEnumerator:trace:
+		
+		[self deliverCompactStanzaForElement:modifiedMessage delegateEnumerator:stanzaEnumerator];
+		
+		SEL selector = @selector(xmppStream:didReceiveMessage:);
+		
+		dispatch_group_t group = [trace beginDelegateDispatch];
+		
+		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+		{
+			XMPPDispatchAsync(group, dq, ^{ @autoreleasepool {
+				
+				[del xmppStream:self didReceiveMessage:modifiedMessage];
+			}});
+		}
+		
+		[trace endDelegateDispatch];
+	}});
+}
+
+- (void)laneReceivePresence:(XMPPPresence *)presence
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	SEL filterSelector = @selector(xmppStream:willReceivePresence:);
+	
+	GCDMulticastDelegateEnumerator *filterEnumerator = nil;
+	if ([multicastDelegate hasDelegateThatRespondsToSelector:filterSelector])
+	{
+		filterEnumerator = [multicastDelegate delegateEnumerator];
+	}
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+	GCDMulticastDelegateEnumerator *stanzaEnumerator = [self compactStanzaDelegateEnumerator];
+	XMPPStanzaTrace *trace = [self traceForElement:presence];
+	int stateAtDispatch = state; // See laneReceiveIQ:
+	
+	dispatch_async([self receiveLaneForElement:presence], ^{ @autoreleasepool {
+		
+		// Allow delegates to modify and/or filter incoming element
+		
+		__block XMPPPresence *modifiedPresence = presence;
+		
+		id del;
+		dispatch_queue_t dq;
+		
+		while (modifiedPresence && [filterEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:filterSelector])
+		{
+			dispatch_sync(dq, ^{ @autoreleasepool {
+				
+				modifiedPresence = [del xmppStream:self willReceivePresence:modifiedPresence];
+				
+			}});
+		}
+		
+		[trace markPoint:XMPPStanzaTracePointReceiveFiltered element:modifiedPresence];
+		
+		if (modifiedPresence == nil || stateAtDispatch != STATE_XMPP_CONNECTED)
+		{
+			return_from_block;
+		}
+		
+		[modifiedPresence enableChildIndex]; // See continueReceiveIQ:handlerNode:delegateEnumerator:trace:
+		
+		[self deliverCompactStanzaForElement:modifiedPresence delegateEnumerator:stanzaEnumerator];
+		
+		SEL selector = @selector(xmppStream:didReceivePresence:);
+		
+		dispatch_group_t group = [trace beginDelegateDispatch];
+		
+		while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+		{
+			XMPPDispatchAsync(group, dq, ^{ @autoreleasepool {
+				
+				[del xmppStream:self didReceivePresence:modifiedPresence];
+			}});
+		}
+		
+		[trace endDelegateDispatch];
+	}});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Instrumentation
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the trace attached to the given stanza, or nil if instrumentation is disabled.
+ * The nil check keeps uninstrumented streams from ever touching the associated object table.
+**/
+- (XMPPStanzaTrace *)traceForElement:(NSXMLElement *)element
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (instrumentation == nil) return nil;
+	
+	return [XMPPStanzaTrace traceForElement:element];
+}
+
+/**
+ * Invoked from sendElement: and sendElement:andGetReceipt:,
+ * with the time the element was handed to the stream (on the caller's thread).
+**/
+- (void)traceSentElement:(NSXMLElement *)element sendTime:(uint64_t)sendTime
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (instrumentation == nil) return;
+	
+	[XMPPStanzaTrace attachTraceToElement:element
+	                      instrumentation:instrumentation
+	                                 time:sendTime
+	                             forPoint:XMPPStanzaTracePointSent];
+}
+
+/**
+ * Invoked right after a stanza has been serialized, and right before it's handed to the socket.
+ * 
+ * If the stanza is traced, the trace is queued until the socket reports the write as complete,
+ * and the returned tag is marked so socket:didWriteDataWithTag: knows to dequeue it.
+**/
+- (long)writeTagForTracedElement:(NSXMLElement *)element tag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPStanzaTrace *trace = [self traceForElement:element];
+	if (trace == nil) return tag;
+	
+	[trace markPoint:XMPPStanzaTracePointSerialized];
+	[trace detachFromElement:element];
+	
+	[pendingWriteTraces addObject:trace];
+	
+	return (tag | TAG_XMPP_WRITE_TRACED);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Stream Negotiation
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2898,14 +3721,14 @@ enum XMPPStreamConfig
 		XMPPLogVerbose(@"%@: Initializing parser...", THIS_FILE);
 		
 		// Need to create the parser.
-		parser = [[XMPPParser alloc] initWithDelegate:self delegateQueue:xmppQueue];
+		parser = [self newParser];
 	}
 	else
 	{
 		XMPPLogVerbose(@"%@: Resetting parser...", THIS_FILE);
 		
 		// We're restarting our negotiation, so we need to reset the parser.
-		parser = [[XMPPParser alloc] initWithDelegate:self delegateQueue:xmppQueue];
+		parser = [self newParser];
 	}
 	
 	NSString *xmlns = @"jabber:client";
@@ -3660,8 +4483,25 @@ enum XMPPStreamConfig
 	XMPPLogTrace();
 	
 	lastSendReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+	[keepAliveEntry noteActivityAtTime:lastSendReceiveTime];
+	
 	numberOfBytesReceived += [data length];
 	
+	if (instrumentation)
+	{
+		// Remember when this chunk was read, so the elements parsed from it can be traced back to it.
+		// The parser processes chunks in order, and informs us after each one (xmppParserDidParseData:).
+		
+		NSUInteger index = (readTimesIndex + readTimesCount) % READ_TIME_RING_SIZE;
+		readTimes[index] = XMPPInstrumentationTime();
+		
+		if (readTimesCount < READ_TIME_RING_SIZE)
+			readTimesCount++;
+		else
+			readTimesIndex = (readTimesIndex + 1) % READ_TIME_RING_SIZE;
+	}
+	
+	// The data is only converted to a string if the log record is actually formatted
 	XMPPLogRecvPre(@"RECV: %@", [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding]);
 	
 	// Asynchronously parse the xml data
@@ -3696,6 +4536,22 @@ enum XMPPStreamConfig
 	XMPPLogTrace();
 	
 	lastSendReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+	[keepAliveEntry noteActivityAtTime:lastSendReceiveTime];
+	
+	if (tag & TAG_XMPP_WRITE_TRACED)
+	{
+		// The socket completes writes in order, so this is the oldest traced write
+		
+		if ([pendingWriteTraces count] > 0)
+		{
+			XMPPStanzaTrace *trace = [pendingWriteTraces objectAtIndex:0];
+			[pendingWriteTraces removeObjectAtIndex:0];
+			
+			[trace finishSend];
+		}
+		
+		tag &= ~TAG_XMPP_WRITE_TRACED;
+	}
 	
 	if (tag == TAG_XMPP_WRITE_RECEIPT)
 	{
@@ -3746,12 +4602,17 @@ enum XMPPStreamConfig
 		rootElement = nil;
 		
 		// Stop the keep alive timer
-		if (keepAliveTimer)
+		if (keepAliveEntry)
 		{
-			dispatch_source_cancel(keepAliveTimer);
-			keepAliveTimer = NULL;
+			[[XMPPLivenessScheduler sharedScheduler] cancelEntry:keepAliveEntry];
+			keepAliveEntry = nil;
 		}
 		
+		// Clear instrumentation state (writes that never completed aren't recorded)
+		readTimesIndex = 0;
+		readTimesCount = 0;
+		[pendingWriteTraces removeAllObjects];
+		
 		// Clear srv results
 		srvResolver = nil;
 		srvResults = nil;
@@ -3895,9 +4756,12 @@ enum XMPPStreamConfig
 	XMPPLogTrace();
 	XMPPLogRecvPost(@"RECV: %@", [element compactXMLString]);
 		
-	NSString *elementName = [element name];
+	// The parser hands us the shared atom strings for all well-known element names,
+	// so routing the element is a matter of comparing integers.
 	
-	if ([elementName isEqualToString:@"stream:error"] || [elementName isEqualToString:@"error"])
+	XMPPAtom elementAtom = XMPPAtomForString([element name]);
+	
+	if (elementAtom == XMPPAtomStreamError || elementAtom == XMPPAtomError)
 	{
 		[multicastDelegate xmppStream:self didReceiveError:element];
 		
@@ -3940,20 +4804,32 @@ enum XMPPStreamConfig
 	}
 	else
 	{
-		if ([elementName isEqualToString:@"iq"])
+		if (instrumentation)
+		{
+			XMPPStanzaTrace *trace = [XMPPStanzaTrace attachTraceToElement:element
+			                                               instrumentation:instrumentation
+			                                                          time:XMPPInstrumentationTime()
+			                                                      forPoint:XMPPStanzaTracePointParsed];
+			
+			if (readTimesCount > 0)
+			{
+				[trace setTime:readTimes[readTimesIndex] forPoint:XMPPStanzaTracePointRead];
+			}
+		}
+		
+		if (elementAtom == XMPPAtomIQ)
 		{
 			[self receiveIQ:[XMPPIQ iqFromElement:element]];
 		}
-		else if ([elementName isEqualToString:@"message"])
+		else if (elementAtom == XMPPAtomMessage)
 		{
 			[self receiveMessage:[XMPPMessage messageFromElement:element]];
 		}
-		else if ([elementName isEqualToString:@"presence"])
+		else if (elementAtom == XMPPAtomPresence)
 		{
 			[self receivePresence:[XMPPPresence presenceFromElement:element]];
 		}
-		else if ([self isP2P] &&
-				([elementName isEqualToString:@"stream:features"] || [elementName isEqualToString:@"features"]))
+		else if ([self isP2P] && (elementAtom == XMPPAtomStreamFeatures || elementAtom == XMPPAtomFeatures))
 		{
 			[multicastDelegate xmppStream:self didReceiveP2PFeatures:element];
 		}
@@ -3964,6 +4840,82 @@ enum XMPPStreamConfig
 	}
 }
 
+- (void)xmppParser:(XMPPParser *)sender didReadStanza:(XMPPReceivedStanza *)stanza
+{
+	// This method is invoked on the xmppQueue.
+	
+	if (sender != parser) return;
+	
+	XMPPLogTrace();
+	
+	// The parser only reads stanzas into compact form if nobody needs the full DOM.
+	// But a delegate that does may have been added since, or we may still be negotiating.
+	// In which case the stanza goes through the regular pipeline (which runs the filters first).
+	
+	BOOL needsElement;
+	if ([stanza isMessage])
+		needsElement = [self needsElementForReceivedMessages];
+	else if ([stanza isPresence])
+		needsElement = [self needsElementForReceivedPresences];
+	else
+		needsElement = YES;
+	
+	if (state != STATE_XMPP_CONNECTED || needsElement)
+	{
+		[self xmppParser:sender didReadElement:[stanza element]];
+		return;
+	}
+	
+	// Nobody filters these stanzas (filters need the DOM), so they can be delivered right away.
+	
+	[multicastDelegate xmppStream:self didReceiveStanza:stanza];
+}
+
+/**
+ * Returns an enumerator for the delegates that want received stanzas in compact form,
+ * or nil if there aren't any (or the receivesCompactStanzas property isn't enabled).
+**/
+- (GCDMulticastDelegateEnumerator *)compactStanzaDelegateEnumerator
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (!receivesCompactStanzas) return nil;
+	if (![multicastDelegate hasDelegateThatRespondsToSelector:@selector(xmppStream:didReceiveStanza:)]) return nil;
+	
+	return [multicastDelegate delegateEnumerator];
+}
+
+/**
+ * Delivers a stanza that went through the regular pipeline (after the filters have run)
+ * to the delegates that want it in compact form.
+ * 
+ * This method may be invoked on any queue (the xmppQueue, or a receive lane).
+**/
+- (void)deliverCompactStanzaForElement:(XMPPElement *)element
+                    delegateEnumerator:(GCDMulticastDelegateEnumerator *)delegateEnumerator
+{
+	SEL selector = @selector(xmppStream:didReceiveStanza:);
+	
+	XMPPReceivedStanza *stanza = nil;
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	while ([delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+	{
+		if (stanza == nil)
+		{
+			stanza = [[XMPPReceivedStanza alloc] initWithElement:element];
+			if (stanza == nil) return;
+		}
+		
+		dispatch_async(dq, ^{ @autoreleasepool {
+			
+			[del xmppStream:self didReceiveStanza:stanza];
+		}});
+	}
+}
+
 - (void)xmppParserDidParseData:(XMPPParser *)sender
 {
 	// This method is invoked on the xmppQueue.
@@ -3972,6 +4924,12 @@ enum XMPPStreamConfig
 	
 	XMPPLogTrace();
 	
+	if (readTimesCount > 0)
+	{
+		readTimesIndex = (readTimesIndex + 1) % READ_TIME_RING_SIZE;
+		readTimesCount--;
+	}
+	
 	if (![self isSecure])
 	{
 		// Continue reading for XML elements
@@ -4019,43 +4977,32 @@ enum XMPPStreamConfig
 	
 	XMPPLogTrace();
 	
-	if (keepAliveTimer)
+	XMPPLivenessScheduler *scheduler = [XMPPLivenessScheduler sharedScheduler];
+	
+	if (keepAliveEntry)
 	{
-		dispatch_source_cancel(keepAliveTimer);
-		keepAliveTimer = NULL;
+		[scheduler cancelEntry:keepAliveEntry];
+		keepAliveEntry = nil;
 	}
 	
 	if (state == STATE_XMPP_CONNECTED)
 	{
 		if (keepAliveInterval > 0)
 		{
-			keepAliveTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
-			
-			dispatch_source_set_event_handler(keepAliveTimer, ^{ @autoreleasepool {
+			// Rather than running our own timer, we register with the process-wide liveness scheduler.
+			// Everytime we send or receive data, we note the activity on our entry,
+			// and the scheduler only invokes us once keepAliveInterval has elapsed without any traffic.
+			// Deadlines of all streams are coalesced into shared buckets,
+			// so thousands of streams don't mean thousands of independent timers.
+			
+			keepAliveEntry = [scheduler scheduleWithInterval:keepAliveInterval
+			                                           queue:xmppQueue
+			                                           block:^{ @autoreleasepool {
 				
 				[self keepAlive];
-			}});
-			
-			#if !OS_OBJECT_USE_OBJC
-			dispatch_source_t theKeepAliveTimer = keepAliveTimer;
-			
-			dispatch_source_set_cancel_handler(keepAliveTimer, ^{
-				XMPPLogVerbose(@"dispatch_release(keepAliveTimer)");
-				dispatch_release(theKeepAliveTimer);
-			});
-			#endif
-			
-			// Everytime we send or receive data, we update our lastSendReceiveTime.
-			// We set our timer to fire several times per keepAliveInterval.
-			// This allows us to maintain a single timer,
-			// and an acceptable timer resolution (assuming larger keepAliveIntervals).
-			
-			uint64_t interval = ((keepAliveInterval / 4.0) * NSEC_PER_SEC);
-			
-			dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, interval);
+			}}];
 			
-			dispatch_source_set_timer(keepAliveTimer, tt, interval, 1.0);
-			dispatch_resume(keepAliveTimer);
+			[keepAliveEntry noteActivityAtTime:lastSendReceiveTime];
 		}
 	}
 }
@@ -4083,6 +5030,7 @@ enum XMPPStreamConfig
 			// which would prevent the socket:didWriteDataWithTag: method from being called for some time.
 			
 			lastSendReceiveTime = [NSDate timeIntervalSinceReferenceDate];
+			[keepAliveEntry noteActivityAtTime:lastSendReceiveTime];
 		}
 	}
 }
@@ -4322,6 +5270,103 @@ enum XMPPStreamConfig
     }];
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark IQ Handlers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)addIQHandler:(id <XMPPIQHandler>)handler
+        handlerQueue:(dispatch_queue_t)handlerQueue
+      forElementName:(NSString *)elementName
+               xmlns:(NSString *)xmlns
+{
+	if (handler == nil) return;
+	if (handlerQueue == NULL) return;
+	if (elementName == nil) return;
+	if (xmlns == nil) return;
+	
+	XMPPIQHandlerNode *node = [[XMPPIQHandlerNode alloc] initWithHandler:handler handlerQueue:handlerQueue];
+	
+	NSString *elementNameCopy = [elementName copy];
+	NSString *xmlnsCopy = [xmlns copy];
+	
+	// Asynchronous operation
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		NSMutableDictionary *handlersForXmlns = [iqHandlers objectForKey:xmlnsCopy];
+		if (handlersForXmlns == nil)
+		{
+			handlersForXmlns = [[NSMutableDictionary alloc] initWithCapacity:1];
+			[iqHandlers setObject:handlersForXmlns forKey:xmlnsCopy];
+		}
+		
+		XMPPIQHandlerNode *existingNode = [handlersForXmlns objectForKey:elementNameCopy];
+		if (existingNode.handler)
+		{
+			XMPPLogWarn(@"%@: Replacing IQ handler for <%@ xmlns='%@'/>", THIS_FILE, elementNameCopy, xmlnsCopy);
+		}
+		existingNode.handler = nil;
+		
+		[handlersForXmlns setObject:node forKey:elementNameCopy];
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (void)removeIQHandler:(id <XMPPIQHandler>)handler forElementName:(NSString *)elementName xmlns:(NSString *)xmlns
+{
+	if (handler == nil) return;
+	// elementName may be nil
+	// xmlns may be nil
+	
+	// Synchronous operation
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		NSArray *xmlnsList = xmlns ? [NSArray arrayWithObject:xmlns] : [iqHandlers allKeys];
+		
+		for (NSString *aXmlns in xmlnsList)
+		{
+			NSMutableDictionary *handlersForXmlns = [iqHandlers objectForKey:aXmlns];
+			
+			NSArray *nameList = elementName ? [NSArray arrayWithObject:elementName] : [handlersForXmlns allKeys];
+			
+			for (NSString *aName in nameList)
+			{
+				XMPPIQHandlerNode *node = [handlersForXmlns objectForKey:aName];
+				id nodeHandler = node.handler;
+				
+				if (node && (nodeHandler == handler || nodeHandler == nil))
+				{
+					// The node may have already been looked up by continueReceiveIQ:.
+					// Nullifying the (atomic) handler property ensures it won't be invoked again.
+					
+					node.handler = nil;
+					[handlersForXmlns removeObjectForKey:aName];
+				}
+			}
+			
+			if (handlersForXmlns && [handlersForXmlns count] == 0)
+			{
+				[iqHandlers removeObjectForKey:aXmlns];
+			}
+		}
+	}};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+}
+
+- (void)removeIQHandler:(id <XMPPIQHandler>)handler
+{
+	[self removeIQHandler:handler forElementName:nil xmlns:nil];
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Utilities
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -4350,6 +5395,38 @@ enum XMPPStreamConfig
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+@implementation XMPPIQHandlerNode
+
+@synthesize handler;
+@synthesize handlerQueue;
+
+- (id)initWithHandler:(id <XMPPIQHandler>)aHandler handlerQueue:(dispatch_queue_t)aHandlerQueue
+{
+	if ((self = [super init]))
+	{
+		handler = aHandler;
+		
+		handlerQueue = aHandlerQueue;
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_retain(handlerQueue);
+		#endif
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(handlerQueue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 @implementation XMPPElementReceipt
 
 static const uint32_t receipt_unknown = 0 << 0;
@@ -0,0 +1,122 @@
+#import <Foundation/Foundation.h>
+
+@class XMPPStream;
+
+#define XMPP_STREAM_HOST_MAX_WORKER_COUNT  64
+
+/**
+ * XMPPStreamHost allows a large number of XMPPStream instances to share a fixed set of dispatch resources.
+ *
+ * A standalone XMPPStream creates its own xmppQueue, six element filter queues, a parser queue,
+ * a socket queue, and a dispatch timer source for its connect timeout.
+ * That's perfectly fine for a client with a handful of connections,
+ * but becomes the dominant cost when a single process hosts thousands of streams.
+ *
+ * A hosted stream instead borrows everything from the host:
+ *
+ * - The host owns a fixed pool of workers (by default one per active processor).
+ *   Each worker consists of a serial stream queue, a serial io queue (socket + parser),
+ *   and a serial filter queue (for the willSend/willReceive delegate methods).
+ *   Every hosted stream is pinned to the least loaded worker when it's created,
+ *   and uses that worker's stream queue as its xmppQueue.
+ *   (Its socket gets a small serial queue of its own, which targets the worker's io queue.)
+ *
+ * - The host owns a single timer service (a hashed timing wheel driven by one dispatch source).
+ *   Hosted streams schedule their connect timeout timers here,
+ *   so the number of kernel timers is constant regardless of the number of streams.
+ *   (Keep alives of all streams, hosted or not, go through the process-wide XMPPLivenessScheduler.)
+ *
+ * Hosting is invisible to delegates and modules.
+ * Delegate methods are still invoked on the delegate queues you provide,
+ * and [xmppStream xmppQueue] / [xmppStream xmppQueueTag] work exactly as before.
+ * The only observable difference is that all streams on a worker are serialized with respect to each other.
+ * So delegates should not block the xmppQueue (which they shouldn't be doing anyway).
+ *
+ * Example:
+ *
+ * XMPPStreamHost *host = [[XMPPStreamHost alloc] initWithWorkerCount:8];
+ *
+ * for (...)
+ * {
+ *     XMPPStream *stream = [[XMPPStream alloc] initWithHost:host];
+ *     [stream addDelegate:self delegateQueue:myQueue];
+ *     ...
+ * }
+ *
+ * The host is retained by all of its streams, and is deallocated after the last of them goes away.
+**/
+
+@interface XMPPStreamHost : NSObject
+
+/**
+ * Creates a host with one worker per active processor, and the default timer resolution.
+**/
+- (id)init;
+
+/**
+ * Creates a host with the given number of workers, and the default timer resolution.
+ * The worker count is capped at XMPP_STREAM_HOST_MAX_WORKER_COUNT.
+**/
+- (id)initWithWorkerCount:(NSUInteger)workerCount;
+
+/**
+ * Creates a host with the given number of workers and timer resolution.
+ *
+ * The timer resolution is the tick interval of the shared timer service.
+ * Timers scheduled through the host fire within one tick of their deadline.
+ * The default is 0.25 seconds, which is plenty for connect timeouts.
+**/
+- (id)initWithWorkerCount:(NSUInteger)workerCount timerResolution:(NSTimeInterval)timerResolution;
+
+@property (readonly) NSUInteger workerCount;
+@property (readonly) NSTimeInterval timerResolution;
+
+/**
+ * The number of streams currently attached to the host.
+**/
+@property (readonly) NSUInteger numberOfStreams;
+
+/**
+ * The number of timers currently scheduled with the shared timer service.
+**/
+@property (readonly) NSUInteger numberOfScheduledTimers;
+
+/**
+ * The sum of the instance sizes of the objects every hosted stream allocates, in bytes.
+ * That is the stream itself, its socket, parser, multicast delegate, connect timer and keep alive entry.
+ *
+ * This is NOT a measurement of the memory a hosted stream uses, only a lower bound for it.
+ * It comes from class_getInstanceSize, so it leaves out malloc rounding,
+ * and everything those objects allocate on their own:
+ * queues, dispatch sources, buffers (which depend entirely on traffic), dictionaries, etc.
+ * Use the allocation instruments to measure the real per stream cost.
+ *
+ * The shared resources (worker queues and timer service) are constant,
+ * and are not part of the per stream cost.
+**/
+- (size_t)instanceSizePerStream;
+
+/**
+ * Schedules a block to be run on the given queue after the given interval.
+ * If repeats is YES, the block is invoked every interval until the timer is cancelled.
+ *
+ * The returned object is an opaque token for use with cancelTimer:.
+ * The block and queue are retained until the timer fires (non-repeating) or is cancelled.
+ *
+ * This method is thread-safe.
+**/
+- (id)scheduleTimerWithInterval:(NSTimeInterval)interval
+                        repeats:(BOOL)repeats
+                          queue:(dispatch_queue_t)queue
+                          block:(dispatch_block_t)block;
+
+/**
+ * Cancels a timer returned by scheduleTimerWithInterval:repeats:queue:block:.
+ * Once this method returns, the block will not be invoked again.
+ * (Unless it's currently executing on the target queue, in which case that invocation completes normally.)
+ *
+ * This method is thread-safe.
+**/
+- (void)cancelTimer:(id)timer;
+
+@end
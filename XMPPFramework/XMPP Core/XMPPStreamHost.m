@@ -0,0 +1,477 @@
+#import "XMPPStreamHost.h"
+#import "XMPPInternal.h"
+#import "XMPPParser.h"
+#import "XMPPLogging.h"
+#import "GCDAsyncSocket.h"
+#import "GCDMulticastDelegate.h"
+#import "XMPPLivenessScheduler.h"
+
+#import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+#define DEFAULT_TIMER_RESOLUTION  0.25 // seconds
+
+// The timer wheel covers (TIMER_WHEEL_SLOT_COUNT * timerResolution) per revolution.
+// Timers with longer intervals simply wait for the appropriate number of revolutions.
+#define TIMER_WHEEL_SLOT_COUNT  256
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A timer scheduled with the host's timer service.
+ *
+ * All variables (except cancelled) are only accessed from within the host's timerQueue.
+**/
+@interface XMPPStreamHostTimer : NSObject
+{
+  @public
+
+	dispatch_queue_t queue;
+	dispatch_block_t block;
+
+	uint64_t ticks;
+	uint64_t rounds;
+	NSUInteger slot;
+	BOOL repeats;
+
+	volatile int32_t cancelled;
+}
+@end
+
+@implementation XMPPStreamHostTimer
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (queue)
+		dispatch_release(queue);
+	#endif
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStreamHost
+{
+	NSUInteger workerCount;
+	NSTimeInterval timerResolution;
+
+	dispatch_queue_t streamQueues[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+	dispatch_queue_t ioQueues[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+	dispatch_queue_t filterQueues[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+
+	char streamQueueTags[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+	char ioQueueTags[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+
+	volatile int32_t streamCounts[XMPP_STREAM_HOST_MAX_WORKER_COUNT];
+	volatile int32_t numberOfStreams;
+
+	dispatch_queue_t timerQueue;
+	void *timerQueueTag;
+
+	dispatch_source_t timerSource;
+	BOOL timerSourceSuspended;
+
+	NSMutableArray *timerWheel[TIMER_WHEEL_SLOT_COUNT];
+	NSUInteger timerWheelIndex;
+	NSUInteger numberOfScheduledTimers;
+}
+
+@synthesize workerCount;
+@synthesize timerResolution;
+
+- (id)init
+{
+	return [self initWithWorkerCount:[[NSProcessInfo processInfo] activeProcessorCount]
+	                 timerResolution:DEFAULT_TIMER_RESOLUTION];
+}
+
+- (id)initWithWorkerCount:(NSUInteger)count
+{
+	return [self initWithWorkerCount:count timerResolution:DEFAULT_TIMER_RESOLUTION];
+}
+
+- (id)initWithWorkerCount:(NSUInteger)count timerResolution:(NSTimeInterval)resolution
+{
+	if ((self = [super init]))
+	{
+		workerCount = MAX(1, MIN(count, XMPP_STREAM_HOST_MAX_WORKER_COUNT));
+		timerResolution = (resolution > 0.0) ? resolution : DEFAULT_TIMER_RESOLUTION;
+
+		NSUInteger i;
+		for (i = 0; i < workerCount; i++)
+		{
+			streamQueues[i] = dispatch_queue_create("xmpp.host.stream", NULL);
+			ioQueues[i]     = dispatch_queue_create("xmpp.host.io", NULL);
+			filterQueues[i] = dispatch_queue_create("xmpp.host.filter", NULL);
+
+			dispatch_queue_set_specific(streamQueues[i], &streamQueueTags[i], &streamQueueTags[i], NULL);
+			dispatch_queue_set_specific(ioQueues[i], &ioQueueTags[i], &ioQueueTags[i], NULL);
+		}
+
+		timerQueueTag = &timerQueueTag;
+		timerQueue = dispatch_queue_create("xmpp.host.timer", NULL);
+		dispatch_queue_set_specific(timerQueue, timerQueueTag, timerQueueTag, NULL);
+
+		timerSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, timerQueue);
+
+		#if __has_feature(objc_arc_weak)
+		__weak XMPPStreamHost *weakSelf = self;
+		#else
+		__unsafe_unretained XMPPStreamHost *weakSelf = self;
+		#endif
+
+		dispatch_source_set_event_handler(timerSource, ^{ @autoreleasepool {
+
+			// Hold a strong reference for the duration of the tick.
+			// Firing a timer may release the last reference to a stream, which in turn may release us.
+
+			XMPPStreamHost *strongSelf = weakSelf;
+			[strongSelf tick];
+		}});
+
+		uint64_t interval = (timerResolution * NSEC_PER_SEC);
+
+		dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, interval);
+		dispatch_source_set_timer(timerSource, tt, interval, (interval / 10));
+
+		// The timer source remains suspended until the first timer is scheduled.
+		timerSourceSuspended = YES;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (timerSourceSuspended)
+	{
+		// A suspended source can't be cancelled or released
+		dispatch_resume(timerSource);
+	}
+	dispatch_source_cancel(timerSource);
+
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(timerSource);
+	dispatch_release(timerQueue);
+
+	NSUInteger i;
+	for (i = 0; i < workerCount; i++)
+	{
+		dispatch_release(streamQueues[i]);
+		dispatch_release(ioQueues[i]);
+		dispatch_release(filterQueues[i]);
+	}
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Statistics
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)numberOfStreams
+{
+	return (NSUInteger)OSAtomicAdd32Barrier(0, &numberOfStreams);
+}
+
+- (NSUInteger)numberOfScheduledTimers
+{
+	__block NSUInteger result = 0;
+
+	dispatch_block_t block = ^{
+		result = numberOfScheduledTimers;
+	};
+
+	if (dispatch_get_specific(timerQueueTag))
+		block();
+	else
+		dispatch_sync(timerQueue, block);
+
+	return result;
+}
+
+- (size_t)instanceSizePerStream
+{
+	// A connected hosted stream always has:
+	// - the stream, its socket, parser, and multicast delegate
+	// - a keep alive entry in the liveness scheduler
+	//
+	// The connect timer only exists while connecting, but it's included anyway.
+	// This only sums the declared instance sizes, so malloc rounding and everything
+	// the objects allocate on their own are left out (see the header).
+
+	size_t result = 0;
+
+	result += class_getInstanceSize([XMPPStream class]);
+	result += class_getInstanceSize([GCDAsyncSocket class]);
+	result += class_getInstanceSize([XMPPParser class]);
+	result += class_getInstanceSize([GCDMulticastDelegate class]);
+	result += class_getInstanceSize([XMPPStreamHostTimer class]);
+	result += class_getInstanceSize([XMPPLivenessEntry class]);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Workers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)attachStream
+{
+	// Pick the least loaded worker.
+	// The counts may change underneath us, but an occasional imperfect choice is harmless.
+
+	NSUInteger bestIndex = 0;
+	int32_t bestCount = INT32_MAX;
+
+	NSUInteger i;
+	for (i = 0; i < workerCount; i++)
+	{
+		int32_t count = streamCounts[i];
+		if (count < bestCount)
+		{
+			bestIndex = i;
+			bestCount = count;
+		}
+	}
+
+	OSAtomicIncrement32Barrier(&streamCounts[bestIndex]);
+	OSAtomicIncrement32Barrier(&numberOfStreams);
+
+	return bestIndex;
+}
+
+- (void)detachStreamFromWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	OSAtomicDecrement32Barrier(&streamCounts[workerIndex]);
+	OSAtomicDecrement32Barrier(&numberOfStreams);
+}
+
+- (dispatch_queue_t)streamQueueForWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	return streamQueues[workerIndex];
+}
+
+- (void *)streamQueueTagForWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	return &streamQueueTags[workerIndex];
+}
+
+- (dispatch_queue_t)ioQueueForWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	return ioQueues[workerIndex];
+}
+
+- (void *)ioQueueTagForWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	return &ioQueueTags[workerIndex];
+}
+
+- (dispatch_queue_t)filterQueueForWorker:(NSUInteger)workerIndex
+{
+	NSAssert(workerIndex < workerCount, @"Invalid worker index");
+
+	return filterQueues[workerIndex];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Timer Service
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (id)scheduleTimerWithInterval:(NSTimeInterval)interval
+                        repeats:(BOOL)repeats
+                          queue:(dispatch_queue_t)queue
+                          block:(dispatch_block_t)block
+{
+	if (queue == NULL || block == nil) return nil;
+
+	XMPPStreamHostTimer *timer = [[XMPPStreamHostTimer alloc] init];
+
+	timer->queue = queue;
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_retain(queue);
+	#endif
+
+	timer->block = [block copy];
+	timer->repeats = repeats;
+	timer->slot = NSNotFound;
+
+	// Round up, so a timer never fires early
+	uint64_t ticks = (uint64_t)ceil(interval / timerResolution);
+	timer->ticks = MAX(ticks, (uint64_t)1);
+
+	dispatch_block_t scheduleBlock = ^{
+
+		[self insertTimer:timer];
+
+		numberOfScheduledTimers++;
+
+		if (timerSourceSuspended)
+		{
+			timerSourceSuspended = NO;
+			dispatch_resume(timerSource);
+		}
+	};
+
+	if (dispatch_get_specific(timerQueueTag))
+		scheduleBlock();
+	else
+		dispatch_async(timerQueue, scheduleBlock);
+
+	return timer;
+}
+
+- (void)cancelTimer:(id)timerToken
+{
+	if (![timerToken isKindOfClass:[XMPPStreamHostTimer class]]) return;
+
+	XMPPStreamHostTimer *timer = (XMPPStreamHostTimer *)timerToken;
+
+	// Setting the flag prevents any invocation that's already been dispatched to the target queue
+
+	if (!OSAtomicCompareAndSwap32Barrier(0, 1, &timer->cancelled)) return;
+
+	dispatch_block_t block = ^{
+
+		if (timer->slot != NSNotFound)
+		{
+			[timerWheel[timer->slot] removeObjectIdenticalTo:timer];
+			[self finishTimer:timer];
+		}
+	};
+
+	if (dispatch_get_specific(timerQueueTag))
+		block();
+	else
+		dispatch_async(timerQueue, block);
+}
+
+- (void)insertTimer:(XMPPStreamHostTimer *)timer
+{
+	NSAssert(dispatch_get_specific(timerQueueTag), @"Invoked on incorrect queue");
+
+	timer->slot = (NSUInteger)((timerWheelIndex + timer->ticks) % TIMER_WHEEL_SLOT_COUNT);
+	timer->rounds = (timer->ticks - 1) / TIMER_WHEEL_SLOT_COUNT;
+
+	NSMutableArray *slot = timerWheel[timer->slot];
+	if (slot == nil)
+	{
+		slot = [[NSMutableArray alloc] init];
+		timerWheel[timer->slot] = slot;
+	}
+
+	[slot addObject:timer];
+}
+
+- (void)finishTimer:(XMPPStreamHostTimer *)timer
+{
+	NSAssert(dispatch_get_specific(timerQueueTag), @"Invoked on incorrect queue");
+
+	timer->slot = NSNotFound;
+	timer->block = nil;
+
+	numberOfScheduledTimers--;
+}
+
+- (void)tick
+{
+	NSAssert(dispatch_get_specific(timerQueueTag), @"Invoked on incorrect queue");
+
+	timerWheelIndex = (timerWheelIndex + 1) % TIMER_WHEEL_SLOT_COUNT;
+
+	NSMutableArray *slot = timerWheel[timerWheelIndex];
+	NSMutableArray *repeating = nil;
+
+	NSUInteger i = 0;
+	NSUInteger count = [slot count];
+
+	while (i < count)
+	{
+		XMPPStreamHostTimer *timer = [slot objectAtIndex:i];
+
+		if (timer->rounds > 0)
+		{
+			timer->rounds--;
+			i++;
+			continue;
+		}
+
+		// Remove the timer from the slot (order within a slot is irrelevant)
+
+		count--;
+		[slot exchangeObjectAtIndex:i withObjectAtIndex:count];
+		[slot removeLastObject];
+
+		if (timer->cancelled)
+		{
+			[self finishTimer:timer];
+			continue;
+		}
+
+		dispatch_block_t block = timer->block;
+
+		dispatch_async(timer->queue, ^{ @autoreleasepool {
+
+			if (!timer->cancelled)
+			{
+				block();
+			}
+		}});
+
+		if (timer->repeats)
+		{
+			if (repeating == nil)
+				repeating = [[NSMutableArray alloc] init];
+
+			[repeating addObject:timer];
+		}
+		else
+		{
+			[self finishTimer:timer];
+		}
+	}
+
+	// Repeating timers are inserted after the loop,
+	// as a timer with an interval that's a multiple of the wheel size is re-inserted into this very slot.
+
+	for (XMPPStreamHostTimer *timer in repeating)
+	{
+		[self insertTimer:timer];
+	}
+
+	if (numberOfScheduledTimers == 0 && !timerSourceSuspended)
+	{
+		XMPPLogVerbose(@"%@: No scheduled timers - suspending timer source", THIS_FILE);
+
+		timerSourceSuspended = YES;
+		dispatch_suspend(timerSource);
+	}
+}
+
+@end
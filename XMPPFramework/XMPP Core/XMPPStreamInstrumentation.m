@@ -0,0 +1,576 @@
+#import "XMPPStreamInstrumentation.h"
+#import "XMPPInternal.h"
+#import "XMPPAtoms.h"
+#import "XMPPLogging.h"
+
+#import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
+
+#if TARGET_OS_IPHONE
+  #import "DDXML.h"
+#endif
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN; // | XMPP_LOG_FLAG_TRACE;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+/**
+ * Histogram layout:
+ *
+ * Values below (2 * SUB_BUCKET_COUNT) microseconds each get their own bucket.
+ * Above that, every power of two is split into SUB_BUCKET_COUNT linear buckets.
+ * Values are clamped to 2^32 - 1 microseconds (a little over 71 minutes).
+**/
+#define SUB_BUCKET_BITS      4
+#define SUB_BUCKET_COUNT     (1 << SUB_BUCKET_BITS)
+#define LINEAR_BUCKET_COUNT  (2 * SUB_BUCKET_COUNT)
+#define MAX_VALUE_BITS       32
+#define BUCKET_COUNT         (LINEAR_BUCKET_COUNT + ((MAX_VALUE_BITS - SUB_BUCKET_BITS - 1) * SUB_BUCKET_COUNT))
+
+typedef struct
+{
+	volatile int64_t counts[BUCKET_COUNT];
+	volatile int64_t totalCount;
+	volatile int64_t totalSum;
+	volatile int64_t maxValue;
+
+} XMPPLatencyHistogram;
+
+static NSUInteger XMPPLatencyBucketIndex(uint64_t value)
+{
+	if (value < LINEAR_BUCKET_COUNT)
+	{
+		return (NSUInteger)value;
+	}
+
+	if (value >= (1ULL << MAX_VALUE_BITS))
+	{
+		value = (1ULL << MAX_VALUE_BITS) - 1;
+	}
+
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BUCKET_BITS;
+
+	NSUInteger subBucket = (NSUInteger)(value >> shift) - SUB_BUCKET_COUNT;
+
+	return LINEAR_BUCKET_COUNT + ((msb - SUB_BUCKET_BITS - 1) * SUB_BUCKET_COUNT) + subBucket;
+}
+
+static uint64_t XMPPLatencyBucketUpperBound(NSUInteger index)
+{
+	if (index < LINEAR_BUCKET_COUNT)
+	{
+		return index;
+	}
+
+	NSUInteger offset = index - LINEAR_BUCKET_COUNT;
+
+	int shift = (int)(offset / SUB_BUCKET_COUNT) + 1;
+	uint64_t subBucket = SUB_BUCKET_COUNT + (offset % SUB_BUCKET_COUNT);
+
+	return ((subBucket + 1) << shift) - 1;
+}
+
+/**
+ * Returns the current time in mach absolute time units.
+**/
+uint64_t XMPPInstrumentationTime(void)
+{
+	return mach_absolute_time();
+}
+
+static uint64_t XMPPInstrumentationMicroseconds(uint64_t elapsed)
+{
+	static mach_timebase_info_data_t timebase;
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info(&timebase);
+	});
+
+	return (elapsed * timebase.numer) / (timebase.denom * NSEC_PER_USEC);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPLatencySnapshot ()
+{
+	uint64_t count;
+	uint64_t maxValue;
+	double mean;
+
+	NSData *counts;
+}
+
+- (id)initWithHistogram:(XMPPLatencyHistogram *)histogram reset:(BOOL)reset;
+
+@end
+
+@interface XMPPInstrumentationSnapshot ()
+{
+	NSDate *date;
+	NSArray *latencies;
+}
+
+- (id)initWithLatencies:(NSArray *)latencies;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStreamInstrumentation
+{
+	XMPPLatencyHistogram histograms[XMPPInstrumentedStanzaTypeCount][XMPPStanzaLatencyStageCount];
+
+	dispatch_queue_t instrumentationQueue;
+	void *instrumentationQueueTag;
+
+	dispatch_source_t snapshotTimer;
+}
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		instrumentationQueueTag = &instrumentationQueueTag;
+		instrumentationQueue = dispatch_queue_create("xmpp.instrumentation", NULL);
+		dispatch_queue_set_specific(instrumentationQueue, instrumentationQueueTag, instrumentationQueueTag, NULL);
+
+		// The histograms are zeroed by alloc
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (snapshotTimer)
+	{
+		dispatch_source_cancel(snapshotTimer);
+
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_release(snapshotTimer);
+		#endif
+	}
+
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(instrumentationQueue);
+	#endif
+}
+
+- (void)recordLatency:(uint64_t)microseconds
+             forStage:(XMPPStanzaLatencyStage)stage
+           stanzaType:(XMPPInstrumentedStanzaType)stanzaType
+{
+	if (stage >= XMPPStanzaLatencyStageCount || stanzaType >= XMPPInstrumentedStanzaTypeCount) return;
+
+	XMPPLatencyHistogram *histogram = &histograms[stanzaType][stage];
+
+	OSAtomicIncrement64(&histogram->counts[XMPPLatencyBucketIndex(microseconds)]);
+	OSAtomicIncrement64(&histogram->totalCount);
+	OSAtomicAdd64((int64_t)microseconds, &histogram->totalSum);
+
+	int64_t oldMax;
+	do
+	{
+		oldMax = histogram->maxValue;
+
+		if ((int64_t)microseconds <= oldMax) break;
+
+	} while (!OSAtomicCompareAndSwap64(oldMax, (int64_t)microseconds, &histogram->maxValue));
+}
+
+- (XMPPInstrumentationSnapshot *)snapshotWithReset:(BOOL)reset
+{
+	NSMutableArray *latencies = [NSMutableArray arrayWithCapacity:(XMPPInstrumentedStanzaTypeCount * XMPPStanzaLatencyStageCount)];
+
+	NSUInteger type, stage;
+	for (type = 0; type < XMPPInstrumentedStanzaTypeCount; type++)
+	{
+		for (stage = 0; stage < XMPPStanzaLatencyStageCount; stage++)
+		{
+			XMPPLatencySnapshot *latency = [[XMPPLatencySnapshot alloc] initWithHistogram:&histograms[type][stage]
+			                                                                        reset:reset];
+			[latencies addObject:latency];
+		}
+	}
+
+	return [[XMPPInstrumentationSnapshot alloc] initWithLatencies:latencies];
+}
+
+- (XMPPInstrumentationSnapshot *)snapshot
+{
+	return [self snapshotWithReset:NO];
+}
+
+- (XMPPInstrumentationSnapshot *)snapshotAndReset
+{
+	return [self snapshotWithReset:YES];
+}
+
+- (void)reset
+{
+	[self snapshotWithReset:YES];
+}
+
+- (void)setSnapshotInterval:(NSTimeInterval)interval
+                      reset:(BOOL)reset
+                      queue:(dispatch_queue_t)queue
+                      block:(void (^)(XMPPInstrumentationSnapshot *snapshot))block
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (queue)
+		dispatch_retain(queue);
+	#endif
+
+	void (^snapshotBlock)(XMPPInstrumentationSnapshot *) = [block copy];
+
+	dispatch_block_t setupBlock = ^{ @autoreleasepool {
+
+		if (snapshotTimer)
+		{
+			dispatch_source_cancel(snapshotTimer);
+
+			#if !OS_OBJECT_USE_OBJC
+			dispatch_release(snapshotTimer);
+			#endif
+			snapshotTimer = NULL;
+		}
+
+		if (interval > 0.0 && snapshotBlock)
+		{
+			dispatch_queue_t targetQueue = queue ? queue : dispatch_get_main_queue();
+
+			snapshotTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, instrumentationQueue);
+
+			#if __has_feature(objc_arc_weak)
+			__weak XMPPStreamInstrumentation *weakSelf = self;
+			#else
+			__unsafe_unretained XMPPStreamInstrumentation *weakSelf = self;
+			#endif
+
+			dispatch_source_set_event_handler(snapshotTimer, ^{ @autoreleasepool {
+
+				XMPPStreamInstrumentation *strongSelf = weakSelf;
+				if (strongSelf == nil) return;
+
+				XMPPInstrumentationSnapshot *snapshot = [strongSelf snapshotWithReset:reset];
+
+				dispatch_async(targetQueue, ^{ @autoreleasepool {
+
+					snapshotBlock(snapshot);
+				}});
+			}});
+
+			#if !OS_OBJECT_USE_OBJC
+			if (queue)
+			{
+				dispatch_source_set_cancel_handler(snapshotTimer, ^{
+					dispatch_release(queue);
+				});
+			}
+			#endif
+
+			uint64_t intervalNanos = (interval * NSEC_PER_SEC);
+
+			dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, intervalNanos);
+			dispatch_source_set_timer(snapshotTimer, tt, intervalNanos, (intervalNanos / 10));
+			dispatch_resume(snapshotTimer);
+		}
+		else
+		{
+			#if !OS_OBJECT_USE_OBJC
+			if (queue)
+				dispatch_release(queue);
+			#endif
+		}
+	}};
+
+	if (dispatch_get_specific(instrumentationQueueTag))
+		setupBlock();
+	else
+		dispatch_async(instrumentationQueue, setupBlock);
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPInstrumentationSnapshot
+
+@synthesize date;
+
+- (id)initWithLatencies:(NSArray *)theLatencies
+{
+	if ((self = [super init]))
+	{
+		date = [[NSDate alloc] init];
+		latencies = theLatencies;
+	}
+	return self;
+}
+
+- (XMPPLatencySnapshot *)latencyForStage:(XMPPStanzaLatencyStage)stage stanzaType:(XMPPInstrumentedStanzaType)type
+{
+	if (stage >= XMPPStanzaLatencyStageCount || type >= XMPPInstrumentedStanzaTypeCount) return nil;
+
+	return [latencies objectAtIndex:((type * XMPPStanzaLatencyStageCount) + stage)];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPLatencySnapshot
+
+@synthesize count;
+@synthesize maxValue;
+@synthesize mean;
+
+- (id)initWithHistogram:(XMPPLatencyHistogram *)histogram reset:(BOOL)reset
+{
+	if ((self = [super init]))
+	{
+		// Each value is read (and optionally subtracted) atomically.
+		// Values recorded concurrently are either part of this snapshot or the next one, but never lost.
+
+		int64_t buffer[BUCKET_COUNT];
+
+		NSUInteger i;
+		for (i = 0; i < BUCKET_COUNT; i++)
+		{
+			buffer[i] = OSAtomicAdd64Barrier(0, &histogram->counts[i]);
+
+			if (reset && buffer[i] != 0)
+				OSAtomicAdd64Barrier(-buffer[i], &histogram->counts[i]);
+		}
+
+		int64_t totalCount = OSAtomicAdd64Barrier(0, &histogram->totalCount);
+		int64_t totalSum = OSAtomicAdd64Barrier(0, &histogram->totalSum);
+		int64_t max = OSAtomicAdd64Barrier(0, &histogram->maxValue);
+
+		if (reset)
+		{
+			OSAtomicAdd64Barrier(-totalCount, &histogram->totalCount);
+			OSAtomicAdd64Barrier(-totalSum, &histogram->totalSum);
+			OSAtomicCompareAndSwap64Barrier(max, 0, &histogram->maxValue);
+		}
+
+		count = (uint64_t)MAX(totalCount, 0);
+		maxValue = (uint64_t)MAX(max, 0);
+		mean = (count > 0) ? ((double)totalSum / (double)count) : 0.0;
+
+		counts = [[NSData alloc] initWithBytes:buffer length:sizeof(buffer)];
+	}
+	return self;
+}
+
+- (uint64_t)valueAtPercentile:(double)percentile
+{
+	const int64_t *buffer = (const int64_t *)[counts bytes];
+
+	int64_t bucketTotal = 0;
+
+	NSUInteger i;
+	for (i = 0; i < BUCKET_COUNT; i++)
+	{
+		bucketTotal += buffer[i];
+	}
+
+	if (bucketTotal <= 0) return 0;
+
+	percentile = MIN(MAX(percentile, 0.0), 100.0);
+
+	int64_t target = (int64_t)ceil((percentile / 100.0) * bucketTotal);
+	if (target < 1) target = 1;
+
+	int64_t runningTotal = 0;
+
+	for (i = 0; i < BUCKET_COUNT; i++)
+	{
+		runningTotal += buffer[i];
+
+		if (runningTotal >= target)
+		{
+			return MIN(XMPPLatencyBucketUpperBound(i), maxValue);
+		}
+	}
+
+	return maxValue;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<XMPPLatencySnapshot count=%llu mean=%.1fus p50=%lluus p99=%lluus max=%lluus>",
+	        count, mean, [self valueAtPercentile:50.0], [self valueAtPercentile:99.0], maxValue];
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static char XMPPStanzaTraceKey;
+
+@implementation XMPPStanzaTrace
+{
+	XMPPStreamInstrumentation *instrumentation;
+	XMPPInstrumentedStanzaType stanzaType;
+
+	uint64_t times[XMPPStanzaTracePointCount];
+
+	dispatch_group_t delegateGroup;
+}
+
++ (XMPPStanzaTrace *)traceForElement:(NSXMLElement *)element
+{
+	if (element == nil) return nil;
+
+	return objc_getAssociatedObject(element, &XMPPStanzaTraceKey);
+}
+
++ (XMPPStanzaTrace *)attachTraceToElement:(NSXMLElement *)element
+                          instrumentation:(XMPPStreamInstrumentation *)instrumentation
+                                     time:(uint64_t)time
+                                 forPoint:(XMPPStanzaTracePoint)point
+{
+	if (element == nil || instrumentation == nil) return nil;
+
+	XMPPInstrumentedStanzaType type;
+
+	XMPPAtom name = XMPPAtomForString([element name]);
+
+	if (name == XMPPAtomMessage)
+		type = XMPPInstrumentedStanzaTypeMessage;
+	else if (name == XMPPAtomPresence)
+		type = XMPPInstrumentedStanzaTypePresence;
+	else if (name == XMPPAtomIQ)
+		type = XMPPInstrumentedStanzaTypeIQ;
+	else
+		return nil;
+
+	XMPPStanzaTrace *trace = [[XMPPStanzaTrace alloc] init];
+	trace->instrumentation = instrumentation;
+	trace->stanzaType = type;
+	trace->times[point] = time;
+
+	[trace attachToElement:element];
+
+	return trace;
+}
+
+- (void)dealloc
+{
+	#if !OS_OBJECT_USE_OBJC
+	if (delegateGroup)
+		dispatch_release(delegateGroup);
+	#endif
+}
+
+- (void)attachToElement:(NSXMLElement *)element
+{
+	if (element == nil) return;
+
+	objc_setAssociatedObject(element, &XMPPStanzaTraceKey, self, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (void)detachFromElement:(NSXMLElement *)element
+{
+	if (element == nil) return;
+
+	if (objc_getAssociatedObject(element, &XMPPStanzaTraceKey) == self)
+	{
+		objc_setAssociatedObject(element, &XMPPStanzaTraceKey, nil, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+	}
+}
+
+- (void)markPoint:(XMPPStanzaTracePoint)point
+{
+	times[point] = XMPPInstrumentationTime();
+}
+
+- (void)markPoint:(XMPPStanzaTracePoint)point element:(NSXMLElement *)element
+{
+	times[point] = XMPPInstrumentationTime();
+
+	// A filter may have returned a different instance, in which case the trace has to follow it
+	[self attachToElement:element];
+}
+
+- (void)setTime:(uint64_t)time forPoint:(XMPPStanzaTracePoint)point
+{
+	times[point] = time;
+}
+
+- (void)recordStage:(XMPPStanzaLatencyStage)stage from:(XMPPStanzaTracePoint)start to:(XMPPStanzaTracePoint)end
+{
+	uint64_t startTime = times[start];
+	uint64_t endTime = times[end];
+
+	// Points that were never reached (e.g. injected elements were never read from the socket) are skipped
+
+	if (startTime == 0 || endTime == 0 || endTime < startTime) return;
+
+	[instrumentation recordLatency:XMPPInstrumentationMicroseconds(endTime - startTime)
+	                      forStage:stage
+	                    stanzaType:stanzaType];
+}
+
+- (dispatch_group_t)beginDelegateDispatch
+{
+	[self markPoint:XMPPStanzaTracePointDispatched];
+
+	if (delegateGroup == NULL)
+	{
+		delegateGroup = dispatch_group_create();
+	}
+
+	return delegateGroup;
+}
+
+- (void)endDelegateDispatch
+{
+	NSAssert(delegateGroup != NULL, @"endDelegateDispatch invoked without beginDelegateDispatch");
+
+	// The notify block retains the trace until the last delegate invocation has finished
+
+	dispatch_group_notify(delegateGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+
+		[self markPoint:XMPPStanzaTracePointCompleted];
+
+		[self recordStage:XMPPStanzaLatencyStageParse         from:XMPPStanzaTracePointRead     to:XMPPStanzaTracePointParsed];
+		[self recordStage:XMPPStanzaLatencyStageReceiveFilter from:XMPPStanzaTracePointParsed   to:XMPPStanzaTracePointReceiveFiltered];
+		[self recordStage:XMPPStanzaLatencyStageDispatch      from:XMPPStanzaTracePointReceiveFiltered to:XMPPStanzaTracePointDispatched];
+		[self recordStage:XMPPStanzaLatencyStageDelegate      from:XMPPStanzaTracePointDispatched to:XMPPStanzaTracePointCompleted];
+		[self recordStage:XMPPStanzaLatencyStageReceiveTotal  from:XMPPStanzaTracePointRead     to:XMPPStanzaTracePointCompleted];
+	});
+}
+
+- (void)finishSend
+{
+	[self markPoint:XMPPStanzaTracePointWritten];
+
+	[self recordStage:XMPPStanzaLatencyStageSendFilter from:XMPPStanzaTracePointSent         to:XMPPStanzaTracePointSendFiltered];
+	[self recordStage:XMPPStanzaLatencyStageSerialize  from:XMPPStanzaTracePointSendFiltered to:XMPPStanzaTracePointSerialized];
+	[self recordStage:XMPPStanzaLatencyStageWrite      from:XMPPStanzaTracePointSerialized   to:XMPPStanzaTracePointWritten];
+	[self recordStage:XMPPStanzaLatencyStageSendTotal  from:XMPPStanzaTracePointSent         to:XMPPStanzaTracePointWritten];
+}
+
+@end
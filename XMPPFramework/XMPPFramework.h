@@ -15,10 +15,13 @@
 #import <XMPPFramework/XMPPMessage+XEP_0071.h>
 #import <XMPPFramework/XMPPvCardTempModule.h>
 #import <XMPPFramework/XMPPvCardTemp.h>
+#import <XMPPFramework/XMPPvCardSQLiteStorage.h>
 #import <XMPPFramework/XMPPRoster.h>
 #import <XMPPFramework/XMPPRosterMemoryStorage.h>
+#import <XMPPFramework/XMPPRosterSQLiteStorage.h>
 #import <XMPPFramework/XMPPCapabilities.h>
 #import <XMPPFramework/XMPPCapabilitiesCoreDataStorage.h>
+#import <XMPPFramework/XMPPCapabilitiesSQLiteStorage.h>
 #import <XMPPFramework/XMPPSoftwareVersion.h>
 #import <XMPPFramework/XMPPSIFileTransfer.h>
 #import <XMPPFramework/TURNSocket.h>